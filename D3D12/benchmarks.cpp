@@ -0,0 +1,2006 @@
+#include "benchmarks.h"
+#include "bvh.h"
+#include "commandCapture.h"
+#include "commandStream.h"
+#include "culling.h"
+#include "drawList.h"
+#include "filteredCommandList.h"
+#include "fixedTimestep.h"
+#include "jobSystem.h"
+#include "occlusionCuller.h"
+#include "pipelineCompiler.h"
+#include "pipelineHash.h"
+#include "radixSort.h"
+#include "shaderCache.h"
+#include "shaderTable.h"
+#include "spatialGrid.h"
+#include "stateObjectBuilder.h"
+#include "transformHierarchy.h"
+#include "uploadRing.h"
+
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstdarg>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	const uint32_t gRepeats = 10;	// every benchmark reports its best run
+
+	std::string gResults;
+	uint32_t gFailures = 0;	// checks that didn't hold, Run() returns them
+
+	void Report(const char *format, ...)
+	{
+		va_list args;
+		va_start(args, format);
+		va_list sizeArgs;
+		va_copy(sizeArgs, args);
+		std::vector<char> text(_vscprintf(format, sizeArgs) + 1);
+		va_end(sizeArgs);
+		vsprintf_s(text.data(), text.size(), format, args);
+		va_end(args);
+
+		::OutputDebugString(text.data());
+		gResults += text.data();
+	}
+
+	// Benchmarks that check their results count a failure for every check that doesn't hold
+	void Expect(bool passed, const char *what)
+	{
+		if (!passed)
+		{
+			Report("FAILED: %s\n", what);
+			gFailures++;
+		}
+	}
+
+	template <typename Function>
+	double MeasureMs(Function function)
+	{
+		static std::chrono::high_resolution_clock clock;
+
+		double best = DBL_MAX;
+		for (uint32_t i = 0; i < gRepeats; ++i)
+		{
+			auto t0 = clock.now();
+			function();
+			best = std::min(best, std::chrono::duration<double, std::milli>(clock.now() - t0).count());
+		}
+
+		return best;
+	}
+
+	// setup runs before every repeat, outside of the timing
+	template <typename Setup, typename Function>
+	double MeasureMs(Setup setup, Function function)
+	{
+		static std::chrono::high_resolution_clock clock;
+
+		double best = DBL_MAX;
+		for (uint32_t i = 0; i < gRepeats; ++i)
+		{
+			setup();
+
+			auto t0 = clock.now();
+			function();
+			best = std::min(best, std::chrono::duration<double, std::milli>(clock.now() - t0).count());
+		}
+
+		return best;
+	}
+
+	// 4 root constants and a root CBV, enough for an object and its material
+	ComPtr<ID3D12RootSignature> CreateRootSignature(ComPtr<ID3D12Device2> device, ComPtr<ID3DBlob> *blobOut = nullptr)
+	{
+		CD3DX12_ROOT_PARAMETER parameters[2];
+		parameters[0].InitAsConstants(4, 0);
+		parameters[1].InitAsConstantBufferView(1);
+
+		CD3DX12_ROOT_SIGNATURE_DESC rootSignatureDesc(_countof(parameters), parameters, 0, nullptr,
+			D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+
+		ComPtr<ID3DBlob> blob;
+		ComPtr<ID3DBlob> errors;
+		ThrowIfFailed(::D3D12SerializeRootSignature(&rootSignatureDesc, D3D_ROOT_SIGNATURE_VERSION_1, &blob, &errors));
+
+		ComPtr<ID3D12RootSignature> rootSignature;
+		ThrowIfFailed(device->CreateRootSignature(0, blob->GetBufferPointer(), blob->GetBufferSize(),
+			IID_PPV_ARGS(&rootSignature)));
+
+		if (blobOut)
+		{
+			*blobOut = blob;
+		}
+		return rootSignature;
+	}
+
+	ComPtr<ID3D12Resource> CreateUploadBuffer(ComPtr<ID3D12Device2> device, UINT64 size)
+	{
+		CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_UPLOAD);
+		CD3DX12_RESOURCE_DESC bufferDesc = CD3DX12_RESOURCE_DESC::Buffer(size);
+
+		ComPtr<ID3D12Resource> buffer;
+		ThrowIfFailed(device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &bufferDesc,
+			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&buffer)));
+		return buffer;
+	}
+
+	// Closed, ready to be reset
+	void CreateCommandList(ComPtr<ID3D12Device2> device, ComPtr<ID3D12CommandAllocator> &allocator,
+		ComPtr<ID3D12GraphicsCommandList> &commandList)
+	{
+		ThrowIfFailed(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&allocator)));
+		ThrowIfFailed(device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, allocator.Get(), nullptr,
+			IID_PPV_ARGS(&commandList)));
+		ThrowIfFailed(commandList->Close());
+	}
+
+	// A draw loop where every object sets all of its state,
+	// and only the material (every 16 objects) and the CBV change
+	void FilteredRecording(ComPtr<ID3D12Device2> device)
+	{
+		const uint32_t numObjects = 10000;
+		const uint32_t objectsPerMaterial = 16;
+		const uint32_t numMaterials = 4;
+
+		ComPtr<ID3D12CommandAllocator> allocator;
+		ComPtr<ID3D12GraphicsCommandList> commandList;
+		CreateCommandList(device, allocator, commandList);
+
+		ComPtr<ID3D12RootSignature> rootSignature = CreateRootSignature(device);
+
+		// Real addresses for the vertex buffers and CBVs, nothing is ever executed
+		ComPtr<ID3D12Resource> buffer = CreateUploadBuffer(device, 64 * 1024);
+		D3D12_GPU_VIRTUAL_ADDRESS address = buffer->GetGPUVirtualAddress();
+
+		D3D12_VERTEX_BUFFER_VIEW vertexBuffers[numMaterials];
+		for (uint32_t i = 0; i < numMaterials; ++i)
+		{
+			vertexBuffers[i] = { address + i * 4096, 4096, 32 };
+		}
+
+		double rawMs = MeasureMs([&]()
+		{
+			ThrowIfFailed(commandList->Reset(allocator.Get(), nullptr));
+
+			for (uint32_t i = 0; i < numObjects; ++i)
+			{
+				UINT material = (i / objectsPerMaterial) % numMaterials;
+				UINT constants[4] = { material, 0, 0, 0 };
+
+				commandList->SetGraphicsRootSignature(rootSignature.Get());
+				commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+				commandList->IASetVertexBuffers(0, 1, &vertexBuffers[material]);
+				commandList->SetGraphicsRoot32BitConstants(0, _countof(constants), constants, 0);
+				commandList->SetGraphicsRootConstantBufferView(1, address + (i % 256) * 256);
+			}
+
+			ThrowIfFailed(commandList->Close());
+		});
+
+		std::unique_ptr<FilteredCommandList> filtered = std::make_unique<FilteredCommandList>();
+
+		double filteredMs = MeasureMs([&]()
+		{
+			ThrowIfFailed(commandList->Reset(allocator.Get(), nullptr));
+			filtered->Begin(commandList.Get());
+			filtered->ResetStats();
+
+			for (uint32_t i = 0; i < numObjects; ++i)
+			{
+				UINT material = (i / objectsPerMaterial) % numMaterials;
+				UINT constants[4] = { material, 0, 0, 0 };
+
+				filtered->SetGraphicsRootSignature(rootSignature.Get());
+				filtered->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+				filtered->IASetVertexBuffers(0, 1, &vertexBuffers[material]);
+				filtered->SetGraphicsRoot32BitConstants(0, _countof(constants), constants, 0);
+				filtered->SetGraphicsRootConstantBufferView(1, address + (i % 256) * 256);
+			}
+
+			ThrowIfFailed(commandList->Close());
+		});
+
+		const FilteredCommandList::Stats &stats = filtered->GetStats();
+		Report("FilteredCommandList, %u objects: raw %.3f ms, filtered %.3f ms (%u calls issued, %u filtered)\n",
+			numObjects, rawMs, filteredMs, stats.issued, stats.filtered);
+	}
+
+	// A job that makes two children until it is deep enough, so workers spawn
+	// and steal from each other
+	struct SplitJob
+	{
+		JobSystem *jobs;
+		uint32_t depth;
+
+		void operator()(JobSystem::Job *job) const
+		{
+			if (depth > 0)
+			{
+				jobs->Run(jobs->CreateJob(SplitJob{ jobs, depth - 1 }, job));
+				jobs->Run(jobs->CreateJob(SplitJob{ jobs, depth - 1 }, job));
+			}
+		}
+	};
+
+	// What it costs to make, queue, steal and wait for a job, with empty jobs
+	void JobOverhead(JobSystem &jobs)
+	{
+		const uint32_t numJobs = 10000;
+		const uint32_t depth = 14;
+
+		// One after the other: queued and waited for on the calling thread
+		double serialMs = MeasureMs([&]()
+		{
+			for (uint32_t i = 0; i < numJobs; ++i)
+			{
+				JobSystem::Job *job = jobs.CreateJob([](JobSystem::Job*) {});
+				jobs.Run(job);
+				jobs.Wait(job);
+			}
+		});
+
+		// Children of one root, all made on the calling thread and mostly stolen
+		JobSystem::Stats before = jobs.GetStats();
+		double fanOutMs = MeasureMs([&]()
+		{
+			JobSystem::Job *root = jobs.CreateJob([](JobSystem::Job*) {});
+			for (uint32_t i = 0; i < numJobs; ++i)
+			{
+				jobs.Run(jobs.CreateJob([](JobSystem::Job*) {}, root));
+			}
+			jobs.Run(root);
+			jobs.Wait(root);
+		});
+		JobSystem::Stats after = jobs.GetStats();
+		uint64_t fanOutSteals = (after.steals - before.steals) / gRepeats;
+
+		// A tree of jobs made on every thread
+		uint32_t treeJobs = (2u << depth) - 1;
+		before = jobs.GetStats();
+		double treeMs = MeasureMs([&]()
+		{
+			JobSystem::Job *root = jobs.CreateJob(SplitJob{ &jobs, depth });
+			jobs.Run(root);
+			jobs.Wait(root);
+		});
+		after = jobs.GetStats();
+		uint64_t treeSteals = (after.steals - before.steals) / gRepeats;
+
+		// Small batches, what ParallelFor adds to a cheap loop
+		std::vector<float> values(1024 * 1024, 1.0f);
+		double loopMs = MeasureMs([&]()
+		{
+			for (float &value : values)
+			{
+				value = value * 0.5f + 1.0f;
+			}
+		});
+		double parallelForMs = MeasureMs([&]()
+		{
+			jobs.ParallelFor(static_cast<uint32_t>(values.size()), 1024, [&values](uint32_t begin, uint32_t end)
+			{
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					values[i] = values[i] * 0.5f + 1.0f;
+				}
+			});
+		});
+
+		Report("Jobs, %u threads: run and wait %.1f ns/job, %u children %.1f ns/job (%llu stolen), tree of %u %.1f ns/job (%llu stolen)\n",
+			jobs.GetNumThreads(), serialMs * 1e6 / numJobs, numJobs, fanOutMs * 1e6 / numJobs, fanOutSteals,
+			treeJobs, treeMs * 1e6 / treeJobs, treeSteals);
+		Report("\t%zu element loop %.3f ms, ParallelFor %.3f ms\n", values.size(), loopMs, parallelForMs);
+	}
+
+	// Recording the same loop into a CommandStream instead of the command list,
+	// then translating it on one list or on one list per job system thread.
+	// No pipeline is bound, so there are no draws, only the per-object state.
+	void CommandStreamTranslation(ComPtr<ID3D12Device2> device, JobSystem &jobs)
+	{
+		const uint32_t numObjects = 10000;
+		const uint32_t numMaterials = 4;
+		const UINT numLists = jobs.GetNumThreads();
+
+		std::vector<ComPtr<ID3D12CommandAllocator>> allocators(numLists);
+		std::vector<ComPtr<ID3D12GraphicsCommandList>> commandLists(numLists);
+		std::vector<ID3D12GraphicsCommandList*> lists(numLists);
+		for (UINT i = 0; i < numLists; ++i)
+		{
+			CreateCommandList(device, allocators[i], commandLists[i]);
+			lists[i] = commandLists[i].Get();
+		}
+
+		ComPtr<ID3DBlob> rootSignatureBlob;
+		ComPtr<ID3D12RootSignature> rootSignature = CreateRootSignature(device, &rootSignatureBlob);
+		ComPtr<ID3D12Resource> buffer = CreateUploadBuffer(device, 64 * 1024);
+		D3D12_GPU_VIRTUAL_ADDRESS address = buffer->GetGPUVirtualAddress();
+
+		D3D12_VERTEX_BUFFER_VIEW vertexBuffers[numMaterials];
+		for (uint32_t i = 0; i < numMaterials; ++i)
+		{
+			vertexBuffers[i] = { address + i * 4096, 4096, 32 };
+		}
+
+		CommandStream stream;
+
+		double recordMs = MeasureMs([&]()
+		{
+			stream.Reset();
+			stream.SetGraphicsRootSignature(rootSignature.Get());
+			stream.IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+			for (uint32_t i = 0; i < numObjects; ++i)
+			{
+				UINT material = (i / 16) % numMaterials;
+				UINT constants[4] = { material, 0, 0, 0 };
+
+				stream.IASetVertexBuffers(0, 1, &vertexBuffers[material]);
+				stream.SetGraphicsRoot32BitConstants(0, _countof(constants), constants, 0);
+				stream.SetGraphicsRootConstantBufferView(1, address + (i % 256) * 256);
+			}
+		});
+
+		const CommandStream *streams[] = { &stream };
+
+		auto translate = [&](CommandTranslator &translator, UINT count)
+		{
+			for (UINT i = 0; i < count; ++i)
+			{
+				ThrowIfFailed(lists[i]->Reset(allocators[i].Get(), nullptr));
+			}
+
+			translator.Translate(streams, _countof(streams), lists.data(), count);
+
+			for (UINT i = 0; i < count; ++i)
+			{
+				ThrowIfFailed(lists[i]->Close());
+			}
+		};
+
+		CommandTranslator serial;
+		double serialMs = MeasureMs([&]() { translate(serial, 1); });
+
+		CommandTranslator parallel(&jobs);
+		double parallelMs = MeasureMs([&]() { translate(parallel, numLists); });
+
+		Report("CommandStream, %u commands (%zu KB): record %.3f ms, translate on 1 list %.3f ms, on %u lists %.3f ms (%u state commands restored)\n",
+			stream.GetNumCommands(), stream.GetSize() / 1024, recordMs, serialMs, numLists, parallelMs,
+			parallel.GetStats().restored);
+
+		// Capture one translation and replay it
+		const wchar_t *capturePath = L"benchmarks.capture";
+
+		CommandCapture capture;
+		capture.AddRootSignature(rootSignature.Get(), rootSignatureBlob->GetBufferPointer(), rootSignatureBlob->GetBufferSize());
+		capture.Start(capturePath, 1);
+		capture.AddResource(buffer.Get());
+
+		parallel.SetCapture(&capture);
+		translate(parallel, numLists);
+		parallel.SetCapture(nullptr);
+
+		if (capture.EndFrame())
+		{
+			CommandReplay replay(device);
+			if (replay.Load(capturePath))
+			{
+				Report("%s", CommandReplay::Describe(replay.Run(gRepeats)).c_str());
+			}
+		}
+	}
+
+	// Sorting the keys of 10k to 1M draws, and what sorting saves when they are
+	// submitted. The packets point at made up objects, they are only recorded
+	// into a CommandStream.
+	void DrawListSorting(JobSystem &jobs)
+	{
+		const uint32_t numPasses = 4;
+		const uint32_t numPipelines = 64;
+		const uint32_t numMaterials = 1024;
+		const uint32_t numMeshes = 256;
+
+		const size_t counts[] = { 10000, 100000, 1000000 };
+		for (size_t count : counts)
+		{
+			std::mt19937 random(1234);
+
+			DrawList drawList(0, 1);
+			for (size_t i = 0; i < count; ++i)
+			{
+				uint32_t pass = random() % numPasses;
+				uint32_t pipeline = random() % numPipelines;
+				uint32_t material = random() % numMaterials;
+				uint32_t mesh = random() % numMeshes;
+				uint16_t depth = static_cast<uint16_t>(random());
+
+				DrawPacket packet = {};
+				packet.pipelineState = reinterpret_cast<ID3D12PipelineState*>(uintptr_t(pipeline + 1) * 256);
+				packet.rootSignature = reinterpret_cast<ID3D12RootSignature*>(uintptr_t(pass + 1) * 256);
+				packet.topology = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+				packet.vertexBuffer = { 0x10000000ull + mesh * 65536ull, 65536, 32 };
+				packet.indexBuffer = { 0x20000000ull + mesh * 16384ull, 16384, DXGI_FORMAT_R16_UINT };
+				packet.materialConstants = 0x30000000ull + material * 256ull;
+				packet.objectConstants = 0x40000000ull + i * 256ull;
+				packet.count = 300;
+				packet.instanceCount = 1;
+
+				drawList.Add(DrawList::MakeKey(static_cast<uint8_t>(pass), pipeline, material, depth), packet);
+			}
+
+			// Submission in the order the draws were added, before sorting
+			CommandStream stream;
+			drawList.Submit(stream);
+			DrawList::Stats unsorted = drawList.GetStats();
+
+			std::vector<uint64_t> originalKeys(count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				originalKeys[i] = drawList.GetKey(i);
+			}
+
+			std::vector<uint64_t> keys(count), tempKeys(count);
+			std::vector<uint32_t> values(count), tempValues(count);
+			auto reset = [&]()
+			{
+				keys = originalKeys;
+				for (size_t i = 0; i < count; ++i)
+				{
+					values[i] = static_cast<uint32_t>(i);
+				}
+			};
+
+			std::vector<std::pair<uint64_t, uint32_t>> pairs(count);
+			double stdSortMs = MeasureMs([&]()
+			{
+				for (size_t i = 0; i < count; ++i)
+				{
+					pairs[i] = std::make_pair(originalKeys[i], static_cast<uint32_t>(i));
+				}
+			},
+			[&]()
+			{
+				std::sort(pairs.begin(), pairs.end());
+			});
+
+			double radixMs = MeasureMs(reset, [&]()
+			{
+				RadixSort::Sort(keys.data(), values.data(), tempKeys.data(), tempValues.data(), count);
+			});
+
+			double parallelMs = MeasureMs(reset, [&]()
+			{
+				RadixSort::Sort(keys.data(), values.data(), tempKeys.data(), tempValues.data(), count, &jobs);
+			});
+
+			drawList.Sort(&jobs);
+
+			stream.Reset();
+			DrawList::Stats before = drawList.GetStats();
+			double submitMs = MeasureMs([&]()
+			{
+				stream.Reset();
+				drawList.Submit(stream);
+			});
+			DrawList::Stats after = drawList.GetStats();
+			uint32_t repeats = (after.draws - before.draws) / static_cast<uint32_t>(count);
+
+			Report("DrawList, %zu draws: std::sort %.3f ms, radix %.3f ms, radix on %u threads %.3f ms, submit %.3f ms\n",
+				count, stdSortMs, radixMs, jobs.GetNumThreads(), parallelMs, submitMs);
+			Report("\tpipeline changes %u -> %u, material changes %u -> %u, geometry changes %u -> %u\n",
+				unsorted.pipelineChanges, (after.pipelineChanges - before.pipelineChanges) / repeats,
+				unsorted.materialChanges, (after.materialChanges - before.materialChanges) / repeats,
+				unsorted.geometryChanges, (after.geometryChanges - before.geometryChanges) / repeats);
+		}
+	}
+
+	// Foliage and props: few meshes and materials drawn many times each
+	void Instancing(JobSystem &jobs)
+	{
+		const uint32_t numMeshes = 50;
+		const uint32_t numMaterials = 20;
+		const size_t count = 100000;
+
+		std::mt19937 random(1234);
+
+		std::vector<DirectX::XMFLOAT4X4> transforms(count);
+		std::vector<uint64_t> keys(count);
+		std::vector<DrawPacket> packets(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			uint32_t mesh = random() % numMeshes;
+			uint32_t material = random() % numMaterials;
+			uint16_t depth = static_cast<uint16_t>(random());
+
+			float x = static_cast<float>(random() % 1000);
+			float z = static_cast<float>(random() % 1000);
+			DirectX::XMStoreFloat4x4(&transforms[i], DirectX::XMMatrixTranslation(x, 0.0f, z));
+
+			DrawPacket &packet = packets[i];
+			packet = {};
+			packet.pipelineState = reinterpret_cast<ID3D12PipelineState*>(uintptr_t(256));
+			packet.rootSignature = reinterpret_cast<ID3D12RootSignature*>(uintptr_t(512));
+			packet.topology = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+			packet.vertexBuffer = { 0x10000000ull + mesh * 65536ull, 65536, 32 };
+			packet.indexBuffer = { 0x20000000ull + mesh * 16384ull, 16384, DXGI_FORMAT_R16_UINT };
+			packet.materialConstants = 0x30000000ull + material * 256ull;
+			packet.objectConstants = 0x40000000ull + i * 256ull;
+			packet.count = 300;
+			packet.instanceCount = 1;
+			packet.transform = &transforms[i];
+
+			keys[i] = DrawList::MakeKey(0, 0, material, depth);
+		}
+
+		// Plain memory with a made up GPU address, nothing is drawn
+		std::vector<uint8_t> memory(count * sizeof(DirectX::XMFLOAT4X4) * 2);
+		UploadRing ring(memory.data(), 0x50000000ull, memory.size());
+		uint64_t frame = 0;
+
+		DrawList drawList(0, 1);
+		auto build = [&]()
+		{
+			// The ring is free again once the last frame is done
+			ring.EndFrame(++frame);
+			ring.Retire(frame);
+
+			drawList.Reset();
+			for (size_t i = 0; i < count; ++i)
+			{
+				drawList.Add(keys[i], packets[i]);
+			}
+			drawList.Sort(&jobs);
+		};
+
+		CommandStream stream;
+		double submitMs = MeasureMs(build, [&]()
+		{
+			stream.Reset();
+			drawList.Submit(stream);
+		});
+		uint32_t commands = stream.GetNumCommands();
+
+		double mergeMs = MeasureMs(build, [&]()
+		{
+			drawList.MergeInstances(ring);
+		});
+		DrawList::Stats stats = drawList.GetStats();
+
+		double mergedSubmitMs = MeasureMs([&]()
+		{
+			stream.Reset();
+			drawList.Submit(stream);
+		});
+		uint32_t mergedCommands = stream.GetNumCommands();
+
+		Report("Instancing, %zu draws of %u meshes and %u materials: merge %.3f ms, %u draws -> %u instanced draws\n",
+			count, numMeshes, numMaterials, mergeMs, stats.mergedDraws, stats.instancedDraws);
+		Report("\tsubmit %.3f ms -> %.3f ms, %u commands -> %u, %llu bytes of transforms\n",
+			submitMs, mergedSubmitMs, commands, mergedCommands, ring.GetStats().peak);
+	}
+
+	// A million boxes spread around a camera looking down +z, a quarter of
+	// them or so in view. The scalar loop is the same test, one object at a time.
+	void FrustumCulling(JobSystem &jobs)
+	{
+		const uint32_t count = 1000000;
+
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> position(-1000.0f, 1000.0f);
+		std::uniform_real_distribution<float> size(0.5f, 10.0f);
+
+		std::vector<DirectX::XMFLOAT3> centers(count);
+		std::vector<DirectX::XMFLOAT3> extents(count);
+
+		FrustumCuller culler;
+		culler.Reserve(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			centers[i] = DirectX::XMFLOAT3(position(random), position(random), position(random));
+			extents[i] = DirectX::XMFLOAT3(size(random), size(random), size(random));
+			culler.Add(centers[i], extents[i]);
+		}
+
+		DirectX::XMMATRIX view = DirectX::XMMatrixLookToLH(DirectX::XMVectorZero(),
+			DirectX::XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), DirectX::XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		DirectX::XMMATRIX projection = DirectX::XMMatrixPerspectiveFovLH(DirectX::XM_PIDIV2, 16.0f / 9.0f, 0.1f, 1000.0f);
+		Frustum frustum = Frustum::FromMatrix(DirectX::XMMatrixMultiply(view, projection));
+
+		std::vector<uint32_t> visible(count);
+		uint32_t numVisible = 0;
+		double scalarMs = MeasureMs([&]()
+		{
+			numVisible = 0;
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				bool inside = true;
+				for (const DirectX::XMFLOAT4 &plane : frustum.planes)
+				{
+					float distance = plane.x * centers[i].x + plane.y * centers[i].y + plane.z * centers[i].z + plane.w;
+					float reach = std::abs(plane.x) * extents[i].x + std::abs(plane.y) * extents[i].y +
+						std::abs(plane.z) * extents[i].z;
+					if (distance < -reach)
+					{
+						inside = false;
+						break;
+					}
+				}
+
+				if (inside)
+				{
+					visible[numVisible++] = i;
+				}
+			}
+		});
+
+		Report("Frustum culling, %u objects: scalar boxes %.3f ms\n", count, scalarMs);
+
+		// The 4 wide path too where the CPU has AVX2, it's what runs without it
+		for (bool avx2 : { false, true })
+		{
+			if (avx2 && !FrustumCuller::CanUseAvx2())
+			{
+				continue;
+			}
+			culler.SetAvx2(avx2);
+
+			double sphereMs = MeasureMs([&]() { culler.Cull(frustum, FrustumCuller::SHAPE_SPHERE); });
+			uint32_t visibleSpheres = culler.GetNumVisible();
+
+			double sphereJobsMs = MeasureMs([&]() { culler.Cull(frustum, FrustumCuller::SHAPE_SPHERE, &jobs); });
+
+			double boxMs = MeasureMs([&]() { culler.Cull(frustum, FrustumCuller::SHAPE_BOX); });
+
+			double boxJobsMs = MeasureMs([&]() { culler.Cull(frustum, FrustumCuller::SHAPE_BOX, &jobs); });
+			bool same = culler.GetNumVisible() == numVisible &&
+				std::equal(visible.begin(), visible.begin() + numVisible, culler.GetVisible());
+
+			Report("\t%u lanes: spheres %.3f ms, on %u threads %.3f ms, boxes %.3f ms, on %u threads %.3f ms\n",
+				culler.GetSimdWidth(), sphereMs, jobs.GetNumThreads(), sphereJobsMs, boxMs, jobs.GetNumThreads(),
+				boxJobsMs);
+			Report("\t%u spheres and %u boxes visible, %s the scalar loop\n", visibleSpheres, culler.GetNumVisible(),
+				same ? "same as" : "DIFFERENT from");
+		}
+	}
+
+	// A street of walls with 100k small props behind and between them:
+	// frustum culling first, then the walls are rasterized and the props
+	// that survived are tested against them
+	void OcclusionCulling(JobSystem &jobs)
+	{
+		const uint32_t numObjects = 100000;
+		const uint32_t numWalls = 64;
+
+		const DirectX::XMFLOAT3 boxVertices[8] =
+		{
+			DirectX::XMFLOAT3(-1.0f, -1.0f, -1.0f), DirectX::XMFLOAT3(1.0f, -1.0f, -1.0f),
+			DirectX::XMFLOAT3(-1.0f, 1.0f, -1.0f), DirectX::XMFLOAT3(1.0f, 1.0f, -1.0f),
+			DirectX::XMFLOAT3(-1.0f, -1.0f, 1.0f), DirectX::XMFLOAT3(1.0f, -1.0f, 1.0f),
+			DirectX::XMFLOAT3(-1.0f, 1.0f, 1.0f), DirectX::XMFLOAT3(1.0f, 1.0f, 1.0f),
+		};
+		const uint32_t boxIndices[36] =
+		{
+			0, 2, 1, 1, 2, 3,	4, 5, 6, 5, 7, 6,	0, 1, 4, 1, 5, 4,
+			2, 6, 3, 3, 6, 7,	0, 4, 2, 2, 4, 6,	1, 3, 5, 3, 7, 5,
+		};
+
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> spread(-500.0f, 500.0f);
+		std::uniform_real_distribution<float> distance(5.0f, 1000.0f);
+
+		std::vector<DirectX::XMFLOAT3> centers(numObjects);
+		std::vector<DirectX::XMFLOAT3> extents(numObjects, DirectX::XMFLOAT3(1.0f, 1.0f, 1.0f));
+
+		FrustumCuller frustumCuller;
+		frustumCuller.Reserve(numObjects);
+		for (uint32_t i = 0; i < numObjects; ++i)
+		{
+			centers[i] = DirectX::XMFLOAT3(spread(random), 1.0f, distance(random));
+			frustumCuller.Add(centers[i], extents[i]);
+		}
+
+		std::vector<DirectX::XMFLOAT4X4> walls(numWalls);
+		for (uint32_t i = 0; i < numWalls; ++i)
+		{
+			DirectX::XMMATRIX world = DirectX::XMMatrixMultiply(DirectX::XMMatrixScaling(20.0f, 10.0f, 0.5f),
+				DirectX::XMMatrixTranslation(spread(random) * 0.2f, 5.0f, 20.0f + distance(random) * 0.1f));
+			DirectX::XMStoreFloat4x4(&walls[i], world);
+		}
+
+		DirectX::XMMATRIX view = DirectX::XMMatrixLookToLH(DirectX::XMVectorSet(0.0f, 2.0f, 0.0f, 1.0f),
+			DirectX::XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), DirectX::XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		DirectX::XMMATRIX projection = DirectX::XMMatrixPerspectiveFovLH(DirectX::XM_PIDIV2, 16.0f / 9.0f, 0.1f, 1000.0f);
+		DirectX::XMMATRIX viewProjection = DirectX::XMMatrixMultiply(view, projection);
+
+		frustumCuller.Cull(Frustum::FromMatrix(viewProjection), FrustumCuller::SHAPE_BOX, &jobs);
+
+		OcclusionCuller occlusionCuller;
+		auto addWalls = [&]()
+		{
+			occlusionCuller.Begin(viewProjection);
+			for (const DirectX::XMFLOAT4X4 &wall : walls)
+			{
+				occlusionCuller.AddOccluder(boxVertices, _countof(boxVertices), boxIndices, _countof(boxIndices),
+					DirectX::XMLoadFloat4x4(&wall));
+			}
+		};
+
+		double binMs = MeasureMs(addWalls);
+		double rasterizeMs = MeasureMs([&]() { occlusionCuller.Rasterize(); });
+		double rasterizeJobsMs = MeasureMs([&]() { occlusionCuller.Rasterize(&jobs); });
+
+		double testMs = MeasureMs([&]()
+		{
+			occlusionCuller.Test(frustumCuller.GetVisible(), frustumCuller.GetNumVisible(), centers.data(), extents.data());
+		});
+		double testJobsMs = MeasureMs([&]()
+		{
+			occlusionCuller.Test(frustumCuller.GetVisible(), frustumCuller.GetNumVisible(), centers.data(), extents.data(),
+				&jobs);
+		});
+
+		const OcclusionCuller::Stats &stats = occlusionCuller.GetStats();
+		Report("Occlusion culling, %ux%u depth, %u occluder triangles (%u binned): bin %.3f ms, rasterize %.3f ms, on %u threads %.3f ms\n",
+			occlusionCuller.GetWidth(), occlusionCuller.GetHeight(), stats.occluderTriangles, stats.binnedTriangles,
+			binMs, rasterizeMs, jobs.GetNumThreads(), rasterizeJobsMs);
+		Report("\t%u objects, %u in the frustum, %u not occluded: test %.3f ms, on %u threads %.3f ms\n",
+			numObjects, frustumCuller.GetNumVisible(), occlusionCuller.GetNumVisible(), testMs, jobs.GetNumThreads(),
+			testJobsMs);
+	}
+
+	// The usual scene graph the hierarchy is compared with: every node its own
+	// allocation, updated by recursing from the roots
+	struct SceneNode
+	{
+		DirectX::XMFLOAT3 position;
+		DirectX::XMFLOAT4 rotation;
+		DirectX::XMFLOAT3 scale;
+		DirectX::XMFLOAT4X4 world;
+		bool dirty;
+		std::vector<SceneNode*> children;
+	};
+
+	void UpdateSceneNode(SceneNode &node, DirectX::FXMMATRIX parentWorld, bool parentChanged)
+	{
+		bool changed = node.dirty || parentChanged;
+		node.dirty = false;
+
+		DirectX::XMMATRIX world;
+		if (changed)
+		{
+			world = DirectX::XMMatrixMultiply(DirectX::XMMatrixAffineTransformation(DirectX::XMLoadFloat3(&node.scale),
+				DirectX::XMVectorZero(), DirectX::XMLoadFloat4(&node.rotation), DirectX::XMLoadFloat3(&node.position)),
+				parentWorld);
+			DirectX::XMStoreFloat4x4(&node.world, world);
+		}
+		else
+		{
+			world = DirectX::XMLoadFloat4x4(&node.world);
+		}
+
+		for (SceneNode *child : node.children)
+		{
+			UpdateSceneNode(*child, world, changed);
+		}
+	}
+
+	// 1000 characters of 500 bones each, 4 children per bone, 6 levels deep
+	void TransformUpdate(JobSystem &jobs)
+	{
+		const uint32_t numRoots = 1000;
+		const uint32_t nodesPerRoot = 500;
+		const uint32_t count = numRoots * nodesPerRoot;
+		const uint32_t numMoved = count / 100;
+
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+		std::uniform_real_distribution<float> angle(-DirectX::XM_PI, DirectX::XM_PI);
+		std::uniform_int_distribution<uint32_t> pick(0, count - 1);
+
+		std::vector<DirectX::XMFLOAT3> positions(count);
+		std::vector<DirectX::XMFLOAT4> rotations(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			positions[i] = DirectX::XMFLOAT3(offset(random), offset(random), offset(random));
+			DirectX::XMStoreFloat4(&rotations[i], DirectX::XMQuaternionRotationRollPitchYaw(angle(random),
+				angle(random), angle(random)));
+		}
+
+		// Added a character at a time, so Update has to sort them by depth
+		TransformHierarchy hierarchy;
+		hierarchy.Reserve(count);
+		std::vector<TransformHierarchy::Node> nodes(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			uint32_t bone = i % nodesPerRoot;
+			TransformHierarchy::Node parent = TransformHierarchy::gNoParent;
+			if (bone > 0)
+			{
+				parent = nodes[i - bone + (bone - 1) / 4];
+			}
+			nodes[i] = hierarchy.Add(parent, positions[i], rotations[i], DirectX::XMFLOAT3(1.0f, 1.0f, 1.0f));
+		}
+
+		// Allocated in a random order, as a long running scene ends up
+		std::vector<uint32_t> order(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			order[i] = i;
+		}
+		std::shuffle(order.begin(), order.end(), random);
+
+		std::vector<std::unique_ptr<SceneNode>> sceneNodes(count);
+		for (uint32_t i : order)
+		{
+			sceneNodes[i] = std::make_unique<SceneNode>();
+			sceneNodes[i]->position = positions[i];
+			sceneNodes[i]->rotation = rotations[i];
+			sceneNodes[i]->scale = DirectX::XMFLOAT3(1.0f, 1.0f, 1.0f);
+			sceneNodes[i]->dirty = true;
+		}
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			uint32_t bone = i % nodesPerRoot;
+			if (bone > 0)
+			{
+				sceneNodes[i - bone + (bone - 1) / 4]->children.push_back(sceneNodes[i].get());
+			}
+		}
+
+		auto updateScene = [&]()
+		{
+			for (uint32_t i = 0; i < count; i += nodesPerRoot)
+			{
+				UpdateSceneNode(*sceneNodes[i], DirectX::XMMatrixIdentity(), false);
+			}
+		};
+
+		hierarchy.Update();
+		double sortMs = hierarchy.GetStats().sortMs;
+		uint32_t numDepths = hierarchy.GetStats().depths;
+
+		auto touchAll = [&]()
+		{
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				hierarchy.SetPosition(nodes[i], positions[i]);
+				sceneNodes[i]->dirty = true;
+			}
+		};
+		double sceneMs = MeasureMs(touchAll, updateScene);
+		double allMs = MeasureMs(touchAll, [&]() { hierarchy.Update(); });
+		double allJobsMs = MeasureMs(touchAll, [&]() { hierarchy.Update(&jobs); });
+
+		bool same = true;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			const DirectX::XMFLOAT4X4 &world = hierarchy.GetWorld(nodes[i]);
+			const DirectX::XMFLOAT4X4 &sceneWorld = sceneNodes[i]->world;
+			for (uint32_t row = 0; row < 4; ++row)
+			{
+				for (uint32_t column = 0; column < 4; ++column)
+				{
+					same = same && std::abs(world.m[row][column] - sceneWorld.m[row][column]) < 1e-3f;
+				}
+			}
+		}
+
+		auto moveSome = [&]()
+		{
+			for (uint32_t i = 0; i < numMoved; ++i)
+			{
+				uint32_t node = pick(random);
+				hierarchy.SetPosition(nodes[node], positions[node]);
+				sceneNodes[node]->dirty = true;
+			}
+		};
+		double sceneMovedMs = MeasureMs(moveSome, updateScene);
+		double movedMs = MeasureMs(moveSome, [&]() { hierarchy.Update(); });
+		double movedJobsMs = MeasureMs(moveSome, [&]() { hierarchy.Update(&jobs); });
+		uint32_t updated = hierarchy.GetStats().updated;
+
+		Report("Transform update, %u nodes in %u depths (sorted in %.3f ms), all moved: scene graph %.3f ms, hierarchy %.3f ms, on %u threads %.3f ms, %s the scene graph\n",
+			count, numDepths, sortMs, sceneMs, allMs, jobs.GetNumThreads(), allJobsMs, same ? "same as" : "DIFFERENT from");
+		Report("\t%u moved (%u updated with their children): scene graph %.3f ms, hierarchy %.3f ms, on %u threads %.3f ms\n",
+			numMoved, updated, sceneMovedMs, movedMs, jobs.GetNumThreads(), movedJobsMs);
+	}
+
+	// 5 seconds of frames at several frame rates, each running the steps of a
+	// 60 Hz simulation moving 1% of 100k transforms: the number of steps and
+	// their cost don't depend on the frame rate
+	void FixedTimestepRates(JobSystem &jobs)
+	{
+		const uint32_t count = 100000;
+		const uint32_t numMoved = count / 100;
+		const double seconds = 5.0;
+		const double frameRates[] = { 30.0, 60.0, 144.0, 300.0 };
+
+		std::mt19937 random(1234);
+		std::uniform_int_distribution<uint32_t> pick(0, count - 1);
+
+		TransformHierarchy hierarchy;
+		hierarchy.Reserve(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			TransformHierarchy::Node parent = TransformHierarchy::gNoParent;
+			if (i % 100 > 0)
+			{
+				parent = i - 1;
+			}
+			hierarchy.Add(parent, DirectX::XMFLOAT3(0.0f, 0.0f, 1.0f), DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f),
+				DirectX::XMFLOAT3(1.0f, 1.0f, 1.0f));
+		}
+		hierarchy.Update(&jobs);
+
+		static std::chrono::high_resolution_clock clock;
+
+		auto simulate = [&](double frameRate, uint32_t hitchEvery, uint64_t &steps, double &simulateMs,
+			double &droppedSeconds)
+		{
+			FixedTimestep timestep;
+			uint32_t numFrames = static_cast<uint32_t>(seconds * frameRate);
+
+			auto t0 = clock.now();
+			for (uint32_t frame = 0; frame < numFrames; ++frame)
+			{
+				double elapsed = 1.0 / frameRate;
+				if (hitchEvery && frame % hitchEvery == hitchEvery - 1)
+				{
+					elapsed = 0.5;
+				}
+
+				uint32_t numSteps = timestep.Advance(elapsed);
+				for (uint32_t step = 0; step < numSteps; ++step)
+				{
+					for (uint32_t i = 0; i < numMoved; ++i)
+					{
+						hierarchy.SetPosition(pick(random), DirectX::XMFLOAT3(0.0f, 0.0f, 1.0f));
+					}
+					hierarchy.Update(&jobs);
+				}
+			}
+
+			steps = timestep.GetStats().steps;
+			droppedSeconds = timestep.GetStats().droppedSeconds;
+			simulateMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+		};
+
+		Report("Fixed timestep, %.0f s at 60 Hz, %u transforms with %u moved every step, on %u threads:\n",
+			seconds, count, numMoved, jobs.GetNumThreads());
+		for (double frameRate : frameRates)
+		{
+			uint64_t steps = 0;
+			double simulateMs = 0.0;
+			double droppedSeconds = 0.0;
+			simulate(frameRate, 0, steps, simulateMs, droppedSeconds);
+
+			Report("\t%.0f Hz frames: %llu steps, %.3f ms per simulated second\n", frameRate,
+				steps, simulateMs / seconds);
+		}
+
+		// A 500 ms hitch every second would need 30 steps in one frame
+		uint64_t steps = 0;
+		double simulateMs = 0.0;
+		double droppedSeconds = 0.0;
+		simulate(60.0, 60, steps, simulateMs, droppedSeconds);
+		Report("\t60 Hz frames with a 500 ms hitch every second: %llu steps, %.3f s dropped, at most %u steps a frame\n",
+			steps, droppedSeconds, FixedTimestep::gMaxSteps);
+	}
+
+	// 50k objects spread so the cells hold 0.1, 1 and 10 objects on average,
+	// 1000 sphere queries of one cell's radius against testing every object
+	void SpatialQueries(JobSystem &jobs)
+	{
+		const uint32_t count = 50000;
+		const uint32_t numQueries = 1000;
+		const uint32_t numMoved = count / 10;
+		const float cellSize = 4.0f;
+		const float densities[] = { 0.1f, 1.0f, 10.0f };
+
+		for (float density : densities)
+		{
+			float size = std::cbrt(count / density) * cellSize;
+
+			std::mt19937 random(1234);
+			std::uniform_real_distribution<float> position(0.0f, size);
+			std::uniform_real_distribution<float> step(-1.0f, 1.0f);
+			std::uniform_int_distribution<uint32_t> pick(0, count - 1);
+
+			std::vector<DirectX::XMFLOAT3> positions(count);
+			for (DirectX::XMFLOAT3 &p : positions)
+			{
+				p = DirectX::XMFLOAT3(position(random), position(random), position(random));
+			}
+
+			std::vector<DirectX::XMFLOAT3> centers(numQueries);
+			std::vector<float> radii(numQueries, cellSize);
+			for (DirectX::XMFLOAT3 &center : centers)
+			{
+				center = DirectX::XMFLOAT3(position(random), position(random), position(random));
+			}
+
+			std::vector<uint32_t> bruteResults;
+			std::vector<uint32_t> bruteOffsets(numQueries + 1);
+			double bruteMs = MeasureMs([&]()
+			{
+				bruteResults.clear();
+				for (uint32_t query = 0; query < numQueries; ++query)
+				{
+					bruteOffsets[query] = static_cast<uint32_t>(bruteResults.size());
+					const DirectX::XMFLOAT3 &center = centers[query];
+					float radiusSquared = radii[query] * radii[query];
+					for (uint32_t i = 0; i < count; ++i)
+					{
+						float x = positions[i].x - center.x;
+						float y = positions[i].y - center.y;
+						float z = positions[i].z - center.z;
+						if (x * x + y * y + z * z <= radiusSquared)
+						{
+							bruteResults.push_back(i);
+						}
+					}
+				}
+				bruteOffsets[numQueries] = static_cast<uint32_t>(bruteResults.size());
+			});
+
+			SpatialGrid grid(cellSize);
+			double buildMs = MeasureMs([&]() { grid.Build(positions.data(), count); });
+			double buildJobsMs = MeasureMs([&]() { grid.Build(positions.data(), count, &jobs); });
+			uint32_t numCells = grid.GetStats().cells;
+
+			double queryMs = MeasureMs([&]() { grid.QuerySpheres(centers.data(), radii.data(), numQueries); });
+			double queryJobsMs = MeasureMs([&]() { grid.QuerySpheres(centers.data(), radii.data(), numQueries, &jobs); });
+
+			// Same objects, the grid gives them cell by cell
+			bool same = grid.GetStats().results == bruteResults.size();
+			for (uint32_t query = 0; query < numQueries && same; ++query)
+			{
+				std::vector<uint32_t> found(grid.GetResults(query), grid.GetResults(query) + grid.GetNumResults(query));
+				std::sort(found.begin(), found.end());
+				same = found.size() == bruteOffsets[query + 1] - bruteOffsets[query] &&
+					std::equal(found.begin(), found.end(), bruteResults.begin() + bruteOffsets[query]);
+			}
+
+			// A tenth of the objects take a small step every frame
+			std::vector<uint32_t> moved(numMoved);
+			std::vector<DirectX::XMFLOAT3> movedPositions(numMoved);
+			auto pickMoves = [&]()
+			{
+				for (uint32_t i = 0; i < numMoved; ++i)
+				{
+					moved[i] = pick(random);
+					const DirectX::XMFLOAT3 &p = grid.GetPosition(moved[i]);
+					movedPositions[i] = DirectX::XMFLOAT3(p.x + step(random), p.y + step(random), p.z + step(random));
+				}
+			};
+			double moveMs = MeasureMs(pickMoves, [&]() { grid.Move(moved.data(), movedPositions.data(), numMoved); });
+			uint32_t changedCells = grid.GetStats().moved;
+
+			Report("Spatial grid, %u objects, %.1f per cell (%u cells): build %.3f ms, on %u threads %.3f ms, %u moved %.3f ms (%u changed cell)\n",
+				count, density, numCells, buildMs, jobs.GetNumThreads(), buildJobsMs, numMoved, moveMs, changedCells);
+			Report("\t%u queries, %u found: brute force %.3f ms, grid %.3f ms, on %u threads %.3f ms, %s brute force\n",
+				numQueries, static_cast<uint32_t>(bruteResults.size()), bruteMs, queryMs, jobs.GetNumThreads(), queryJobsMs,
+				same ? "same as" : "DIFFERENT from");
+		}
+	}
+
+	// 200k boxes over a 1 km square, picking rays from above at a slant:
+	// build, refit after every box moved a little, rays against testing
+	// every box
+	void BvhQueries(JobSystem &jobs)
+	{
+		const uint32_t count = 200000;
+		const uint32_t numRays = 100000;
+		const uint32_t numBruteRays = 200;
+		const float maxDistance = 2000.0f;
+
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+		std::uniform_real_distribution<float> height(0.0f, 20.0f);
+		std::uniform_real_distribution<float> size(0.5f, 5.0f);
+		std::uniform_real_distribution<float> step(-0.5f, 0.5f);
+
+		std::vector<DirectX::XMFLOAT3> mins(count);
+		std::vector<DirectX::XMFLOAT3> maxs(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			DirectX::XMFLOAT3 center(position(random), height(random), position(random));
+			DirectX::XMFLOAT3 extents(size(random), size(random), size(random));
+			mins[i] = DirectX::XMFLOAT3(center.x - extents.x, center.y - extents.y, center.z - extents.z);
+			maxs[i] = DirectX::XMFLOAT3(center.x + extents.x, center.y + extents.y, center.z + extents.z);
+		}
+
+		std::vector<DirectX::XMFLOAT3> origins(numRays);
+		std::vector<DirectX::XMFLOAT3> directions(numRays);
+		for (uint32_t i = 0; i < numRays; ++i)
+		{
+			origins[i] = DirectX::XMFLOAT3(position(random), 100.0f, position(random));
+			directions[i] = DirectX::XMFLOAT3(step(random), -1.0f, step(random));
+		}
+
+		Bvh bvh;
+		double buildMs = MeasureMs([&]() { bvh.Build(mins.data(), maxs.data(), count); });
+		double buildJobsMs = MeasureMs([&]() { bvh.Build(mins.data(), maxs.data(), count, &jobs); });
+		Bvh::Stats buildStats = bvh.GetStats();
+
+		std::vector<uint32_t> hits(numRays);
+		auto castRays = [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				hits[i] = bvh.RayCast(origins[i], directions[i], maxDistance);
+			}
+		};
+		double raysMs = MeasureMs([&]() { castRays(0, numRays); });
+		double raysJobsMs = MeasureMs([&]() { jobs.ParallelFor(numRays, 256, castRays); });
+
+		std::vector<float> distances(numBruteRays);
+		double bruteMs = MeasureMs([&]()
+		{
+			for (uint32_t i = 0; i < numBruteRays; ++i)
+			{
+				DirectX::XMVECTOR origin = DirectX::XMLoadFloat3(&origins[i]);
+				DirectX::XMVECTOR invDirection = DirectX::XMVectorReciprocal(DirectX::XMLoadFloat3(&directions[i]));
+
+				distances[i] = maxDistance;
+				for (uint32_t j = 0; j < count; ++j)
+				{
+					distances[i] = std::min(distances[i], Bvh::IntersectBox(mins[j], maxs[j], origin, invDirection,
+						distances[i]));
+				}
+			}
+		});
+
+		// Boxes can overlap, so compare the distances rather than the boxes hit
+		bool same = true;
+		for (uint32_t i = 0; i < numBruteRays; ++i)
+		{
+			float distance = maxDistance;
+			bvh.RayCast(origins[i], directions[i], maxDistance, &distance);
+			same = same && distance == distances[i];
+		}
+
+		auto moveBoxes = [&]()
+		{
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				float x = step(random);
+				float z = step(random);
+				mins[i].x += x;
+				maxs[i].x += x;
+				mins[i].z += z;
+				maxs[i].z += z;
+			}
+		};
+		double refitMs = MeasureMs(moveBoxes, [&]() { bvh.Refit(mins.data(), maxs.data()); });
+		double refitRaysMs = MeasureMs([&]() { jobs.ParallelFor(numRays, 256, castRays); });
+
+		Report("BVH, %u boxes: build %.3f ms, on %u threads %.3f ms (%u subtrees), %u nodes, %u leaves, depth %u, refit %.3f ms\n",
+			count, buildMs, jobs.GetNumThreads(), buildJobsMs, buildStats.subtrees, buildStats.nodes, buildStats.leaves,
+			buildStats.depth, refitMs);
+		Report("\t%u rays: %.3f ms, on %u threads %.3f ms, after %u refits %.3f ms; %u rays testing every box %.3f ms, %s the BVH\n",
+			numRays, raysMs, jobs.GetNumThreads(), raysJobsMs, gRepeats, refitRaysMs, numBruteRays, bruteMs,
+			same ? "same as" : "DIFFERENT from");
+	}
+
+	// Raytracing pipelines with 300 hit groups each, one local root signature
+	// for all of them: described with CD3DX12_STATE_OBJECT_DESC and with the
+	// builder in one block reused for every pipeline
+	void StateObjectDescription()
+	{
+		const uint32_t numPipelines = 50;
+		const uint32_t numHitGroups = 300;
+
+		std::vector<std::wstring> names(numHitGroups);
+		std::vector<LPCWSTR> hitGroups(numHitGroups);
+		for (uint32_t i = 0; i < numHitGroups; ++i)
+		{
+			names[i] = L"HitGroup" + std::to_wstring(i);
+			hitGroups[i] = names[i].c_str();
+		}
+		LPCWSTR exports[] = { L"RayGen", L"Miss", L"ClosestHit", L"AnyHit", L"Intersection" };
+		const UINT numExports = static_cast<UINT>(sizeof(exports) / sizeof(exports[0]));
+
+		// Stands in for compiled DXIL, nothing reads it here
+		uint32_t library[64] = {};
+		D3D12_SHADER_BYTECODE bytecode = { library, sizeof(library) };
+
+		// Every third hit group has an any hit shader, every fifth is procedural
+		auto anyHit = [&](uint32_t i) { return i % 3 == 0 ? exports[3] : nullptr; };
+		auto intersection = [&](uint32_t i) { return i % 5 == 0 ? exports[4] : nullptr; };
+
+		std::vector<D3D12_STATE_SUBOBJECT_TYPE> cd3dx12Types;
+		std::vector<std::wstring> cd3dx12Names;
+		double cd3dx12Ms = MeasureMs([&]()
+		{
+			for (uint32_t pipeline = 0; pipeline < numPipelines; ++pipeline)
+			{
+				CD3DX12_STATE_OBJECT_DESC stateObject(D3D12_STATE_OBJECT_TYPE_RAYTRACING_PIPELINE);
+
+				auto dxilLibrary = stateObject.CreateSubobject<CD3DX12_DXIL_LIBRARY_SUBOBJECT>();
+				dxilLibrary->SetDXILLibrary(&bytecode);
+				dxilLibrary->DefineExports(exports, numExports);
+
+				for (uint32_t i = 0; i < numHitGroups; ++i)
+				{
+					auto hitGroup = stateObject.CreateSubobject<CD3DX12_HIT_GROUP_SUBOBJECT>();
+					hitGroup->SetHitGroupExport(hitGroups[i]);
+					hitGroup->SetClosestHitShaderImport(exports[2]);
+					if (anyHit(i))
+					{
+						hitGroup->SetAnyHitShaderImport(anyHit(i));
+					}
+					if (intersection(i))
+					{
+						hitGroup->SetIntersectionShaderImport(intersection(i));
+						hitGroup->SetHitGroupType(D3D12_HIT_GROUP_TYPE_PROCEDURAL_PRIMITIVE);
+					}
+					else
+					{
+						hitGroup->SetHitGroupType(D3D12_HIT_GROUP_TYPE_TRIANGLES);
+					}
+				}
+
+				auto shaderConfig = stateObject.CreateSubobject<CD3DX12_RAYTRACING_SHADER_CONFIG_SUBOBJECT>();
+				shaderConfig->Config(16, 8);
+
+				auto localRootSignature = stateObject.CreateSubobject<CD3DX12_LOCAL_ROOT_SIGNATURE_SUBOBJECT>();
+				localRootSignature->SetRootSignature(nullptr);
+				auto association = stateObject.CreateSubobject<CD3DX12_SUBOBJECT_TO_EXPORTS_ASSOCIATION_SUBOBJECT>();
+				association->SetSubobjectToAssociate(*localRootSignature);
+				association->AddExports(hitGroups.data(), numHitGroups);
+
+				auto globalRootSignature = stateObject.CreateSubobject<CD3DX12_GLOBAL_ROOT_SIGNATURE_SUBOBJECT>();
+				globalRootSignature->SetRootSignature(nullptr);
+				auto pipelineConfig = stateObject.CreateSubobject<CD3DX12_RAYTRACING_PIPELINE_CONFIG_SUBOBJECT>();
+				pipelineConfig->Config(1);
+
+				const D3D12_STATE_OBJECT_DESC *desc = stateObject;
+				if (pipeline == 0)
+				{
+					cd3dx12Types.clear();
+					cd3dx12Names.clear();
+					for (UINT i = 0; i < desc->NumSubobjects; ++i)
+					{
+						cd3dx12Types.push_back(desc->pSubobjects[i].Type);
+						if (desc->pSubobjects[i].Type == D3D12_STATE_SUBOBJECT_TYPE_HIT_GROUP)
+						{
+							cd3dx12Names.push_back(
+								static_cast<const D3D12_HIT_GROUP_DESC*>(desc->pSubobjects[i].pDesc)->HitGroupExport);
+						}
+					}
+				}
+			}
+		});
+
+		std::vector<uint64_t> memory(128 * 1024 / sizeof(uint64_t));
+		StateObjectBuilder builder(memory.data(), memory.size() * sizeof(uint64_t));
+		bool same = true;
+		size_t usedSize = 0;
+		double builderMs = MeasureMs([&]()
+		{
+			for (uint32_t pipeline = 0; pipeline < numPipelines; ++pipeline)
+			{
+				builder.Reset(D3D12_STATE_OBJECT_TYPE_RAYTRACING_PIPELINE);
+
+				builder.AddDxilLibrary(bytecode, exports, numExports);
+				for (uint32_t i = 0; i < numHitGroups; ++i)
+				{
+					builder.AddHitGroup(hitGroups[i], exports[2], anyHit(i), intersection(i));
+				}
+				builder.AddShaderConfig(16, 8);
+				StateObjectBuilder::Subobject localRootSignature = builder.AddLocalRootSignature(nullptr);
+				builder.AddAssociation(localRootSignature, hitGroups.data(), numHitGroups);
+				builder.AddGlobalRootSignature(nullptr);
+				builder.AddPipelineConfig(1);
+
+				const D3D12_STATE_OBJECT_DESC *desc = builder.GetDesc();
+				if (pipeline == 0)
+				{
+					same = desc && desc->NumSubobjects == cd3dx12Types.size();
+					for (UINT i = 0, hitGroup = 0; same && i < desc->NumSubobjects; ++i)
+					{
+						same = desc->pSubobjects[i].Type == cd3dx12Types[i];
+						if (same && desc->pSubobjects[i].Type == D3D12_STATE_SUBOBJECT_TYPE_HIT_GROUP)
+						{
+							same = cd3dx12Names[hitGroup++] ==
+								static_cast<const D3D12_HIT_GROUP_DESC*>(desc->pSubobjects[i].pDesc)->HitGroupExport;
+						}
+					}
+					usedSize = builder.GetUsedSize();
+				}
+			}
+		});
+
+		Report("State object descs, %u pipelines of %u hit groups (%u subobjects): CD3DX12_STATE_OBJECT_DESC %.3f ms, builder %.3f ms (%zu bytes), %s\n",
+			numPipelines, numHitGroups, static_cast<uint32_t>(cd3dx12Types.size()), cd3dx12Ms, builderMs, usedSize,
+			same ? "same subobjects" : "DIFFERENT subobjects");
+	}
+
+	// 50k instances with two ray types, so 100k hit group records with 32
+	// bytes of material arguments, and 1% of the materials changing every
+	// frame: only the changed records copied, the whole table rebuilt in the
+	// upload ring, and every record set again with only the changed ones
+	// copied
+	void ShaderTableUpdates()
+	{
+		const uint32_t numInstances = 50000;
+		const uint32_t numRayTypes = 2;
+		const uint32_t numRecords = numInstances * numRayTypes;
+		const uint32_t numChanged = numInstances / 100;
+		const uint32_t rootArgumentsSize = 32;
+
+		struct Material
+		{
+			uint32_t arguments[rootArgumentsSize / sizeof(uint32_t)];
+		};
+
+		std::mt19937 random(1234);
+		std::uniform_int_distribution<uint32_t> value;
+		std::uniform_int_distribution<uint32_t> pick(0, numInstances - 1);
+
+		// Made up identifiers, one for the hit group of every ray type
+		uint8_t identifiers[numRayTypes][D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES];
+		for (uint32_t i = 0; i < numRayTypes; ++i)
+		{
+			for (uint32_t j = 0; j < D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES; ++j)
+			{
+				identifiers[i][j] = static_cast<uint8_t>(value(random));
+			}
+		}
+
+		std::vector<Material> materials(numInstances);
+		for (Material &material : materials)
+		{
+			for (uint32_t &argument : material.arguments)
+			{
+				argument = value(random);
+			}
+		}
+
+		ShaderTable::Layout layouts[ShaderTable::NUM_KINDS] = {};
+		layouts[ShaderTable::RAY_GENERATION].numRecords = 1;
+		layouts[ShaderTable::MISS].numRecords = numRayTypes;
+		layouts[ShaderTable::HIT_GROUP].numRecords = numRecords;
+		layouts[ShaderTable::HIT_GROUP].rootArgumentsSize = rootArgumentsSize;
+
+		ShaderTable table(layouts);
+		ShaderTable changedTable(layouts);
+		for (uint32_t i = 0; i < numRecords; ++i)
+		{
+			const Material &material = materials[i / numRayTypes];
+			table.SetRecord(ShaderTable::HIT_GROUP, i, identifiers[i % numRayTypes], &material, rootArgumentsSize);
+			changedTable.SetRecord(ShaderTable::HIT_GROUP, i, identifiers[i % numRayTypes], &material, rootArgumentsSize);
+		}
+
+		std::vector<uint8_t> ringMemory(4 * table.GetSize());
+		UploadRing ring(ringMemory.data(), 0x100000000ull, ringMemory.size());
+		uint64_t fenceValue = 0;
+		auto endFrame = [&]()
+		{
+			ring.EndFrame(++fenceValue);
+			ring.Retire(fenceValue);
+		};
+
+		// Everything to the GPU once, as after loading
+		table.Update(ring, nullptr);
+		changedTable.Update(ring, nullptr);
+		endFrame();
+
+		std::vector<uint32_t> changed(numChanged);
+		auto changeMaterials = [&]()
+		{
+			for (uint32_t &instance : changed)
+			{
+				instance = pick(random);
+				materials[instance].arguments[0] = value(random);
+			}
+		};
+
+		uint64_t stride = table.GetStride(ShaderTable::HIT_GROUP);
+		uint64_t hitGroupOffset = table.GetOffset(ShaderTable::HIT_GROUP);
+
+		// Whether the hit group records hold the materials as they are now
+		auto isCurrent = [&](const ShaderTable &current)
+		{
+			const uint8_t *records = current.GetData() + hitGroupOffset;
+			for (uint32_t i = 0; i < numRecords; ++i)
+			{
+				if (std::memcmp(records + stride * i + D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES, &materials[i / numRayTypes],
+					rootArgumentsSize) != 0)
+				{
+					return false;
+				}
+			}
+			return true;
+		};
+
+		bool uploaded = true;
+		double changedMs = MeasureMs(changeMaterials, [&]()
+		{
+			for (uint32_t instance : changed)
+			{
+				for (uint32_t rayType = 0; rayType < numRayTypes; ++rayType)
+				{
+					changedTable.SetRootArguments(ShaderTable::HIT_GROUP, instance * numRayTypes + rayType,
+						&materials[instance], rootArgumentsSize);
+				}
+			}
+			uploaded = changedTable.Update(ring, nullptr) && uploaded;
+			endFrame();
+		});
+		ShaderTable::Stats changedStats = changedTable.GetStats();
+		bool same = isCurrent(changedTable);
+
+		double rebuildMs = MeasureMs(changeMaterials, [&]()
+		{
+			UploadRing::Allocation allocation;
+			if (!ring.Allocate(table.GetSize(), D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT, allocation))
+			{
+				uploaded = false;
+				return;
+			}
+
+			uint8_t *records = static_cast<uint8_t*>(allocation.cpu) + hitGroupOffset;
+			for (uint32_t i = 0; i < numRecords; ++i)
+			{
+				std::memcpy(records + stride * i, identifiers[i % numRayTypes], D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
+				std::memcpy(records + stride * i + D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES, &materials[i / numRayTypes],
+					rootArgumentsSize);
+			}
+			endFrame();
+		});
+
+		double everyRecordMs = MeasureMs(changeMaterials, [&]()
+		{
+			for (uint32_t i = 0; i < numRecords; ++i)
+			{
+				table.SetRootArguments(ShaderTable::HIT_GROUP, i, &materials[i / numRayTypes], rootArgumentsSize);
+			}
+			uploaded = table.Update(ring, nullptr) && uploaded;
+			endFrame();
+		});
+		ShaderTable::Stats everyRecordStats = table.GetStats();
+		same = same && uploaded && isCurrent(table);
+
+		Report("Shader table, %u hit group records of %u bytes (%.1f MB): rebuilt %.3f ms, %u materials changed %.3f ms (%u records in %u copies, %.1f KB)\n",
+			numRecords, static_cast<uint32_t>(stride), table.GetSize() / (1024.0 * 1024.0), rebuildMs, numChanged,
+			changedMs, changedStats.patched, changedStats.copies, changedStats.uploaded / 1024.0);
+		Report("\tevery record set, changed ones copied %.3f ms (%u records in %u copies), %s\n",
+			everyRecordMs, everyRecordStats.patched, everyRecordStats.copies,
+			same ? "tables current" : "tables NOT current");
+	}
+
+	// Doesn't compile anything: the "bytecode" is the source with every
+	// #include "..." replaced by the file it names, after a line with the entry
+	// point, target and defines. Takes compileMs per shader to stand in for the
+	// real compiler, and remembers how many compiles ran at once.
+	class StubShaderCompiler : public ShaderCompilerBackend
+	{
+	public:
+		explicit StubShaderCompiler(uint32_t compileMs) :
+			m_compileMs(compileMs),
+			m_concurrent(0),
+			m_maxConcurrent(0)
+		{
+		}
+
+		bool Compile(const ShaderDesc &desc, const std::string &source, const IncludeFunction &include,
+			std::vector<uint8_t> &bytecode, std::string &errors) override
+		{
+			uint32_t concurrent = ++m_concurrent;
+			uint32_t maxConcurrent = m_maxConcurrent;
+			while (concurrent > maxConcurrent && !m_maxConcurrent.compare_exchange_weak(maxConcurrent, concurrent))
+			{
+			}
+
+			std::string output = "// " + desc.entryPoint + " " + desc.target;
+			for (const auto &define : desc.defines)
+			{
+				output += " " + define.first + "=" + define.second;
+			}
+			output += "\n";
+
+			bool compiled = Preprocess(source, desc.path, include, 0, output, errors);
+			if (compiled)
+			{
+				bytecode.assign(output.begin(), output.end());
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(m_compileMs));
+			--m_concurrent;
+
+			return compiled;
+		}
+
+		uint64_t GetCompilerVersion() const override { return 1; }
+
+		uint32_t GetMaxConcurrent() const { return m_maxConcurrent; }
+
+	private:
+		bool Preprocess(const std::string &text, const std::string &path, const IncludeFunction &include,
+			uint32_t depth, std::string &output, std::string &errors) const
+		{
+			// Deep enough for any real shader, stops an include cycle
+			if (depth > 32)
+			{
+				errors += path + ": includes nested too deep\n";
+				return false;
+			}
+
+			std::istringstream lines(text);
+			std::string line;
+			while (std::getline(lines, line))
+			{
+				size_t directive = line.find_first_not_of(" \t");
+				if (directive == std::string::npos || line.compare(directive, 8, "#include") != 0)
+				{
+					output += line + "\n";
+					continue;
+				}
+
+				size_t begin = line.find('"', directive + 8);
+				size_t end = begin == std::string::npos ? std::string::npos : line.find('"', begin + 1);
+				if (end == std::string::npos)
+				{
+					errors += path + ": bad " + line + "\n";
+					return false;
+				}
+
+				std::string name = line.substr(begin + 1, end - begin - 1);
+				std::string includePath;
+				std::string contents;
+				if (!include(name, path, includePath, contents))
+				{
+					errors += path + ": can't open " + name + "\n";
+					return false;
+				}
+
+				if (!Preprocess(contents, includePath, include, depth + 1, output, errors))
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		uint32_t m_compileMs;
+		std::atomic<uint32_t> m_concurrent;
+		std::atomic<uint32_t> m_maxConcurrent;
+	};
+
+	// The shader cache with the stub compiler, which takes 20 ms per shader:
+	// 16 variants of a shader that includes a header compiled on 4 threads,
+	// asked for again (memory hits), after the header changed (compiled
+	// again) and from a new cache on the same directory (disk hits)
+	void ShaderCacheStub()
+	{
+		const uint32_t numVariants = 16;
+		const uint32_t numThreads = 4;
+		const uint32_t compileMs = 20;
+		const std::string directory = "shaderCacheBenchmark\\";
+		const std::wstring cacheDirectory = L"shaderCacheBenchmark\\cache";
+
+		// Bytecode left from an earlier run would turn the first compiles into disk hits
+		::CreateDirectoryW(L"shaderCacheBenchmark", nullptr);
+		::CreateDirectoryW(cacheDirectory.c_str(), nullptr);
+		WIN32_FIND_DATAW found;
+		HANDLE find = ::FindFirstFileW((cacheDirectory + L"\\*").c_str(), &found);
+		if (find != INVALID_HANDLE_VALUE)
+		{
+			do
+			{
+				if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+				{
+					::DeleteFileW((cacheDirectory + L"\\" + found.cFileName).c_str());
+				}
+			} while (::FindNextFileW(find, &found));
+			::FindClose(find);
+		}
+
+		auto writeFile = [&](const char *name, const std::string &text)
+		{
+			std::ofstream file(directory + name, std::ios::binary | std::ios::trunc);
+			file << text;
+		};
+		writeFile("common.hlsli", "float4 Tint() { return float4(1, 1, 1, 1); }\n");
+		writeFile("shader.hlsl", "#include \"common.hlsli\"\nfloat4 PSMain() : SV_Target { return Tint(); }\n");
+
+		std::vector<ShaderDesc> descs(numVariants);
+		for (uint32_t i = 0; i < numVariants; ++i)
+		{
+			descs[i].path = directory + "shader.hlsl";
+			descs[i].entryPoint = "PSMain";
+			descs[i].target = "ps_5_1";
+			descs[i].defines.push_back(std::make_pair(std::string("VARIANT"), std::to_string(i)));
+			descs[i].flags = 0;
+		}
+
+		static std::chrono::high_resolution_clock clock;
+		auto compileAll = [&](ShaderCache &cache, std::vector<ShaderCache::ShaderPtr> &shaders)
+		{
+			auto t0 = clock.now();
+			std::vector<ShaderCache::Future> futures;
+			for (const ShaderDesc &desc : descs)
+			{
+				futures.push_back(cache.Compile(desc));
+			}
+			shaders.clear();
+			for (ShaderCache::Future &future : futures)
+			{
+				shaders.push_back(future.get());
+			}
+			return std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+		};
+
+		// Every variant compiled, and the header's text made it into every one
+		auto allContain = [](const std::vector<ShaderCache::ShaderPtr> &shaders, const char *text)
+		{
+			for (const ShaderCache::ShaderPtr &shader : shaders)
+			{
+				std::string bytecode(shader->bytecode.begin(), shader->bytecode.end());
+				if (shader->key == 0 || bytecode.find(text) == std::string::npos || shader->dependencies.size() != 2)
+				{
+					return false;
+				}
+			}
+			return true;
+		};
+
+		std::unique_ptr<StubShaderCompiler> stub = std::make_unique<StubShaderCompiler>(compileMs);
+		StubShaderCompiler *compiler = stub.get();
+		std::vector<ShaderCache::ShaderPtr> first, hits, changed, disk;
+		double firstMs, hitsMs, changedMs, diskMs;
+		ShaderCache::Stats stats;
+		uint32_t maxConcurrent;
+		{
+			ShaderCache cache(std::move(stub), cacheDirectory, numThreads);
+
+			firstMs = compileAll(cache, first);
+			hitsMs = compileAll(cache, hits);
+
+			writeFile("common.hlsli", "float4 Tint() { return float4(1, 0, 0, 1); }\n");
+			changedMs = compileAll(cache, changed);
+
+			stats = cache.GetStats();
+			maxConcurrent = compiler->GetMaxConcurrent();
+		}
+
+		ShaderCache::Stats diskStats;
+		{
+			ShaderCache cache(std::make_unique<StubShaderCompiler>(compileMs), cacheDirectory, numThreads);
+			diskMs = compileAll(cache, disk);
+			diskStats = cache.GetStats();
+		}
+
+		bool sameHits = true;
+		bool newKeys = true;
+		bool sameDisk = true;
+		for (uint32_t i = 0; i < numVariants; ++i)
+		{
+			sameHits = sameHits && hits[i] == first[i];
+			newKeys = newKeys && changed[i]->key != first[i]->key;
+			sameDisk = sameDisk && disk[i]->key == changed[i]->key && disk[i]->bytecode == changed[i]->bytecode;
+		}
+
+		bool compiled = allContain(first, "float4(1, 1, 1, 1)") && stats.compiled == 2 * numVariants && stats.failed == 0;
+		bool cached = sameHits && stats.memoryHits == numVariants;
+		bool invalidated = newKeys && allContain(changed, "float4(1, 0, 0, 1)");
+		bool fromDisk = sameDisk && diskStats.diskHits == numVariants && diskStats.compiled == 0;
+
+		Report("Shader cache, %u variants of %u ms on %u threads: compiled %.1f ms (%u at once), %s\n",
+			numVariants, compileMs, numThreads, firstMs, maxConcurrent, compiled ? "compiled" : "NOT compiled");
+		Report("\tasked again %.3f ms (%u memory hits), %s; include changed %.1f ms, %s; new cache %.3f ms (%u disk hits), %s\n",
+			hitsMs, stats.memoryHits, cached ? "cached" : "NOT cached", changedMs,
+			invalidated ? "recompiled" : "NOT recompiled", diskMs, diskStats.diskHits, fromDisk ? "loaded" : "NOT loaded");
+
+		Expect(compiled, "shader cache didn't compile every variant");
+		Expect(cached, "shader cache compiled variants it already had");
+		Expect(invalidated, "shader cache didn't recompile after an include changed");
+		Expect(fromDisk, "shader cache didn't load the variants from disk");
+	}
+
+	// Doesn't compile anything: every compile takes compileMs and returns the
+	// pipeline it was given, or nullptr for the root signature key set to fail.
+	// Compiles run in the order GetOrder() lists their root signature keys, and
+	// a compile of the held key waits for Release(), so requests can be queued
+	// behind it.
+	class StubPipelineCompiler
+	{
+	public:
+		StubPipelineCompiler(ComPtr<ID3D12PipelineState> pipeline, uint32_t compileMs) :
+			m_pipeline(pipeline),
+			m_compileMs(compileMs),
+			m_holding(false),
+			m_heldKey(0),
+			m_failing(false),
+			m_failingKey(0)
+		{
+		}
+
+		// Refers to the stub, which has to outlive the PipelineCompiler
+		PipelineCompiler::CompileFunction GetFunction()
+		{
+			return [this](const D3D12_PIPELINE_STATE_STREAM_DESC &desc, uint64_t rootSignatureKey)
+			{
+				return Compile(rootSignatureKey);
+			};
+		}
+
+		void Hold(uint64_t rootSignatureKey)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_holding = true;
+			m_heldKey = rootSignatureKey;
+		}
+
+		void Release()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_holding = false;
+			}
+			m_released.notify_all();
+		}
+
+		void Fail(uint64_t rootSignatureKey)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_failing = true;
+			m_failingKey = rootSignatureKey;
+		}
+
+		std::vector<uint64_t> GetOrder()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_order;
+		}
+
+	private:
+		ComPtr<ID3D12PipelineState> Compile(uint64_t rootSignatureKey)
+		{
+			bool failing;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_order.push_back(rootSignatureKey);
+				m_released.wait(lock, [&]() { return !m_holding || m_heldKey != rootSignatureKey; });
+				failing = m_failing && m_failingKey == rootSignatureKey;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(m_compileMs));
+
+			return failing ? ComPtr<ID3D12PipelineState>() : m_pipeline;
+		}
+
+		ComPtr<ID3D12PipelineState> m_pipeline;
+		uint32_t m_compileMs;
+
+		std::mutex m_mutex;
+		std::condition_variable m_released;
+		bool m_holding;
+		uint64_t m_heldKey;
+		bool m_failing;
+		uint64_t m_failingKey;
+		std::vector<uint64_t> m_order;
+	};
+
+	// The pipeline compiler with StubPipelineCompiler taking 5 ms per
+	// pipeline. The root signature key stands for the pipeline, request 0
+	// holds the only worker until the other 30 are queued:
+	//	- they have to run by priority, oldest first within one
+	//	- asking for a queued one again must share its future
+	//	- while 0 is compiling Get() returns its fallback, afterwards the
+	//	  compiled pipeline, and the fallback again if the compile failed
+	void PipelineCompilerStub(ComPtr<ID3D12Device2> device)
+	{
+		const uint32_t numRequests = 30;
+		const uint32_t compileMs = 5;
+		const uint64_t failingKey = 7;
+
+		// Two real pipelines, so Get() can tell the compiled one from the fallback
+		ComPtr<ID3DBlob> shader;
+		const char source[] = "[numthreads(1, 1, 1)] void main() {}";
+		ThrowIfFailed(::D3DCompile(source, sizeof(source) - 1, nullptr, nullptr, nullptr, "main", "cs_5_1", 0, 0,
+			&shader, nullptr));
+
+		ComPtr<ID3D12RootSignature> rootSignature = CreateRootSignature(device);
+		D3D12_COMPUTE_PIPELINE_STATE_DESC computeDesc = {};
+		computeDesc.pRootSignature = rootSignature.Get();
+		computeDesc.CS = { shader->GetBufferPointer(), shader->GetBufferSize() };
+
+		ComPtr<ID3D12PipelineState> compiledPipeline;
+		ComPtr<ID3D12PipelineState> fallbackPipeline;
+		ThrowIfFailed(device->CreateComputePipelineState(&computeDesc, IID_PPV_ARGS(&compiledPipeline)));
+		ThrowIfFailed(device->CreateComputePipelineState(&computeDesc, IID_PPV_ARGS(&fallbackPipeline)));
+
+		StubPipelineCompiler stub(compiledPipeline, compileMs);
+		stub.Hold(0);
+		stub.Fail(failingKey);
+
+		// Every request has the same stream, only the root signature key tells them apart
+		struct Stream
+		{
+			CD3DX12_PIPELINE_STATE_STREAM_NODE_MASK nodeMask;
+		} stream;
+
+		std::vector<PipelineCompiler::Request> requests;		// by root signature key
+		std::vector<PipelineCompiler::Request> duplicates;	// of every fifth request
+		std::vector<uint64_t> expected;
+		bool fallbackUsed;
+		static std::chrono::high_resolution_clock clock;
+		double queuedMs;
+		PipelineCompiler::Stats stats;
+		{
+			PipelineCompiler compiler(stub.GetFunction(), 1);
+
+			requests.push_back(compiler.Compile(stream, 0, PipelineCompiler::PRIORITY_HIGH));
+			compiler.SetFallback(requests[0].key, fallbackPipeline);
+			expected.push_back(0);
+
+			for (uint64_t i = 1; i <= numRequests; ++i)
+			{
+				PipelineCompiler::Priority priority = static_cast<PipelineCompiler::Priority>(i % 3);
+				requests.push_back(compiler.Compile(stream, i, priority));
+			}
+			for (int priority = PipelineCompiler::PRIORITY_HIGH; priority >= PipelineCompiler::PRIORITY_LOW; --priority)
+			{
+				for (uint64_t i = 1; i <= numRequests; ++i)
+				{
+					if (i % 3 == static_cast<uint64_t>(priority))
+					{
+						expected.push_back(i);
+					}
+				}
+			}
+
+			// Queued ones again, at another priority
+			for (uint64_t i = 1; i <= numRequests; i += 5)
+			{
+				duplicates.push_back(compiler.Compile(stream, i, PipelineCompiler::PRIORITY_HIGH));
+			}
+
+			compiler.SetFallback(requests[failingKey].key, fallbackPipeline);
+
+			fallbackUsed = compiler.Get(requests[0].key) == fallbackPipeline.Get() &&
+				compiler.Get(requests[1].key) == nullptr;
+
+			auto t0 = clock.now();
+			stub.Release();
+			compiler.WaitIdle();
+			queuedMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+
+			fallbackUsed = fallbackUsed &&
+				compiler.Get(requests[0].key) == compiledPipeline.Get() &&
+				compiler.Get(requests[1].key) == compiledPipeline.Get() &&
+				compiler.Get(requests[failingKey].key) == fallbackPipeline.Get();
+
+			stats = compiler.GetStats();
+		}
+
+		// A shared future hands out a reference into its shared state
+		bool shared = stats.completed + stats.failed == numRequests + 1;
+		for (size_t i = 0; i < duplicates.size(); ++i)
+		{
+			const PipelineCompiler::Request &first = requests[1 + 5 * i];
+			shared = shared && duplicates[i].key == first.key && &duplicates[i].future.get() == &first.future.get();
+		}
+
+		bool inOrder = stub.GetOrder() == expected;
+
+		Report("Pipeline compiler, %u requests of %u ms on 1 thread: %.1f ms, %s, %s\n",
+			numRequests + 1, compileMs, queuedMs, inOrder ? "by priority" : "NOT by priority",
+			shared ? "duplicates shared" : "duplicates NOT shared");
+		Report("\tfallback while compiling and after failing, %s\n", fallbackUsed ? "used" : "NOT used");
+
+		Expect(inOrder, "pipeline compiler ran the requests out of priority order");
+		Expect(shared, "pipeline compiler didn't share the futures of duplicate requests");
+		Expect(fallbackUsed, "pipeline compiler didn't hand out the fallback");
+	}
+
+	// What looking up a pipeline costs per draw: parsing and hashing the
+	// stream, hashing a stream that was parsed already, and the compare with
+	// the copy PipelineStateCache keeps that confirms a hit. 4 KB vertex and
+	// pixel shaders and a 4 element input layout.
+	void PipelineHashing()
+	{
+		const uint32_t numDraws = 100000;
+
+		// Stands in for compiled DXBC, the hash only reads the tag and the digest after it
+		std::vector<uint8_t> vertexShader(4096, 0x11);
+		std::vector<uint8_t> pixelShader(4096, 0x22);
+		std::memcpy(vertexShader.data(), "DXBC", 4);
+		std::memcpy(pixelShader.data(), "DXBC", 4);
+
+		D3D12_INPUT_ELEMENT_DESC inputElements[] =
+		{
+			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+			{ "COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 32, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		};
+
+		CD3DX12_PIPELINE_STATE_STREAM stream;
+		stream.InputLayout = D3D12_INPUT_LAYOUT_DESC{ inputElements, _countof(inputElements) };
+		stream.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+		stream.VS = CD3DX12_SHADER_BYTECODE(vertexShader.data(), vertexShader.size());
+		stream.PS = CD3DX12_SHADER_BYTECODE(pixelShader.data(), pixelShader.size());
+		D3D12_PIPELINE_STATE_STREAM_DESC desc = { sizeof(stream), &stream };
+
+		uint64_t sum = 0;
+		double parseMs = MeasureMs([&]()
+		{
+			for (uint32_t i = 0; i < numDraws; ++i)
+			{
+				sum += HashPipelineStream(desc, 1);
+			}
+		});
+
+		PipelineStreamView view;
+		ThrowIfFailed(view.Parse(desc));
+		double hashMs = MeasureMs([&]()
+		{
+			for (uint32_t i = 0; i < numDraws; ++i)
+			{
+				sum += HashPipelineStream(view, 1);
+			}
+		});
+
+		PipelineStreamCopy copy(view);
+		view.rootSignature = nullptr;
+		uint32_t numEqual = 0;
+		double compareMs = MeasureMs([&]()
+		{
+			for (uint32_t i = 0; i < numDraws; ++i)
+			{
+				numEqual += PipelineStreamEqual(copy.GetView(), view) ? 1 : 0;
+			}
+		});
+
+		// Both ways of hashing agree on every draw, and the copy matches the stream
+		bool consistent = sum == HashPipelineStream(desc, 1) * (2ull * numDraws * gRepeats) &&
+			numEqual == numDraws * gRepeats;
+
+		Report("Pipeline hashing, %u draws: parse and hash %.1f ns per draw, hash %.1f ns, confirm a hit %.1f ns, %s\n",
+			numDraws, parseMs * 1e6 / numDraws, hashMs * 1e6 / numDraws, compareMs * 1e6 / numDraws,
+			consistent ? "consistent" : "NOT consistent");
+	}
+}
+
+uint32_t Benchmarks::Run(ComPtr<ID3D12Device2> device, JobSystem &jobs)
+{
+	gResults.clear();
+	gFailures = 0;
+
+	FilteredRecording(device);
+	JobOverhead(jobs);
+	CommandStreamTranslation(device, jobs);
+	DrawListSorting(jobs);
+	Instancing(jobs);
+	FrustumCulling(jobs);
+	OcclusionCulling(jobs);
+	TransformUpdate(jobs);
+	FixedTimestepRates(jobs);
+	SpatialQueries(jobs);
+	BvhQueries(jobs);
+	StateObjectDescription();
+	ShaderTableUpdates();
+	ShaderCacheStub();
+	PipelineCompilerStub(device);
+	PipelineHashing();
+
+	Report("%u failures\n", gFailures);
+
+	std::ofstream file("benchmarks.txt", std::ios::trunc);
+	file << gResults;
+
+	return gFailures;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "includes.h"
+
+// Microbenchmarks for the CPU side of the renderer. Started with -bench
+// instead of opening the window; results go to the debugger output and to
+// benchmarks.txt next to the executable. Benchmarks that check their results
+// count the checks that failed, -bench exits with 1 if there were any.
+
+class JobSystem;
+
+namespace Benchmarks
+{
+	// Returns the number of failed checks
+	uint32_t Run(ComPtr<ID3D12Device2> device, JobSystem &jobs);
+}
@@ -0,0 +1,465 @@
+#include "bindingLayout.h"
+#include "pipelineHash.h"
+
+#include <climits>
+
+namespace
+{
+	const UINT gMaxRootDwords = 64;
+
+	const char *gRangeTypeNames[] = { "SRV", "UAV", "CBV", "Sampler" };
+	const char gRegisterLetters[] = { 't', 'u', 'b', 's' };
+	const char *gVisibilityNames[] = { "all", "vertex", "hull", "domain", "geometry", "pixel" };
+
+	enum Placement
+	{
+		PLACE_CONSTANTS,
+		PLACE_DESCRIPTOR,
+		PLACE_TABLE,
+	};
+
+	D3D12_DESCRIPTOR_RANGE_TYPE GetRangeType(D3D_SHADER_INPUT_TYPE type)
+	{
+		switch (type)
+		{
+		case D3D_SIT_CBUFFER:
+			return D3D12_DESCRIPTOR_RANGE_TYPE_CBV;
+		case D3D_SIT_SAMPLER:
+			return D3D12_DESCRIPTOR_RANGE_TYPE_SAMPLER;
+		case D3D_SIT_UAV_RWTYPED:
+		case D3D_SIT_UAV_RWSTRUCTURED:
+		case D3D_SIT_UAV_RWBYTEADDRESS:
+		case D3D_SIT_UAV_APPEND_STRUCTURED:
+		case D3D_SIT_UAV_CONSUME_STRUCTURED:
+		case D3D_SIT_UAV_RWSTRUCTURED_WITH_COUNTER:
+			return D3D12_DESCRIPTOR_RANGE_TYPE_UAV;
+		default:
+			// Textures, tbuffers, structured and byte address buffers
+			return D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
+		}
+	}
+
+	// Root SRVs and UAVs are just an address, only buffers without a format or a counter can be bound that way
+	bool IsRawOrStructured(D3D_SHADER_INPUT_TYPE type)
+	{
+		return type == D3D_SIT_STRUCTURED || type == D3D_SIT_BYTEADDRESS ||
+			type == D3D_SIT_UAV_RWSTRUCTURED || type == D3D_SIT_UAV_RWBYTEADDRESS;
+	}
+
+	D3D12_SHADER_VISIBILITY GetVisibility(UINT shaderType)
+	{
+		switch (shaderType)
+		{
+		case D3D12_SHVER_VERTEX_SHADER:
+			return D3D12_SHADER_VISIBILITY_VERTEX;
+		case D3D12_SHVER_HULL_SHADER:
+			return D3D12_SHADER_VISIBILITY_HULL;
+		case D3D12_SHVER_DOMAIN_SHADER:
+			return D3D12_SHADER_VISIBILITY_DOMAIN;
+		case D3D12_SHVER_GEOMETRY_SHADER:
+			return D3D12_SHADER_VISIBILITY_GEOMETRY;
+		case D3D12_SHVER_PIXEL_SHADER:
+			return D3D12_SHADER_VISIBILITY_PIXEL;
+		default:
+			return D3D12_SHADER_VISIBILITY_ALL;
+		}
+	}
+
+	struct StageDenyFlag
+	{
+		UINT shaderType;
+		D3D12_ROOT_SIGNATURE_FLAGS flag;
+	};
+
+	// Stages that don't read the root signature skip loading it
+	const StageDenyFlag gStageDenyFlags[] =
+	{
+		{ D3D12_SHVER_VERTEX_SHADER, D3D12_ROOT_SIGNATURE_FLAG_DENY_VERTEX_SHADER_ROOT_ACCESS },
+		{ D3D12_SHVER_HULL_SHADER, D3D12_ROOT_SIGNATURE_FLAG_DENY_HULL_SHADER_ROOT_ACCESS },
+		{ D3D12_SHVER_DOMAIN_SHADER, D3D12_ROOT_SIGNATURE_FLAG_DENY_DOMAIN_SHADER_ROOT_ACCESS },
+		{ D3D12_SHVER_GEOMETRY_SHADER, D3D12_ROOT_SIGNATURE_FLAG_DENY_GEOMETRY_SHADER_ROOT_ACCESS },
+		{ D3D12_SHVER_PIXEL_SHADER, D3D12_ROOT_SIGNATURE_FLAG_DENY_PIXEL_SHADER_ROOT_ACCESS },
+	};
+}
+
+BindingLayoutCache::BindingLayoutCache(RootSignatureCache *rootSignatures) :
+	m_rootSignatures(rootSignatures)
+{
+}
+
+std::shared_ptr<const BindingLayout> BindingLayoutCache::GetOrCreate(const D3D12_SHADER_BYTECODE *shaders, UINT numShaders)
+{
+	uint64_t hash = 0;
+	for (UINT i = 0; i < numShaders; ++i)
+	{
+		hash = PipelineHash::Shader(hash, shaders[i]);
+	}
+
+	auto it = m_layouts.find(hash);
+	if (it != m_layouts.end())
+	{
+		return it->second;
+	}
+
+	Reflection reflection = {};
+	for (UINT i = 0; i < numShaders; ++i)
+	{
+		if (shaders[i].BytecodeLength > 0)
+		{
+			Reflect(shaders[i], reflection);
+		}
+	}
+
+	std::shared_ptr<BindingLayout> layout = Generate(reflection);
+
+#if defined(_DEBUG)
+	::OutputDebugString(layout->description.c_str());
+#endif
+
+	return m_layouts.emplace(hash, layout).first->second;
+}
+
+std::string BindingLayoutCache::Describe() const
+{
+	// By shader hash, so two dumps of the same shaders compare equal
+	std::vector<uint64_t> hashes;
+	for (const auto &layout : m_layouts)
+	{
+		hashes.push_back(layout.first);
+	}
+	std::sort(hashes.begin(), hashes.end());
+
+	std::string description;
+	char line[64];
+	for (uint64_t hash : hashes)
+	{
+		sprintf_s(line, "shaders %016llx\n", static_cast<unsigned long long>(hash));
+		description += line;
+		description += m_layouts.at(hash)->description;
+	}
+	return description;
+}
+
+void BindingLayoutCache::Reflect(const D3D12_SHADER_BYTECODE &shader, Reflection &reflection)
+{
+	ComPtr<ID3D12ShaderReflection> shaderReflection;
+	ThrowIfFailed(::D3DReflect(shader.pShaderBytecode, shader.BytecodeLength, IID_PPV_ARGS(&shaderReflection)));
+
+	D3D12_SHADER_DESC shaderDesc = {};
+	ThrowIfFailed(shaderReflection->GetDesc(&shaderDesc));
+
+	UINT shaderType = D3D12_SHVER_GET_TYPE(shaderDesc.Version);
+	D3D12_SHADER_VISIBILITY visibility = GetVisibility(shaderType);
+	reflection.stageMask |= 1u << shaderType;
+
+	if (shaderType == D3D12_SHVER_VERTEX_SHADER)
+	{
+		for (UINT i = 0; i < shaderDesc.InputParameters; ++i)
+		{
+			D3D12_SIGNATURE_PARAMETER_DESC input = {};
+			ThrowIfFailed(shaderReflection->GetInputParameterDesc(i, &input));
+
+			// SV_VertexID and SV_InstanceID don't need an input layout
+			reflection.inputAssembler = reflection.inputAssembler || input.SystemValueType == D3D_NAME_UNDEFINED;
+		}
+	}
+
+	for (UINT i = 0; i < shaderDesc.BoundResources; ++i)
+	{
+		D3D12_SHADER_INPUT_BIND_DESC bind = {};
+		ThrowIfFailed(shaderReflection->GetResourceBindingDesc(i, &bind));
+
+		D3D12_DESCRIPTOR_RANGE_TYPE rangeType = GetRangeType(bind.Type);
+
+		UINT size = 0;
+		if (rangeType == D3D12_DESCRIPTOR_RANGE_TYPE_CBV)
+		{
+			D3D12_SHADER_BUFFER_DESC bufferDesc = {};
+			if (SUCCEEDED(shaderReflection->GetConstantBufferByName(bind.Name)->GetDesc(&bufferDesc)))
+			{
+				size = bufferDesc.Size;
+			}
+		}
+
+		// The same register used by another stage
+		auto it = std::find_if(reflection.resources.begin(), reflection.resources.end(), [&](const Resource &resource)
+		{
+			return resource.rangeType == rangeType && resource.space == bind.Space && resource.bindPoint == bind.BindPoint;
+		});
+
+		if (it != reflection.resources.end())
+		{
+			if (it->visibility != visibility)
+			{
+				it->visibility = D3D12_SHADER_VISIBILITY_ALL;
+			}
+			it->bindCount = it->bindCount == 0 || bind.BindCount == 0 ? 0 : std::max(it->bindCount, bind.BindCount);
+			it->size = std::max(it->size, size);
+			it->rootDescriptor = it->rootDescriptor && IsRawOrStructured(bind.Type);
+			if (std::find(it->names.begin(), it->names.end(), bind.Name) == it->names.end())
+			{
+				it->names.push_back(bind.Name);
+			}
+			continue;
+		}
+
+		Resource resource;
+		resource.names.push_back(bind.Name);
+		resource.rangeType = rangeType;
+		resource.bindPoint = bind.BindPoint;
+		resource.bindCount = bind.BindCount;
+		resource.space = bind.Space;
+		resource.size = size;
+		resource.rootDescriptor = rangeType == D3D12_DESCRIPTOR_RANGE_TYPE_CBV || IsRawOrStructured(bind.Type);
+		resource.visibility = visibility;
+		reflection.resources.push_back(resource);
+	}
+}
+
+std::shared_ptr<BindingLayout> BindingLayoutCache::Generate(const Reflection &reflection)
+{
+	const std::vector<Resource> &resources = reflection.resources;
+
+	std::vector<Placement> placements(resources.size());
+	for (size_t i = 0; i < resources.size(); ++i)
+	{
+		const Resource &resource = resources[i];
+		bool singleCbv = resource.rangeType == D3D12_DESCRIPTOR_RANGE_TYPE_CBV && resource.bindCount == 1;
+
+		if (singleCbv && resource.size > 0 && resource.size <= gMaxRootConstantsBytes)
+		{
+			placements[i] = PLACE_CONSTANTS;
+		}
+		else if (resource.rootDescriptor && resource.bindCount == 1)
+		{
+			placements[i] = PLACE_DESCRIPTOR;
+		}
+		else
+		{
+			placements[i] = PLACE_TABLE;
+		}
+	}
+
+	// One table per visibility for views and one for samplers,
+	// unbounded arrays have to be last in a table so they get their own
+	auto tableKey = [&](size_t i) -> uint64_t
+	{
+		const Resource &resource = resources[i];
+		if (resource.bindCount == 0)
+		{
+			return (1ull << 63) | i;
+		}
+		return (uint64_t(resource.visibility) << 1) | (resource.rangeType == D3D12_DESCRIPTOR_RANGE_TYPE_SAMPLER ? 1 : 0);
+	};
+
+	auto rootSize = [&]()
+	{
+		UINT size = 0;
+		std::vector<uint64_t> tableKeys;
+		for (size_t i = 0; i < resources.size(); ++i)
+		{
+			switch (placements[i])
+			{
+			case PLACE_CONSTANTS:
+				size += resources[i].size / static_cast<UINT>(sizeof(UINT));
+				break;
+			case PLACE_DESCRIPTOR:
+				size += 2;
+				break;
+			default:
+				if (std::find(tableKeys.begin(), tableKeys.end(), tableKey(i)) == tableKeys.end())
+				{
+					tableKeys.push_back(tableKey(i));
+					size += 1;
+				}
+				break;
+			}
+		}
+		return size;
+	};
+
+	// Over the limit, demote the largest root constants first, then root descriptors
+	while (rootSize() > gMaxRootDwords)
+	{
+		size_t largest = resources.size();
+		size_t lastDescriptor = resources.size();
+		for (size_t i = 0; i < resources.size(); ++i)
+		{
+			if (placements[i] == PLACE_CONSTANTS && (largest == resources.size() || resources[i].size > resources[largest].size))
+			{
+				largest = i;
+			}
+			else if (placements[i] == PLACE_DESCRIPTOR)
+			{
+				lastDescriptor = i;
+			}
+		}
+
+		if (largest < resources.size())
+		{
+			placements[largest] = PLACE_DESCRIPTOR;
+		}
+		else if (lastDescriptor < resources.size())
+		{
+			placements[lastDescriptor] = PLACE_TABLE;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	std::shared_ptr<BindingLayout> layout = std::make_shared<BindingLayout>();
+	layout->rootSizeInDwords = rootSize();
+
+	std::vector<CD3DX12_ROOT_PARAMETER1> parameters;
+	char line[256];
+
+	auto addBinding = [&](const Resource &resource, D3D12_ROOT_PARAMETER_TYPE type, UINT tableOffset)
+	{
+		for (const std::string &name : resource.names)
+		{
+			layout->bindings[name] = { type, static_cast<UINT>(parameters.size()), tableOffset };
+		}
+	};
+
+	// Root constants and root descriptors first, they change most often
+	for (int placement = PLACE_CONSTANTS; placement <= PLACE_DESCRIPTOR; ++placement)
+	{
+		for (size_t i = 0; i < resources.size(); ++i)
+		{
+			const Resource &resource = resources[i];
+			if (placements[i] != placement)
+			{
+				continue;
+			}
+
+			CD3DX12_ROOT_PARAMETER1 parameter;
+			if (placement == PLACE_CONSTANTS)
+			{
+				parameter.InitAsConstants(resource.size / sizeof(UINT), resource.bindPoint, resource.space, resource.visibility);
+				addBinding(resource, D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS, 0);
+				sprintf_s(line, "%2u: constants b%u space%u, %u DWORDs, %s (%s)\n", static_cast<UINT>(parameters.size()),
+					resource.bindPoint, resource.space, resource.size / static_cast<UINT>(sizeof(UINT)),
+					gVisibilityNames[resource.visibility], resource.names[0].c_str());
+			}
+			else
+			{
+				D3D12_ROOT_PARAMETER_TYPE type;
+				switch (resource.rangeType)
+				{
+				case D3D12_DESCRIPTOR_RANGE_TYPE_SRV:
+					parameter.InitAsShaderResourceView(resource.bindPoint, resource.space,
+						D3D12_ROOT_DESCRIPTOR_FLAG_NONE, resource.visibility);
+					type = D3D12_ROOT_PARAMETER_TYPE_SRV;
+					break;
+				case D3D12_DESCRIPTOR_RANGE_TYPE_UAV:
+					parameter.InitAsUnorderedAccessView(resource.bindPoint, resource.space,
+						D3D12_ROOT_DESCRIPTOR_FLAG_NONE, resource.visibility);
+					type = D3D12_ROOT_PARAMETER_TYPE_UAV;
+					break;
+				default:
+					parameter.InitAsConstantBufferView(resource.bindPoint, resource.space,
+						D3D12_ROOT_DESCRIPTOR_FLAG_NONE, resource.visibility);
+					type = D3D12_ROOT_PARAMETER_TYPE_CBV;
+					break;
+				}
+				addBinding(resource, type, 0);
+				sprintf_s(line, "%2u: %s %c%u space%u, %s (%s)\n", static_cast<UINT>(parameters.size()),
+					gRangeTypeNames[resource.rangeType], gRegisterLetters[resource.rangeType], resource.bindPoint,
+					resource.space, gVisibilityNames[resource.visibility], resource.names[0].c_str());
+			}
+
+			parameters.push_back(parameter);
+			layout->description += line;
+		}
+	}
+
+	// Group the rest into tables, the ranges have to stay put until the root signature is created
+	std::vector<uint64_t> tableKeys;
+	std::vector<std::vector<size_t>> tables;
+	for (size_t i = 0; i < resources.size(); ++i)
+	{
+		if (placements[i] != PLACE_TABLE)
+		{
+			continue;
+		}
+
+		auto it = std::find(tableKeys.begin(), tableKeys.end(), tableKey(i));
+		if (it == tableKeys.end())
+		{
+			tableKeys.push_back(tableKey(i));
+			tables.emplace_back();
+			it = tableKeys.end() - 1;
+		}
+		tables[it - tableKeys.begin()].push_back(i);
+	}
+
+	std::vector<std::vector<CD3DX12_DESCRIPTOR_RANGE1>> ranges(tables.size());
+	for (size_t t = 0; t < tables.size(); ++t)
+	{
+		D3D12_SHADER_VISIBILITY visibility = resources[tables[t][0]].visibility;
+
+		sprintf_s(line, "%2u: table, %s\n", static_cast<UINT>(parameters.size()), gVisibilityNames[visibility]);
+		layout->description += line;
+
+		UINT offset = 0;
+		for (size_t i : tables[t])
+		{
+			const Resource &resource = resources[i];
+			UINT numDescriptors = resource.bindCount == 0 ? UINT_MAX : resource.bindCount;
+
+			CD3DX12_DESCRIPTOR_RANGE1 range;
+			range.Init(resource.rangeType, numDescriptors, resource.bindPoint, resource.space,
+				D3D12_DESCRIPTOR_RANGE_FLAG_NONE, offset);
+			ranges[t].push_back(range);
+			addBinding(resource, D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE, offset);
+
+			if (resource.bindCount == 0)
+			{
+				sprintf_s(line, "      +%u: %s %u.. space%u, unbounded (%s)\n", offset, gRangeTypeNames[resource.rangeType],
+					resource.bindPoint, resource.space, resource.names[0].c_str());
+			}
+			else
+			{
+				sprintf_s(line, "      +%u: %s %u..%u space%u (%s)\n", offset, gRangeTypeNames[resource.rangeType],
+					resource.bindPoint, resource.bindPoint + numDescriptors - 1, resource.space, resource.names[0].c_str());
+			}
+			layout->description += line;
+
+			offset += numDescriptors;
+		}
+
+		CD3DX12_ROOT_PARAMETER1 parameter;
+		parameter.InitAsDescriptorTable(static_cast<UINT>(ranges[t].size()), ranges[t].data(), visibility);
+		parameters.push_back(parameter);
+	}
+
+	D3D12_ROOT_SIGNATURE_FLAGS flags = D3D12_ROOT_SIGNATURE_FLAG_NONE;
+	if ((reflection.stageMask & (1u << D3D12_SHVER_COMPUTE_SHADER)) == 0)
+	{
+		if (reflection.inputAssembler)
+		{
+			flags |= D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT;
+		}
+
+		for (const StageDenyFlag &stage : gStageDenyFlags)
+		{
+			if ((reflection.stageMask & (1u << stage.shaderType)) == 0)
+			{
+				flags |= stage.flag;
+			}
+		}
+	}
+
+	CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC desc;
+	desc.Init_1_1(static_cast<UINT>(parameters.size()), parameters.data(), 0, nullptr, flags);
+
+	layout->rootSignature = m_rootSignatures->GetOrCreate(desc, &layout->rootSignatureKey);
+
+	sprintf_s(line, "    %u DWORDs, root signature %016llx\n", layout->rootSizeInDwords,
+		static_cast<unsigned long long>(layout->rootSignatureKey));
+	layout->description += line;
+
+	return layout;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "includes.h"
+#include "rootSignatureCache.h"
+
+#include <d3d12shader.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Root signatures generated from what the shaders of a pipeline actually
+// bind, instead of written by hand next to them.
+//
+// Every stage is reflected and bindings to the same register are merged
+// (visible to all stages if more than one uses it). The layout is then
+// picked to keep per-draw binding cheap:
+//	- small constant buffers become root constants, set without a buffer
+//	- other constant buffers, and structured and byte address buffers,
+//	  become root descriptors, set with just an address
+//	- everything else goes in descriptor tables, one per visibility
+//	  (samplers in their own tables, as D3D12 requires)
+// If that's over the 64 DWORD root signature limit, root constants are
+// demoted to root CBVs and then root descriptors to table entries.
+// Parameters that change most often come first.
+//
+// Layouts are cached by the hash of the shaders, and the root signature
+// itself comes from the RootSignatureCache, so identical layouts share one.
+
+struct BindingLayout
+{
+	struct Binding
+	{
+		D3D12_ROOT_PARAMETER_TYPE type;
+		UINT rootParameter;
+		UINT tableOffset;		// descriptors from the start of the table, only for tables
+	};
+
+	ComPtr<ID3D12RootSignature> rootSignature;
+	uint64_t rootSignatureKey;	// for the pipeline cache
+	UINT rootSizeInDwords;
+
+	// By the name the shaders use for the resource
+	std::unordered_map<std::string, Binding> bindings;
+
+	// One line per root parameter, for the debugger output or an offline dump
+	std::string description;
+
+	const Binding *Find(const std::string &name) const
+	{
+		auto it = bindings.find(name);
+		return it != bindings.end() ? &it->second : nullptr;
+	}
+};
+
+// Not thread safe, like the RootSignatureCache it creates root signatures with
+class BindingLayoutCache
+{
+public:
+	explicit BindingLayoutCache(RootSignatureCache *rootSignatures);
+
+	// One entry per stage of the pipeline, empty bytecode is skipped
+	std::shared_ptr<const BindingLayout> GetOrCreate(const D3D12_SHADER_BYTECODE *shaders, UINT numShaders);
+
+	// Every layout created so far, for the -bindings dump
+	std::string Describe() const;
+
+	// Larger constant buffers are bound as root CBVs
+	static const UINT gMaxRootConstantsBytes = 64;
+
+private:
+	struct Resource
+	{
+		std::vector<std::string> names;	// stages may call it differently
+		D3D12_DESCRIPTOR_RANGE_TYPE rangeType;
+		UINT bindPoint;
+		UINT bindCount;					// 0 for unbounded arrays
+		UINT space;
+		UINT size;						// constant buffers only
+		bool rootDescriptor;			// can be bound by address, without a descriptor
+		D3D12_SHADER_VISIBILITY visibility;
+	};
+
+	struct Reflection
+	{
+		std::vector<Resource> resources;
+		UINT stageMask;					// 1 << D3D12_SHVER_*
+		bool inputAssembler;			// the vertex shader reads vertex attributes
+	};
+
+	static void Reflect(const D3D12_SHADER_BYTECODE &shader, Reflection &reflection);
+	std::shared_ptr<BindingLayout> Generate(const Reflection &reflection);
+
+	RootSignatureCache *m_rootSignatures;
+	std::unordered_map<uint64_t, std::shared_ptr<const BindingLayout>> m_layouts;	// shader hash -> layout
+};
@@ -0,0 +1,646 @@
+#include "bvh.h"
+#include "jobSystem.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Nodes with more primitives are binned on every thread, in blocks
+	const uint32_t gParallelThreshold = 64 * 1024;
+	const uint32_t gBlockSize = 16 * 1024;
+	// Subtrees built as jobs have at least this many primitives
+	const uint32_t gMinSubtreeSize = 4096;
+	// Testing a node's box against testing a primitive
+	const float gTraversalCost = 1.0f;
+	const uint32_t gNone = ~0u;
+
+	struct Box
+	{
+		XMVECTOR min;
+		XMVECTOR max;
+	};
+
+	Box EmptyBox()
+	{
+		Box box = { XMVectorReplicate(FLT_MAX), XMVectorReplicate(-FLT_MAX) };
+		return box;
+	}
+
+	void Grow(Box &box, FXMVECTOR min, FXMVECTOR max)
+	{
+		box.min = XMVectorMin(box.min, min);
+		box.max = XMVectorMax(box.max, max);
+	}
+
+	// Half the surface area, only ever compared
+	float HalfArea(const Box &box)
+	{
+		XMFLOAT3 size;
+		XMStoreFloat3(&size, XMVectorMax(XMVectorSubtract(box.max, box.min), XMVectorZero()));
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+
+	float Component(const XMFLOAT3 &v, uint32_t axis)
+	{
+		return (&v.x)[axis];
+	}
+
+	// The build moves these around rather than indices to the boxes, so it
+	// reads them in order
+	struct Primitive
+	{
+		XMFLOAT3 min;
+		uint32_t index;
+		XMFLOAT3 max;
+		uint32_t padding;
+
+		float GetCenter(uint32_t axis) const { return (Component(min, axis) + Component(max, axis)) * 0.5f; }
+	};
+
+	struct Bin
+	{
+		Box bounds;
+		uint32_t count;
+	};
+
+	struct Bins
+	{
+		Bin bins[3][Bvh::gNumBins];
+	};
+
+	uint32_t BinIndex(float center, float min, float scale, uint32_t numBins)
+	{
+		return std::min(numBins - 1, static_cast<uint32_t>((center - min) * scale));
+	}
+
+	// Splits the top of the tree and builds the subtrees below it, each into
+	// its own nodes, then copies them into one array depth first
+	class Builder
+	{
+	public:
+		Builder(Primitive *primitives) :
+			m_primitives(primitives)
+		{
+		}
+
+		// Returns the top node of the range. Ranges of subtreeSize or less are
+		// left to BuildSubtrees.
+		uint32_t BuildTop(uint32_t begin, uint32_t end, uint32_t depth, uint32_t subtreeSize, JobSystem *jobs)
+		{
+			uint32_t index = static_cast<uint32_t>(m_top.size());
+			m_top.emplace_back();
+			m_top[index].subtree = gNone;
+
+			if (end - begin <= subtreeSize)
+			{
+				m_top[index].subtree = static_cast<uint32_t>(m_subtrees.size());
+				m_subtrees.emplace_back();
+				m_subtrees.back().begin = begin;
+				m_subtrees.back().end = end;
+				m_subtrees.back().depth = depth;
+				return index;
+			}
+
+			Box bounds, centerBounds;
+			ComputeBounds(begin, end, bounds, centerBounds, jobs);
+			m_top[index].bounds = bounds;
+
+			// More than gMaxLeafSize primitives, never a leaf
+			uint32_t middle = Split(begin, end, bounds, centerBounds, depth, jobs);
+
+			uint32_t left = BuildTop(begin, middle, depth + 1, subtreeSize, jobs);
+			uint32_t right = BuildTop(middle, end, depth + 1, subtreeSize, jobs);
+			m_top[index].left = left;
+			m_top[index].right = right;
+			return index;
+		}
+
+		void BuildSubtrees(JobSystem *jobs)
+		{
+			auto build = [&](uint32_t first, uint32_t last)
+			{
+				for (uint32_t i = first; i < last; ++i)
+				{
+					Subtree &subtree = m_subtrees[i];
+					subtree.nodes.clear();
+					subtree.maxDepth = BuildSubtree(subtree.begin, subtree.end, subtree.depth, subtree.nodes);
+				}
+			};
+
+			uint32_t numSubtrees = GetNumSubtrees();
+			if (jobs)
+			{
+				jobs->ParallelFor(numSubtrees, 1, build);
+			}
+			else
+			{
+				build(0, numSubtrees);
+			}
+		}
+
+		void Emit(uint32_t top, std::vector<Bvh::Node> &nodes) const
+		{
+			const TopNode &topNode = m_top[top];
+			if (topNode.subtree != gNone)
+			{
+				// The right children move with the rest of the subtree
+				uint32_t base = static_cast<uint32_t>(nodes.size());
+				for (Bvh::Node node : m_subtrees[topNode.subtree].nodes)
+				{
+					if (node.count == 0)
+					{
+						node.first += base;
+					}
+					nodes.push_back(node);
+				}
+				return;
+			}
+
+			uint32_t index = static_cast<uint32_t>(nodes.size());
+			nodes.emplace_back();
+			XMStoreFloat3(&nodes[index].min, topNode.bounds.min);
+			XMStoreFloat3(&nodes[index].max, topNode.bounds.max);
+			nodes[index].count = 0;
+
+			Emit(topNode.left, nodes);
+			nodes[index].first = static_cast<uint32_t>(nodes.size());
+			Emit(topNode.right, nodes);
+		}
+
+		uint32_t GetNumSubtrees() const { return static_cast<uint32_t>(m_subtrees.size()); }
+
+		uint32_t GetNumNodes() const
+		{
+			uint32_t numNodes = static_cast<uint32_t>(m_top.size() - m_subtrees.size());
+			for (const Subtree &subtree : m_subtrees)
+			{
+				numNodes += static_cast<uint32_t>(subtree.nodes.size());
+			}
+			return numNodes;
+		}
+
+		uint32_t GetDepth() const
+		{
+			uint32_t depth = 0;
+			for (const Subtree &subtree : m_subtrees)
+			{
+				depth = std::max(depth, subtree.maxDepth);
+			}
+			return depth;
+		}
+
+	private:
+		struct TopNode
+		{
+			Box bounds;
+			uint32_t left;
+			uint32_t right;
+			uint32_t subtree;		// gNone above the subtrees
+		};
+
+		struct Subtree
+		{
+			uint32_t begin;
+			uint32_t end;
+			uint32_t depth;
+			uint32_t maxDepth;
+			std::vector<Bvh::Node> nodes;
+		};
+
+		void ComputeBounds(uint32_t begin, uint32_t end, Box &bounds, Box &centerBounds, JobSystem *jobs) const
+		{
+			auto compute = [&](uint32_t first, uint32_t last, Box &rangeBounds, Box &rangeCenterBounds)
+			{
+				rangeBounds = EmptyBox();
+				rangeCenterBounds = EmptyBox();
+				for (uint32_t i = first; i < last; ++i)
+				{
+					XMVECTOR min = XMLoadFloat3(&m_primitives[i].min);
+					XMVECTOR max = XMLoadFloat3(&m_primitives[i].max);
+					XMVECTOR center = XMVectorScale(XMVectorAdd(min, max), 0.5f);
+					Grow(rangeBounds, min, max);
+					Grow(rangeCenterBounds, center, center);
+				}
+			};
+
+			uint32_t count = end - begin;
+			if (!jobs || count < gParallelThreshold)
+			{
+				compute(begin, end, bounds, centerBounds);
+				return;
+			}
+
+			uint32_t numBlocks = (count + gBlockSize - 1) / gBlockSize;
+			std::vector<Box> blockBounds(numBlocks * 2);
+			jobs->ParallelFor(numBlocks, 1, [&](uint32_t firstBlock, uint32_t lastBlock)
+			{
+				for (uint32_t block = firstBlock; block < lastBlock; ++block)
+				{
+					uint32_t first = begin + block * gBlockSize;
+					compute(first, std::min(end, first + gBlockSize), blockBounds[block * 2], blockBounds[block * 2 + 1]);
+				}
+			});
+
+			bounds = EmptyBox();
+			centerBounds = EmptyBox();
+			for (uint32_t block = 0; block < numBlocks; ++block)
+			{
+				Grow(bounds, blockBounds[block * 2].min, blockBounds[block * 2].max);
+				Grow(centerBounds, blockBounds[block * 2 + 1].min, blockBounds[block * 2 + 1].max);
+			}
+		}
+
+		// Reorders the range so the primitives of the left child come first and
+		// returns where the right child starts, or end for a leaf
+		uint32_t Split(uint32_t begin, uint32_t end, const Box &bounds, const Box &centerBounds, uint32_t depth,
+			JobSystem *jobs)
+		{
+			uint32_t count = end - begin;
+			if (count <= 1)
+			{
+				return end;
+			}
+
+			XMFLOAT3 centerMin, centerMax;
+			XMStoreFloat3(&centerMin, centerBounds.min);
+			XMStoreFloat3(&centerMax, centerBounds.max);
+
+			// No more bins than primitives, small nodes are the most numerous
+			uint32_t numBins = count < Bvh::gNumBins ? count : Bvh::gNumBins;
+
+			float extents[3];
+			float scales[3];
+			uint32_t largestAxis = 0;
+			for (uint32_t axis = 0; axis < 3; ++axis)
+			{
+				extents[axis] = Component(centerMax, axis) - Component(centerMin, axis);
+				scales[axis] = extents[axis] > 0.0f ? numBins / extents[axis] : 0.0f;
+				if (extents[axis] > extents[largestAxis])
+				{
+					largestAxis = axis;
+				}
+			}
+
+			// Halves along the longest axis, when the heuristic can't help
+			auto splitMiddle = [&]() -> uint32_t
+			{
+				if (count <= Bvh::gMaxLeafSize)
+				{
+					return end;
+				}
+
+				uint32_t middle = begin + count / 2;
+				std::nth_element(m_primitives + begin, m_primitives + middle, m_primitives + end,
+					[&](const Primitive &a, const Primitive &b)
+				{
+					return a.GetCenter(largestAxis) < b.GetCenter(largestAxis);
+				});
+				return middle;
+			};
+
+			if (depth >= Bvh::gMaxSahDepth || extents[largestAxis] <= 0.0f)
+			{
+				return splitMiddle();
+			}
+
+			Bins bins;
+			BinRange(begin, end, centerMin, extents, scales, numBins, bins, jobs);
+
+			// Sweep from the right first, then from the left, through every split
+			// between two bins
+			uint32_t bestAxis = gNone;
+			uint32_t bestBin = 0;
+			float bestCost = FLT_MAX;
+			for (uint32_t axis = 0; axis < 3; ++axis)
+			{
+				if (extents[axis] <= 0.0f)
+				{
+					continue;
+				}
+
+				float rightCosts[Bvh::gNumBins];
+				Box right = EmptyBox();
+				uint32_t rightCount = 0;
+				for (uint32_t bin = numBins - 1; bin > 0; --bin)
+				{
+					const Bin &current = bins.bins[axis][bin];
+					Grow(right, current.bounds.min, current.bounds.max);
+					rightCount += current.count;
+					rightCosts[bin] = rightCount * HalfArea(right);
+				}
+
+				Box left = EmptyBox();
+				uint32_t leftCount = 0;
+				for (uint32_t bin = 0; bin + 1 < numBins; ++bin)
+				{
+					const Bin &current = bins.bins[axis][bin];
+					Grow(left, current.bounds.min, current.bounds.max);
+					leftCount += current.count;
+
+					float cost = leftCount * HalfArea(left) + rightCosts[bin + 1];
+					if (leftCount > 0 && leftCount < count && cost < bestCost)
+					{
+						bestAxis = axis;
+						bestBin = bin;
+						bestCost = cost;
+					}
+				}
+			}
+
+			if (bestAxis == gNone)
+			{
+				return splitMiddle();
+			}
+
+			float splitCost = gTraversalCost + bestCost / HalfArea(bounds);
+			if (count <= Bvh::gMaxLeafSize && splitCost >= count)
+			{
+				return end;
+			}
+
+			float axisMin = Component(centerMin, bestAxis);
+			float axisScale = scales[bestAxis];
+			Primitive *middle = std::partition(m_primitives + begin, m_primitives + end, [&](const Primitive &primitive)
+			{
+				return BinIndex(primitive.GetCenter(bestAxis), axisMin, axisScale, numBins) <= bestBin;
+			});
+
+			// Only when rounding put every center on one side
+			if (middle == m_primitives + begin || middle == m_primitives + end)
+			{
+				return splitMiddle();
+			}
+			return static_cast<uint32_t>(middle - m_primitives);
+		}
+
+		void BinRange(uint32_t begin, uint32_t end, const XMFLOAT3 &centerMin, const float *extents, const float *scales,
+			uint32_t numBins, Bins &bins, JobSystem *jobs) const
+		{
+			auto binPrimitives = [&](uint32_t first, uint32_t last, Bins &rangeBins)
+			{
+				for (uint32_t axis = 0; axis < 3; ++axis)
+				{
+					for (uint32_t i = 0; i < numBins; ++i)
+					{
+						rangeBins.bins[axis][i].bounds = EmptyBox();
+						rangeBins.bins[axis][i].count = 0;
+					}
+				}
+
+				for (uint32_t i = first; i < last; ++i)
+				{
+					const Primitive &primitive = m_primitives[i];
+					XMVECTOR min = XMLoadFloat3(&primitive.min);
+					XMVECTOR max = XMLoadFloat3(&primitive.max);
+					for (uint32_t axis = 0; axis < 3; ++axis)
+					{
+						if (extents[axis] <= 0.0f)
+						{
+							continue;
+						}
+
+						Bin &bin = rangeBins.bins[axis][BinIndex(primitive.GetCenter(axis), Component(centerMin, axis),
+							scales[axis], numBins)];
+						Grow(bin.bounds, min, max);
+						bin.count++;
+					}
+				}
+			};
+
+			uint32_t count = end - begin;
+			if (!jobs || count < gParallelThreshold)
+			{
+				binPrimitives(begin, end, bins);
+				return;
+			}
+
+			uint32_t numBlocks = (count + gBlockSize - 1) / gBlockSize;
+			std::vector<Bins> blockBins(numBlocks);
+			jobs->ParallelFor(numBlocks, 1, [&](uint32_t firstBlock, uint32_t lastBlock)
+			{
+				for (uint32_t block = firstBlock; block < lastBlock; ++block)
+				{
+					uint32_t first = begin + block * gBlockSize;
+					binPrimitives(first, std::min(end, first + gBlockSize), blockBins[block]);
+				}
+			});
+
+			bins = blockBins[0];
+			for (uint32_t block = 1; block < numBlocks; ++block)
+			{
+				for (uint32_t axis = 0; axis < 3; ++axis)
+				{
+					for (uint32_t i = 0; i < numBins; ++i)
+					{
+						const Bin &blockBin = blockBins[block].bins[axis][i];
+						Grow(bins.bins[axis][i].bounds, blockBin.bounds.min, blockBin.bounds.max);
+						bins.bins[axis][i].count += blockBin.count;
+					}
+				}
+			}
+		}
+
+		// Returns the depth of the deepest leaf
+		uint32_t BuildSubtree(uint32_t begin, uint32_t end, uint32_t depth, std::vector<Bvh::Node> &nodes)
+		{
+			Box bounds, centerBounds;
+			ComputeBounds(begin, end, bounds, centerBounds, nullptr);
+
+			uint32_t index = static_cast<uint32_t>(nodes.size());
+			nodes.emplace_back();
+			XMStoreFloat3(&nodes[index].min, bounds.min);
+			XMStoreFloat3(&nodes[index].max, bounds.max);
+
+			uint32_t middle = Split(begin, end, bounds, centerBounds, depth, nullptr);
+			if (middle == end)
+			{
+				nodes[index].first = begin;
+				nodes[index].count = end - begin;
+				return depth;
+			}
+
+			nodes[index].count = 0;
+			uint32_t leftDepth = BuildSubtree(begin, middle, depth + 1, nodes);
+			nodes[index].first = static_cast<uint32_t>(nodes.size());
+			uint32_t rightDepth = BuildSubtree(middle, end, depth + 1, nodes);
+			return std::max(leftDepth, rightDepth);
+		}
+
+		Primitive *m_primitives;
+
+		std::vector<TopNode> m_top;
+		std::vector<Subtree> m_subtrees;
+	};
+}
+
+Bvh::Bvh() :
+	m_stats()
+{
+}
+
+void Bvh::Build(const XMFLOAT3 *mins, const XMFLOAT3 *maxs, uint32_t count, JobSystem *jobs)
+{
+	static std::chrono::high_resolution_clock clock;
+	auto t0 = clock.now();
+
+	m_mins.assign(mins, mins + count);
+	m_maxs.assign(maxs, maxs + count);
+	m_primitives.resize(count);
+
+	std::vector<Primitive> primitives(count);
+	auto prepare = [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			primitives[i].min = mins[i];
+			primitives[i].index = i;
+			primitives[i].max = maxs[i];
+			primitives[i].padding = 0;
+		}
+	};
+
+	if (jobs)
+	{
+		jobs->ParallelFor(count, gBlockSize, prepare);
+	}
+	else
+	{
+		prepare(0, count);
+	}
+
+	m_nodes.clear();
+	m_stats.subtrees = 0;
+	m_stats.depth = 0;
+
+	if (count > 0)
+	{
+		// A few subtrees per thread, so the ones done early can take another
+		uint32_t subtreeSize = count;
+		if (jobs)
+		{
+			subtreeSize = std::max(gMinSubtreeSize, count / (jobs->GetNumThreads() * 4));
+		}
+
+		Builder builder(primitives.data());
+		uint32_t root = builder.BuildTop(0, count, 0, subtreeSize, jobs);
+		builder.BuildSubtrees(jobs);
+
+		m_nodes.reserve(builder.GetNumNodes());
+		builder.Emit(root, m_nodes);
+
+		m_stats.subtrees = builder.GetNumSubtrees();
+		m_stats.depth = builder.GetDepth();
+	}
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		m_primitives[i] = primitives[i].index;
+	}
+
+	uint32_t leaves = 0;
+	for (const Node &node : m_nodes)
+	{
+		if (node.count > 0)
+		{
+			leaves++;
+		}
+	}
+
+	m_stats.primitives = count;
+	m_stats.nodes = GetNumNodes();
+	m_stats.leaves = leaves;
+	m_stats.buildMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+}
+
+void Bvh::Refit(const XMFLOAT3 *mins, const XMFLOAT3 *maxs)
+{
+	static std::chrono::high_resolution_clock clock;
+	auto t0 = clock.now();
+
+	std::copy(mins, mins + m_mins.size(), m_mins.begin());
+	std::copy(maxs, maxs + m_maxs.size(), m_maxs.begin());
+
+	// Children always come after their parent
+	for (size_t i = m_nodes.size(); i-- > 0;)
+	{
+		Node &node = m_nodes[i];
+
+		Box bounds = EmptyBox();
+		if (node.count > 0)
+		{
+			for (uint32_t j = node.first; j < node.first + node.count; ++j)
+			{
+				uint32_t primitive = m_primitives[j];
+				Grow(bounds, XMLoadFloat3(&m_mins[primitive]), XMLoadFloat3(&m_maxs[primitive]));
+			}
+		}
+		else
+		{
+			const Node &left = m_nodes[i + 1];
+			const Node &right = m_nodes[node.first];
+			Grow(bounds, XMLoadFloat3(&left.min), XMLoadFloat3(&left.max));
+			Grow(bounds, XMLoadFloat3(&right.min), XMLoadFloat3(&right.max));
+		}
+
+		XMStoreFloat3(&node.min, bounds.min);
+		XMStoreFloat3(&node.max, bounds.max);
+	}
+
+	m_stats.refitMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+}
+
+uint32_t Bvh::RayCast(const XMFLOAT3 &origin, const XMFLOAT3 &direction, float maxDistance, float *distance) const
+{
+	XMVECTOR rayOrigin = XMLoadFloat3(&origin);
+	XMVECTOR invDirection = XMVectorReciprocal(XMLoadFloat3(&direction));
+
+	return RayCast(origin, direction, maxDistance, [&](uint32_t primitive, float closest)
+	{
+		return IntersectBox(m_mins[primitive], m_maxs[primitive], rayOrigin, invDirection, closest);
+	}, distance);
+}
+
+void Bvh::QueryBox(const XMFLOAT3 &min, const XMFLOAT3 &max, std::vector<uint32_t> &primitives) const
+{
+	XMVECTOR queryMin = XMLoadFloat3(&min);
+	XMVECTOR queryMax = XMLoadFloat3(&max);
+
+	auto overlaps = [&](const XMFLOAT3 &boxMin, const XMFLOAT3 &boxMax)
+	{
+		return XMVector3LessOrEqual(XMLoadFloat3(&boxMin), queryMax) && XMVector3LessOrEqual(queryMin, XMLoadFloat3(&boxMax));
+	};
+
+	uint32_t stack[gMaxDepth + 1];
+	uint32_t stackSize = 0;
+	if (!m_nodes.empty())
+	{
+		stack[stackSize++] = 0;
+	}
+
+	while (stackSize > 0)
+	{
+		uint32_t index = stack[--stackSize];
+		const Node &node = m_nodes[index];
+		if (!overlaps(node.min, node.max))
+		{
+			continue;
+		}
+
+		if (node.count > 0)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				uint32_t primitive = m_primitives[i];
+				if (overlaps(m_mins[primitive], m_maxs[primitive]))
+				{
+					primitives.push_back(primitive);
+				}
+			}
+		}
+		else
+		{
+			stack[stackSize++] = node.first;
+			stack[stackSize++] = index + 1;
+		}
+	}
+}
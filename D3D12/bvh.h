@@ -0,0 +1,211 @@
+#pragma once
+
+#include "includes.h"
+
+#include <cfloat>
+#include <vector>
+
+class JobSystem;
+
+// Bounding volume hierarchy over boxes (objects, or the triangles of a mesh)
+// for picking and other ray and region queries on the CPU.
+//
+// Every node splits its boxes in two by the surface area heuristic: the
+// centers are put in gNumBins bins along each axis and the split between
+// bins that gives the smallest expected cost of a ray test is taken, or the
+// node is kept as a leaf when no split is worth it.
+//
+// The top of the tree is split on the calling thread, with the boxes of the
+// big nodes binned on every thread of the job system. The subtrees below are
+// then built on their own threads and copied after each other, so the nodes
+// end up in depth-first order whichever thread built them: the left child
+// is the next node and only the right one has to be stored. A node is 32
+// bytes, two to a cache line.
+//
+// Rays are tested against the 3 slabs of a box at once with DirectXMath
+// vectors, nearest child first, and the far one is skipped when something
+// closer was already hit.
+//
+// Refit() only updates the boxes of the nodes for primitives that moved
+// (animated geometry), which is much faster than building again but makes
+// the tree worse as the primitives move away from where they were built.
+
+class Bvh
+{
+public:
+	struct Node
+	{
+		DirectX::XMFLOAT3 min;
+		uint32_t first;		// leaf: first of GetPrimitives(), interior node: the right child
+		DirectX::XMFLOAT3 max;
+		uint32_t count;		// primitives of a leaf, 0 for an interior node
+	};
+
+	struct Stats
+	{
+		uint32_t primitives;
+		uint32_t nodes;
+		uint32_t leaves;
+		uint32_t depth;
+		uint32_t subtrees;		// built as jobs
+		double buildMs;
+		double refitMs;
+	};
+
+	static const uint32_t gNoHit = ~0u;
+	static const uint32_t gNumBins = 16;
+	static const uint32_t gMaxLeafSize = 8;
+	// Past this depth nodes are split in the middle, so the depth stays under gMaxDepth
+	static const uint32_t gMaxSahDepth = 32;
+	static const uint32_t gMaxDepth = 64;
+
+	Bvh();
+
+	// Primitive i has the box mins[i], maxs[i]
+	void Build(const DirectX::XMFLOAT3 *mins, const DirectX::XMFLOAT3 *maxs, uint32_t count,
+		JobSystem *jobs = nullptr);
+	// The same primitives, moved
+	void Refit(const DirectX::XMFLOAT3 *mins, const DirectX::XMFLOAT3 *maxs);
+
+	// The closest primitive whose box the ray hits within maxDistance
+	uint32_t RayCast(const DirectX::XMFLOAT3 &origin, const DirectX::XMFLOAT3 &direction, float maxDistance,
+		float *distance = nullptr) const;
+	// The closest primitive for which intersect(primitive, closest) returns less
+	// than closest, the distance to the closest hit so far
+	template <typename Intersect>
+	uint32_t RayCast(const DirectX::XMFLOAT3 &origin, const DirectX::XMFLOAT3 &direction, float maxDistance,
+		const Intersect &intersect, float *distance = nullptr) const;
+
+	// Appends the primitives whose box overlaps min, max
+	void QueryBox(const DirectX::XMFLOAT3 &min, const DirectX::XMFLOAT3 &max, std::vector<uint32_t> &primitives) const;
+
+	const Node *GetNodes() const { return m_nodes.data(); }
+	uint32_t GetNumNodes() const { return static_cast<uint32_t>(m_nodes.size()); }
+	// The primitives in the order the leaves refer to them
+	const uint32_t *GetPrimitives() const { return m_primitives.data(); }
+
+	const Stats &GetStats() const { return m_stats; }
+
+	// The distance the ray enters the box at, FLT_MAX if it misses it or
+	// only enters it after maxDistance
+	static float IntersectBox(const DirectX::XMFLOAT3 &min, const DirectX::XMFLOAT3 &max, DirectX::FXMVECTOR origin,
+		DirectX::FXMVECTOR invDirection, float maxDistance);
+
+private:
+	std::vector<Node> m_nodes;
+	std::vector<uint32_t> m_primitives;
+
+	// By primitive
+	std::vector<DirectX::XMFLOAT3> m_mins;
+	std::vector<DirectX::XMFLOAT3> m_maxs;
+
+	Stats m_stats;
+};
+
+inline float Bvh::IntersectBox(const DirectX::XMFLOAT3 &min, const DirectX::XMFLOAT3 &max, DirectX::FXMVECTOR origin,
+	DirectX::FXMVECTOR invDirection, float maxDistance)
+{
+	using namespace DirectX;
+
+	XMVECTOR t0 = XMVectorMultiply(XMVectorSubtract(XMLoadFloat3(&min), origin), invDirection);
+	XMVECTOR t1 = XMVectorMultiply(XMVectorSubtract(XMLoadFloat3(&max), origin), invDirection);
+	XMVECTOR enter = XMVectorMin(t0, t1);
+	XMVECTOR exit = XMVectorMax(t0, t1);
+
+	// The ray is in the box where it is between all 3 pairs of planes
+	enter = XMVectorMax(enter, XMVectorMax(XMVectorSplatY(enter), XMVectorSplatZ(enter)));
+	exit = XMVectorMin(exit, XMVectorMin(XMVectorSplatY(exit), XMVectorSplatZ(exit)));
+
+	float enterDistance = std::max(XMVectorGetX(enter), 0.0f);
+	float exitDistance = std::min(XMVectorGetX(exit), maxDistance);
+	if (enterDistance > exitDistance)
+	{
+		return FLT_MAX;
+	}
+	return enterDistance;
+}
+
+template <typename Intersect>
+uint32_t Bvh::RayCast(const DirectX::XMFLOAT3 &origin, const DirectX::XMFLOAT3 &direction, float maxDistance,
+	const Intersect &intersect, float *distance) const
+{
+	using namespace DirectX;
+
+	uint32_t hit = gNoHit;
+	float closest = maxDistance;
+
+	XMVECTOR rayOrigin = XMLoadFloat3(&origin);
+	XMVECTOR invDirection = XMVectorReciprocal(XMLoadFloat3(&direction));
+
+	struct Entry
+	{
+		uint32_t node;
+		float distance;
+	};
+	Entry stack[gMaxDepth];
+	uint32_t stackSize = 0;
+
+	if (!m_nodes.empty())
+	{
+		float rootDistance = IntersectBox(m_nodes[0].min, m_nodes[0].max, rayOrigin, invDirection, closest);
+		if (rootDistance != FLT_MAX)
+		{
+			stack[stackSize++] = { 0, rootDistance };
+		}
+	}
+
+	while (stackSize > 0)
+	{
+		Entry entry = stack[--stackSize];
+		if (entry.distance > closest)
+		{
+			continue;
+		}
+
+		// Down the near children, the far ones wait on the stack
+		uint32_t index = entry.node;
+		for (;;)
+		{
+			const Node &node = m_nodes[index];
+			if (node.count > 0)
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; ++i)
+				{
+					float t = intersect(m_primitives[i], closest);
+					if (t < closest)
+					{
+						closest = t;
+						hit = m_primitives[i];
+					}
+				}
+				break;
+			}
+
+			Entry left = { index + 1, 0.0f };
+			Entry right = { node.first, 0.0f };
+			left.distance = IntersectBox(m_nodes[left.node].min, m_nodes[left.node].max, rayOrigin, invDirection, closest);
+			right.distance = IntersectBox(m_nodes[right.node].min, m_nodes[right.node].max, rayOrigin, invDirection,
+				closest);
+			if (right.distance < left.distance)
+			{
+				std::swap(left, right);
+			}
+
+			if (left.distance == FLT_MAX)
+			{
+				break;
+			}
+			if (right.distance != FLT_MAX)
+			{
+				stack[stackSize++] = right;
+			}
+			index = left.node;
+		}
+	}
+
+	if (distance && hit != gNoHit)
+	{
+		*distance = closest;
+	}
+	return hit;
+}
@@ -0,0 +1,1091 @@
+#include "commandCapture.h"
+#include "rootSignatureCache.h"
+
+#include <cfloat>
+#include <fstream>
+
+using namespace CaptureFile;
+
+namespace
+{
+	const uint32_t gCaptureMagic = 0x50414343;	// "CCAP"
+	const uint32_t gCaptureVersion = 2;
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t numObjects;
+		uint32_t numFrames;
+	};
+
+	struct ObjectHeader
+	{
+		uint32_t type;
+		uint32_t padding;
+		uint64_t size;
+	};
+
+	struct FrameHeader
+	{
+		uint32_t numCommands;
+		uint32_t numUploads;
+		uint64_t size;			// of the commands
+		uint64_t uploadsSize;	// of the uploads after them
+	};
+
+	template <typename Payload>
+	Payload *GetMutable(Command::Header *command)
+	{
+		return reinterpret_cast<Payload*>(command + 1);
+	}
+
+	template <typename Payload, typename Element>
+	Element *GetMutableArray(Command::Header *command)
+	{
+		return reinterpret_cast<Element*>(reinterpret_cast<uint8_t*>(command + 1) + Command::PayloadSize<Payload>());
+	}
+
+	// The smallest a command of its type can be: the header, the payload and
+	// the array the header (or the payload) says follows. Commands from a file
+	// that are shorter would be read past their end.
+	uint64_t GetMinimumSize(const Command::Header *command)
+	{
+		using namespace Command;
+
+		const uint64_t header = sizeof(Header);
+		const uint64_t count = command->param;
+
+		switch (command->type)
+		{
+		case SET_PIPELINE_STATE:
+		case SET_GRAPHICS_ROOT_SIGNATURE:
+		case SET_COMPUTE_ROOT_SIGNATURE:
+			return header + PayloadSize<Object>();
+		case SET_DESCRIPTOR_HEAPS:
+			return header + PayloadSize<DescriptorHeaps>();
+		case SET_PRIMITIVE_TOPOLOGY:
+		case SET_STENCIL_REF:
+			return header;
+		case SET_VERTEX_BUFFERS:
+			return header + PayloadSize<VertexBuffers>() + count * sizeof(D3D12_VERTEX_BUFFER_VIEW);
+		case SET_INDEX_BUFFER:
+			return header + PayloadSize<IndexBuffer>();
+		case SET_VIEWPORTS:
+			return header + count * sizeof(D3D12_VIEWPORT);
+		case SET_SCISSOR_RECTS:
+			return header + count * sizeof(D3D12_RECT);
+		case SET_RENDER_TARGETS:
+			return header + PayloadSize<RenderTargets>() + count * sizeof(D3D12_CPU_DESCRIPTOR_HANDLE);
+		case SET_BLEND_FACTOR:
+			return header + PayloadSize<BlendFactor>();
+		case SET_GRAPHICS_ROOT_CONSTANTS:
+		case SET_COMPUTE_ROOT_CONSTANTS:
+		{
+			// The number of values is in the payload, which has to be there first
+			uint64_t size = header + PayloadSize<RootConstants>();
+			if (command->size >= size)
+			{
+				size += uint64_t(Get<RootConstants>(command)->numValues) * sizeof(UINT);
+			}
+			return size;
+		}
+		case SET_GRAPHICS_ROOT_CBV:
+		case SET_COMPUTE_ROOT_CBV:
+		case SET_GRAPHICS_ROOT_SRV:
+		case SET_COMPUTE_ROOT_SRV:
+		case SET_GRAPHICS_ROOT_UAV:
+		case SET_COMPUTE_ROOT_UAV:
+			return header + PayloadSize<RootAddress>();
+		case SET_GRAPHICS_ROOT_TABLE:
+		case SET_COMPUTE_ROOT_TABLE:
+			return header + PayloadSize<RootTable>();
+		case CLEAR_RENDER_TARGET:
+			return header + PayloadSize<ClearRenderTarget>();
+		case CLEAR_DEPTH_STENCIL:
+			return header + PayloadSize<ClearDepthStencil>();
+		case RESOURCE_BARRIER:
+			return header + count * sizeof(D3D12_RESOURCE_BARRIER);
+		case COPY_BUFFER_REGION:
+			return header + PayloadSize<CopyBufferRegion>();
+		case COPY_RESOURCE:
+			return header + PayloadSize<CopyResource>();
+		case COPY_TEXTURE_REGION:
+			return header + PayloadSize<CopyTextureRegion>();
+		case DRAW:
+			return header + PayloadSize<Draw>();
+		case DRAW_INDEXED:
+			return header + PayloadSize<DrawIndexed>();
+		case DISPATCH:
+			return header + PayloadSize<Dispatch>();
+		}
+		return UINT64_MAX;
+	}
+
+	// Counts and root parameters too big for the fixed size arrays they index
+	bool IsValidCount(const Command::Header *command)
+	{
+		switch (command->type)
+		{
+		case Command::SET_DESCRIPTOR_HEAPS:
+			return command->param <= _countof(Command::DescriptorHeaps::heaps);
+		case Command::SET_RENDER_TARGETS:
+			return command->param <= D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT;
+		case Command::SET_GRAPHICS_ROOT_CONSTANTS:
+		case Command::SET_COMPUTE_ROOT_CONSTANTS:
+		case Command::SET_GRAPHICS_ROOT_CBV:
+		case Command::SET_COMPUTE_ROOT_CBV:
+		case Command::SET_GRAPHICS_ROOT_SRV:
+		case Command::SET_COMPUTE_ROOT_SRV:
+		case Command::SET_GRAPHICS_ROOT_UAV:
+		case Command::SET_COMPUTE_ROOT_UAV:
+		case Command::SET_GRAPHICS_ROOT_TABLE:
+		case Command::SET_COMPUTE_ROOT_TABLE:
+			return command->param < Command::gMaxRootParameters;
+		}
+		return true;
+	}
+
+	// Reads size bytes, which have to be in what's left of the file, so a
+	// corrupt size is a failed load and not a huge allocation
+	bool ReadBlock(std::ifstream &file, uint64_t fileSize, uint64_t size, std::vector<uint8_t> &data)
+	{
+		std::streamoff position = file.tellg();
+		if (position < 0 || size > fileSize - static_cast<uint64_t>(position))
+		{
+			return false;
+		}
+
+		data.resize(static_cast<size_t>(size));
+		return static_cast<bool>(file.read(reinterpret_cast<char*>(data.data()), data.size()));
+	}
+
+	// Calls function(void **field, ObjectType) for every object a command points at
+	template <typename Function>
+	void ForEachObject(Command::Header *command, Function function)
+	{
+		switch (command->type)
+		{
+		case Command::SET_PIPELINE_STATE:
+			function(&GetMutable<Command::Object>(command)->object, OBJECT_PIPELINE_STATE);
+			break;
+		case Command::SET_GRAPHICS_ROOT_SIGNATURE:
+		case Command::SET_COMPUTE_ROOT_SIGNATURE:
+			function(&GetMutable<Command::Object>(command)->object, OBJECT_ROOT_SIGNATURE);
+			break;
+		case Command::SET_DESCRIPTOR_HEAPS:
+			for (UINT i = 0; i < command->param; ++i)
+			{
+				function(reinterpret_cast<void**>(&GetMutable<Command::DescriptorHeaps>(command)->heaps[i]), OBJECT_DESCRIPTOR_HEAP);
+			}
+			break;
+		case Command::RESOURCE_BARRIER:
+		{
+			D3D12_RESOURCE_BARRIER *barriers = GetMutableArray<Command::Empty, D3D12_RESOURCE_BARRIER>(command);
+			for (UINT i = 0; i < command->param; ++i)
+			{
+				switch (barriers[i].Type)
+				{
+				case D3D12_RESOURCE_BARRIER_TYPE_TRANSITION:
+					function(reinterpret_cast<void**>(&barriers[i].Transition.pResource), OBJECT_RESOURCE);
+					break;
+				case D3D12_RESOURCE_BARRIER_TYPE_ALIASING:
+					function(reinterpret_cast<void**>(&barriers[i].Aliasing.pResourceBefore), OBJECT_RESOURCE);
+					function(reinterpret_cast<void**>(&barriers[i].Aliasing.pResourceAfter), OBJECT_RESOURCE);
+					break;
+				case D3D12_RESOURCE_BARRIER_TYPE_UAV:
+					function(reinterpret_cast<void**>(&barriers[i].UAV.pResource), OBJECT_RESOURCE);
+					break;
+				}
+			}
+			break;
+		}
+		case Command::COPY_BUFFER_REGION:
+			function(reinterpret_cast<void**>(&GetMutable<Command::CopyBufferRegion>(command)->dst), OBJECT_RESOURCE);
+			function(reinterpret_cast<void**>(&GetMutable<Command::CopyBufferRegion>(command)->src), OBJECT_RESOURCE);
+			break;
+		case Command::COPY_RESOURCE:
+			function(reinterpret_cast<void**>(&GetMutable<Command::CopyResource>(command)->dst), OBJECT_RESOURCE);
+			function(reinterpret_cast<void**>(&GetMutable<Command::CopyResource>(command)->src), OBJECT_RESOURCE);
+			break;
+		case Command::COPY_TEXTURE_REGION:
+			function(reinterpret_cast<void**>(&GetMutable<Command::CopyTextureRegion>(command)->dst.pResource), OBJECT_RESOURCE);
+			function(reinterpret_cast<void**>(&GetMutable<Command::CopyTextureRegion>(command)->src.pResource), OBJECT_RESOURCE);
+			break;
+		}
+	}
+
+	template <typename T>
+	void Append(std::vector<uint8_t> &data, const T &value)
+	{
+		const uint8_t *bytes = reinterpret_cast<const uint8_t*>(&value);
+		data.insert(data.end(), bytes, bytes + sizeof(T));
+	}
+}
+
+CommandCapture::CommandCapture(RootSignatureCache *rootSignatures) :
+	m_rootSignatures(rootSignatures),
+	m_numFrames(0)
+{
+	m_frame.numCommands = 0;
+	m_frame.numUploads = 0;
+}
+
+void CommandCapture::AddResource(ID3D12Resource *resource)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (IsCapturing())
+	{
+		GetId(resource, OBJECT_RESOURCE);
+	}
+}
+
+void CommandCapture::AddDescriptorHeap(ID3D12DescriptorHeap *heap)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (IsCapturing())
+	{
+		GetId(heap, OBJECT_DESCRIPTOR_HEAP);
+	}
+}
+
+void CommandCapture::AddRootSignature(ID3D12RootSignature *rootSignature, const void *blob, size_t size)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	const uint8_t *bytes = static_cast<const uint8_t*>(blob);
+	m_rootSignatureBlobs[rootSignature].assign(bytes, bytes + size);
+}
+
+void CommandCapture::AddPipelineState(ID3D12PipelineState *pipelineState, uint64_t key)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_pipelineKeys[pipelineState] = key;
+}
+
+void CommandCapture::Start(const std::wstring &path, uint32_t numFrames)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// Objects are saved again, they may have changed since the last capture
+	m_ids.clear();
+	m_objects.clear();
+	m_uploadBuffers.clear();
+	m_frames.clear();
+	m_frame = Frame();
+	m_frame.numCommands = 0;
+	m_frame.numUploads = 0;
+
+	m_path = path;
+	m_numFrames = numFrames;
+}
+
+void CommandCapture::Record(const CommandStream *const *streams, UINT numStreams)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!IsCapturing())
+	{
+		return;
+	}
+
+	for (UINT i = 0; i < numStreams; ++i)
+	{
+		const CommandStream *stream = streams[i];
+		if (stream->GetSize() == 0)
+		{
+			continue;
+		}
+
+		size_t offset = m_frame.commands.size();
+		m_frame.commands.insert(m_frame.commands.end(), stream->GetData(), stream->GetData() + stream->GetSize());
+		m_frame.numCommands += stream->GetNumCommands();
+
+		// The copy points at ids instead of objects
+		uint8_t *begin = m_frame.commands.data() + offset;
+		uint8_t *end = m_frame.commands.data() + m_frame.commands.size();
+		for (uint8_t *command = begin; command != end; command += reinterpret_cast<Command::Header*>(command)->size)
+		{
+			ForEachObject(reinterpret_cast<Command::Header*>(command), [this](void **object, ObjectType type)
+			{
+				*object = reinterpret_cast<void*>(static_cast<uintptr_t>(GetId(*object, type)));
+			});
+		}
+	}
+}
+
+bool CommandCapture::EndFrame()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!IsCapturing())
+	{
+		return true;
+	}
+
+	// What the CPU wrote for this frame, wherever in the buffers it went
+	for (const auto &buffer : m_uploadBuffers)
+	{
+		ID3D12Resource *resource = buffer.second.Get();
+		CaptureFile::Upload upload = { buffer.first, 0, resource->GetDesc().Width };
+
+		void *contents;
+		D3D12_RANGE readRange = { 0, static_cast<SIZE_T>(upload.size) };
+		if (FAILED(resource->Map(0, &readRange, &contents)))
+		{
+			continue;
+		}
+
+		Append(m_frame.uploads, upload);
+		const uint8_t *bytes = static_cast<const uint8_t*>(contents);
+		m_frame.uploads.insert(m_frame.uploads.end(), bytes, bytes + upload.size);
+		m_frame.numUploads++;
+
+		D3D12_RANGE writtenRange = { 0, 0 };
+		resource->Unmap(0, &writtenRange);
+	}
+
+	m_frames.push_back(std::move(m_frame));
+	m_frame = Frame();
+	m_frame.numCommands = 0;
+	m_frame.numUploads = 0;
+
+	if (--m_numFrames > 0)
+	{
+		return true;
+	}
+
+	bool written = Write();
+
+	char message[256];
+	sprintf_s(message, "CommandCapture: %zu frames, %zu objects %s\n", m_frames.size(), m_objects.size(),
+		written ? "written" : "could not be written");
+	::OutputDebugString(message);
+
+	m_frames.clear();
+	m_objects.clear();
+	m_uploadBuffers.clear();
+	m_ids.clear();
+	return written;
+}
+
+uint32_t CommandCapture::GetId(void *object, ObjectType type)
+{
+	if (!object)
+	{
+		return 0;
+	}
+
+	auto it = m_ids.find(object);
+	if (it != m_ids.end())
+	{
+		return it->second;
+	}
+
+	return AddObject(object, type);
+}
+
+uint32_t CommandCapture::AddObject(void *object, ObjectType type)
+{
+	Object captured;
+	captured.type = type;
+
+	switch (type)
+	{
+	case OBJECT_RESOURCE:
+	{
+		ID3D12Resource *resource = static_cast<ID3D12Resource*>(object);
+
+		Resource info = {};
+		info.desc = resource->GetDesc();
+		info.heapType = D3D12_HEAP_TYPE_DEFAULT;
+
+		D3D12_HEAP_PROPERTIES heapProperties;
+		D3D12_HEAP_FLAGS heapFlags;
+		if (SUCCEEDED(resource->GetHeapProperties(&heapProperties, &heapFlags)) && heapProperties.Type != D3D12_HEAP_TYPE_CUSTOM)
+		{
+			info.heapType = heapProperties.Type;
+		}
+
+		if (info.desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
+		{
+			info.gpuAddress = resource->GetGPUVirtualAddress();
+
+			// Its contents are saved at the end of every frame from now on
+			if (info.heapType == D3D12_HEAP_TYPE_UPLOAD)
+			{
+				m_uploadBuffers.push_back(std::make_pair(static_cast<uint32_t>(m_objects.size() + 1), resource));
+			}
+		}
+
+		Append(captured.data, info);
+		break;
+	}
+	case OBJECT_DESCRIPTOR_HEAP:
+	{
+		ID3D12DescriptorHeap *heap = static_cast<ID3D12DescriptorHeap*>(object);
+
+		DescriptorHeap info = {};
+		info.desc = heap->GetDesc();
+		info.cpuStart = heap->GetCPUDescriptorHandleForHeapStart().ptr;
+		if (info.desc.Flags & D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE)
+		{
+			info.gpuStart = heap->GetGPUDescriptorHandleForHeapStart().ptr;
+		}
+
+		ComPtr<ID3D12Device> device;
+		ThrowIfFailed(heap->GetDevice(IID_PPV_ARGS(&device)));
+		info.increment = device->GetDescriptorHandleIncrementSize(info.desc.Type);
+
+		Append(captured.data, info);
+		break;
+	}
+	case OBJECT_ROOT_SIGNATURE:
+	{
+		ID3D12RootSignature *rootSignature = static_cast<ID3D12RootSignature*>(object);
+
+		const std::vector<uint8_t> *blob = nullptr;
+		auto it = m_rootSignatureBlobs.find(object);
+		if (it != m_rootSignatureBlobs.end())
+		{
+			blob = &it->second;
+		}
+		else if (m_rootSignatures)
+		{
+			blob = m_rootSignatures->GetBlob(rootSignature);
+		}
+
+		if (blob)
+		{
+			captured.data = *blob;
+		}
+		break;
+	}
+	case OBJECT_PIPELINE_STATE:
+	{
+		uint64_t key = 0;
+		auto it = m_pipelineKeys.find(object);
+		if (it != m_pipelineKeys.end())
+		{
+			key = it->second;
+		}
+
+		Append(captured.data, key);
+		break;
+	}
+	}
+
+	m_objects.push_back(std::move(captured));
+
+	uint32_t id = static_cast<uint32_t>(m_objects.size());
+	m_ids[object] = id;
+	return id;
+}
+
+bool CommandCapture::Write()
+{
+	FileHeader header = {};
+	header.magic = gCaptureMagic;
+	header.version = gCaptureVersion;
+	header.numObjects = static_cast<uint32_t>(m_objects.size());
+	header.numFrames = static_cast<uint32_t>(m_frames.size());
+
+	std::wstring tempPath = m_path + L".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		for (const Object &object : m_objects)
+		{
+			ObjectHeader objectHeader = { object.type, 0, object.data.size() };
+			file.write(reinterpret_cast<const char*>(&objectHeader), sizeof(objectHeader));
+			file.write(reinterpret_cast<const char*>(object.data.data()), object.data.size());
+		}
+
+		for (const Frame &frame : m_frames)
+		{
+			FrameHeader frameHeader = { frame.numCommands, frame.numUploads, frame.commands.size(), frame.uploads.size() };
+			file.write(reinterpret_cast<const char*>(&frameHeader), sizeof(frameHeader));
+			file.write(reinterpret_cast<const char*>(frame.commands.data()), frame.commands.size());
+			file.write(reinterpret_cast<const char*>(frame.uploads.data()), frame.uploads.size());
+		}
+
+		if (!file)
+		{
+			return false;
+		}
+	}
+
+	return ::MoveFileExW(tempPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+}
+
+CommandReplay::CommandReplay(ComPtr<ID3D12Device2> device, PipelineFunction pipelines) :
+	m_device(device),
+	m_pipelines(pipelines),
+	m_rtvIncrement(0),
+	m_skipped(0)
+{
+	ThrowIfFailed(m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&m_allocator)));
+	ThrowIfFailed(m_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, m_allocator.Get(), nullptr,
+		IID_PPV_ARGS(&m_commandList)));
+	ThrowIfFailed(m_commandList->Close());
+
+	D3D12_DESCRIPTOR_HEAP_DESC rtvDesc = { D3D12_DESCRIPTOR_HEAP_TYPE_RTV, D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT };
+	ThrowIfFailed(m_device->CreateDescriptorHeap(&rtvDesc, IID_PPV_ARGS(&m_nullRtvs)));
+	CreateNullDescriptors(m_nullRtvs.Get(), rtvDesc);
+	m_rtvIncrement = m_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
+
+	D3D12_DESCRIPTOR_HEAP_DESC dsvDesc = { D3D12_DESCRIPTOR_HEAP_TYPE_DSV, 1 };
+	ThrowIfFailed(m_device->CreateDescriptorHeap(&dsvDesc, IID_PPV_ARGS(&m_nullDsv)));
+	CreateNullDescriptors(m_nullDsv.Get(), dsvDesc);
+}
+
+bool CommandReplay::Load(const std::wstring &path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+	{
+		return false;
+	}
+	uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+	file.seekg(0);
+
+	FileHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+		header.magic != gCaptureMagic || header.version != gCaptureVersion)
+	{
+		return false;
+	}
+
+	m_objects.clear();
+	m_addresses.clear();
+	m_heaps.clear();
+	m_frames.clear();
+	m_uploads.clear();
+	m_skipped = 0;
+
+	std::vector<uint8_t> data;
+	for (uint32_t i = 0; i < header.numObjects; ++i)
+	{
+		ObjectHeader objectHeader;
+		if (!file.read(reinterpret_cast<char*>(&objectHeader), sizeof(objectHeader)))
+		{
+			return false;
+		}
+
+		if (!ReadBlock(file, fileSize, objectHeader.size, data))
+		{
+			return false;
+		}
+
+		CreateObject(static_cast<ObjectType>(objectHeader.type), data);
+	}
+
+	std::sort(m_addresses.begin(), m_addresses.end(),
+		[](const AddressRange &a, const AddressRange &b) { return a.captured < b.captured; });
+
+	// Commands are remapped once here, so replaying them costs what recording them did
+	std::vector<uint64_t> command;	// 8 byte aligned, like in a stream
+	for (uint32_t i = 0; i < header.numFrames; ++i)
+	{
+		FrameHeader frameHeader;
+		if (!file.read(reinterpret_cast<char*>(&frameHeader), sizeof(frameHeader)))
+		{
+			return false;
+		}
+
+		if (!ReadBlock(file, fileSize, frameHeader.size, data))
+		{
+			return false;
+		}
+
+		std::unique_ptr<CommandStream> stream = std::make_unique<CommandStream>(data.size());
+		for (size_t offset = 0; offset + sizeof(Command::Header) <= data.size();)
+		{
+			const Command::Header *captured = reinterpret_cast<const Command::Header*>(data.data() + offset);
+			if (captured->size < sizeof(Command::Header) || captured->size % sizeof(uint64_t) != 0 ||
+				offset + captured->size > data.size() || captured->type >= Command::NUM_TYPES ||
+				captured->size < GetMinimumSize(captured) || !IsValidCount(captured))
+			{
+				return false;
+			}
+
+			command.resize(captured->size / sizeof(uint64_t));
+			std::memcpy(command.data(), captured, captured->size);
+
+			Command::Header *remapped = reinterpret_cast<Command::Header*>(command.data());
+			if (Remap(remapped))
+			{
+				stream->Write(remapped);
+			}
+			else
+			{
+				m_skipped++;
+			}
+
+			offset += captured->size;
+		}
+
+		m_frames.push_back(std::move(stream));
+
+		if (!ReadBlock(file, fileSize, frameHeader.uploadsSize, data))
+		{
+			return false;
+		}
+
+		// Uploads into buffers that couldn't be created are dropped
+		std::vector<Upload> uploads;
+		size_t offset = 0;
+		for (uint32_t j = 0; j < frameHeader.numUploads; ++j)
+		{
+			CaptureFile::Upload upload;
+			if (offset + sizeof(upload) > data.size())
+			{
+				return false;
+			}
+			std::memcpy(&upload, data.data() + offset, sizeof(upload));
+			offset += sizeof(upload);
+
+			if (upload.size > data.size() - offset)
+			{
+				return false;
+			}
+
+			ComPtr<ID3D12Resource> resource;
+			if (upload.id > 0 && upload.id <= m_objects.size() && m_objects[upload.id - 1])
+			{
+				m_objects[upload.id - 1].As(&resource);
+			}
+
+			if (resource && resource->GetDesc().Width >= upload.size)
+			{
+				Upload replayed;
+				replayed.object = upload.id - 1;
+				replayed.contents.assign(data.data() + offset, data.data() + offset + upload.size);
+				uploads.push_back(std::move(replayed));
+			}
+			offset += static_cast<size_t>(upload.size);
+		}
+
+		m_uploads.push_back(std::move(uploads));
+	}
+
+	return true;
+}
+
+void CommandReplay::CreateObject(ObjectType type, const std::vector<uint8_t> &data)
+{
+	ComPtr<ID3D12DeviceChild> object;
+
+	switch (type)
+	{
+	case OBJECT_RESOURCE:
+	{
+		Resource info;
+		if (data.size() < sizeof(info))
+		{
+			break;
+		}
+		std::memcpy(&info, data.data(), sizeof(info));
+
+		D3D12_RESOURCE_STATES state = D3D12_RESOURCE_STATE_COMMON;
+		if (info.heapType == D3D12_HEAP_TYPE_UPLOAD)
+		{
+			state = D3D12_RESOURCE_STATE_GENERIC_READ;
+		}
+		else if (info.heapType == D3D12_HEAP_TYPE_READBACK)
+		{
+			state = D3D12_RESOURCE_STATE_COPY_DEST;
+		}
+
+		CD3DX12_HEAP_PROPERTIES heapProperties(info.heapType);
+		ComPtr<ID3D12Resource> resource;
+		ThrowIfFailed(m_device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &info.desc, state,
+			nullptr, IID_PPV_ARGS(&resource)));
+
+		if (info.desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
+		{
+			AddressRange range = { info.gpuAddress, info.desc.Width, resource->GetGPUVirtualAddress() };
+			m_addresses.push_back(range);
+		}
+
+		object = resource;
+		break;
+	}
+	case OBJECT_DESCRIPTOR_HEAP:
+	{
+		DescriptorHeap info;
+		if (data.size() < sizeof(info))
+		{
+			break;
+		}
+		std::memcpy(&info, data.data(), sizeof(info));
+
+		ComPtr<ID3D12DescriptorHeap> heap;
+		ThrowIfFailed(m_device->CreateDescriptorHeap(&info.desc, IID_PPV_ARGS(&heap)));
+		CreateNullDescriptors(heap.Get(), info.desc);
+
+		HeapRange range = {};
+		range.type = info.desc.Type;
+		range.capturedCpu = info.cpuStart;
+		range.capturedGpu = info.gpuStart;
+		range.capturedIncrement = info.increment;
+		range.numDescriptors = info.desc.NumDescriptors;
+		range.cpu = heap->GetCPUDescriptorHandleForHeapStart();
+		if (info.desc.Flags & D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE)
+		{
+			range.gpu = heap->GetGPUDescriptorHandleForHeapStart();
+		}
+		range.increment = m_device->GetDescriptorHandleIncrementSize(info.desc.Type);
+		m_heaps.push_back(range);
+
+		object = heap;
+		break;
+	}
+	case OBJECT_ROOT_SIGNATURE:
+	{
+		// Without the blob there is only an empty root signature to bind
+		ComPtr<ID3DBlob> emptyBlob;
+		const void *blob = data.data();
+		size_t size = data.size();
+		if (data.empty())
+		{
+			CD3DX12_ROOT_SIGNATURE_DESC desc(0, nullptr, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+			ComPtr<ID3DBlob> errors;
+			ThrowIfFailed(::D3D12SerializeRootSignature(&desc, D3D_ROOT_SIGNATURE_VERSION_1, &emptyBlob, &errors));
+			blob = emptyBlob->GetBufferPointer();
+			size = emptyBlob->GetBufferSize();
+		}
+
+		ComPtr<ID3D12RootSignature> rootSignature;
+		ThrowIfFailed(m_device->CreateRootSignature(0, blob, size, IID_PPV_ARGS(&rootSignature)));
+		object = rootSignature;
+		break;
+	}
+	case OBJECT_PIPELINE_STATE:
+	{
+		uint64_t key = 0;
+		if (data.size() >= sizeof(key))
+		{
+			std::memcpy(&key, data.data(), sizeof(key));
+		}
+
+		if (m_pipelines)
+		{
+			object = m_pipelines(key);
+		}
+		break;
+	}
+	}
+
+	m_objects.push_back(object);
+}
+
+void CommandReplay::WriteUploads(const std::vector<Upload> &uploads)
+{
+	for (const Upload &upload : uploads)
+	{
+		ComPtr<ID3D12Resource> resource;
+		ThrowIfFailed(m_objects[upload.object].As(&resource));
+
+		void *contents;
+		D3D12_RANGE readRange = { 0, 0 };
+		ThrowIfFailed(resource->Map(0, &readRange, &contents));
+		std::memcpy(contents, upload.contents.data(), upload.contents.size());
+		resource->Unmap(0, nullptr);
+	}
+}
+
+void CommandReplay::CreateNullDescriptors(ID3D12DescriptorHeap *heap, const D3D12_DESCRIPTOR_HEAP_DESC &desc)
+{
+	UINT increment = m_device->GetDescriptorHandleIncrementSize(desc.Type);
+	CD3DX12_CPU_DESCRIPTOR_HANDLE handle(heap->GetCPUDescriptorHandleForHeapStart());
+
+	for (UINT i = 0; i < desc.NumDescriptors; ++i, handle.Offset(increment))
+	{
+		switch (desc.Type)
+		{
+		case D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV:
+		{
+			D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+			srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+			srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+			srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+			srvDesc.Texture2D.MipLevels = 1;
+			m_device->CreateShaderResourceView(nullptr, &srvDesc, handle);
+			break;
+		}
+		case D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER:
+		{
+			D3D12_SAMPLER_DESC samplerDesc = {};
+			samplerDesc.Filter = D3D12_FILTER_MIN_MAG_MIP_POINT;
+			samplerDesc.AddressU = samplerDesc.AddressV = samplerDesc.AddressW = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+			samplerDesc.MaxLOD = D3D12_FLOAT32_MAX;
+			m_device->CreateSampler(&samplerDesc, handle);
+			break;
+		}
+		case D3D12_DESCRIPTOR_HEAP_TYPE_RTV:
+		{
+			D3D12_RENDER_TARGET_VIEW_DESC rtvDesc = {};
+			rtvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+			rtvDesc.ViewDimension = D3D12_RTV_DIMENSION_TEXTURE2D;
+			m_device->CreateRenderTargetView(nullptr, &rtvDesc, handle);
+			break;
+		}
+		case D3D12_DESCRIPTOR_HEAP_TYPE_DSV:
+		{
+			D3D12_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
+			dsvDesc.Format = DXGI_FORMAT_D32_FLOAT;
+			dsvDesc.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D;
+			m_device->CreateDepthStencilView(nullptr, &dsvDesc, handle);
+			break;
+		}
+		}
+	}
+}
+
+bool CommandReplay::Remap(Command::Header *command)
+{
+	bool valid = true;
+	ForEachObject(command, [this, &valid](void **object, ObjectType type)
+	{
+		uintptr_t id = reinterpret_cast<uintptr_t>(*object);
+		if (id > m_objects.size())
+		{
+			valid = false;
+			id = 0;
+		}
+		*object = id ? m_objects[id - 1].Get() : nullptr;
+	});
+
+	if (!valid)
+	{
+		return false;
+	}
+
+	switch (command->type)
+	{
+	case Command::SET_PIPELINE_STATE:
+		return GetMutable<Command::Object>(command)->object != nullptr;
+	case Command::SET_VERTEX_BUFFERS:
+	{
+		D3D12_VERTEX_BUFFER_VIEW *views = GetMutableArray<Command::VertexBuffers, D3D12_VERTEX_BUFFER_VIEW>(command);
+		for (UINT i = 0; i < command->param; ++i)
+		{
+			views[i].BufferLocation = RemapAddress(views[i].BufferLocation);
+		}
+		break;
+	}
+	case Command::SET_INDEX_BUFFER:
+	{
+		Command::IndexBuffer *payload = GetMutable<Command::IndexBuffer>(command);
+		if (payload->valid)
+		{
+			payload->view.BufferLocation = RemapAddress(payload->view.BufferLocation);
+		}
+		break;
+	}
+	case Command::SET_RENDER_TARGETS:
+	{
+		D3D12_CPU_DESCRIPTOR_HANDLE *handles = GetMutableArray<Command::RenderTargets, D3D12_CPU_DESCRIPTOR_HANDLE>(command);
+		for (UINT i = 0; i < command->param; ++i)
+		{
+			handles[i] = RemapCpu(handles[i], D3D12_DESCRIPTOR_HEAP_TYPE_RTV, i);
+		}
+
+		Command::RenderTargets *payload = GetMutable<Command::RenderTargets>(command);
+		if (payload->hasDepthStencil)
+		{
+			payload->depthStencil = RemapCpu(payload->depthStencil, D3D12_DESCRIPTOR_HEAP_TYPE_DSV, 0);
+		}
+		break;
+	}
+	case Command::SET_GRAPHICS_ROOT_CBV:
+	case Command::SET_COMPUTE_ROOT_CBV:
+	case Command::SET_GRAPHICS_ROOT_SRV:
+	case Command::SET_COMPUTE_ROOT_SRV:
+	case Command::SET_GRAPHICS_ROOT_UAV:
+	case Command::SET_COMPUTE_ROOT_UAV:
+		GetMutable<Command::RootAddress>(command)->address = RemapAddress(GetMutable<Command::RootAddress>(command)->address);
+		break;
+	case Command::SET_GRAPHICS_ROOT_TABLE:
+	case Command::SET_COMPUTE_ROOT_TABLE:
+		GetMutable<Command::RootTable>(command)->baseDescriptor = RemapGpu(GetMutable<Command::RootTable>(command)->baseDescriptor);
+		break;
+	case Command::CLEAR_RENDER_TARGET:
+		GetMutable<Command::ClearRenderTarget>(command)->view =
+			RemapCpu(GetMutable<Command::ClearRenderTarget>(command)->view, D3D12_DESCRIPTOR_HEAP_TYPE_RTV, 0);
+		break;
+	case Command::CLEAR_DEPTH_STENCIL:
+		GetMutable<Command::ClearDepthStencil>(command)->view =
+			RemapCpu(GetMutable<Command::ClearDepthStencil>(command)->view, D3D12_DESCRIPTOR_HEAP_TYPE_DSV, 0);
+		break;
+	}
+
+	return true;
+}
+
+D3D12_GPU_VIRTUAL_ADDRESS CommandReplay::RemapAddress(D3D12_GPU_VIRTUAL_ADDRESS address) const
+{
+	// Last range starting at or before the address
+	auto it = std::upper_bound(m_addresses.begin(), m_addresses.end(), address,
+		[](D3D12_GPU_VIRTUAL_ADDRESS value, const AddressRange &range) { return value < range.captured; });
+
+	if (it == m_addresses.begin())
+	{
+		return address;
+	}
+
+	--it;
+	if (address - it->captured >= it->size)
+	{
+		// Not in a captured buffer, nothing reads it while recording
+		return address;
+	}
+
+	return it->replayed + (address - it->captured);
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE CommandReplay::RemapCpu(D3D12_CPU_DESCRIPTOR_HANDLE handle, D3D12_DESCRIPTOR_HEAP_TYPE type,
+	UINT slot) const
+{
+	for (const HeapRange &heap : m_heaps)
+	{
+		if (heap.type != type || handle.ptr < heap.capturedCpu)
+		{
+			continue;
+		}
+
+		uint64_t index = (handle.ptr - heap.capturedCpu) / heap.capturedIncrement;
+		if (index < heap.numDescriptors)
+		{
+			return CD3DX12_CPU_DESCRIPTOR_HANDLE(heap.cpu, static_cast<INT>(index), heap.increment);
+		}
+	}
+
+	if (type == D3D12_DESCRIPTOR_HEAP_TYPE_DSV)
+	{
+		return m_nullDsv->GetCPUDescriptorHandleForHeapStart();
+	}
+
+	return CD3DX12_CPU_DESCRIPTOR_HANDLE(m_nullRtvs->GetCPUDescriptorHandleForHeapStart(),
+		static_cast<INT>(slot % D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT), m_rtvIncrement);
+}
+
+D3D12_GPU_DESCRIPTOR_HANDLE CommandReplay::RemapGpu(D3D12_GPU_DESCRIPTOR_HANDLE handle) const
+{
+	for (const HeapRange &heap : m_heaps)
+	{
+		if (!heap.capturedGpu || handle.ptr < heap.capturedGpu)
+		{
+			continue;
+		}
+
+		uint64_t index = (handle.ptr - heap.capturedGpu) / heap.capturedIncrement;
+		if (index < heap.numDescriptors)
+		{
+			return CD3DX12_GPU_DESCRIPTOR_HANDLE(heap.gpu, static_cast<INT>(index), heap.increment);
+		}
+	}
+
+	return handle;
+}
+
+CommandReplay::Result CommandReplay::Run(uint32_t repeats)
+{
+	static std::chrono::high_resolution_clock clock;
+
+	Result result = {};
+	result.frames = static_cast<uint32_t>(m_frames.size());
+	result.skipped = m_skipped;
+	result.bestMs = DBL_MAX;
+
+	for (const std::unique_ptr<CommandStream> &frame : m_frames)
+	{
+		result.commands += frame->GetNumCommands();
+	}
+
+	double sumMs = 0.0;
+	for (uint32_t repeat = 0; repeat < repeats; ++repeat)
+	{
+		// As fast as possible, writing the uploads isn't part of recording
+		double frameMs = 0.0;
+		for (size_t i = 0; i < m_frames.size(); ++i)
+		{
+			const std::unique_ptr<CommandStream> &frame = m_frames[i];
+			WriteUploads(m_uploads[i]);
+
+			auto t0 = clock.now();
+			ThrowIfFailed(m_allocator->Reset());
+			ThrowIfFailed(m_commandList->Reset(m_allocator.Get(), nullptr));
+
+			for (const Command::Header *command = frame->Begin(); command != frame->End(); command = Command::Next(command))
+			{
+				Command::Execute(command, m_commandList.Get());
+			}
+
+			ThrowIfFailed(m_commandList->Close());
+			frameMs += std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+		}
+
+		result.bestMs = std::min(result.bestMs, frameMs);
+		sumMs += frameMs;
+
+		// Again, timing every command
+		for (size_t i = 0; i < m_frames.size(); ++i)
+		{
+			const std::unique_ptr<CommandStream> &frame = m_frames[i];
+			WriteUploads(m_uploads[i]);
+
+			ThrowIfFailed(m_allocator->Reset());
+			ThrowIfFailed(m_commandList->Reset(m_allocator.Get(), nullptr));
+
+			for (const Command::Header *command = frame->Begin(); command != frame->End(); command = Command::Next(command))
+			{
+				auto c0 = clock.now();
+				Command::Execute(command, m_commandList.Get());
+				result.totalMs[command->type] += std::chrono::duration<double, std::milli>(clock.now() - c0).count();
+				result.count[command->type]++;
+			}
+
+			ThrowIfFailed(m_commandList->Close());
+		}
+	}
+
+	if (repeats > 0)
+	{
+		result.averageMs = sumMs / repeats;
+	}
+	else
+	{
+		result.bestMs = 0.0;
+	}
+
+	return result;
+}
+
+std::string CommandReplay::Describe(const Result &result)
+{
+	char line[256];
+	sprintf_s(line, "Replay of %u frames, %u commands (%u skipped): best %.3f ms, average %.3f ms\n",
+		result.frames, result.commands, result.skipped, result.bestMs, result.averageMs);
+	std::string description = line;
+
+	std::vector<uint16_t> types;
+	for (uint16_t type = 0; type < Command::NUM_TYPES; ++type)
+	{
+		if (result.count[type] > 0)
+		{
+			types.push_back(type);
+		}
+	}
+
+	std::sort(types.begin(), types.end(),
+		[&result](uint16_t a, uint16_t b) { return result.totalMs[a] > result.totalMs[b]; });
+
+	for (uint16_t type : types)
+	{
+		sprintf_s(line, "\t%-28s %8u calls %10.3f ms %8.1f ns/call\n", Command::GetName(type), result.count[type],
+			result.totalMs[type], result.totalMs[type] * 1000000.0 / result.count[type]);
+		description += line;
+	}
+
+	return description;
+}
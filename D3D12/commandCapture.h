@@ -0,0 +1,226 @@
+#pragma once
+
+#include "includes.h"
+#include "commandStream.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class RootSignatureCache;
+
+// Capturing what was recorded through CommandStreams for a few frames, so a
+// slow frame can be replayed somewhere else and profiled.
+//
+// CommandCapture is handed every stream a CommandTranslator translates (see
+// CommandTranslator::SetCapture) and keeps a copy of its commands, with the
+// objects they use replaced by ids. Each object is saved once, the first
+// time it is seen:
+//	- resources as their description and heap type
+//	- descriptor heaps as their description and where they started
+//	- root signatures as their serialized blob, when the RootSignatureCache
+//	  or the caller has it
+//	- pipelines as the key they were compiled with, if the caller gave one
+// Resources that are only reached through GPU addresses (vertex and
+// constant buffers) have to be added by hand to be saved and remapped.
+//
+// Upload buffers are rewritten every frame (an UploadRing holds a different
+// frame's data in each part), so at the end of every captured frame the
+// whole contents of every upload buffer seen so far are saved with it.
+//
+// CommandReplay loads the file, creates the objects again, points the
+// commands at them and records the frames into a command list as fast as it
+// can, once as is and once timing every command. Nothing is executed, it
+// measures what recording costs on the CPU.
+//
+// The replay writes a frame's upload contents back before recording it, so
+// the command lists it records read what the captured frame read.
+// Descriptors can't be read back, so recreated heaps are filled with null
+// descriptors, and render targets that weren't in a known heap use null
+// ones too. Pipelines the replay can't resolve are left out, with the draws
+// still recorded.
+
+namespace CaptureFile
+{
+	enum ObjectType : uint32_t
+	{
+		OBJECT_RESOURCE,
+		OBJECT_DESCRIPTOR_HEAP,
+		OBJECT_ROOT_SIGNATURE,
+		OBJECT_PIPELINE_STATE,
+	};
+
+	struct Resource
+	{
+		D3D12_RESOURCE_DESC desc;
+		D3D12_HEAP_TYPE heapType;
+		D3D12_GPU_VIRTUAL_ADDRESS gpuAddress;	// buffers only
+	};
+
+	// After a frame's commands, one per upload buffer, the contents follow
+	struct Upload
+	{
+		uint32_t id;
+		uint32_t padding;
+		uint64_t size;
+	};
+
+	struct DescriptorHeap
+	{
+		D3D12_DESCRIPTOR_HEAP_DESC desc;
+		uint64_t cpuStart;
+		uint64_t gpuStart;						// shader visible heaps only
+		uint32_t increment;
+		uint32_t padding;
+	};
+
+	// Root signatures are just the blob, pipeline states just a uint64_t key
+}
+
+// Thread safe: Record can be called from any thread translating streams
+class CommandCapture
+{
+public:
+	// rootSignatures is used to find the blobs of the root signatures it created
+	explicit CommandCapture(RootSignatureCache *rootSignatures = nullptr);
+
+	// Objects the commands only point at through addresses or handles, only while capturing
+	void AddResource(ID3D12Resource *resource);
+	void AddDescriptorHeap(ID3D12DescriptorHeap *heap);
+	// For root signatures that don't come from the RootSignatureCache
+	void AddRootSignature(ID3D12RootSignature *rootSignature, const void *blob, size_t size);
+	// The key is passed back to the replay to find the pipeline, e.g. a PipelineCompiler key
+	void AddPipelineState(ID3D12PipelineState *pipelineState, uint64_t key);
+
+	// Captures the next numFrames frames into path
+	void Start(const std::wstring &path, uint32_t numFrames);
+	bool IsCapturing() const { return m_numFrames > 0; }
+
+	// Streams translated this frame, in submission order
+	void Record(const CommandStream *const *streams, UINT numStreams);
+
+	// Saves the upload buffers as the frame left them, and writes the file
+	// after the last frame. Returns false if that failed.
+	bool EndFrame();
+
+private:
+	struct Object
+	{
+		CaptureFile::ObjectType type;
+		std::vector<uint8_t> data;
+	};
+
+	struct Frame
+	{
+		uint32_t numCommands;
+		std::vector<uint8_t> commands;
+		uint32_t numUploads;
+		std::vector<uint8_t> uploads;	// CaptureFile::Upload and the contents, for every upload buffer
+	};
+
+	// 1 based, 0 is nullptr
+	uint32_t GetId(void *object, CaptureFile::ObjectType type);
+	uint32_t AddObject(void *object, CaptureFile::ObjectType type);
+	bool Write();
+
+	RootSignatureCache *m_rootSignatures;
+
+	std::mutex m_mutex;
+	std::unordered_map<void*, uint32_t> m_ids;
+	std::unordered_map<void*, uint64_t> m_pipelineKeys;
+	std::unordered_map<void*, std::vector<uint8_t>> m_rootSignatureBlobs;
+	std::vector<Object> m_objects;
+	std::vector<std::pair<uint32_t, ComPtr<ID3D12Resource>>> m_uploadBuffers;	// id, kept alive until written
+	std::vector<Frame> m_frames;
+	Frame m_frame;
+
+	std::wstring m_path;
+	std::atomic<uint32_t> m_numFrames;	// left to capture
+};
+
+class CommandReplay
+{
+public:
+	typedef std::function<ID3D12PipelineState*(uint64_t key)> PipelineFunction;
+
+	struct Result
+	{
+		uint32_t frames;
+		uint32_t commands;		// per replay of all the frames
+		uint32_t skipped;		// commands left out, pipelines that couldn't be resolved
+		double bestMs;			// all the frames without timing each command
+		double averageMs;
+		uint32_t count[Command::NUM_TYPES];
+		double totalMs[Command::NUM_TYPES];	// over every timed replay
+	};
+
+	explicit CommandReplay(ComPtr<ID3D12Device2> device, PipelineFunction pipelines = nullptr);
+
+	// Creates the objects and remaps the commands, false if the file can't be read
+	bool Load(const std::wstring &path);
+
+	Result Run(uint32_t repeats);
+
+	// One line per command type, slowest first
+	static std::string Describe(const Result &result);
+
+private:
+	struct AddressRange
+	{
+		D3D12_GPU_VIRTUAL_ADDRESS captured;
+		uint64_t size;
+		D3D12_GPU_VIRTUAL_ADDRESS replayed;
+	};
+
+	struct Upload
+	{
+		uint32_t object;				// in m_objects
+		std::vector<uint8_t> contents;
+	};
+
+	struct HeapRange
+	{
+		D3D12_DESCRIPTOR_HEAP_TYPE type;
+		uint64_t capturedCpu;
+		uint64_t capturedGpu;
+		uint32_t capturedIncrement;
+		uint32_t numDescriptors;
+		D3D12_CPU_DESCRIPTOR_HANDLE cpu;
+		D3D12_GPU_DESCRIPTOR_HANDLE gpu;
+		uint32_t increment;
+	};
+
+	void CreateObject(CaptureFile::ObjectType type, const std::vector<uint8_t> &data);
+	void CreateNullDescriptors(ID3D12DescriptorHeap *heap, const D3D12_DESCRIPTOR_HEAP_DESC &desc);
+	void WriteUploads(const std::vector<Upload> &uploads);
+	// False if the command has to be left out
+	bool Remap(Command::Header *command);
+	D3D12_GPU_VIRTUAL_ADDRESS RemapAddress(D3D12_GPU_VIRTUAL_ADDRESS address) const;
+	// Render target and depth handles that weren't in a captured heap become the null ones
+	D3D12_CPU_DESCRIPTOR_HANDLE RemapCpu(D3D12_CPU_DESCRIPTOR_HANDLE handle, D3D12_DESCRIPTOR_HEAP_TYPE type, UINT slot) const;
+	D3D12_GPU_DESCRIPTOR_HANDLE RemapGpu(D3D12_GPU_DESCRIPTOR_HANDLE handle) const;
+
+	ComPtr<ID3D12Device2> m_device;
+	PipelineFunction m_pipelines;
+
+	std::vector<ComPtr<ID3D12DeviceChild>> m_objects;	// by id - 1
+	std::vector<AddressRange> m_addresses;				// sorted by captured address
+	std::vector<HeapRange> m_heaps;
+
+	// Null render target and depth views for handles that weren't captured
+	ComPtr<ID3D12DescriptorHeap> m_nullRtvs;
+	ComPtr<ID3D12DescriptorHeap> m_nullDsv;
+	UINT m_rtvIncrement;
+
+	std::vector<std::unique_ptr<CommandStream>> m_frames;
+	std::vector<std::vector<Upload>> m_uploads;		// by frame
+	uint32_t m_skipped;
+
+	ComPtr<ID3D12CommandAllocator> m_allocator;
+	ComPtr<ID3D12GraphicsCommandList> m_commandList;
+};
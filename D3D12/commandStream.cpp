@@ -0,0 +1,610 @@
+#include "commandStream.h"
+#include "commandCapture.h"
+#include "jobSystem.h"
+
+void Command::Execute(const Header *command, ID3D12GraphicsCommandList *commandList)
+{
+	switch (command->type)
+	{
+	case SET_PIPELINE_STATE:
+		commandList->SetPipelineState(static_cast<ID3D12PipelineState*>(Get<Object>(command)->object));
+		break;
+	case SET_GRAPHICS_ROOT_SIGNATURE:
+		commandList->SetGraphicsRootSignature(static_cast<ID3D12RootSignature*>(Get<Object>(command)->object));
+		break;
+	case SET_COMPUTE_ROOT_SIGNATURE:
+		commandList->SetComputeRootSignature(static_cast<ID3D12RootSignature*>(Get<Object>(command)->object));
+		break;
+	case SET_DESCRIPTOR_HEAPS:
+	{
+		ID3D12DescriptorHeap *heaps[2] = { Get<DescriptorHeaps>(command)->heaps[0], Get<DescriptorHeaps>(command)->heaps[1] };
+		commandList->SetDescriptorHeaps(command->param, heaps);
+		break;
+	}
+	case SET_PRIMITIVE_TOPOLOGY:
+		commandList->IASetPrimitiveTopology(static_cast<D3D12_PRIMITIVE_TOPOLOGY>(command->param));
+		break;
+	case SET_VERTEX_BUFFERS:
+		commandList->IASetVertexBuffers(Get<VertexBuffers>(command)->startSlot, command->param,
+			GetArray<VertexBuffers, D3D12_VERTEX_BUFFER_VIEW>(command));
+		break;
+	case SET_INDEX_BUFFER:
+	{
+		const IndexBuffer *payload = Get<IndexBuffer>(command);
+		if (payload->valid)
+		{
+			commandList->IASetIndexBuffer(&payload->view);
+		}
+		else
+		{
+			commandList->IASetIndexBuffer(nullptr);
+		}
+		break;
+	}
+	case SET_VIEWPORTS:
+		commandList->RSSetViewports(command->param, GetArray<Empty, D3D12_VIEWPORT>(command));
+		break;
+	case SET_SCISSOR_RECTS:
+		commandList->RSSetScissorRects(command->param, GetArray<Empty, D3D12_RECT>(command));
+		break;
+	case SET_RENDER_TARGETS:
+	{
+		const RenderTargets *payload = Get<RenderTargets>(command);
+		commandList->OMSetRenderTargets(command->param, GetArray<RenderTargets, D3D12_CPU_DESCRIPTOR_HANDLE>(command),
+			FALSE, payload->hasDepthStencil ? &payload->depthStencil : nullptr);
+		break;
+	}
+	case SET_BLEND_FACTOR:
+		commandList->OMSetBlendFactor(Get<BlendFactor>(command)->factor);
+		break;
+	case SET_STENCIL_REF:
+		commandList->OMSetStencilRef(command->param);
+		break;
+	case SET_GRAPHICS_ROOT_CONSTANTS:
+	{
+		const RootConstants *payload = Get<RootConstants>(command);
+		commandList->SetGraphicsRoot32BitConstants(command->param, payload->numValues,
+			GetArray<RootConstants, UINT>(command), payload->destOffset);
+		break;
+	}
+	case SET_COMPUTE_ROOT_CONSTANTS:
+	{
+		const RootConstants *payload = Get<RootConstants>(command);
+		commandList->SetComputeRoot32BitConstants(command->param, payload->numValues,
+			GetArray<RootConstants, UINT>(command), payload->destOffset);
+		break;
+	}
+	case SET_GRAPHICS_ROOT_CBV:
+		commandList->SetGraphicsRootConstantBufferView(command->param, Get<RootAddress>(command)->address);
+		break;
+	case SET_COMPUTE_ROOT_CBV:
+		commandList->SetComputeRootConstantBufferView(command->param, Get<RootAddress>(command)->address);
+		break;
+	case SET_GRAPHICS_ROOT_SRV:
+		commandList->SetGraphicsRootShaderResourceView(command->param, Get<RootAddress>(command)->address);
+		break;
+	case SET_COMPUTE_ROOT_SRV:
+		commandList->SetComputeRootShaderResourceView(command->param, Get<RootAddress>(command)->address);
+		break;
+	case SET_GRAPHICS_ROOT_UAV:
+		commandList->SetGraphicsRootUnorderedAccessView(command->param, Get<RootAddress>(command)->address);
+		break;
+	case SET_COMPUTE_ROOT_UAV:
+		commandList->SetComputeRootUnorderedAccessView(command->param, Get<RootAddress>(command)->address);
+		break;
+	case SET_GRAPHICS_ROOT_TABLE:
+		commandList->SetGraphicsRootDescriptorTable(command->param, Get<RootTable>(command)->baseDescriptor);
+		break;
+	case SET_COMPUTE_ROOT_TABLE:
+		commandList->SetComputeRootDescriptorTable(command->param, Get<RootTable>(command)->baseDescriptor);
+		break;
+	case CLEAR_RENDER_TARGET:
+		commandList->ClearRenderTargetView(Get<ClearRenderTarget>(command)->view, Get<ClearRenderTarget>(command)->color, 0, nullptr);
+		break;
+	case CLEAR_DEPTH_STENCIL:
+	{
+		const ClearDepthStencil *payload = Get<ClearDepthStencil>(command);
+		commandList->ClearDepthStencilView(payload->view, payload->flags, payload->depth, payload->stencil, 0, nullptr);
+		break;
+	}
+	case RESOURCE_BARRIER:
+		commandList->ResourceBarrier(command->param, GetArray<Empty, D3D12_RESOURCE_BARRIER>(command));
+		break;
+	case COPY_BUFFER_REGION:
+	{
+		const CopyBufferRegion *payload = Get<CopyBufferRegion>(command);
+		commandList->CopyBufferRegion(payload->dst, payload->dstOffset, payload->src, payload->srcOffset, payload->numBytes);
+		break;
+	}
+	case COPY_RESOURCE:
+		commandList->CopyResource(Get<CopyResource>(command)->dst, Get<CopyResource>(command)->src);
+		break;
+	case COPY_TEXTURE_REGION:
+	{
+		const CopyTextureRegion *payload = Get<CopyTextureRegion>(command);
+		commandList->CopyTextureRegion(&payload->dst, payload->dstX, payload->dstY, payload->dstZ, &payload->src,
+			payload->hasBox ? &payload->box : nullptr);
+		break;
+	}
+	case DRAW:
+	{
+		const Draw *payload = Get<Draw>(command);
+		commandList->DrawInstanced(payload->vertexCount, payload->instanceCount, payload->startVertex, payload->startInstance);
+		break;
+	}
+	case DRAW_INDEXED:
+	{
+		const DrawIndexed *payload = Get<DrawIndexed>(command);
+		commandList->DrawIndexedInstanced(payload->indexCount, payload->instanceCount, payload->startIndex,
+			payload->baseVertex, payload->startInstance);
+		break;
+	}
+	case DISPATCH:
+		commandList->Dispatch(Get<Dispatch>(command)->x, Get<Dispatch>(command)->y, Get<Dispatch>(command)->z);
+		break;
+	default:
+		assert(false && "unknown command");
+		break;
+	}
+}
+
+const char *Command::GetName(uint16_t type)
+{
+	static const char *const names[NUM_TYPES] =
+	{
+		"SET_PIPELINE_STATE",
+		"SET_GRAPHICS_ROOT_SIGNATURE",
+		"SET_COMPUTE_ROOT_SIGNATURE",
+		"SET_DESCRIPTOR_HEAPS",
+		"SET_PRIMITIVE_TOPOLOGY",
+		"SET_VERTEX_BUFFERS",
+		"SET_INDEX_BUFFER",
+		"SET_VIEWPORTS",
+		"SET_SCISSOR_RECTS",
+		"SET_RENDER_TARGETS",
+		"SET_BLEND_FACTOR",
+		"SET_STENCIL_REF",
+		"SET_GRAPHICS_ROOT_CONSTANTS",
+		"SET_COMPUTE_ROOT_CONSTANTS",
+		"SET_GRAPHICS_ROOT_CBV",
+		"SET_COMPUTE_ROOT_CBV",
+		"SET_GRAPHICS_ROOT_SRV",
+		"SET_COMPUTE_ROOT_SRV",
+		"SET_GRAPHICS_ROOT_UAV",
+		"SET_COMPUTE_ROOT_UAV",
+		"SET_GRAPHICS_ROOT_TABLE",
+		"SET_COMPUTE_ROOT_TABLE",
+		"CLEAR_RENDER_TARGET",
+		"CLEAR_DEPTH_STENCIL",
+		"RESOURCE_BARRIER",
+		"COPY_BUFFER_REGION",
+		"COPY_RESOURCE",
+		"COPY_TEXTURE_REGION",
+		"DRAW",
+		"DRAW_INDEXED",
+		"DISPATCH",
+	};
+
+	return type < NUM_TYPES ? names[type] : "UNKNOWN";
+}
+
+CommandStream::CommandStream(size_t initialCapacity) :
+	m_size(0),
+	m_capacity(0),
+	m_numCommands(0),
+	m_numActions(0)
+{
+	Grow(initialCapacity);
+}
+
+void CommandStream::Grow(size_t minCapacity)
+{
+	size_t capacity = std::max(minCapacity, m_capacity * 2);
+
+	std::unique_ptr<uint8_t[]> data(new uint8_t[capacity]);
+	if (m_size > 0)
+	{
+		std::memcpy(data.get(), m_data.get(), m_size);
+	}
+
+	m_data = std::move(data);
+	m_capacity = capacity;
+}
+
+void CommandStream::Append(const CommandStream &other)
+{
+	if (other.m_size == 0)
+	{
+		return;
+	}
+
+	std::memcpy(Allocate(other.m_size), other.m_data.get(), other.m_size);
+	m_numCommands += other.m_numCommands;
+	m_numActions += other.m_numActions;
+}
+
+void CommandStream::Write(const Command::Header *command)
+{
+	std::memcpy(Allocate(command->size), command, command->size);
+	m_numCommands++;
+
+	switch (command->type)
+	{
+	case Command::CLEAR_RENDER_TARGET:
+	case Command::CLEAR_DEPTH_STENCIL:
+	case Command::COPY_BUFFER_REGION:
+	case Command::COPY_RESOURCE:
+	case Command::COPY_TEXTURE_REGION:
+	case Command::DRAW:
+	case Command::DRAW_INDEXED:
+	case Command::DISPATCH:
+		m_numActions++;
+		break;
+	}
+}
+
+void CommandStream::ResourceBarrier(UINT numBarriers, const D3D12_RESOURCE_BARRIER *barriers)
+{
+	const UINT maxBarriers = static_cast<UINT>(gMaxArrayBytes / sizeof(D3D12_RESOURCE_BARRIER));
+
+	while (numBarriers > 0)
+	{
+		UINT count = std::min(numBarriers, maxBarriers);
+		PushArray<Command::Empty>(Command::RESOURCE_BARRIER, count, barriers);
+
+		barriers += count;
+		numBarriers -= count;
+	}
+}
+
+void CommandTranslator::State::Reset()
+{
+	descriptorHeaps = nullptr;
+	rootSignatures[0] = rootSignatures[1] = nullptr;
+	pipelineState = nullptr;
+	topology = nullptr;
+	indexBuffer = nullptr;
+	viewports = nullptr;
+	scissorRects = nullptr;
+	renderTargets = nullptr;
+	blendFactor = nullptr;
+	stencilRef = nullptr;
+	std::fill(&rootArguments[0][0], &rootArguments[0][0] + 2 * Command::gMaxRootParameters, nullptr);
+	numConstants[0] = numConstants[1] = 0;
+	vertexBuffersValid = 0;
+}
+
+void CommandTranslator::State::Track(const Command::Header *command)
+{
+	switch (command->type)
+	{
+	case Command::SET_PIPELINE_STATE:
+		pipelineState = command;
+		break;
+	case Command::SET_GRAPHICS_ROOT_SIGNATURE:
+	case Command::SET_COMPUTE_ROOT_SIGNATURE:
+	{
+		// Root arguments only survive setting the same root signature again
+		UINT bindPoint = command->type == Command::SET_COMPUTE_ROOT_SIGNATURE ? 1 : 0;
+		const Command::Header *previous = rootSignatures[bindPoint];
+		if (!previous || Command::Get<Command::Object>(previous)->object != Command::Get<Command::Object>(command)->object)
+		{
+			std::fill(rootArguments[bindPoint], rootArguments[bindPoint] + Command::gMaxRootParameters, nullptr);
+			numConstants[bindPoint] = 0;
+		}
+		rootSignatures[bindPoint] = command;
+		break;
+	}
+	case Command::SET_DESCRIPTOR_HEAPS:
+		// Tables point into the heaps that were bound
+		descriptorHeaps = command;
+		for (UINT bindPoint = 0; bindPoint < 2; ++bindPoint)
+		{
+			for (const Command::Header *&argument : rootArguments[bindPoint])
+			{
+				if (argument && (argument->type == Command::SET_GRAPHICS_ROOT_TABLE || argument->type == Command::SET_COMPUTE_ROOT_TABLE))
+				{
+					argument = nullptr;
+				}
+			}
+		}
+		break;
+	case Command::SET_PRIMITIVE_TOPOLOGY:
+		topology = command;
+		break;
+	case Command::SET_VERTEX_BUFFERS:
+	{
+		UINT startSlot = Command::Get<Command::VertexBuffers>(command)->startSlot;
+		const D3D12_VERTEX_BUFFER_VIEW *views = Command::GetArray<Command::VertexBuffers, D3D12_VERTEX_BUFFER_VIEW>(command);
+		for (UINT i = 0; i < command->param && startSlot + i < D3D12_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT; ++i)
+		{
+			vertexBuffers[startSlot + i] = views[i];
+			vertexBuffersValid |= 1u << (startSlot + i);
+		}
+		break;
+	}
+	case Command::SET_INDEX_BUFFER:
+		indexBuffer = command;
+		break;
+	case Command::SET_VIEWPORTS:
+		viewports = command;
+		break;
+	case Command::SET_SCISSOR_RECTS:
+		scissorRects = command;
+		break;
+	case Command::SET_RENDER_TARGETS:
+		renderTargets = command;
+		break;
+	case Command::SET_BLEND_FACTOR:
+		blendFactor = command;
+		break;
+	case Command::SET_STENCIL_REF:
+		stencilRef = command;
+		break;
+	case Command::SET_GRAPHICS_ROOT_CONSTANTS:
+		TrackConstants(0, command);
+		break;
+	case Command::SET_COMPUTE_ROOT_CONSTANTS:
+		TrackConstants(1, command);
+		break;
+	case Command::SET_GRAPHICS_ROOT_CBV:
+	case Command::SET_GRAPHICS_ROOT_SRV:
+	case Command::SET_GRAPHICS_ROOT_UAV:
+	case Command::SET_GRAPHICS_ROOT_TABLE:
+		TrackArgument(0, command);
+		break;
+	case Command::SET_COMPUTE_ROOT_CBV:
+	case Command::SET_COMPUTE_ROOT_SRV:
+	case Command::SET_COMPUTE_ROOT_UAV:
+	case Command::SET_COMPUTE_ROOT_TABLE:
+		TrackArgument(1, command);
+		break;
+	}
+}
+
+void CommandTranslator::State::TrackArgument(UINT bindPoint, const Command::Header *command)
+{
+	// Recording asserts already, this keeps release builds and streams written by hand in bounds
+	if (command->param >= Command::gMaxRootParameters)
+	{
+		assert(false && "more root parameters than a root signature can have");
+		return;
+	}
+	rootArguments[bindPoint][command->param] = command;
+}
+
+void CommandTranslator::State::TrackConstants(UINT bindPoint, const Command::Header *command)
+{
+	const Command::RootConstants *payload = Command::Get<Command::RootConstants>(command);
+	const UINT *values = Command::GetArray<Command::RootConstants, UINT>(command);
+	if (command->param >= Command::gMaxRootParameters || payload->destOffset + payload->numValues > D3D12_MAX_ROOT_COST)
+	{
+		assert(false && "more root constants than a root signature can have");
+		return;
+	}
+
+	uint16_t *keys = constantKeys[bindPoint];
+	UINT *shadow = constantValues[bindPoint];
+	uint32_t &count = numConstants[bindPoint];
+	for (UINT i = 0; i < payload->numValues; ++i)
+	{
+		uint16_t key = static_cast<uint16_t>(command->param << 8 | (payload->destOffset + i));
+		uint32_t position = static_cast<uint32_t>(std::lower_bound(keys, keys + count, key) - keys);
+		if (position == count || keys[position] != key)
+		{
+			if (count == D3D12_MAX_ROOT_COST)
+			{
+				assert(false && "more root constants than a root signature can have");
+				continue;
+			}
+
+			std::copy_backward(keys + position, keys + count, keys + count + 1);
+			std::copy_backward(shadow + position, shadow + count, shadow + count + 1);
+			keys[position] = key;
+			count++;
+		}
+		shadow[position] = values[i];
+	}
+}
+
+uint32_t CommandTranslator::State::Restore(ID3D12GraphicsCommandList *commandList) const
+{
+	uint32_t restored = 0;
+
+	// Heaps before tables, root signatures before their arguments
+	const Command::Header *singles[] =
+	{
+		descriptorHeaps, rootSignatures[0], rootSignatures[1], pipelineState, topology, indexBuffer,
+		viewports, scissorRects, renderTargets, blendFactor, stencilRef,
+	};
+	for (const Command::Header *command : singles)
+	{
+		if (command)
+		{
+			Command::Execute(command, commandList);
+			restored++;
+		}
+	}
+
+	for (UINT bindPoint = 0; bindPoint < 2; ++bindPoint)
+	{
+		for (const Command::Header *command : rootArguments[bindPoint])
+		{
+			if (command)
+			{
+				Command::Execute(command, commandList);
+				restored++;
+			}
+		}
+
+		// One call per parameter, from its first constant set to its last. The
+		// ones in between that were never set are undefined anyway.
+		const uint16_t *keys = constantKeys[bindPoint];
+		uint32_t i = 0;
+		while (i < numConstants[bindPoint])
+		{
+			UINT parameter = keys[i] >> 8;
+			UINT destOffset = keys[i] & 0xff;
+			UINT values[D3D12_MAX_ROOT_COST] = {};
+			UINT numValues = 0;
+			for (; i < numConstants[bindPoint] && (keys[i] >> 8) == parameter; ++i)
+			{
+				numValues = (keys[i] & 0xff) - destOffset + 1;
+				values[numValues - 1] = constantValues[bindPoint][i];
+			}
+
+			if (bindPoint == 0)
+			{
+				commandList->SetGraphicsRoot32BitConstants(parameter, numValues, values, destOffset);
+			}
+			else
+			{
+				commandList->SetComputeRoot32BitConstants(parameter, numValues, values, destOffset);
+			}
+			restored++;
+		}
+	}
+
+	// One call per run of consecutive slots
+	uint32_t valid = vertexBuffersValid;
+	UINT slot = 0;
+	while (valid >> slot)
+	{
+		if (!(valid & (1u << slot)))
+		{
+			slot++;
+			continue;
+		}
+
+		UINT start = slot;
+		while (slot < D3D12_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT && (valid & (1u << slot)))
+		{
+			slot++;
+		}
+
+		commandList->IASetVertexBuffers(start, slot - start, &vertexBuffers[start]);
+		restored++;
+
+		if (slot == D3D12_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT)
+		{
+			break;
+		}
+	}
+
+	return restored;
+}
+
+CommandTranslator::CommandTranslator(JobSystem *jobs) :
+	m_jobs(jobs),
+	m_streams(nullptr),
+	m_capture(nullptr),
+	m_stats()
+{
+}
+
+void CommandTranslator::Translate(const CommandStream *const *streams, UINT numStreams,
+	ID3D12GraphicsCommandList *const *commandLists, UINT numCommandLists)
+{
+	static std::chrono::high_resolution_clock clock;
+	auto t0 = clock.now();
+
+	uint32_t numCommands = 0;
+	for (UINT i = 0; i < numStreams; ++i)
+	{
+		numCommands += streams[i]->GetNumCommands();
+	}
+
+	m_stats.commands = numCommands;
+	m_stats.chunks = 0;
+	m_stats.restored = 0;
+
+	if (m_capture && m_capture->IsCapturing())
+	{
+		m_capture->Record(streams, numStreams);
+	}
+
+	if (numCommands == 0 || numCommandLists == 0)
+	{
+		m_stats.lastTranslateMs = 0.0;
+		return;
+	}
+
+	// Cut the streams and find the state at the start of every chunk
+	uint32_t commandsPerChunk = (numCommands + numCommandLists - 1) / numCommandLists;
+
+	std::vector<Chunk> chunks;
+	chunks.reserve(numCommandLists);
+
+	State state;
+	state.Reset();
+
+	uint32_t index = 0;
+	for (UINT stream = 0; stream < numStreams; ++stream)
+	{
+		for (const Command::Header *command = streams[stream]->Begin(); command != streams[stream]->End();
+			command = Command::Next(command))
+		{
+			if (index % commandsPerChunk == 0)
+			{
+				chunks.emplace_back();
+				Chunk &chunk = chunks.back();
+				chunk.stream = stream;
+				chunk.begin = command;
+				chunk.numCommands = std::min(commandsPerChunk, numCommands - index);
+				chunk.state = state;
+				chunk.commandList = commandLists[chunks.size() - 1];
+				chunk.restored = 0;
+			}
+
+			state.Track(command);
+			index++;
+		}
+	}
+
+	m_streams = streams;
+	m_chunks.swap(chunks);
+
+	if (m_jobs)
+	{
+		m_jobs->ParallelFor(static_cast<uint32_t>(m_chunks.size()), 1, [this](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				TranslateChunk(m_chunks[i]);
+			}
+		});
+	}
+	else
+	{
+		for (Chunk &chunk : m_chunks)
+		{
+			TranslateChunk(chunk);
+		}
+	}
+
+	m_stats.chunks = static_cast<uint32_t>(m_chunks.size());
+	for (const Chunk &chunk : m_chunks)
+	{
+		m_stats.restored += chunk.restored;
+	}
+	m_stats.lastTranslateMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+}
+
+void CommandTranslator::TranslateChunk(Chunk &chunk)
+{
+	chunk.restored = chunk.state.Restore(chunk.commandList);
+
+	UINT stream = chunk.stream;
+	const Command::Header *command = chunk.begin;
+	for (uint32_t i = 0; i < chunk.numCommands; ++i)
+	{
+		// The chunk goes on in the next stream
+		while (command == m_streams[stream]->End())
+		{
+			command = m_streams[++stream]->Begin();
+		}
+
+		Command::Execute(command, chunk.commandList);
+		command = Command::Next(command);
+	}
+}
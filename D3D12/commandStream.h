@@ -0,0 +1,532 @@
+#pragma once
+
+#include "includes.h"
+
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Our own command buffer, recorded in front of the D3D12 one.
+//
+// Recording into a CommandStream is just copying a few bytes: there is no
+// call into the runtime and no command allocator to own, so gameplay and
+// scene code can record from any thread (one stream per thread) as early as
+// they like. Streams can be appended to each other, reordered or saved, and
+// the CommandTranslator replays them into real command lists later, split
+// in chunks recorded in parallel.
+//
+// Every command is an 8 byte header followed by a fixed payload and, for
+// the calls that take arrays, the array itself. Small arguments (counts,
+// root parameter indices, ...) are kept in the header. Objects are stored
+// as raw pointers, they have to outlive the translation like they would
+// have to outlive a command list.
+
+namespace Command
+{
+	enum Type : uint16_t
+	{
+		SET_PIPELINE_STATE,
+		SET_GRAPHICS_ROOT_SIGNATURE,
+		SET_COMPUTE_ROOT_SIGNATURE,
+		SET_DESCRIPTOR_HEAPS,
+		SET_PRIMITIVE_TOPOLOGY,
+		SET_VERTEX_BUFFERS,
+		SET_INDEX_BUFFER,
+		SET_VIEWPORTS,
+		SET_SCISSOR_RECTS,
+		SET_RENDER_TARGETS,
+		SET_BLEND_FACTOR,
+		SET_STENCIL_REF,
+		SET_GRAPHICS_ROOT_CONSTANTS,
+		SET_COMPUTE_ROOT_CONSTANTS,
+		SET_GRAPHICS_ROOT_CBV,
+		SET_COMPUTE_ROOT_CBV,
+		SET_GRAPHICS_ROOT_SRV,
+		SET_COMPUTE_ROOT_SRV,
+		SET_GRAPHICS_ROOT_UAV,
+		SET_COMPUTE_ROOT_UAV,
+		SET_GRAPHICS_ROOT_TABLE,
+		SET_COMPUTE_ROOT_TABLE,
+		CLEAR_RENDER_TARGET,
+		CLEAR_DEPTH_STENCIL,
+		RESOURCE_BARRIER,
+		COPY_BUFFER_REGION,
+		COPY_RESOURCE,
+		COPY_TEXTURE_REGION,
+		DRAW,
+		DRAW_INDEXED,
+		DISPATCH,
+		NUM_TYPES,
+	};
+
+	struct Header
+	{
+		uint16_t type;
+		uint16_t size;		// of the whole command, a multiple of 8
+		uint32_t param;		// root parameter, count, topology, ... depending on the type
+	};
+
+	static_assert(sizeof(Header) == 8, "payloads start 8 byte aligned");
+
+	// A root signature costs at most 64 DWORDs and every parameter at least one
+	const UINT gMaxRootParameters = 64;
+
+	inline const Header *Next(const Header *command)
+	{
+		return reinterpret_cast<const Header*>(reinterpret_cast<const uint8_t*>(command) + command->size);
+	}
+
+	template <typename Payload>
+	inline const Payload *Get(const Header *command)
+	{
+		return reinterpret_cast<const Payload*>(command + 1);
+	}
+
+	// No payload: topology, stencil ref, array lengths are in param
+	struct Empty {};
+
+	template <typename Payload>
+	inline size_t PayloadSize()
+	{
+		return std::is_empty<Payload>::value ? 0 : sizeof(Payload);
+	}
+
+	// The array right after the payload
+	template <typename Payload, typename Element>
+	inline const Element *GetArray(const Header *command)
+	{
+		return reinterpret_cast<const Element*>(reinterpret_cast<const uint8_t*>(command + 1) + PayloadSize<Payload>());
+	}
+
+	struct Object { void *object; };							// pipeline, root signature
+	struct DescriptorHeaps { ID3D12DescriptorHeap *heaps[2]; };	// param heaps
+	struct VertexBuffers { UINT startSlot; UINT pad; };			// param views follow
+	struct IndexBuffer { D3D12_INDEX_BUFFER_VIEW view; BOOL valid; };
+	struct RenderTargets { D3D12_CPU_DESCRIPTOR_HANDLE depthStencil; BOOL hasDepthStencil; BOOL pad; };	// param handles follow
+	struct BlendFactor { FLOAT factor[4]; };
+	struct RootConstants { UINT destOffset; UINT numValues; };	// param parameter, values follow
+	struct RootAddress { D3D12_GPU_VIRTUAL_ADDRESS address; };	// param parameter
+	struct RootTable { D3D12_GPU_DESCRIPTOR_HANDLE baseDescriptor; };	// param parameter
+	struct ClearRenderTarget { D3D12_CPU_DESCRIPTOR_HANDLE view; FLOAT color[4]; };
+	struct ClearDepthStencil { D3D12_CPU_DESCRIPTOR_HANDLE view; D3D12_CLEAR_FLAGS flags; FLOAT depth; UINT8 stencil; };
+	struct CopyBufferRegion { ID3D12Resource *dst; UINT64 dstOffset; ID3D12Resource *src; UINT64 srcOffset; UINT64 numBytes; };
+	struct CopyResource { ID3D12Resource *dst; ID3D12Resource *src; };
+	struct CopyTextureRegion { D3D12_TEXTURE_COPY_LOCATION dst; D3D12_TEXTURE_COPY_LOCATION src; UINT dstX, dstY, dstZ; BOOL hasBox; D3D12_BOX box; };
+	struct Draw { UINT vertexCount; UINT instanceCount; UINT startVertex; UINT startInstance; };
+	struct DrawIndexed { UINT indexCount; UINT instanceCount; UINT startIndex; INT baseVertex; UINT startInstance; };
+	struct Dispatch { UINT x, y, z; };
+
+	// Records one command into commandList
+	void Execute(const Header *command, ID3D12GraphicsCommandList *commandList);
+
+	// For reports, e.g. "DRAW_INDEXED"
+	const char *GetName(uint16_t type);
+}
+
+// Not thread safe: record each stream from one thread at a time
+class CommandStream
+{
+public:
+	explicit CommandStream(size_t initialCapacity = 64 * 1024);
+
+	CommandStream(const CommandStream&) = delete;
+	CommandStream &operator=(const CommandStream&) = delete;
+
+	// Keeps the memory for the next frame
+	void Reset()
+	{
+		m_size = 0;
+		m_numCommands = 0;
+		m_numActions = 0;
+	}
+
+	// Copies all of other's commands to the end of this stream
+	void Append(const CommandStream &other);
+
+	const Command::Header *Begin() const { return reinterpret_cast<const Command::Header*>(m_data.get()); }
+	const Command::Header *End() const { return reinterpret_cast<const Command::Header*>(m_data.get() + m_size); }
+	const uint8_t *GetData() const { return m_data.get(); }
+	size_t GetSize() const { return m_size; }
+	uint32_t GetNumCommands() const { return m_numCommands; }
+	uint32_t GetNumActions() const { return m_numActions; }	// draws, dispatches, clears and copies
+
+	// Records one command with its array, already encoded (e.g. read back from a file)
+	void Write(const Command::Header *command);
+
+	void SetPipelineState(ID3D12PipelineState *pipelineState)
+	{
+		Push<Command::Object>(Command::SET_PIPELINE_STATE, 0)->object = pipelineState;
+	}
+
+	void SetGraphicsRootSignature(ID3D12RootSignature *rootSignature)
+	{
+		Push<Command::Object>(Command::SET_GRAPHICS_ROOT_SIGNATURE, 0)->object = rootSignature;
+	}
+
+	void SetComputeRootSignature(ID3D12RootSignature *rootSignature)
+	{
+		Push<Command::Object>(Command::SET_COMPUTE_ROOT_SIGNATURE, 0)->object = rootSignature;
+	}
+
+	void SetDescriptorHeaps(UINT numHeaps, ID3D12DescriptorHeap *const *heaps)
+	{
+		assert(numHeaps <= 2);
+		Command::DescriptorHeaps *payload = Push<Command::DescriptorHeaps>(Command::SET_DESCRIPTOR_HEAPS, numHeaps);
+		payload->heaps[0] = numHeaps > 0 ? heaps[0] : nullptr;
+		payload->heaps[1] = numHeaps > 1 ? heaps[1] : nullptr;
+	}
+
+	void IASetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY topology)
+	{
+		Push<Command::Empty>(Command::SET_PRIMITIVE_TOPOLOGY, topology);
+	}
+
+	void IASetVertexBuffers(UINT startSlot, UINT numViews, const D3D12_VERTEX_BUFFER_VIEW *views)
+	{
+		Command::VertexBuffers *payload = PushArray<Command::VertexBuffers>(Command::SET_VERTEX_BUFFERS, numViews, views);
+		payload->startSlot = startSlot;
+	}
+
+	void IASetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW *view)
+	{
+		Command::IndexBuffer *payload = Push<Command::IndexBuffer>(Command::SET_INDEX_BUFFER, 0);
+		payload->valid = view != nullptr;
+		if (view)
+		{
+			payload->view = *view;
+		}
+	}
+
+	void RSSetViewports(UINT numViewports, const D3D12_VIEWPORT *viewports)
+	{
+		PushArray<Command::Empty>(Command::SET_VIEWPORTS, numViewports, viewports);
+	}
+
+	void RSSetScissorRects(UINT numRects, const D3D12_RECT *rects)
+	{
+		PushArray<Command::Empty>(Command::SET_SCISSOR_RECTS, numRects, rects);
+	}
+
+	// Handles are always stored one by one, not as a contiguous range
+	void OMSetRenderTargets(UINT numRenderTargets, const D3D12_CPU_DESCRIPTOR_HANDLE *renderTargets,
+		const D3D12_CPU_DESCRIPTOR_HANDLE *depthStencil)
+	{
+		Command::RenderTargets *payload = PushArray<Command::RenderTargets>(Command::SET_RENDER_TARGETS,
+			numRenderTargets, renderTargets);
+		payload->hasDepthStencil = depthStencil != nullptr;
+		if (depthStencil)
+		{
+			payload->depthStencil = *depthStencil;
+		}
+	}
+
+	void OMSetBlendFactor(const FLOAT factor[4])
+	{
+		std::memcpy(Push<Command::BlendFactor>(Command::SET_BLEND_FACTOR, 0)->factor, factor, sizeof(FLOAT) * 4);
+	}
+
+	void OMSetStencilRef(UINT stencilRef)
+	{
+		Push<Command::Empty>(Command::SET_STENCIL_REF, stencilRef);
+	}
+
+	void SetGraphicsRoot32BitConstants(UINT rootParameter, UINT numValues, const void *values, UINT destOffset)
+	{
+		PushConstants(Command::SET_GRAPHICS_ROOT_CONSTANTS, rootParameter, numValues, values, destOffset);
+	}
+
+	void SetComputeRoot32BitConstants(UINT rootParameter, UINT numValues, const void *values, UINT destOffset)
+	{
+		PushConstants(Command::SET_COMPUTE_ROOT_CONSTANTS, rootParameter, numValues, values, destOffset);
+	}
+
+	void SetGraphicsRootConstantBufferView(UINT rootParameter, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		PushRoot<Command::RootAddress>(Command::SET_GRAPHICS_ROOT_CBV, rootParameter)->address = address;
+	}
+
+	void SetComputeRootConstantBufferView(UINT rootParameter, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		PushRoot<Command::RootAddress>(Command::SET_COMPUTE_ROOT_CBV, rootParameter)->address = address;
+	}
+
+	void SetGraphicsRootShaderResourceView(UINT rootParameter, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		PushRoot<Command::RootAddress>(Command::SET_GRAPHICS_ROOT_SRV, rootParameter)->address = address;
+	}
+
+	void SetComputeRootShaderResourceView(UINT rootParameter, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		PushRoot<Command::RootAddress>(Command::SET_COMPUTE_ROOT_SRV, rootParameter)->address = address;
+	}
+
+	void SetGraphicsRootUnorderedAccessView(UINT rootParameter, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		PushRoot<Command::RootAddress>(Command::SET_GRAPHICS_ROOT_UAV, rootParameter)->address = address;
+	}
+
+	void SetComputeRootUnorderedAccessView(UINT rootParameter, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		PushRoot<Command::RootAddress>(Command::SET_COMPUTE_ROOT_UAV, rootParameter)->address = address;
+	}
+
+	void SetGraphicsRootDescriptorTable(UINT rootParameter, D3D12_GPU_DESCRIPTOR_HANDLE baseDescriptor)
+	{
+		PushRoot<Command::RootTable>(Command::SET_GRAPHICS_ROOT_TABLE, rootParameter)->baseDescriptor = baseDescriptor;
+	}
+
+	void SetComputeRootDescriptorTable(UINT rootParameter, D3D12_GPU_DESCRIPTOR_HANDLE baseDescriptor)
+	{
+		PushRoot<Command::RootTable>(Command::SET_COMPUTE_ROOT_TABLE, rootParameter)->baseDescriptor = baseDescriptor;
+	}
+
+	void ClearRenderTargetView(D3D12_CPU_DESCRIPTOR_HANDLE view, const FLOAT color[4])
+	{
+		Command::ClearRenderTarget *payload = Push<Command::ClearRenderTarget>(Command::CLEAR_RENDER_TARGET, 0);
+		payload->view = view;
+		std::memcpy(payload->color, color, sizeof(FLOAT) * 4);
+		m_numActions++;
+	}
+
+	void ClearDepthStencilView(D3D12_CPU_DESCRIPTOR_HANDLE view, D3D12_CLEAR_FLAGS flags, FLOAT depth, UINT8 stencil)
+	{
+		Command::ClearDepthStencil *payload = Push<Command::ClearDepthStencil>(Command::CLEAR_DEPTH_STENCIL, 0);
+		payload->view = view;
+		payload->flags = flags;
+		payload->depth = depth;
+		payload->stencil = stencil;
+		m_numActions++;
+	}
+
+	// Long lists are split, a command holds at most gMaxArrayBytes
+	void ResourceBarrier(UINT numBarriers, const D3D12_RESOURCE_BARRIER *barriers);
+
+	void CopyBufferRegion(ID3D12Resource *dst, UINT64 dstOffset, ID3D12Resource *src, UINT64 srcOffset, UINT64 numBytes)
+	{
+		Command::CopyBufferRegion *payload = Push<Command::CopyBufferRegion>(Command::COPY_BUFFER_REGION, 0);
+		payload->dst = dst;
+		payload->dstOffset = dstOffset;
+		payload->src = src;
+		payload->srcOffset = srcOffset;
+		payload->numBytes = numBytes;
+		m_numActions++;
+	}
+
+	void CopyResource(ID3D12Resource *dst, ID3D12Resource *src)
+	{
+		Command::CopyResource *payload = Push<Command::CopyResource>(Command::COPY_RESOURCE, 0);
+		payload->dst = dst;
+		payload->src = src;
+		m_numActions++;
+	}
+
+	void CopyTextureRegion(const D3D12_TEXTURE_COPY_LOCATION *dst, UINT dstX, UINT dstY, UINT dstZ,
+		const D3D12_TEXTURE_COPY_LOCATION *src, const D3D12_BOX *srcBox)
+	{
+		Command::CopyTextureRegion *payload = Push<Command::CopyTextureRegion>(Command::COPY_TEXTURE_REGION, 0);
+		payload->dst = *dst;
+		payload->src = *src;
+		payload->dstX = dstX;
+		payload->dstY = dstY;
+		payload->dstZ = dstZ;
+		payload->hasBox = srcBox != nullptr;
+		if (srcBox)
+		{
+			payload->box = *srcBox;
+		}
+		m_numActions++;
+	}
+
+	void DrawInstanced(UINT vertexCount, UINT instanceCount, UINT startVertex, UINT startInstance)
+	{
+		Command::Draw *payload = Push<Command::Draw>(Command::DRAW, 0);
+		payload->vertexCount = vertexCount;
+		payload->instanceCount = instanceCount;
+		payload->startVertex = startVertex;
+		payload->startInstance = startInstance;
+		m_numActions++;
+	}
+
+	void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance)
+	{
+		Command::DrawIndexed *payload = Push<Command::DrawIndexed>(Command::DRAW_INDEXED, 0);
+		payload->indexCount = indexCount;
+		payload->instanceCount = instanceCount;
+		payload->startIndex = startIndex;
+		payload->baseVertex = baseVertex;
+		payload->startInstance = startInstance;
+		m_numActions++;
+	}
+
+	void Dispatch(UINT x, UINT y, UINT z)
+	{
+		Command::Dispatch *payload = Push<Command::Dispatch>(Command::DISPATCH, 0);
+		payload->x = x;
+		payload->y = y;
+		payload->z = z;
+		m_numActions++;
+	}
+
+	// Keeps every command under the 16 bit size in the header
+	static const size_t gMaxArrayBytes = 32 * 1024;
+
+private:
+	static size_t Align(size_t size) { return (size + 7) & ~size_t(7); }
+
+	uint8_t *Allocate(size_t size)
+	{
+		if (m_size + size > m_capacity)
+		{
+			Grow(m_size + size);
+		}
+
+		uint8_t *data = m_data.get() + m_size;
+		m_size += size;
+		return data;
+	}
+
+	void Grow(size_t minCapacity);
+
+	template <typename Payload>
+	Payload *Push(Command::Type type, uint32_t param, size_t arrayBytes = 0)
+	{
+		size_t size = Align(sizeof(Command::Header) + Command::PayloadSize<Payload>() + arrayBytes);
+		assert(size <= 0xffff);
+
+		Command::Header *header = reinterpret_cast<Command::Header*>(Allocate(size));
+		header->type = type;
+		header->size = static_cast<uint16_t>(size);
+		header->param = param;
+		m_numCommands++;
+
+		return reinterpret_cast<Payload*>(header + 1);
+	}
+
+	template <typename Payload, typename Element>
+	Payload *PushArray(Command::Type type, UINT count, const Element *elements)
+	{
+		Payload *payload = Push<Payload>(type, count, sizeof(Element) * count);
+		uint8_t *array = reinterpret_cast<uint8_t*>(payload) + Command::PayloadSize<Payload>();
+		if (count > 0)
+		{
+			std::memcpy(array, elements, sizeof(Element) * count);
+		}
+		return payload;
+	}
+
+	// Root parameters index fixed size arrays when the stream is translated
+	template <typename Payload>
+	Payload *PushRoot(Command::Type type, UINT rootParameter)
+	{
+		assert(rootParameter < Command::gMaxRootParameters && "more root parameters than a root signature can have");
+		return Push<Payload>(type, rootParameter);
+	}
+
+	void PushConstants(Command::Type type, UINT rootParameter, UINT numValues, const void *values, UINT destOffset)
+	{
+		assert(rootParameter < Command::gMaxRootParameters && "more root parameters than a root signature can have");
+		assert(destOffset + numValues <= D3D12_MAX_ROOT_COST && "more root constants than a root signature can have");
+		Command::RootConstants *payload = Push<Command::RootConstants>(type, rootParameter, sizeof(UINT) * numValues);
+		payload->destOffset = destOffset;
+		payload->numValues = numValues;
+		std::memcpy(payload + 1, values, sizeof(UINT) * numValues);
+	}
+
+	std::unique_ptr<uint8_t[]> m_data;
+	size_t m_size;
+	size_t m_capacity;
+	uint32_t m_numCommands;
+	uint32_t m_numActions;
+};
+
+// Replays command streams into command lists, in parallel.
+//
+// The streams are treated as one sequence and cut into as many chunks as
+// there are command lists. A quick pass over the headers first finds the
+// state bound at the start of every chunk (pipeline, root signatures and
+// arguments, IA, viewports, render targets, ...), which is set again at
+// the top of the chunk's list, so each list can be recorded on its own.
+// Barriers, clears and copies are not state and are never repeated.
+//
+// The command lists have to be open, and are left open. Executing them in
+// the order they were given gives the same result as a single list.
+
+class CommandCapture;
+class JobSystem;
+
+class CommandTranslator
+{
+public:
+	struct Stats
+	{
+		uint32_t commands;
+		uint32_t chunks;
+		uint32_t restored;		// state commands repeated at the start of chunks
+		double lastTranslateMs;
+	};
+
+	// The chunks are translated on the job system's threads, or one after the
+	// other on the calling thread without one
+	explicit CommandTranslator(JobSystem *jobs = nullptr);
+
+	void Translate(const CommandStream *const *streams, UINT numStreams,
+		ID3D12GraphicsCommandList *const *commandLists, UINT numCommandLists);
+
+	// Every translated stream is given to the capture while it is capturing
+	void SetCapture(CommandCapture *capture) { m_capture = capture; }
+
+	const Stats &GetStats() const { return m_stats; }
+
+private:
+	// What has to be set again before a chunk: the last command of each kind
+	struct State
+	{
+		const Command::Header *descriptorHeaps;
+		const Command::Header *rootSignatures[2];		// graphics, compute
+		const Command::Header *pipelineState;
+		const Command::Header *topology;
+		const Command::Header *indexBuffer;
+		const Command::Header *viewports;
+		const Command::Header *scissorRects;
+		const Command::Header *renderTargets;
+		const Command::Header *blendFactor;
+		const Command::Header *stencilRef;
+		const Command::Header *rootArguments[2][Command::gMaxRootParameters];	// CBV, SRV, UAV and table commands
+		// Root constants are set in pieces, so the latest value of each is kept,
+		// sorted by parameter << 8 | offset. A root signature has room for
+		// D3D12_MAX_ROOT_COST of them at most.
+		uint16_t constantKeys[2][D3D12_MAX_ROOT_COST];
+		UINT constantValues[2][D3D12_MAX_ROOT_COST];
+		uint32_t numConstants[2];
+		D3D12_VERTEX_BUFFER_VIEW vertexBuffers[D3D12_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+		uint32_t vertexBuffersValid;
+
+		void Reset();
+		void Track(const Command::Header *command);
+		void TrackArgument(UINT bindPoint, const Command::Header *command);
+		void TrackConstants(UINT bindPoint, const Command::Header *command);
+		uint32_t Restore(ID3D12GraphicsCommandList *commandList) const;
+	};
+
+	struct Chunk
+	{
+		UINT stream;
+		const Command::Header *begin;
+		uint32_t numCommands;
+		State state;
+		ID3D12GraphicsCommandList *commandList;
+		uint32_t restored;
+	};
+
+	void TranslateChunk(Chunk &chunk);
+
+	JobSystem *m_jobs;
+
+	// The translation running
+	const CommandStream *const *m_streams;
+	std::vector<Chunk> m_chunks;
+
+	CommandCapture *m_capture;
+	Stats m_stats;
+};
@@ -0,0 +1,306 @@
+#include "culling.h"
+#include "cullingAvx2.h"
+#include "jobSystem.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using namespace DirectX;
+
+namespace
+{
+	uint32_t MoveMask(FXMVECTOR mask)
+	{
+#if defined(_XM_SSE_INTRINSICS_)
+		return static_cast<uint32_t>(_mm_movemask_ps(mask));
+#else
+		XMUINT4 lanes;
+		XMStoreUInt4(&lanes, mask);
+		return (lanes.x & 1) | ((lanes.y & 1) << 1) | ((lanes.z & 1) << 2) | ((lanes.w & 1) << 3);
+#endif
+	}
+
+	// AVX2 and FMA, and the OS saving the ymm registers on a thread switch
+	bool CpuHasAvx2()
+	{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+		{
+			return false;
+		}
+
+		__cpuid(info, 1);
+		bool fma = (info[2] & (1 << 12)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		if (!fma || !osxsave || (_xgetbv(0) & 6) != 6)
+		{
+			return false;
+		}
+
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+		return false;
+#endif
+	}
+
+	XMVECTOR Load(const float *values)
+	{
+		return XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(values));
+	}
+
+	template <bool Boxes>
+	uint32_t CullBlock(const CullBounds &bounds, const CullPlanes &planes, uint32_t begin, uint32_t end, uint32_t *visible)
+	{
+		XMVECTOR normal[6][3];
+		XMVECTOR absNormal[6][3];
+		XMVECTOR distance[6];
+		for (uint32_t p = 0; p < 6; ++p)
+		{
+			for (uint32_t axis = 0; axis < 3; ++axis)
+			{
+				normal[p][axis] = XMVectorReplicate(planes.normal[p][axis]);
+				absNormal[p][axis] = XMVectorReplicate(planes.absNormal[p][axis]);
+			}
+			distance[p] = XMVectorReplicate(planes.distance[p]);
+		}
+
+		uint32_t numVisible = 0;
+		for (uint32_t i = begin; i < end; i += 4)
+		{
+			XMVECTOR x = Load(bounds.centerX + i);
+			XMVECTOR y = Load(bounds.centerY + i);
+			XMVECTOR z = Load(bounds.centerZ + i);
+
+			XMVECTOR extentX = XMVectorZero(), extentY = XMVectorZero(), extentZ = XMVectorZero();
+			XMVECTOR negRadius = XMVectorZero();
+			if (Boxes)
+			{
+				extentX = Load(bounds.extentX + i);
+				extentY = Load(bounds.extentY + i);
+				extentZ = Load(bounds.extentZ + i);
+			}
+			else
+			{
+				negRadius = XMVectorNegate(Load(bounds.radius + i));
+			}
+
+			XMVECTOR inside = XMVectorTrueInt();
+			for (uint32_t p = 0; p < 6; ++p)
+			{
+				XMVECTOR d = XMVectorMultiplyAdd(x, normal[p][0],
+					XMVectorMultiplyAdd(y, normal[p][1], XMVectorMultiplyAdd(z, normal[p][2], distance[p])));
+
+				if (Boxes)
+				{
+					negRadius = XMVectorNegate(XMVectorMultiplyAdd(extentX, absNormal[p][0],
+						XMVectorMultiplyAdd(extentY, absNormal[p][1], XMVectorMultiply(extentZ, absNormal[p][2]))));
+				}
+
+				inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(d, negRadius));
+			}
+
+			// Every index is written, only the visible ones move the end forward
+			uint32_t mask = MoveMask(inside);
+			uint32_t lanes = std::min(4u, end - i);
+			for (uint32_t k = 0; k < lanes; ++k)
+			{
+				visible[numVisible] = i + k;
+				numVisible += (mask >> k) & 1;
+			}
+		}
+
+		return numVisible;
+	}
+}
+
+Frustum Frustum::FromMatrix(FXMMATRIX viewProjection)
+{
+	// The columns of the matrix give the clip space coordinates: -w <= x <= w,
+	// -w <= y <= w and 0 <= z <= w
+	XMMATRIX columns = XMMatrixTranspose(viewProjection);
+
+	XMVECTOR planes[6] =
+	{
+		XMVectorAdd(columns.r[3], columns.r[0]),
+		XMVectorSubtract(columns.r[3], columns.r[0]),
+		XMVectorAdd(columns.r[3], columns.r[1]),
+		XMVectorSubtract(columns.r[3], columns.r[1]),
+		columns.r[2],
+		XMVectorSubtract(columns.r[3], columns.r[2]),
+	};
+
+	Frustum frustum;
+	for (uint32_t i = 0; i < 6; ++i)
+	{
+		XMStoreFloat4(&frustum.planes[i], XMPlaneNormalize(planes[i]));
+	}
+	return frustum;
+}
+
+bool FrustumCuller::CanUseAvx2()
+{
+	static const bool canUse = CullingAvx2::IsBuilt() && CpuHasAvx2();
+	return canUse;
+}
+
+FrustumCuller::FrustumCuller() :
+	m_avx2(CanUseAvx2()),
+	m_count(0),
+	m_numVisible(0),
+	m_stats()
+{
+}
+
+void FrustumCuller::SetAvx2(bool avx2)
+{
+	m_avx2 = avx2 && CanUseAvx2();
+}
+
+void FrustumCuller::Clear()
+{
+	m_count = 0;
+	m_numVisible = 0;
+
+	m_centerX.clear();
+	m_centerY.clear();
+	m_centerZ.clear();
+	m_extentX.clear();
+	m_extentY.clear();
+	m_extentZ.clear();
+	m_radius.clear();
+}
+
+void FrustumCuller::Reserve(uint32_t count)
+{
+	size_t padded = (count + gLanes - 1) / gLanes * gLanes;
+
+	m_centerX.reserve(padded);
+	m_centerY.reserve(padded);
+	m_centerZ.reserve(padded);
+	m_extentX.reserve(padded);
+	m_extentY.reserve(padded);
+	m_extentZ.reserve(padded);
+	m_radius.reserve(padded);
+}
+
+uint32_t FrustumCuller::Add(const XMFLOAT3 &center, const XMFLOAT3 &extents)
+{
+	// A whole group of lanes at a time, so the last objects can be loaded together
+	if (m_count % gLanes == 0)
+	{
+		size_t padded = m_count + gLanes;
+
+		m_centerX.resize(padded, 0.0f);
+		m_centerY.resize(padded, 0.0f);
+		m_centerZ.resize(padded, 0.0f);
+		m_extentX.resize(padded, 0.0f);
+		m_extentY.resize(padded, 0.0f);
+		m_extentZ.resize(padded, 0.0f);
+		m_radius.resize(padded, 0.0f);
+	}
+
+	uint32_t index = m_count++;
+	Set(index, center, extents);
+	return index;
+}
+
+void FrustumCuller::Set(uint32_t index, const XMFLOAT3 &center, const XMFLOAT3 &extents)
+{
+	assert(index < m_count);
+
+	m_centerX[index] = center.x;
+	m_centerY[index] = center.y;
+	m_centerZ[index] = center.z;
+	m_extentX[index] = extents.x;
+	m_extentY[index] = extents.y;
+	m_extentZ[index] = extents.z;
+	m_radius[index] = std::sqrt(extents.x * extents.x + extents.y * extents.y + extents.z * extents.z);
+}
+
+void FrustumCuller::Cull(const Frustum &frustum, Shape shape, JobSystem *jobs)
+{
+	static std::chrono::high_resolution_clock clock;
+	auto t0 = clock.now();
+
+	CullPlanes planes;
+	for (uint32_t p = 0; p < 6; ++p)
+	{
+		const XMFLOAT4 &plane = frustum.planes[p];
+		planes.normal[p][0] = plane.x;
+		planes.normal[p][1] = plane.y;
+		planes.normal[p][2] = plane.z;
+		planes.absNormal[p][0] = std::abs(plane.x);
+		planes.absNormal[p][1] = std::abs(plane.y);
+		planes.absNormal[p][2] = std::abs(plane.z);
+		planes.distance[p] = plane.w;
+	}
+
+	CullBounds bounds = { m_centerX.data(), m_centerY.data(), m_centerZ.data(), m_extentX.data(), m_extentY.data(),
+		m_extentZ.data(), m_radius.data() };
+
+	uint32_t numBlocks = (m_count + gBlockSize - 1) / gBlockSize;
+	m_visible.resize(m_count);
+	m_blockCounts.resize(numBlocks);
+
+	auto cullBlocks = [&](uint32_t firstBlock, uint32_t lastBlock)
+	{
+		for (uint32_t block = firstBlock; block < lastBlock; ++block)
+		{
+			uint32_t begin = block * gBlockSize;
+			uint32_t end = std::min(m_count, begin + gBlockSize);
+			uint32_t *visible = m_visible.data() + begin;
+
+			if (m_avx2)
+			{
+				m_blockCounts[block] = shape == SHAPE_BOX ?
+					CullingAvx2::CullBoxes(bounds, planes, begin, end, visible) :
+					CullingAvx2::CullSpheres(bounds, planes, begin, end, visible);
+			}
+			else if (shape == SHAPE_BOX)
+			{
+				m_blockCounts[block] = CullBlock<true>(bounds, planes, begin, end, visible);
+			}
+			else
+			{
+				m_blockCounts[block] = CullBlock<false>(bounds, planes, begin, end, visible);
+			}
+		}
+	};
+
+	if (jobs)
+	{
+		jobs->ParallelFor(numBlocks, 1, cullBlocks);
+	}
+	else
+	{
+		cullBlocks(0, numBlocks);
+	}
+
+	// Pack the blocks, each one starts at or after where it moves to
+	m_numVisible = 0;
+	for (uint32_t block = 0; block < numBlocks; ++block)
+	{
+		uint32_t begin = block * gBlockSize;
+		if (begin != m_numVisible)
+		{
+			std::memmove(&m_visible[m_numVisible], &m_visible[begin], sizeof(uint32_t) * m_blockCounts[block]);
+		}
+		m_numVisible += m_blockCounts[block];
+	}
+
+	m_stats.tested = m_count;
+	m_stats.visible = m_numVisible;
+	m_stats.cullMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+// The view frustum as six planes pointing inside: a point p is inside a
+// plane when dot(plane.xyz, p) + plane.w >= 0. The planes are normalized so
+// that is also the distance to the plane.
+struct Frustum
+{
+	DirectX::XMFLOAT4 planes[6];	// left, right, bottom, top, near, far
+
+	// From a row vector view * projection matrix with D3D's [0, 1] depth
+	static Frustum FromMatrix(DirectX::FXMMATRIX viewProjection);
+};
+
+// Frustum culling of many objects at once.
+//
+// The bounds are kept as structure of arrays (all the center x, then all
+// the center y, ...) so several objects are tested against a plane with one
+// instruction: 8 at a time with AVX2 when the CPU has it (checked once at
+// startup, see cullingAvx2.h), otherwise 4 at a time with DirectXMath
+// vectors (SSE, NEON, or plain floats where there are neither).
+//
+// Every object has a box, center and half extents, and the sphere around
+// it. Spheres are cheaper to test, boxes reject more.
+//
+// The objects are culled in blocks, on the job system's threads if there is
+// one. Every block writes the indices it keeps at its own offset, without
+// branches, and the blocks are packed into one list after.
+
+class FrustumCuller
+{
+public:
+	enum Shape
+	{
+		SHAPE_SPHERE,
+		SHAPE_BOX,
+	};
+
+	struct Stats
+	{
+		uint32_t tested;
+		uint32_t visible;
+		double cullMs;
+	};
+
+	// The arrays are padded to a multiple of this, enough for either path
+	static const uint32_t gLanes = 8;
+
+	// Objects per block, a job each
+	static const uint32_t gBlockSize = 4096;
+
+	// Built with AVX2 and running on a CPU that has it
+	static bool CanUseAvx2();
+
+	FrustumCuller();
+
+	// On by default where it can be used, off to test or time the 4 wide path
+	void SetAvx2(bool avx2);
+	uint32_t GetSimdWidth() const { return m_avx2 ? 8 : 4; }
+
+	void Clear();
+	void Reserve(uint32_t count);
+
+	// Returns the object's index
+	uint32_t Add(const DirectX::XMFLOAT3 &center, const DirectX::XMFLOAT3 &extents);
+	void Set(uint32_t index, const DirectX::XMFLOAT3 &center, const DirectX::XMFLOAT3 &extents);
+
+	uint32_t GetSize() const { return m_count; }
+
+	void Cull(const Frustum &frustum, Shape shape, JobSystem *jobs = nullptr);
+
+	// The objects at least partly inside the last frustum, in index order
+	const uint32_t *GetVisible() const { return m_visible.data(); }
+	uint32_t GetNumVisible() const { return m_numVisible; }
+
+	const Stats &GetStats() const { return m_stats; }
+
+private:
+	bool m_avx2;
+	uint32_t m_count;
+
+	// Padded to a whole number of lanes
+	std::vector<float> m_centerX;
+	std::vector<float> m_centerY;
+	std::vector<float> m_centerZ;
+	std::vector<float> m_extentX;
+	std::vector<float> m_extentY;
+	std::vector<float> m_extentZ;
+	std::vector<float> m_radius;
+
+	std::vector<uint32_t> m_visible;
+	std::vector<uint32_t> m_blockCounts;
+	uint32_t m_numVisible;
+
+	Stats m_stats;
+};
@@ -0,0 +1,109 @@
+#include "cullingAvx2.h"
+
+// The only file built with AVX2. It stays away from the standard library and
+// DirectXMath: inline functions compiled here could be the copy the linker
+// keeps for every other file, which would then need AVX2 too.
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+namespace
+{
+	template <bool Boxes>
+	uint32_t CullBlock(const CullBounds &bounds, const CullPlanes &planes, uint32_t begin, uint32_t end, uint32_t *visible)
+	{
+		__m256 normal[6][3];
+		__m256 absNormal[6][3];
+		__m256 distance[6];
+		for (uint32_t p = 0; p < 6; ++p)
+		{
+			for (uint32_t axis = 0; axis < 3; ++axis)
+			{
+				normal[p][axis] = _mm256_set1_ps(planes.normal[p][axis]);
+				absNormal[p][axis] = _mm256_set1_ps(planes.absNormal[p][axis]);
+			}
+			distance[p] = _mm256_set1_ps(planes.distance[p]);
+		}
+
+		const __m256 zero = _mm256_setzero_ps();
+
+		uint32_t numVisible = 0;
+		for (uint32_t i = begin; i < end; i += 8)
+		{
+			__m256 x = _mm256_loadu_ps(bounds.centerX + i);
+			__m256 y = _mm256_loadu_ps(bounds.centerY + i);
+			__m256 z = _mm256_loadu_ps(bounds.centerZ + i);
+
+			__m256 extentX = zero, extentY = zero, extentZ = zero, negRadius = zero;
+			if (Boxes)
+			{
+				extentX = _mm256_loadu_ps(bounds.extentX + i);
+				extentY = _mm256_loadu_ps(bounds.extentY + i);
+				extentZ = _mm256_loadu_ps(bounds.extentZ + i);
+			}
+			else
+			{
+				negRadius = _mm256_sub_ps(zero, _mm256_loadu_ps(bounds.radius + i));
+			}
+
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (uint32_t p = 0; p < 6; ++p)
+			{
+				__m256 d = _mm256_fmadd_ps(x, normal[p][0],
+					_mm256_fmadd_ps(y, normal[p][1], _mm256_fmadd_ps(z, normal[p][2], distance[p])));
+
+				if (Boxes)
+				{
+					negRadius = _mm256_sub_ps(zero, _mm256_fmadd_ps(extentX, absNormal[p][0],
+						_mm256_fmadd_ps(extentY, absNormal[p][1], _mm256_mul_ps(extentZ, absNormal[p][2]))));
+				}
+
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, negRadius, _CMP_GE_OQ));
+			}
+
+			// Every index is written, only the visible ones move the end forward
+			uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(inside));
+			uint32_t lanes = end - i < 8 ? end - i : 8;
+			for (uint32_t k = 0; k < lanes; ++k)
+			{
+				visible[numVisible] = i + k;
+				numVisible += (mask >> k) & 1;
+			}
+		}
+
+		return numVisible;
+	}
+}
+
+bool CullingAvx2::IsBuilt()
+{
+	return true;
+}
+
+uint32_t CullingAvx2::CullSpheres(const CullBounds &bounds, const CullPlanes &planes, uint32_t begin, uint32_t end,
+	uint32_t *visible)
+{
+	return CullBlock<false>(bounds, planes, begin, end, visible);
+}
+
+uint32_t CullingAvx2::CullBoxes(const CullBounds &bounds, const CullPlanes &planes, uint32_t begin, uint32_t end,
+	uint32_t *visible)
+{
+	return CullBlock<true>(bounds, planes, begin, end, visible);
+}
+#else
+bool CullingAvx2::IsBuilt()
+{
+	return false;
+}
+
+uint32_t CullingAvx2::CullSpheres(const CullBounds&, const CullPlanes&, uint32_t, uint32_t, uint32_t*)
+{
+	return 0;
+}
+
+uint32_t CullingAvx2::CullBoxes(const CullBounds&, const CullPlanes&, uint32_t, uint32_t, uint32_t*)
+{
+	return 0;
+}
+#endif
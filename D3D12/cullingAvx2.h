@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+
+// FrustumCuller's block test 8 objects at a time with AVX2 and FMA.
+//
+// cullingAvx2.cpp is the only file built with AVX2 (/arch:AVX2 on that file
+// in the project, -mavx2 -mfma in the Linux build), the rest of the program
+// runs on any x64 CPU. FrustumCuller checks the CPU before calling it.
+
+struct CullBounds
+{
+	const float *centerX;
+	const float *centerY;
+	const float *centerZ;
+	const float *extentX;
+	const float *extentY;
+	const float *extentZ;
+	const float *radius;
+};
+
+// The absolute normal gives how far a box reaches towards the plane
+struct CullPlanes
+{
+	float normal[6][3];
+	float absNormal[6][3];
+	float distance[6];
+};
+
+namespace CullingAvx2
+{
+	// False if the compiler didn't target AVX2, the functions do nothing then
+	bool IsBuilt();
+
+	// Writes the indices in [begin, end) that are inside, returns how many.
+	// The bounds are read 8 at a time past end, up to the next multiple of 8.
+	uint32_t CullSpheres(const CullBounds &bounds, const CullPlanes &planes, uint32_t begin, uint32_t end,
+		uint32_t *visible);
+	uint32_t CullBoxes(const CullBounds &bounds, const CullPlanes &planes, uint32_t begin, uint32_t end,
+		uint32_t *visible);
+}
@@ -0,0 +1,176 @@
+#include "drawList.h"
+#include "radixSort.h"
+#include "uploadRing.h"
+
+#include <tuple>
+
+namespace
+{
+	// Everything but the transform, draws that compare equal can be instances of one draw
+	auto DrawTuple(const DrawPacket &p)
+	{
+		return std::make_tuple(reinterpret_cast<uintptr_t>(p.pipelineState), reinterpret_cast<uintptr_t>(p.rootSignature),
+			p.topology, p.vertexBuffer.BufferLocation, p.vertexBuffer.SizeInBytes, p.vertexBuffer.StrideInBytes,
+			p.indexBuffer.BufferLocation, p.indexBuffer.SizeInBytes, p.indexBuffer.Format, p.materialConstants,
+			p.count, p.startIndex, p.baseVertex);
+	}
+
+	bool Mergeable(const DrawPacket &p)
+	{
+		return p.transform != nullptr && p.instanceCount == 1;
+	}
+}
+
+DrawList::DrawList(UINT materialParameter, UINT objectParameter) :
+	m_materialParameter(materialParameter),
+	m_objectParameter(objectParameter),
+	m_stats()
+{
+}
+
+void DrawList::Reset()
+{
+	m_packets.clear();
+	m_keys.clear();
+	m_indices.clear();
+	m_stats = Stats();
+}
+
+void DrawList::Sort(JobSystem *jobs)
+{
+	static std::chrono::high_resolution_clock clock;
+	auto t0 = clock.now();
+
+	m_tempKeys.resize(m_keys.size());
+	m_tempIndices.resize(m_indices.size());
+
+	RadixSort::Sort(m_keys.data(), m_indices.data(), m_tempKeys.data(), m_tempIndices.data(), m_keys.size(), jobs);
+
+	m_stats.sortMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+}
+
+void DrawList::GetPassRange(uint8_t pass, size_t &begin, size_t &end) const
+{
+	auto first = std::lower_bound(m_keys.begin(), m_keys.end(), uint64_t(pass) << 56);
+	auto last = m_keys.end();
+	if (pass < UINT8_MAX)
+	{
+		last = std::lower_bound(first, m_keys.end(), uint64_t(pass + 1) << 56);
+	}
+
+	begin = first - m_keys.begin();
+	end = last - m_keys.begin();
+}
+
+void DrawList::MergeInstances(UploadRing &ring, uint32_t minInstances)
+{
+	static std::chrono::high_resolution_clock clock;
+	auto t0 = clock.now();
+
+	m_mergedKeys.clear();
+	m_mergedIndices.clear();
+
+	bool ringFull = false;
+	size_t numDraws = m_keys.size();
+	for (size_t begin = 0; begin < numDraws;)
+	{
+		// A run of draws with the same pass, pipeline and material
+		uint64_t runKey = m_keys[begin] >> gDepthBits;
+		size_t end = begin + 1;
+		while (end < numDraws && (m_keys[end] >> gDepthBits) == runKey)
+		{
+			end++;
+		}
+
+		m_run.clear();
+		m_runDraws.clear();
+		for (size_t i = begin; i < end; ++i)
+		{
+			if (Mergeable(m_packets[m_indices[i]]))
+			{
+				m_run.push_back(static_cast<uint32_t>(i));
+			}
+			else
+			{
+				m_runDraws.push_back(std::make_pair(m_keys[i], m_indices[i]));
+			}
+		}
+
+		// Same draws next to each other, still nearest first within each
+		std::stable_sort(m_run.begin(), m_run.end(), [this](uint32_t a, uint32_t b)
+		{
+			return DrawTuple(m_packets[m_indices[a]]) < DrawTuple(m_packets[m_indices[b]]);
+		});
+
+		for (size_t group = 0; group < m_run.size();)
+		{
+			size_t groupEnd = group + 1;
+			while (groupEnd < m_run.size() &&
+				DrawTuple(m_packets[m_indices[m_run[group]]]) == DrawTuple(m_packets[m_indices[m_run[groupEnd]]]))
+			{
+				groupEnd++;
+			}
+
+			for (size_t i = group; i < groupEnd;)
+			{
+				uint32_t count = static_cast<uint32_t>(std::min<size_t>(groupEnd - i, gMaxInstancesPerDraw));
+
+				UploadRing::Allocation allocation;
+				bool merge = count >= minInstances && !ringFull;
+				if (merge && !ring.Allocate(sizeof(DirectX::XMFLOAT4X4) * count,
+					D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT, allocation))
+				{
+					ringFull = true;
+					merge = false;
+				}
+
+				if (merge)
+				{
+					DirectX::XMFLOAT4X4 *transforms = static_cast<DirectX::XMFLOAT4X4*>(allocation.cpu);
+					for (uint32_t k = 0; k < count; ++k)
+					{
+						transforms[k] = *m_packets[m_indices[m_run[i + k]]].transform;
+					}
+
+					DrawPacket instanced = m_packets[m_indices[m_run[i]]];
+					instanced.objectConstants = allocation.gpu;
+					instanced.instanceCount = count;
+					instanced.startInstance = 0;
+					instanced.transform = nullptr;
+
+					m_runDraws.push_back(std::make_pair(m_keys[m_run[i]], static_cast<uint32_t>(m_packets.size())));
+					m_packets.push_back(instanced);
+
+					m_stats.instancedDraws++;
+					m_stats.mergedDraws += count;
+				}
+				else
+				{
+					for (uint32_t k = 0; k < count; ++k)
+					{
+						m_runDraws.push_back(std::make_pair(m_keys[m_run[i + k]], m_indices[m_run[i + k]]));
+					}
+				}
+
+				i += count;
+			}
+
+			group = groupEnd;
+		}
+
+		// Back to depth order within the run
+		std::sort(m_runDraws.begin(), m_runDraws.end());
+		for (const std::pair<uint64_t, uint32_t> &draw : m_runDraws)
+		{
+			m_mergedKeys.push_back(draw.first);
+			m_mergedIndices.push_back(draw.second);
+		}
+
+		begin = end;
+	}
+
+	m_keys.swap(m_mergedKeys);
+	m_indices.swap(m_mergedIndices);
+
+	m_stats.mergeMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include "includes.h"
+
+#include <vector>
+
+// The draws of a frame, collected in any order and submitted sorted.
+//
+// Every draw is a packet with all the state it needs, and a 64-bit sort key:
+//
+//	 63      56 55          40 39                  16 15         0
+//	| pass    | pipeline      | material            | depth       |
+//
+// Sorting by the key groups the draws of a pass together, then the ones
+// sharing a pipeline, then the ones sharing a material, so submitting them
+// in that order only changes state when the key does. The depth bucket
+// sorts opaque draws front to back; pass InvertDepth() for transparent ones
+// to get back to front.
+//
+// Pipeline and material ids are whatever the caller uses to tell them apart
+// (an index into its own table), they only have to fit in the key.
+//
+// Packets are sorted through their keys and indices only, with
+// RadixSort, so packets are never moved.
+//
+// After sorting, MergeInstances() turns draws of the same mesh with the same
+// pipeline and material in a pass into instanced draws. Their transforms are
+// copied one after the other into the UploadRing, and the instanced draw
+// binds that array as its object constants, so shaders index the object
+// constants with SV_InstanceID (a draw that wasn't merged has one instance
+// and its own constants). Only draws that give their transform can be merged.
+
+struct DrawPacket
+{
+	ID3D12PipelineState *pipelineState;
+	ID3D12RootSignature *rootSignature;
+	D3D12_PRIMITIVE_TOPOLOGY topology;
+	D3D12_VERTEX_BUFFER_VIEW vertexBuffer;
+	D3D12_INDEX_BUFFER_VIEW indexBuffer;		// SizeInBytes 0 to draw without indices
+	D3D12_GPU_VIRTUAL_ADDRESS materialConstants;
+	D3D12_GPU_VIRTUAL_ADDRESS objectConstants;
+	UINT count;									// indices, or vertices without indices
+	UINT instanceCount;
+	UINT startIndex;							// or start vertex
+	INT baseVertex;
+	UINT startInstance;
+	const DirectX::XMFLOAT4X4 *transform;		// to be merged with other instances, must live until MergeInstances
+};
+
+class JobSystem;
+class UploadRing;
+
+class DrawList
+{
+public:
+	struct Stats
+	{
+		uint32_t draws;
+		uint32_t pipelineChanges;
+		uint32_t rootSignatureChanges;
+		uint32_t materialChanges;
+		uint32_t geometryChanges;		// vertex or index buffer
+		uint32_t instancedDraws;		// made by MergeInstances
+		uint32_t mergedDraws;			// draws that became instances
+		double sortMs;
+		double mergeMs;
+	};
+
+	static const uint32_t gPipelineBits = 16;
+	static const uint32_t gMaterialBits = 24;
+	static const uint32_t gDepthBits = 16;
+
+	// What one root CBV can hold
+	static const uint32_t gMaxInstancesPerDraw = D3D12_REQ_CONSTANT_BUFFER_ELEMENT_COUNT * 16 / sizeof(DirectX::XMFLOAT4X4);
+
+	static uint64_t MakeKey(uint8_t pass, uint32_t pipeline, uint32_t material, uint16_t depth)
+	{
+		assert(pipeline < (1u << gPipelineBits) && material < (1u << gMaterialBits));
+		return (uint64_t(pass) << 56) | (uint64_t(pipeline) << 40) | (uint64_t(material) << 16) | depth;
+	}
+
+	static uint8_t GetPass(uint64_t key) { return static_cast<uint8_t>(key >> 56); }
+
+	// View space depth quantized between the near and far planes
+	static uint16_t DepthBucket(float depth, float nearZ, float farZ)
+	{
+		float t = (depth - nearZ) / (farZ - nearZ);
+		t = std::min(std::max(t, 0.0f), 1.0f);
+		return static_cast<uint16_t>(t * 65535.0f);
+	}
+
+	static uint16_t InvertDepth(uint16_t depth) { return static_cast<uint16_t>(65535 - depth); }
+
+	// The root parameters the packets' material and object constants are bound to
+	DrawList(UINT materialParameter, UINT objectParameter);
+
+	// Keeps the memory for the next frame
+	void Reset();
+
+	void Add(uint64_t key, const DrawPacket &packet)
+	{
+		m_keys.push_back(key);
+		m_indices.push_back(static_cast<uint32_t>(m_packets.size()));
+		m_packets.push_back(packet);
+	}
+
+	// Sorts on the job system's threads if there is one and enough draws
+	void Sort(JobSystem *jobs = nullptr);
+
+	// After Sort(), merges draws that differ only by their transform. Groups of
+	// fewer than minInstances draws are left alone, as are all the draws that
+	// are left once the ring is full. Instanced draws sort by their nearest instance.
+	void MergeInstances(UploadRing &ring, uint32_t minInstances = 2);
+
+	size_t GetSize() const { return m_keys.size(); }
+	uint64_t GetKey(size_t i) const { return m_keys[i]; }
+	const DrawPacket &GetPacket(size_t i) const { return m_packets[m_indices[i]]; }
+
+	// Sorted draws of one pass, [begin, end)
+	void GetPassRange(uint8_t pass, size_t &begin, size_t &end) const;
+
+	// Records the sorted draws [begin, end), only setting what changed from the
+	// draw before. The recorder is anything with the ID3D12GraphicsCommandList
+	// methods: a CommandStream, a FilteredCommandList or the list itself.
+	template <typename Recorder>
+	void Submit(Recorder &recorder, size_t begin, size_t end);
+
+	template <typename Recorder>
+	void Submit(Recorder &recorder) { Submit(recorder, 0, m_keys.size()); }
+
+	const Stats &GetStats() const { return m_stats; }
+
+private:
+	UINT m_materialParameter;
+	UINT m_objectParameter;
+
+	std::vector<DrawPacket> m_packets;
+	std::vector<uint64_t> m_keys;
+	std::vector<uint32_t> m_indices;
+	std::vector<uint64_t> m_tempKeys;
+	std::vector<uint32_t> m_tempIndices;
+
+	// MergeInstances scratch, kept between frames
+	std::vector<uint32_t> m_run;
+	std::vector<std::pair<uint64_t, uint32_t>> m_runDraws;
+	std::vector<uint64_t> m_mergedKeys;
+	std::vector<uint32_t> m_mergedIndices;
+
+	Stats m_stats;
+};
+
+template <typename Recorder>
+void DrawList::Submit(Recorder &recorder, size_t begin, size_t end)
+{
+	// The first draw sets everything
+	const DrawPacket *previous = nullptr;
+
+	for (size_t i = begin; i < end; ++i)
+	{
+		const DrawPacket &packet = m_packets[m_indices[i]];
+
+		bool first = previous == nullptr;
+
+		// Root arguments are lost when the root signature changes
+		bool newRootSignature = first || packet.rootSignature != previous->rootSignature;
+		if (newRootSignature)
+		{
+			recorder.SetGraphicsRootSignature(packet.rootSignature);
+			m_stats.rootSignatureChanges++;
+		}
+
+		if (first || packet.pipelineState != previous->pipelineState)
+		{
+			recorder.SetPipelineState(packet.pipelineState);
+			m_stats.pipelineChanges++;
+		}
+
+		if (first || packet.topology != previous->topology)
+		{
+			recorder.IASetPrimitiveTopology(packet.topology);
+		}
+
+		if (first || packet.vertexBuffer.BufferLocation != previous->vertexBuffer.BufferLocation ||
+			packet.vertexBuffer.SizeInBytes != previous->vertexBuffer.SizeInBytes ||
+			packet.vertexBuffer.StrideInBytes != previous->vertexBuffer.StrideInBytes)
+		{
+			recorder.IASetVertexBuffers(0, 1, &packet.vertexBuffer);
+			m_stats.geometryChanges++;
+		}
+
+		if (packet.indexBuffer.SizeInBytes > 0 && (first ||
+			packet.indexBuffer.BufferLocation != previous->indexBuffer.BufferLocation ||
+			packet.indexBuffer.SizeInBytes != previous->indexBuffer.SizeInBytes ||
+			packet.indexBuffer.Format != previous->indexBuffer.Format))
+		{
+			recorder.IASetIndexBuffer(&packet.indexBuffer);
+			m_stats.geometryChanges++;
+		}
+
+		if (newRootSignature || packet.materialConstants != previous->materialConstants)
+		{
+			recorder.SetGraphicsRootConstantBufferView(m_materialParameter, packet.materialConstants);
+			m_stats.materialChanges++;
+		}
+
+		if (newRootSignature || packet.objectConstants != previous->objectConstants)
+		{
+			recorder.SetGraphicsRootConstantBufferView(m_objectParameter, packet.objectConstants);
+		}
+
+		if (packet.indexBuffer.SizeInBytes > 0)
+		{
+			recorder.DrawIndexedInstanced(packet.count, packet.instanceCount, packet.startIndex, packet.baseVertex,
+				packet.startInstance);
+		}
+		else
+		{
+			recorder.DrawInstanced(packet.count, packet.instanceCount, packet.startIndex, packet.startInstance);
+		}
+
+		m_stats.draws++;
+		previous = &packet;
+	}
+}
@@ -0,0 +1,239 @@
+#include "fileWatcher.h"
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <cstdint>
+#endif
+
+#if defined(_WIN32)
+DirectoryWatcher::~DirectoryWatcher()
+{
+	for (auto &directory : m_directories)
+	{
+		// The read has to be finished before the buffer goes away
+		::CancelIoEx(directory->handle, &directory->overlapped);
+
+		DWORD bytes = 0;
+		::GetOverlappedResult(directory->handle, &directory->overlapped, &bytes, TRUE);
+
+		::CloseHandle(directory->overlapped.hEvent);
+		::CloseHandle(directory->handle);
+	}
+}
+
+bool DirectoryWatcher::Watch(const std::string &path)
+{
+	HANDLE handle = ::CreateFileA(path.c_str(), FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	std::unique_ptr<Directory> directory = std::make_unique<Directory>();
+	directory->path = path;
+	if (!path.empty() && path.back() != '/' && path.back() != '\\')
+	{
+		directory->path += '\\';
+	}
+	directory->handle = handle;
+	directory->overlapped = {};
+	directory->overlapped.hEvent = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+	if (!Read(*directory))
+	{
+		::CloseHandle(directory->overlapped.hEvent);
+		::CloseHandle(handle);
+		return false;
+	}
+
+	m_directories.push_back(std::move(directory));
+
+	return true;
+}
+
+bool DirectoryWatcher::Read(Directory &directory)
+{
+	// Editors save in all sorts of ways (write in place, write a copy and
+	// rename it over), file names and last write times cover all of them
+	return ::ReadDirectoryChangesW(directory.handle, directory.buffer, sizeof(directory.buffer), TRUE,
+		FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE, nullptr, &directory.overlapped, nullptr) != FALSE;
+}
+
+void DirectoryWatcher::Poll(std::vector<std::string> &changed)
+{
+	for (auto &directory : m_directories)
+	{
+		DWORD bytes = 0;
+		if (!::GetOverlappedResult(directory->handle, &directory->overlapped, &bytes, FALSE))
+		{
+			// ERROR_IO_INCOMPLETE, nothing happened yet
+			continue;
+		}
+
+		if (bytes == 0)
+		{
+			// The buffer overflowed and the changes are lost
+			changed.push_back(directory->path);
+		}
+
+		const uint8_t *record = reinterpret_cast<const uint8_t*>(directory->buffer);
+		while (bytes > 0)
+		{
+			const FILE_NOTIFY_INFORMATION *info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(record);
+
+			// The project uses the multi-byte character set, so do the paths
+			char name[MAX_PATH];
+			int length = ::WideCharToMultiByte(CP_ACP, 0, info->FileName, info->FileNameLength / sizeof(WCHAR),
+				name, MAX_PATH - 1, nullptr, nullptr);
+			if (length > 0 && info->Action != FILE_ACTION_REMOVED && info->Action != FILE_ACTION_RENAMED_OLD_NAME)
+			{
+				changed.push_back(directory->path + std::string(name, length));
+			}
+
+			if (info->NextEntryOffset == 0)
+			{
+				break;
+			}
+			record += info->NextEntryOffset;
+		}
+
+		::ResetEvent(directory->overlapped.hEvent);
+		Read(*directory);
+	}
+}
+#elif defined(__linux__)
+namespace
+{
+	// Same as the Win32 one: names and writes, whichever way the editor saves
+	const uint32_t gEvents = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO;
+}
+
+InotifyWatcher::InotifyWatcher() :
+	m_fd(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+{
+}
+
+InotifyWatcher::~InotifyWatcher()
+{
+	if (m_fd >= 0)
+	{
+		::close(m_fd);
+	}
+}
+
+bool InotifyWatcher::Watch(const std::string &path)
+{
+	if (m_fd < 0)
+	{
+		return false;
+	}
+
+	std::string directory = path;
+	if (!directory.empty() && directory.back() != '/')
+	{
+		directory += '/';
+	}
+
+	return AddDirectory(directory);
+}
+
+bool InotifyWatcher::AddDirectory(const std::string &path)
+{
+	int wd = ::inotify_add_watch(m_fd, path.c_str(), gEvents | IN_ONLYDIR);
+	if (wd < 0)
+	{
+		return false;
+	}
+	m_directories[wd] = path;
+
+	DIR *dir = ::opendir(path.c_str());
+	if (!dir)
+	{
+		return true;
+	}
+
+	while (const dirent *entry = ::readdir(dir))
+	{
+		std::string name = entry->d_name;
+		if (entry->d_type == DT_DIR && name != "." && name != "..")
+		{
+			AddDirectory(path + name + '/');
+		}
+	}
+	::closedir(dir);
+
+	return true;
+}
+
+void InotifyWatcher::Poll(std::vector<std::string> &changed)
+{
+	if (m_fd < 0)
+	{
+		return;
+	}
+
+	alignas(inotify_event) char buffer[4096];
+	for (;;)
+	{
+		ssize_t bytes = ::read(m_fd, buffer, sizeof(buffer));
+		if (bytes <= 0)
+		{
+			// EAGAIN, nothing more happened
+			break;
+		}
+
+		for (ssize_t offset = 0; offset < bytes;)
+		{
+			const inotify_event *event = reinterpret_cast<const inotify_event*>(buffer + offset);
+			offset += sizeof(inotify_event) + event->len;
+
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				// The queue overflowed and the changes are lost
+				for (const auto &directory : m_directories)
+				{
+					changed.push_back(directory.second);
+				}
+				continue;
+			}
+
+			auto it = m_directories.find(event->wd);
+			if (it == m_directories.end())
+			{
+				continue;
+			}
+
+			if (event->mask & IN_IGNORED)
+			{
+				// The directory was deleted
+				m_directories.erase(it);
+				continue;
+			}
+
+			if (event->len == 0)
+			{
+				continue;
+			}
+
+			std::string path = it->second + event->name;
+			if (event->mask & IN_ISDIR)
+			{
+				// New directories are watched too, with whatever was put in them already
+				if (event->mask & (IN_CREATE | IN_MOVED_TO))
+				{
+					AddDirectory(path + '/');
+					changed.push_back(path + '/');
+				}
+				continue;
+			}
+
+			changed.push_back(path);
+		}
+	}
+}
+#endif
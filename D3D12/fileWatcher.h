@@ -0,0 +1,78 @@
+#pragma once
+
+#if defined(_WIN32)
+#include "includes.h"
+#endif
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Reports files that changed since the last Poll(). Polling never blocks, so
+// it can be called once per frame from the render thread.
+//
+// DirectoryWatcher is the Win32 one, InotifyWatcher the Linux one the tests
+// use. Anything that can produce a list of
+// paths can be plugged in instead, e.g. a stub fed by hand.
+class FileWatcher
+{
+public:
+	virtual ~FileWatcher() {}
+
+	// Returns false if the directory can't be watched
+	virtual bool Watch(const std::string &directory) = 0;
+
+	// Appends changed paths. A path ending in a slash means the watcher lost
+	// track of that directory and everything in it should be treated as changed.
+	virtual void Poll(std::vector<std::string> &changed) = 0;
+};
+
+#if defined(_WIN32)
+// Overlapped ReadDirectoryChangesW on every watched directory, subdirectories included
+class DirectoryWatcher : public FileWatcher
+{
+public:
+	DirectoryWatcher() = default;
+	DirectoryWatcher(const DirectoryWatcher&) = delete;
+	DirectoryWatcher &operator=(const DirectoryWatcher&) = delete;
+	~DirectoryWatcher();
+
+	bool Watch(const std::string &directory) override;
+	void Poll(std::vector<std::string> &changed) override;
+
+private:
+	struct Directory
+	{
+		std::string path;		// with a trailing slash
+		HANDLE handle;
+		OVERLAPPED overlapped;
+		DWORD buffer[4096];		// FILE_NOTIFY_INFORMATION records have to be DWORD aligned
+	};
+
+	bool Read(Directory &directory);
+
+	std::vector<std::unique_ptr<Directory>> m_directories;	// OVERLAPPED mustn't move while a read is pending
+};
+#elif defined(__linux__)
+// One non-blocking inotify instance. inotify doesn't watch subdirectories, so
+// every directory below a watched one gets its own watch, including the ones
+// created later.
+class InotifyWatcher : public FileWatcher
+{
+public:
+	InotifyWatcher();
+	InotifyWatcher(const InotifyWatcher&) = delete;
+	InotifyWatcher &operator=(const InotifyWatcher&) = delete;
+	~InotifyWatcher();
+
+	bool Watch(const std::string &directory) override;
+	void Poll(std::vector<std::string> &changed) override;
+
+private:
+	bool AddDirectory(const std::string &path);
+
+	int m_fd;
+	std::unordered_map<int, std::string> m_directories;	// watch descriptor -> path with a trailing slash
+};
+#endif
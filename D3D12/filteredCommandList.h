@@ -0,0 +1,496 @@
+#pragma once
+
+#include "includes.h"
+
+// Records into an ID3D12GraphicsCommandList but remembers what's bound, and
+// drops calls that would set the same thing again. Each of those still costs
+// a trip into the runtime and the driver, and shows up on every draw when
+// materials and objects set their state without knowing what came before.
+//
+// Only the calls below are filtered. Anything recorded through Get() that
+// changes state (bundles, ClearState, ...) has to be followed by
+// Invalidate(), after which the next call of every kind goes through.
+//
+// Setting another root signature drops the root arguments of that bind
+// point, and setting descriptor heaps drops descriptor tables, as the
+// runtime does. Root constants are shadowed in full, so the wrapper is a
+// few dozen KB: keep one per thread and Begin() it for every list.
+
+class FilteredCommandList
+{
+public:
+	struct Stats
+	{
+		uint32_t issued;	// state calls passed on to the command list
+		uint32_t filtered;	// state calls dropped
+		uint32_t draws;		// draws and dispatches
+	};
+
+	explicit FilteredCommandList(ID3D12GraphicsCommandList *commandList = nullptr) :
+		m_commandList(commandList),
+		m_stats()
+	{
+		Invalidate();
+	}
+
+	// Wraps another list (or the same one after it was reset)
+	void Begin(ID3D12GraphicsCommandList *commandList, ID3D12PipelineState *initialState = nullptr)
+	{
+		m_commandList = commandList;
+		Invalidate();
+		m_pipelineState = initialState;
+		m_pipelineStateValid = true;
+	}
+
+	void Invalidate()
+	{
+		m_pipelineState = nullptr;
+		m_pipelineStateValid = false;
+		m_topology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
+		m_topologyValid = false;
+		m_vertexBuffersValid = 0;
+		m_indexBufferValid = false;
+		m_heaps[0] = m_heaps[1] = nullptr;
+		m_heapsValid = false;
+		m_viewportsValid = false;
+		m_scissorRectsValid = false;
+		m_blendFactorValid = false;
+		m_stencilRefValid = false;
+		m_renderTargetsValid = false;
+		m_graphics.Invalidate();
+		m_compute.Invalidate();
+	}
+
+	ID3D12GraphicsCommandList *Get() const { return m_commandList; }
+
+	const Stats &GetStats() const { return m_stats; }
+	void ResetStats() { m_stats = Stats(); }
+
+	void SetPipelineState(ID3D12PipelineState *pipelineState)
+	{
+		if (Changed(!m_pipelineStateValid || m_pipelineState != pipelineState))
+		{
+			m_pipelineState = pipelineState;
+			m_pipelineStateValid = true;
+			m_commandList->SetPipelineState(pipelineState);
+		}
+	}
+
+	void SetGraphicsRootSignature(ID3D12RootSignature *rootSignature)
+	{
+		if (Changed(m_graphics.SetRootSignature(rootSignature)))
+		{
+			m_commandList->SetGraphicsRootSignature(rootSignature);
+		}
+	}
+
+	void SetComputeRootSignature(ID3D12RootSignature *rootSignature)
+	{
+		if (Changed(m_compute.SetRootSignature(rootSignature)))
+		{
+			m_commandList->SetComputeRootSignature(rootSignature);
+		}
+	}
+
+	void IASetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY topology)
+	{
+		if (Changed(!m_topologyValid || m_topology != topology))
+		{
+			m_topology = topology;
+			m_topologyValid = true;
+			m_commandList->IASetPrimitiveTopology(topology);
+		}
+	}
+
+	// Only the slots that changed are set
+	void IASetVertexBuffers(UINT startSlot, UINT numViews, const D3D12_VERTEX_BUFFER_VIEW *views)
+	{
+		assert(startSlot + numViews <= D3D12_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT);
+
+		UINT first = numViews;
+		UINT last = 0;
+		for (UINT i = 0; i < numViews; ++i)
+		{
+			UINT slot = startSlot + i;
+			D3D12_VERTEX_BUFFER_VIEW view = views ? views[i] : D3D12_VERTEX_BUFFER_VIEW();
+
+			bool valid = (m_vertexBuffersValid & (1u << slot)) != 0;
+			if (!valid || ::memcmp(&m_vertexBuffers[slot], &view, sizeof(view)) != 0)
+			{
+				m_vertexBuffers[slot] = view;
+				m_vertexBuffersValid |= 1u << slot;
+				first = std::min(first, i);
+				last = i;
+			}
+		}
+
+		if (Changed(first < numViews))
+		{
+			m_commandList->IASetVertexBuffers(startSlot + first, last - first + 1, views ? views + first : nullptr);
+		}
+	}
+
+	void IASetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW *view)
+	{
+		D3D12_INDEX_BUFFER_VIEW indexBuffer = view ? *view : D3D12_INDEX_BUFFER_VIEW();
+		if (Changed(!m_indexBufferValid || ::memcmp(&m_indexBuffer, &indexBuffer, sizeof(indexBuffer)) != 0))
+		{
+			m_indexBuffer = indexBuffer;
+			m_indexBufferValid = true;
+			m_commandList->IASetIndexBuffer(view);
+		}
+	}
+
+	void SetDescriptorHeaps(UINT numHeaps, ID3D12DescriptorHeap *const *heaps)
+	{
+		// At most one CBV/SRV/UAV heap and one sampler heap, in either order
+		ID3D12DescriptorHeap *sorted[2] = {};
+		for (UINT i = 0; i < numHeaps; ++i)
+		{
+			sorted[heaps[i]->GetDesc().Type == D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER ? 1 : 0] = heaps[i];
+		}
+
+		if (Changed(!m_heapsValid || m_heaps[0] != sorted[0] || m_heaps[1] != sorted[1]))
+		{
+			m_heaps[0] = sorted[0];
+			m_heaps[1] = sorted[1];
+			m_heapsValid = true;
+			m_graphics.InvalidateTables();
+			m_compute.InvalidateTables();
+			m_commandList->SetDescriptorHeaps(numHeaps, heaps);
+		}
+	}
+
+	void RSSetViewports(UINT numViewports, const D3D12_VIEWPORT *viewports)
+	{
+		assert(numViewports <= D3D12_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE);
+		if (Changed(!m_viewportsValid || m_numViewports != numViewports ||
+			(numViewports > 0 && ::memcmp(m_viewports, viewports, numViewports * sizeof(D3D12_VIEWPORT)) != 0)))
+		{
+			m_numViewports = numViewports;
+			m_viewportsValid = true;
+			std::copy(viewports, viewports + numViewports, m_viewports);
+			m_commandList->RSSetViewports(numViewports, viewports);
+		}
+	}
+
+	void RSSetScissorRects(UINT numRects, const D3D12_RECT *rects)
+	{
+		assert(numRects <= D3D12_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE);
+		if (Changed(!m_scissorRectsValid || m_numScissorRects != numRects ||
+			(numRects > 0 && ::memcmp(m_scissorRects, rects, numRects * sizeof(D3D12_RECT)) != 0)))
+		{
+			m_numScissorRects = numRects;
+			m_scissorRectsValid = true;
+			std::copy(rects, rects + numRects, m_scissorRects);
+			m_commandList->RSSetScissorRects(numRects, rects);
+		}
+	}
+
+	void OMSetRenderTargets(UINT numRenderTargets, const D3D12_CPU_DESCRIPTOR_HANDLE *renderTargets,
+		BOOL singleHandleToDescriptorRange, const D3D12_CPU_DESCRIPTOR_HANDLE *depthStencil)
+	{
+		RenderTargets targets = {};
+		targets.count = numRenderTargets;
+		targets.singleHandle = singleHandleToDescriptorRange;
+		for (UINT i = 0; i < (singleHandleToDescriptorRange ? std::min(numRenderTargets, 1u) : numRenderTargets); ++i)
+		{
+			targets.handles[i] = renderTargets[i].ptr;
+		}
+		targets.depthStencil = depthStencil ? depthStencil->ptr : 0;
+
+		if (Changed(!m_renderTargetsValid || ::memcmp(&m_renderTargets, &targets, sizeof(targets)) != 0))
+		{
+			m_renderTargets = targets;
+			m_renderTargetsValid = true;
+			m_commandList->OMSetRenderTargets(numRenderTargets, renderTargets, singleHandleToDescriptorRange, depthStencil);
+		}
+	}
+
+	void OMSetBlendFactor(const FLOAT blendFactor[4])
+	{
+		if (Changed(!m_blendFactorValid || ::memcmp(m_blendFactor, blendFactor, sizeof(m_blendFactor)) != 0))
+		{
+			::memcpy(m_blendFactor, blendFactor, sizeof(m_blendFactor));
+			m_blendFactorValid = true;
+			m_commandList->OMSetBlendFactor(blendFactor);
+		}
+	}
+
+	void OMSetStencilRef(UINT stencilRef)
+	{
+		if (Changed(!m_stencilRefValid || m_stencilRef != stencilRef))
+		{
+			m_stencilRef = stencilRef;
+			m_stencilRefValid = true;
+			m_commandList->OMSetStencilRef(stencilRef);
+		}
+	}
+
+	void SetGraphicsRoot32BitConstant(UINT index, UINT value, UINT offset)
+	{
+		if (Changed(m_graphics.SetConstants(index, 1, &value, offset)))
+		{
+			m_commandList->SetGraphicsRoot32BitConstant(index, value, offset);
+		}
+	}
+
+	void SetGraphicsRoot32BitConstants(UINT index, UINT num32BitValues, const void *data, UINT offset)
+	{
+		if (Changed(m_graphics.SetConstants(index, num32BitValues, data, offset)))
+		{
+			m_commandList->SetGraphicsRoot32BitConstants(index, num32BitValues, data, offset);
+		}
+	}
+
+	void SetGraphicsRootConstantBufferView(UINT index, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		if (Changed(m_graphics.SetArgument(index, ARGUMENT_CBV, address)))
+		{
+			m_commandList->SetGraphicsRootConstantBufferView(index, address);
+		}
+	}
+
+	void SetGraphicsRootShaderResourceView(UINT index, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		if (Changed(m_graphics.SetArgument(index, ARGUMENT_SRV, address)))
+		{
+			m_commandList->SetGraphicsRootShaderResourceView(index, address);
+		}
+	}
+
+	void SetGraphicsRootUnorderedAccessView(UINT index, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		if (Changed(m_graphics.SetArgument(index, ARGUMENT_UAV, address)))
+		{
+			m_commandList->SetGraphicsRootUnorderedAccessView(index, address);
+		}
+	}
+
+	void SetGraphicsRootDescriptorTable(UINT index, D3D12_GPU_DESCRIPTOR_HANDLE table)
+	{
+		if (Changed(m_graphics.SetArgument(index, ARGUMENT_TABLE, table.ptr)))
+		{
+			m_commandList->SetGraphicsRootDescriptorTable(index, table);
+		}
+	}
+
+	void SetComputeRoot32BitConstant(UINT index, UINT value, UINT offset)
+	{
+		if (Changed(m_compute.SetConstants(index, 1, &value, offset)))
+		{
+			m_commandList->SetComputeRoot32BitConstant(index, value, offset);
+		}
+	}
+
+	void SetComputeRoot32BitConstants(UINT index, UINT num32BitValues, const void *data, UINT offset)
+	{
+		if (Changed(m_compute.SetConstants(index, num32BitValues, data, offset)))
+		{
+			m_commandList->SetComputeRoot32BitConstants(index, num32BitValues, data, offset);
+		}
+	}
+
+	void SetComputeRootConstantBufferView(UINT index, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		if (Changed(m_compute.SetArgument(index, ARGUMENT_CBV, address)))
+		{
+			m_commandList->SetComputeRootConstantBufferView(index, address);
+		}
+	}
+
+	void SetComputeRootShaderResourceView(UINT index, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		if (Changed(m_compute.SetArgument(index, ARGUMENT_SRV, address)))
+		{
+			m_commandList->SetComputeRootShaderResourceView(index, address);
+		}
+	}
+
+	void SetComputeRootUnorderedAccessView(UINT index, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		if (Changed(m_compute.SetArgument(index, ARGUMENT_UAV, address)))
+		{
+			m_commandList->SetComputeRootUnorderedAccessView(index, address);
+		}
+	}
+
+	void SetComputeRootDescriptorTable(UINT index, D3D12_GPU_DESCRIPTOR_HANDLE table)
+	{
+		if (Changed(m_compute.SetArgument(index, ARGUMENT_TABLE, table.ptr)))
+		{
+			m_commandList->SetComputeRootDescriptorTable(index, table);
+		}
+	}
+
+	void DrawInstanced(UINT vertexCount, UINT instanceCount, UINT startVertex, UINT startInstance)
+	{
+		m_stats.draws++;
+		m_commandList->DrawInstanced(vertexCount, instanceCount, startVertex, startInstance);
+	}
+
+	void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance)
+	{
+		m_stats.draws++;
+		m_commandList->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+	}
+
+	void Dispatch(UINT x, UINT y, UINT z)
+	{
+		m_stats.draws++;
+		m_commandList->Dispatch(x, y, z);
+	}
+
+	void ResourceBarrier(UINT numBarriers, const D3D12_RESOURCE_BARRIER *barriers)
+	{
+		m_commandList->ResourceBarrier(numBarriers, barriers);
+	}
+
+private:
+	static const UINT gMaxRootParameters = 64;	// a root signature is at most 64 DWORDs
+	static const UINT gMaxRootConstants = 64;
+
+	enum ArgumentKind : uint8_t
+	{
+		ARGUMENT_NONE,
+		ARGUMENT_CBV,
+		ARGUMENT_SRV,
+		ARGUMENT_UAV,
+		ARGUMENT_TABLE,
+	};
+
+	// Root signature and root arguments of the graphics or the compute bind point
+	struct BindPoint
+	{
+		ID3D12RootSignature *rootSignature;
+		bool rootSignatureValid;
+		ArgumentKind kinds[gMaxRootParameters];
+		uint64_t values[gMaxRootParameters];
+		uint64_t constantsValid[gMaxRootParameters];	// one bit per DWORD
+		UINT constants[gMaxRootParameters][gMaxRootConstants];
+
+		void Invalidate()
+		{
+			rootSignature = nullptr;
+			rootSignatureValid = false;
+			InvalidateArguments();
+		}
+
+		void InvalidateArguments()
+		{
+			::memset(kinds, ARGUMENT_NONE, sizeof(kinds));
+			::memset(constantsValid, 0, sizeof(constantsValid));
+		}
+
+		void InvalidateTables()
+		{
+			for (ArgumentKind &kind : kinds)
+			{
+				if (kind == ARGUMENT_TABLE)
+				{
+					kind = ARGUMENT_NONE;
+				}
+			}
+		}
+
+		bool SetRootSignature(ID3D12RootSignature *value)
+		{
+			if (rootSignatureValid && rootSignature == value)
+			{
+				return false;
+			}
+
+			rootSignature = value;
+			rootSignatureValid = true;
+			InvalidateArguments();
+			return true;
+		}
+
+		bool SetArgument(UINT index, ArgumentKind kind, uint64_t value)
+		{
+			assert(index < gMaxRootParameters);
+			if (kinds[index] == kind && values[index] == value)
+			{
+				return false;
+			}
+
+			kinds[index] = kind;
+			values[index] = value;
+			return true;
+		}
+
+		bool SetConstants(UINT index, UINT num32BitValues, const void *data, UINT offset)
+		{
+			assert(index < gMaxRootParameters && offset + num32BitValues <= gMaxRootConstants);
+
+			uint64_t mask = (num32BitValues == 64 ? ~0ull : ((1ull << num32BitValues) - 1)) << offset;
+			UINT *shadow = constants[index] + offset;
+			if ((constantsValid[index] & mask) == mask && ::memcmp(shadow, data, num32BitValues * sizeof(UINT)) == 0)
+			{
+				return false;
+			}
+
+			::memcpy(shadow, data, num32BitValues * sizeof(UINT));
+			constantsValid[index] |= mask;
+			return true;
+		}
+	};
+
+	struct RenderTargets
+	{
+		UINT count;
+		BOOL singleHandle;
+		SIZE_T handles[D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT];
+		SIZE_T depthStencil;
+	};
+
+	bool Changed(bool changed)
+	{
+		if (changed)
+		{
+			m_stats.issued++;
+		}
+		else
+		{
+			m_stats.filtered++;
+		}
+		return changed;
+	}
+
+	ID3D12GraphicsCommandList *m_commandList;
+	Stats m_stats;
+
+	ID3D12PipelineState *m_pipelineState;
+	bool m_pipelineStateValid;
+
+	D3D12_PRIMITIVE_TOPOLOGY m_topology;
+	bool m_topologyValid;
+
+	D3D12_VERTEX_BUFFER_VIEW m_vertexBuffers[D3D12_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	uint32_t m_vertexBuffersValid;
+
+	D3D12_INDEX_BUFFER_VIEW m_indexBuffer;
+	bool m_indexBufferValid;
+
+	ID3D12DescriptorHeap *m_heaps[2];
+	bool m_heapsValid;
+
+	D3D12_VIEWPORT m_viewports[D3D12_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+	UINT m_numViewports;
+	bool m_viewportsValid;
+	D3D12_RECT m_scissorRects[D3D12_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+	UINT m_numScissorRects;
+	bool m_scissorRectsValid;
+
+	RenderTargets m_renderTargets;
+	bool m_renderTargetsValid;
+
+	FLOAT m_blendFactor[4];
+	bool m_blendFactorValid;
+
+	UINT m_stencilRef;
+	bool m_stencilRefValid;
+
+	BindPoint m_graphics;
+	BindPoint m_compute;
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "includes.h"
+
+// Fixed function pipeline state as compile time constants. The CD3DX12_*
+// helpers fill their fields in a constructor at runtime, these are plain
+// D3D12 structs built by constexpr functions, so the tables below end up in
+// read-only data and nothing is constructed when a stream is assembled.
+//
+// The defaults match CD3DX12_*(D3D12_DEFAULT).
+
+namespace FixedFunction
+{
+	constexpr D3D12_RENDER_TARGET_BLEND_DESC BlendTarget(BOOL enable, D3D12_BLEND src, D3D12_BLEND dest,
+		D3D12_BLEND srcAlpha, D3D12_BLEND destAlpha)
+	{
+		return { enable, FALSE, src, dest, D3D12_BLEND_OP_ADD, srcAlpha, destAlpha, D3D12_BLEND_OP_ADD,
+			D3D12_LOGIC_OP_NOOP, D3D12_COLOR_WRITE_ENABLE_ALL };
+	}
+
+	constexpr D3D12_RENDER_TARGET_BLEND_DESC gBlendTargetDefault =
+		BlendTarget(FALSE, D3D12_BLEND_ONE, D3D12_BLEND_ZERO, D3D12_BLEND_ONE, D3D12_BLEND_ZERO);
+
+	// IndependentBlendEnable is off, only the first target is used
+	constexpr D3D12_BLEND_DESC Blend(const D3D12_RENDER_TARGET_BLEND_DESC &rt)
+	{
+		return { FALSE, FALSE, { rt, gBlendTargetDefault, gBlendTargetDefault, gBlendTargetDefault,
+			gBlendTargetDefault, gBlendTargetDefault, gBlendTargetDefault, gBlendTargetDefault } };
+	}
+
+	constexpr D3D12_BLEND_DESC gBlendOpaque = Blend(gBlendTargetDefault);
+	constexpr D3D12_BLEND_DESC gBlendAlpha = Blend(BlendTarget(TRUE,
+		D3D12_BLEND_SRC_ALPHA, D3D12_BLEND_INV_SRC_ALPHA, D3D12_BLEND_ONE, D3D12_BLEND_INV_SRC_ALPHA));
+	constexpr D3D12_BLEND_DESC gBlendAdditive = Blend(BlendTarget(TRUE,
+		D3D12_BLEND_ONE, D3D12_BLEND_ONE, D3D12_BLEND_ONE, D3D12_BLEND_ONE));
+	constexpr D3D12_BLEND_DESC gBlendPremultiplied = Blend(BlendTarget(TRUE,
+		D3D12_BLEND_ONE, D3D12_BLEND_INV_SRC_ALPHA, D3D12_BLEND_ONE, D3D12_BLEND_INV_SRC_ALPHA));
+
+	constexpr D3D12_RASTERIZER_DESC Rasterizer(D3D12_CULL_MODE cull = D3D12_CULL_MODE_BACK,
+		D3D12_FILL_MODE fill = D3D12_FILL_MODE_SOLID)
+	{
+		return { fill, cull, FALSE, D3D12_DEFAULT_DEPTH_BIAS, D3D12_DEFAULT_DEPTH_BIAS_CLAMP,
+			D3D12_DEFAULT_SLOPE_SCALED_DEPTH_BIAS, TRUE, FALSE, FALSE, 0, D3D12_CONSERVATIVE_RASTERIZATION_MODE_OFF };
+	}
+
+	constexpr D3D12_DEPTH_STENCILOP_DESC gStencilKeep =
+		{ D3D12_STENCIL_OP_KEEP, D3D12_STENCIL_OP_KEEP, D3D12_STENCIL_OP_KEEP, D3D12_COMPARISON_FUNC_ALWAYS };
+
+	constexpr D3D12_DEPTH_STENCIL_DESC1 DepthStencil(BOOL depthEnable, D3D12_DEPTH_WRITE_MASK writeMask,
+		D3D12_COMPARISON_FUNC func = D3D12_COMPARISON_FUNC_LESS)
+	{
+		return { depthEnable, writeMask, func, FALSE, D3D12_DEFAULT_STENCIL_READ_MASK, D3D12_DEFAULT_STENCIL_WRITE_MASK,
+			gStencilKeep, gStencilKeep, FALSE };
+	}
+
+	constexpr D3D12_DEPTH_STENCIL_DESC1 gDepthOff = DepthStencil(FALSE, D3D12_DEPTH_WRITE_MASK_ZERO);
+	constexpr D3D12_DEPTH_STENCIL_DESC1 gDepthRead = DepthStencil(TRUE, D3D12_DEPTH_WRITE_MASK_ZERO);
+	constexpr D3D12_DEPTH_STENCIL_DESC1 gDepthReadWrite = DepthStencil(TRUE, D3D12_DEPTH_WRITE_MASK_ALL);
+
+	constexpr D3D12_RT_FORMAT_ARRAY RenderTargetFormats(DXGI_FORMAT format)
+	{
+		return { { format, DXGI_FORMAT_UNKNOWN, DXGI_FORMAT_UNKNOWN, DXGI_FORMAT_UNKNOWN,
+			DXGI_FORMAT_UNKNOWN, DXGI_FORMAT_UNKNOWN, DXGI_FORMAT_UNKNOWN, DXGI_FORMAT_UNKNOWN }, 1 };
+	}
+}
+
+// Everything in a graphics pipeline that isn't a shader, an input layout or
+// a root signature. Start from gFixedFunctionDefault and chain With*() to
+// get another constant:
+//
+//	constexpr FixedFunctionState gTransparent = gFixedFunctionDefault
+//		.WithBlend(FixedFunction::gBlendAlpha)
+//		.WithDepthStencil(FixedFunction::gDepthRead);
+struct FixedFunctionState
+{
+	D3D12_RASTERIZER_DESC rasterizer;
+	D3D12_BLEND_DESC blend;
+	D3D12_DEPTH_STENCIL_DESC1 depthStencil;
+	D3D12_PRIMITIVE_TOPOLOGY_TYPE topology;
+	D3D12_RT_FORMAT_ARRAY renderTargets;
+	DXGI_FORMAT depthStencilFormat;
+
+	constexpr FixedFunctionState WithRasterizer(const D3D12_RASTERIZER_DESC &value) const
+	{
+		FixedFunctionState state = *this;
+		state.rasterizer = value;
+		return state;
+	}
+
+	constexpr FixedFunctionState WithCull(D3D12_CULL_MODE value) const
+	{
+		FixedFunctionState state = *this;
+		state.rasterizer.CullMode = value;
+		return state;
+	}
+
+	constexpr FixedFunctionState WithBlend(const D3D12_BLEND_DESC &value) const
+	{
+		FixedFunctionState state = *this;
+		state.blend = value;
+		return state;
+	}
+
+	constexpr FixedFunctionState WithDepthStencil(const D3D12_DEPTH_STENCIL_DESC1 &value) const
+	{
+		FixedFunctionState state = *this;
+		state.depthStencil = value;
+		return state;
+	}
+
+	constexpr FixedFunctionState WithTopology(D3D12_PRIMITIVE_TOPOLOGY_TYPE value) const
+	{
+		FixedFunctionState state = *this;
+		state.topology = value;
+		return state;
+	}
+
+	constexpr FixedFunctionState WithRenderTargets(const D3D12_RT_FORMAT_ARRAY &value, DXGI_FORMAT depthFormat) const
+	{
+		FixedFunctionState state = *this;
+		state.renderTargets = value;
+		state.depthStencilFormat = depthFormat;
+		return state;
+	}
+
+	// Copies every field into the stream, shaders and the rest are left alone
+	void Apply(CD3DX12_PIPELINE_STATE_STREAM &stream) const
+	{
+		stream.RasterizerState = CD3DX12_RASTERIZER_DESC(rasterizer);
+		stream.BlendState = CD3DX12_BLEND_DESC(blend);
+		stream.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC1(depthStencil);
+		stream.PrimitiveTopologyType = topology;
+		stream.RTVFormats = renderTargets;
+		stream.DSVFormat = depthStencilFormat;
+	}
+};
+
+constexpr FixedFunctionState gFixedFunctionDefault =
+{
+	FixedFunction::Rasterizer(),
+	FixedFunction::gBlendOpaque,
+	FixedFunction::gDepthReadWrite,
+	D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE,
+	FixedFunction::RenderTargetFormats(DXGI_FORMAT_R8G8B8A8_UNORM),
+	DXGI_FORMAT_D32_FLOAT,
+};
@@ -0,0 +1,36 @@
+#include "fixedTimestep.h"
+
+#include <cmath>
+
+FixedTimestep::FixedTimestep(double stepSeconds, uint32_t maxSteps) :
+	m_step(stepSeconds),
+	m_maxSteps(maxSteps),
+	m_accumulator(0.0),
+	m_stats()
+{
+	assert(stepSeconds > 0.0 && maxSteps > 0);
+}
+
+uint32_t FixedTimestep::Advance(double elapsedSeconds)
+{
+	m_accumulator += std::max(0.0, elapsedSeconds);
+
+	uint32_t steps = 0;
+	while (m_accumulator >= m_step && steps < m_maxSteps)
+	{
+		m_accumulator -= m_step;
+		steps++;
+	}
+
+	// Keep less than a step so the alpha stays below 1
+	if (m_accumulator >= m_step)
+	{
+		double kept = std::fmod(m_accumulator, m_step);
+		m_stats.hitches++;
+		m_stats.droppedSeconds += m_accumulator - kept;
+		m_accumulator = kept;
+	}
+
+	m_stats.steps += steps;
+	return steps;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "includes.h"
+
+// Runs the simulation at a fixed rate whatever the frame rate is.
+//
+// Every frame adds the time it took to an accumulator and the simulation
+// takes as many fixed steps as fit in it, so it costs the same whether the
+// frames come at 60 Hz with vsync or at 300 Hz with tearing. What is left
+// over is less than a step: rendering blends the last two simulated states
+// by that fraction (GetAlpha) so motion stays smooth when the two rates
+// don't line up.
+//
+// A frame that took very long (a hitch, a breakpoint, dragging the window)
+// would ask for more steps than can be simulated in a frame, which makes the
+// next frame longer still. Past gMaxSteps the rest of the time is dropped and
+// the simulation runs slower than real time for that frame instead.
+
+class FixedTimestep
+{
+public:
+	struct Stats
+	{
+		uint64_t steps;			// in total
+		uint32_t hitches;		// frames that hit the step limit
+		double droppedSeconds;
+	};
+
+	static const uint32_t gMaxSteps = 8;
+
+	FixedTimestep(double stepSeconds = 1.0 / 60.0, uint32_t maxSteps = gMaxSteps);
+
+	// Adds the frame's time, returns the number of steps to simulate
+	uint32_t Advance(double elapsedSeconds);
+
+	double GetStep() const { return m_step; }
+	// How far between the previous and the current step to render, in [0, 1)
+	float GetAlpha() const { return static_cast<float>(m_accumulator / m_step); }
+
+	const Stats &GetStats() const { return m_stats; }
+
+private:
+	double m_step;
+	uint32_t m_maxSteps;
+	double m_accumulator;
+
+	Stats m_stats;
+};
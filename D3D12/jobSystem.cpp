@@ -0,0 +1,335 @@
+#include "jobSystem.h"
+
+#ifdef _WIN32
+#include "includes.h"
+#endif
+
+#include <cassert>
+#include <string>
+#include <thread>
+
+namespace
+{
+	// Idle workers yield this many times before they go to sleep
+	const uint32_t gSpinCount = 64;
+
+	// The thread's job system and index in it
+	thread_local JobSystem *tJobSystem = nullptr;
+	thread_local uint32_t tThreadIndex = 0;
+}
+
+// Chase-Lev deque of a fixed size. The owner pushes and pops at the bottom,
+// any thread steals from the top.
+class JobSystem::Deque
+{
+public:
+	Deque() :
+		m_jobs(new std::atomic<Job*>[gMaxJobsPerThread]),
+		m_top(0),
+		m_bottom(0)
+	{
+	}
+
+	// Owner only. False when full.
+	bool Push(Job *job)
+	{
+		int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+		int64_t top = m_top.load(std::memory_order_acquire);
+		if (bottom - top >= gMaxJobsPerThread)
+		{
+			return false;
+		}
+
+		m_jobs[bottom & (gMaxJobsPerThread - 1)].store(job, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Owner only
+	Job *Pop()
+	{
+		int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+		m_bottom.store(bottom, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t top = m_top.load(std::memory_order_relaxed);
+
+		if (top > bottom)
+		{
+			// Empty
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		Job *job = m_jobs[bottom & (gMaxJobsPerThread - 1)].load(std::memory_order_relaxed);
+		if (top == bottom)
+		{
+			// The last one, a thief may be taking it too
+			if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			{
+				job = nullptr;
+			}
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		}
+		return job;
+	}
+
+	// Any thread. Null when empty or when another thread got there first.
+	Job *Steal()
+	{
+		int64_t top = m_top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t bottom = m_bottom.load(std::memory_order_acquire);
+
+		if (top >= bottom)
+		{
+			return nullptr;
+		}
+
+		Job *job = m_jobs[top & (gMaxJobsPerThread - 1)].load(std::memory_order_relaxed);
+		if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			return nullptr;
+		}
+		return job;
+	}
+
+private:
+	std::unique_ptr<std::atomic<Job*>[]> m_jobs;
+	std::atomic<int64_t> m_top;
+	std::atomic<int64_t> m_bottom;
+};
+
+struct JobSystem::Thread
+{
+	Deque deque;
+
+	std::unique_ptr<Job[]> jobs;		// the ring jobs are allocated from
+	uint32_t nextJob;
+	uint32_t nextVictim;
+
+	std::atomic<uint64_t> executed;
+	std::atomic<uint64_t> steals;
+	std::atomic<uint64_t> sleeps;
+
+	std::thread thread;		// none for thread 0
+};
+
+JobSystem::JobSystem(uint32_t numWorkers, bool pinThreads) :
+	m_queuedJobs(0),
+	m_sleeping(0),
+	m_quit(false)
+{
+	for (uint32_t i = 0; i <= numWorkers; ++i)
+	{
+		std::unique_ptr<Thread> thread = std::make_unique<Thread>();
+		thread->jobs.reset(new Job[gMaxJobsPerThread]());
+		thread->nextJob = 0;
+		thread->nextVictim = i + 1;
+		thread->executed = 0;
+		thread->steals = 0;
+		thread->sleeps = 0;
+		m_threads.push_back(std::move(thread));
+	}
+
+	tJobSystem = this;
+	tThreadIndex = 0;
+
+	// Every thread is there before the first one can steal
+	for (uint32_t i = 1; i <= numWorkers; ++i)
+	{
+		Thread &thread = *m_threads[i];
+		thread.thread = std::thread(&JobSystem::WorkerThread, this, i);
+
+#ifdef _WIN32
+		HANDLE handle = thread.thread.native_handle();
+
+		std::wstring name = L"Job worker " + std::to_wstring(i);
+		::SetThreadDescription(handle, name.c_str());
+
+		if (pinThreads && i < sizeof(DWORD_PTR) * 8)
+		{
+			::SetThreadAffinityMask(handle, DWORD_PTR(1) << i);
+		}
+#else
+		(void)pinThreads;
+#endif
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_quit = true;
+	}
+	m_wakeCondition.notify_all();
+
+	for (size_t i = 1; i < m_threads.size(); ++i)
+	{
+		m_threads[i]->thread.join();
+	}
+
+	if (tJobSystem == this)
+	{
+		tJobSystem = nullptr;
+	}
+}
+
+void JobSystem::Run(Job *job)
+{
+	assert(tJobSystem == this);
+
+	if (!m_threads[tThreadIndex]->deque.Push(job))
+	{
+		// Too many jobs queued already, this one doesn't have to wait
+		Execute(job);
+		return;
+	}
+
+	m_queuedJobs++;
+	if (m_sleeping > 0)
+	{
+		// Taking the lock makes sure a worker about to sleep saw the job or is waiting
+		{
+			std::lock_guard<std::mutex> lock(m_sleepMutex);
+		}
+		m_wakeCondition.notify_one();
+	}
+}
+
+void JobSystem::Wait(const Job *job)
+{
+	assert(tJobSystem == this);
+
+	while (job->unfinished.load(std::memory_order_acquire) > 0)
+	{
+		Job *other = GetJob();
+		if (other)
+		{
+			Execute(other);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+JobSystem::Stats JobSystem::GetStats() const
+{
+	Stats stats = {};
+	for (const std::unique_ptr<Thread> &thread : m_threads)
+	{
+		stats.jobs += thread->executed.load(std::memory_order_relaxed);
+		stats.steals += thread->steals.load(std::memory_order_relaxed);
+		stats.sleeps += thread->sleeps.load(std::memory_order_relaxed);
+	}
+	return stats;
+}
+
+JobSystem::Job *JobSystem::AllocateJob(void (*function)(Job*), Job *parent)
+{
+	assert(tJobSystem == this);
+
+	Thread &thread = *m_threads[tThreadIndex];
+	Job *job = &thread.jobs[thread.nextJob++ & (gMaxJobsPerThread - 1)];
+	assert(job->unfinished.load(std::memory_order_relaxed) == 0 && "More than gMaxJobsPerThread jobs alive");
+
+	job->function = function;
+	job->parent = parent;
+	job->unfinished.store(1, std::memory_order_relaxed);
+
+	if (parent)
+	{
+		assert(parent->unfinished.load(std::memory_order_relaxed) > 0);
+		parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	return job;
+}
+
+JobSystem::Job *JobSystem::GetJob()
+{
+	Thread &thread = *m_threads[tThreadIndex];
+
+	Job *job = thread.deque.Pop();
+	if (job)
+	{
+		m_queuedJobs--;
+		return job;
+	}
+
+	// Start with a different victim every time so thieves spread out
+	uint32_t numThreads = GetNumThreads();
+	for (uint32_t i = 0; i < numThreads; ++i)
+	{
+		uint32_t victim = thread.nextVictim++ % numThreads;
+		if (victim == tThreadIndex)
+		{
+			continue;
+		}
+
+		job = m_threads[victim]->deque.Steal();
+		if (job)
+		{
+			m_queuedJobs--;
+			thread.steals.fetch_add(1, std::memory_order_relaxed);
+			return job;
+		}
+	}
+
+	return nullptr;
+}
+
+void JobSystem::Execute(Job *job)
+{
+	job->function(job);
+	m_threads[tThreadIndex]->executed.fetch_add(1, std::memory_order_relaxed);
+	Finish(job);
+}
+
+void JobSystem::Finish(Job *job)
+{
+	// The parent is finished with its last child
+	while (job && job->unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		job = job->parent;
+	}
+}
+
+void JobSystem::WorkerThread(uint32_t index)
+{
+	tJobSystem = this;
+	tThreadIndex = index;
+
+	Thread &thread = *m_threads[index];
+
+	uint32_t idle = 0;
+	while (!m_quit.load(std::memory_order_relaxed))
+	{
+		Job *job = GetJob();
+		if (job)
+		{
+			Execute(job);
+			idle = 0;
+			continue;
+		}
+
+		if (++idle < gSpinCount)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		// Nothing to steal for a while. Counting itself as sleeping before
+		// looking at the queued jobs means Run() either sees it or it sees the job.
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_sleeping++;
+		m_wakeCondition.wait(lock, [this]() { return m_quit || m_queuedJobs > 0; });
+		m_sleeping--;
+
+		thread.sleeps.fetch_add(1, std::memory_order_relaxed);
+		idle = 0;
+	}
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Frame work (update, culling, recording, uploads) split into small jobs run
+// by a fixed set of worker threads.
+//
+// Every thread has its own deque of jobs. It pushes and pops at the bottom,
+// so the job it runs next is the one it just made and is still in cache.
+// A thread whose deque is empty steals from the top of another one's, where
+// the oldest and usually biggest jobs are. The deques are lock free
+// (Chase-Lev); locks are only taken to put idle workers to sleep and wake
+// them up.
+//
+// A job created with a parent keeps the parent unfinished until it is
+// finished itself, so waiting for the parent waits for the whole tree.
+// Wait() runs other jobs while it waits instead of blocking, so jobs can
+// wait for their children.
+//
+// The thread that creates the JobSystem is thread 0: it runs jobs only while
+// it waits. Jobs can be created and waited for from it and from the workers
+// only.
+//
+// Jobs are never freed, they come from a ring per thread: a thread can have
+// at most gMaxJobsPerThread jobs that aren't finished at once.
+
+class JobSystem
+{
+public:
+	static const uint32_t gMaxJobsPerThread = 16 * 1024;	// power of two
+
+	struct Job
+	{
+		void (*function)(Job *job);
+		Job *parent;
+		uint8_t data[40];		// the function object
+		std::atomic<int32_t> unfinished;	// itself and its children
+	};
+
+	struct Stats
+	{
+		uint64_t jobs;			// run, on all threads
+		uint64_t steals;
+		uint64_t sleeps;		// times a worker ran out of jobs and slept
+	};
+
+	// numWorkers threads besides the calling one, named "Job worker <n>". With
+	// pinThreads worker n only runs on logical processor n, so the calling
+	// thread has processor 0 mostly to itself. Naming and pinning are Windows only.
+	JobSystem(uint32_t numWorkers, bool pinThreads = false);
+	// Jobs that haven't run by then are dropped
+	~JobSystem();
+
+	// The workers and the calling thread
+	uint32_t GetNumThreads() const { return static_cast<uint32_t>(m_threads.size()); }
+
+	// The function object is copied into the job and called with it, so it can
+	// make children of it. It has to be small and trivially destructible:
+	// capture by reference or capture a pointer to the data.
+	template <typename Function>
+	Job *CreateJob(const Function &function, Job *parent = nullptr)
+	{
+		static_assert(sizeof(Function) <= sizeof(Job::data), "The job's function object is too big");
+		static_assert(alignof(Function) <= alignof(void*), "The job's function object is over aligned");
+		static_assert(std::is_trivially_destructible<Function>::value, "The job's function object is never destroyed");
+
+		Job *job = AllocateJob(&Invoke<Function>, parent);
+		new (job->data) Function(function);
+		return job;
+	}
+
+	// Queues the job on the calling thread
+	void Run(Job *job);
+	// Runs jobs until this one and its children are finished
+	void Wait(const Job *job);
+
+	// Calls function(begin, end) over ranges of [0, count) of at least
+	// batchSize elements, on every thread, and waits for all of them
+	template <typename Function>
+	void ParallelFor(uint32_t count, uint32_t batchSize, const Function &function);
+
+	Stats GetStats() const;
+
+private:
+	class Deque;
+	struct Thread;
+
+	template <typename Function>
+	static void Invoke(Job *job)
+	{
+		(*reinterpret_cast<const Function*>(job->data))(job);
+	}
+
+	Job *AllocateJob(void (*function)(Job*), Job *parent);
+	// The calling thread's next job: its own, or stolen from another thread
+	Job *GetJob();
+	void Execute(Job *job);
+	void Finish(Job *job);
+	void WorkerThread(uint32_t index);
+
+	std::vector<std::unique_ptr<Thread>> m_threads;
+
+	std::atomic<int32_t> m_queuedJobs;		// in a deque
+	std::atomic<int32_t> m_sleeping;
+	std::atomic<bool> m_quit;
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wakeCondition;
+};
+
+template <typename Function>
+void JobSystem::ParallelFor(uint32_t count, uint32_t batchSize, const Function &function)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	// A few batches per thread so the ones that finish early can steal
+	uint32_t maxBatches = GetNumThreads() * 4;
+	batchSize = std::max(batchSize, (count + maxBatches - 1) / maxBatches);
+
+	if (batchSize >= count)
+	{
+		function(0u, count);
+		return;
+	}
+
+	// Never queued, only finished once the batches are queued
+	Job *root = AllocateJob(nullptr, nullptr);
+
+	const Function *body = &function;
+	for (uint32_t begin = 0; begin < count; begin += batchSize)
+	{
+		uint32_t end = std::min(count, begin + batchSize);
+		Run(CreateJob([body, begin, end](Job*) { (*body)(begin, end); }, root));
+	}
+
+	Finish(root);
+	Wait(root);
+}
@@ -1,7 +1,34 @@
 #include "includes.h"
+#include "benchmarks.h"
+#include "bindingLayout.h"
+#include "commandCapture.h"
+#include "commandStream.h"
+#include "fixedFunctionState.h"
+#include "fixedTimestep.h"
+#include "jobSystem.h"
+#include "pipelineCache.h"
+#include "pipelineCompiler.h"
+#include "pipelineVariants.h"
+#include "renderPass.h"
+#include "rootSignatureCache.h"
+#include "shaderCache.h"
+#include "shaderHotReload.h"
+#include "spatialGrid.h"
+#include "renderTargetPool.h"
+#include "transformHierarchy.h"
+#include "uploadRing.h"
+
+#include <fstream>
+#include <memory>
+#include <utility>
+#include <vector>
 
 const uint8_t gNumFrames = 3;	// number of swap chain back buffers - triple buffering
 bool gUseWarp = false;			// use WARP adapter (software rasterizer)
+bool gRunBenchmarks = false;	// run the CPU benchmarks instead of the window
+bool gDumpBindings = false;		// write the generated root signatures to bindings.txt instead of the window
+std::wstring gReplayPath;		// replay a command capture instead of the window
+uint32_t gCaptureFrames = 0;	// capture the first frames into gCapturePath
 
 uint32_t gClientWidth = 1280;
 uint32_t gClientHeight = 1080;
@@ -33,6 +60,93 @@ ComPtr<ID3D12DescriptorHeap> gRTVDescriptorHeap;	// each of these is a back buff
 UINT gRTVDescriptorSize;
 UINT gCurrBackBufferIdx;	// current back buffer index in the swap chain
 
+// Transient render targets, created with an optimized clear value
+// so that clearing them takes the fast path
+std::unique_ptr<RenderTargetPool> gRenderTargetPool;
+const uint32_t gMaxPooledTargets = 32;
+const FLOAT gClearColor[] = { 0.4f, 0.6f, 0.9f, 1.0f };
+// Window sized, acquired again when the window is resized
+RenderTargetPool::Handle gDepthBuffer = RenderTargetPool::InvalidHandle;
+
+// Per-frame data the shaders read, e.g. the objects' world matrices
+std::unique_ptr<UploadRing> gUploadRing;
+const uint64_t gUploadRingSize = 4 * 1024 * 1024;
+
+// Render pass descriptions are built once and reused every frame
+RenderPassCache gRenderPasses;
+RenderPassCache::PassId gBackBufferPasses[gNumFrames];
+
+// Identical root signatures are shared, serialized blobs are kept on disk
+std::unique_ptr<RootSignatureCache> gRootSignatureCache;
+const wchar_t *gRootSignatureCachePath = L"rootsignatures.cache";
+// Root signatures generated from shader reflection, by shader hash
+std::unique_ptr<BindingLayoutCache> gBindingLayouts;
+
+// Compiled shaders are kept on disk under the hash of their source and includes
+std::unique_ptr<ShaderCache> gShaderCache;
+const wchar_t *gShaderCachePath = L"shadercache";
+// Saving a shader rebuilds the pipelines that use it without restarting
+std::unique_ptr<ShaderHotReload> gShaderHotReload;
+const char *gShaderDirectory = "shaders";
+
+// Compiled pipelines are kept on disk between runs
+std::unique_ptr<PipelineStateCache> gPipelineCache;
+const wchar_t *gPipelineCachePath = L"pipelines.cache";
+// Pipelines are compiled in the background, the render thread never waits for them
+std::unique_ptr<PipelineCompiler> gPipelineCompiler;
+// Variants used in this session are recorded and compiled up front next time
+std::vector<PipelineVariantSet*> gPipelineVariantSets;
+const wchar_t *gPipelineVariantsPath = L"pipelines.variants";
+
+// The scene is drawn by one pipeline, with an opaque and a transparent
+// variant. Its root signature is generated from what the shaders bind, the
+// draws find their parameters by the names scene.hlsl uses.
+std::shared_ptr<const BindingLayout> gSceneLayout;
+ComPtr<ID3D12RootSignature> gSceneRootSignature;
+UINT gSceneConstantsParameter = 0;					// SceneConstants, the view projection
+UINT gSceneInstancesParameter = 0;					// gInstances, world matrix and color of every object
+const UINT gSceneConstantsDwords = sizeof(DirectX::XMFLOAT4X4) / sizeof(UINT);
+ShaderCache::ShaderPtr gSceneShaders[2];			// vertex, pixel
+// Replaced by hot reload, kept until the variants compiling with them are done
+std::vector<ShaderCache::ShaderPtr> gRetiredSceneShaders;
+std::unique_ptr<PipelineVariantSet> gScenePipelines;
+
+const PipelineVariantKey gOpaqueKey = {};
+const PipelineVariantKey gTransparentKey = { PipelineVariantKey::BLEND_ALPHA, PipelineVariantKey::DEPTH_READ,
+	PipelineVariantKey::CULL_BASE, 0 };
+
+// The scene is recorded into a command stream and translated into the
+// command list, which is where -capture picks the frames up
+CommandStream gSceneStream;
+std::unique_ptr<CommandTranslator> gCommandTranslator;
+std::unique_ptr<CommandCapture> gCommandCapture;
+const wchar_t *gCapturePath = L"frame.capture";
+
+// What the vertex shader reads for every object
+struct SceneInstance
+{
+	DirectX::XMFLOAT4X4 world;
+	DirectX::XMFLOAT4 color;
+};
+
+// Update, culling, recording and uploads fan out into jobs on every core
+std::unique_ptr<JobSystem> gJobSystem;
+
+// Every object's place in the scene, relative to its parent
+TransformHierarchy gTransforms;
+// The scene: rings of cubes, each ring turning around its center
+const uint32_t gNumRings = 4;
+const uint32_t gCubesPerRing = 16;
+TransformHierarchy::Node gRingNodes[gNumRings];
+double gSceneSeconds = 0.0;		// simulated, advances by fixed steps
+// Object i is drawn in gObjectColors[i], the ones with alpha < 1 blended
+std::vector<DirectX::XMFLOAT4> gObjectColors;
+// Object i of the grid follows gObjectNodes[i], for picking and streaming
+SpatialGrid gObjectGrid(4.0f);
+std::vector<TransformHierarchy::Node> gObjectNodes;
+// The scene is simulated at 60 Hz whatever the frame rate
+FixedTimestep gTimestep(1.0 / 60.0);
+
 // Sync objects
 ComPtr<ID3D12Fence> gFence;
 uint64_t gFenceValue = 0;				// next fence value to signal the command queue
@@ -58,25 +172,40 @@ void ParseCommandLineArguments()
 	int argc;
 	wchar_t **argv = ::CommandLineToArgvW(::GetCommandLineW(), &argc);
 
-	for (size_t i = 0; i < argc; ++i)
+	for (int i = 1; i < argc; ++i)
 	{
 		wchar_t *flag = argv[i];
-		wchar_t *value = argv[++i];
-		if (::wcscmp(flag, L"-w") == 0 || ::wcscmp(flag, L"-width") == 0)
+		if ((::wcscmp(flag, L"-w") == 0 || ::wcscmp(flag, L"-width") == 0) && i + 1 < argc)
 		{
-			gClientWidth = ::wcstol(value, nullptr, 10);
+			gClientWidth = ::wcstol(argv[++i], nullptr, 10);
 		}
-		if (::wcscmp(flag, L"-h") == 0 || ::wcscmp(flag, L"-height") == 0)
+		if ((::wcscmp(flag, L"-h") == 0 || ::wcscmp(flag, L"-height") == 0) && i + 1 < argc)
 		{
-			gClientHeight = ::wcstol(value, nullptr, 10);
+			gClientHeight = ::wcstol(argv[++i], nullptr, 10);
 		}
-		if (::wcscmp(flag, L"-warp") == 0 || ::wcscmp(flag, L"--width") == 0)
+		if (::wcscmp(flag, L"-warp") == 0 || ::wcscmp(flag, L"--warp") == 0)
 		{
 			gUseWarp = true;
 		}
-
-		::LocalFree(argv);
+		if (::wcscmp(flag, L"-bench") == 0)
+		{
+			gRunBenchmarks = true;
+		}
+		if (::wcscmp(flag, L"-bindings") == 0)
+		{
+			gDumpBindings = true;
+		}
+		if (::wcscmp(flag, L"-replay") == 0 && i + 1 < argc)
+		{
+			gReplayPath = argv[++i];
+		}
+		if (::wcscmp(flag, L"-capture") == 0 && i + 1 < argc)
+		{
+			gCaptureFrames = ::wcstol(argv[++i], nullptr, 10);
+		}
 	}
+
+	::LocalFree(argv);
 }
 
 // Want to make sure that the device is created 
@@ -231,7 +360,10 @@ ComPtr<ID3D12Device2> CreateDevice(ComPtr<IDXGIAdapter4> adapter)
 	};
 
 	D3D12_MESSAGE_ID DenyIds[] = {
-			D3D12_MESSAGE_ID_CLEARRENDERTARGETVIEW_MISMATCHINGCLEARVALUE,   // I'm really not sure how to avoid this message.
+			// Stays denied: DXGI creates the back buffers without an optimized clear
+			// value, so every clear of them is reported and no clear color can match.
+			// Depth clears (CLEARDEPTHSTENCILVIEW_MISMATCHINGCLEARVALUE) are still reported.
+			D3D12_MESSAGE_ID_CLEARRENDERTARGETVIEW_MISMATCHINGCLEARVALUE,
 			D3D12_MESSAGE_ID_MAP_INVALID_NULLRANGE,                         // This warning occurs when using capture frame while graphics debugging.
 			D3D12_MESSAGE_ID_UNMAP_INVALID_NULLRANGE,                       // This warning occurs when using capture frame while graphics debugging.
 	}; 
@@ -447,6 +579,195 @@ void Flush(ComPtr<ID3D12CommandQueue> commandQueue, ComPtr<ID3D12Fence> fence,
 	WaitForFenceValue(fence, fenceValueForSignal, fenceEvent);
 }
 
+CD3DX12_PIPELINE_STATE_STREAM MakeSceneStream(const ShaderCache::ShaderPtr &vertexShader,
+	const ShaderCache::ShaderPtr &pixelShader)
+{
+	CD3DX12_PIPELINE_STATE_STREAM stream;
+	gFixedFunctionDefault.Apply(stream);
+	stream.pRootSignature = gSceneRootSignature.Get();
+	stream.VS = vertexShader->GetBytecode();
+	stream.PS = pixelShader->GetBytecode();
+	return stream;
+}
+
+// Hot reload built the scene pipeline with new shaders, every variant is
+// compiled again with them and drawn with the old one until it's ready
+void SwapSceneShaders(const std::vector<ShaderCache::ShaderPtr> &shaders)
+{
+	gRetiredSceneShaders.push_back(gSceneShaders[0]);
+	gRetiredSceneShaders.push_back(gSceneShaders[1]);
+	gSceneShaders[0] = shaders[0];
+	gSceneShaders[1] = shaders[1];
+
+	gScenePipelines->SetBase(MakeSceneStream(gSceneShaders[0], gSceneShaders[1]));
+}
+
+// The variant set has to be registered before the variants of the last
+// session are prewarmed. The shaders are needed for the base stream, so
+// this waits for them.
+bool CreateScenePipelines()
+{
+	std::string path = std::string(gShaderDirectory) + "/scene.hlsl";
+	std::vector<ShaderDesc> shaderDescs =
+	{
+		{ path, "VSMain", "vs_5_1", {}, 0 },
+		{ path, "PSMain", "ps_5_1", {}, 0 },
+	};
+	ShaderCache::Future vertexShader = gShaderCache->Compile(shaderDescs[0]);
+	ShaderCache::Future pixelShader = gShaderCache->Compile(shaderDescs[1]);
+	gSceneShaders[0] = vertexShader.get();
+	gSceneShaders[1] = pixelShader.get();
+
+	for (const ShaderCache::ShaderPtr &shader : gSceneShaders)
+	{
+		if (shader->key == 0)
+		{
+			::OutputDebugString(shader->errors.c_str());
+			return false;
+		}
+	}
+
+	// Hot reload keeps this root signature, editing what the shaders bind
+	// needs a restart
+	D3D12_SHADER_BYTECODE bytecode[] = { gSceneShaders[0]->GetBytecode(), gSceneShaders[1]->GetBytecode() };
+	gSceneLayout = gBindingLayouts->GetOrCreate(bytecode, _countof(bytecode));
+	gSceneRootSignature = gSceneLayout->rootSignature;
+	uint64_t rootSignatureKey = gSceneLayout->rootSignatureKey;
+
+	const BindingLayout::Binding *constants = gSceneLayout->Find("SceneConstants");
+	const BindingLayout::Binding *instances = gSceneLayout->Find("gInstances");
+	if (!constants || constants->type != D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS ||
+		!instances || instances->type != D3D12_ROOT_PARAMETER_TYPE_SRV)
+	{
+		::OutputDebugString("scene.hlsl doesn't bind the root constants and the root SRV the draws set:\n");
+		::OutputDebugString(gSceneLayout->description.c_str());
+		return false;
+	}
+	gSceneConstantsParameter = constants->rootParameter;
+	gSceneInstancesParameter = instances->rootParameter;
+
+	gScenePipelines = std::make_unique<PipelineVariantSet>("scene", MakeSceneStream(gSceneShaders[0], gSceneShaders[1]),
+		rootSignatureKey, gPipelineCache.get(), gPipelineCompiler.get());
+	gPipelineVariantSets.push_back(gScenePipelines.get());
+
+	// The hot reload pipeline is the base variant, the set follows it when
+	// the shaders change
+	gShaderHotReload->Register(shaderDescs, rootSignatureKey,
+		[](const std::vector<ShaderCache::ShaderPtr> &shaders) { return MakeSceneStream(shaders[0], shaders[1]); },
+		SwapSceneShaders);
+	return true;
+}
+
+// The caches and compilers the pipelines come from, and the scene's
+// pipelines. The replay uses them too, to find the captured pipelines again.
+bool CreatePipelines(ComPtr<IDXGIAdapter4> adapter)
+{
+	gShaderCache = std::make_unique<ShaderCache>(std::make_unique<D3DShaderCompiler>(), gShaderCachePath,
+		std::max(1u, std::thread::hardware_concurrency() / 2));
+	gRootSignatureCache = std::make_unique<RootSignatureCache>(gDevice, gRootSignatureCachePath);
+	gBindingLayouts = std::make_unique<BindingLayoutCache>(gRootSignatureCache.get());
+	gPipelineCache = std::make_unique<PipelineStateCache>(gDevice, adapter, gPipelineCachePath);
+	gPipelineCompiler = std::make_unique<PipelineCompiler>(
+		[](const D3D12_PIPELINE_STATE_STREAM_DESC &desc, uint64_t rootSignatureKey)
+		{
+			return gPipelineCache->GetOrCreate(desc, rootSignatureKey);
+		},
+		std::max(1u, std::thread::hardware_concurrency() / 2));
+
+	gShaderHotReload = std::make_unique<ShaderHotReload>(gShaderCache.get(), gPipelineCompiler.get(),
+		std::make_unique<DirectoryWatcher>());
+	gShaderHotReload->Watch(gShaderDirectory);
+
+	bool created = CreateScenePipelines();
+	PipelineVariantSet::PrewarmVariants(gPipelineVariantsPath, gPipelineVariantSets);
+	return created;
+}
+
+void DestroyPipelines()
+{
+	PipelineVariantSet::SaveUsedVariants(gPipelineVariantsPath, gPipelineVariantSets);
+	gPipelineVariantSets.clear();
+	gScenePipelines.reset();
+	gSceneRootSignature.Reset();
+	gSceneLayout.reset();
+
+	gShaderHotReload.reset();
+
+	// Finish what's queued so it ends up in the pipeline library
+	gPipelineCompiler->WaitIdle();
+	gPipelineCompiler.reset();
+	gRetiredSceneShaders.clear();
+
+	gPipelineCache->Save();
+	gPipelineCache.reset();
+
+	gBindingLayouts.reset();
+
+	gRootSignatureCache->Save();
+	gRootSignatureCache.reset();
+
+	gShaderCache->WaitIdle();
+	gShaderCache.reset();
+}
+
+// The cubes are children of their ring so turning the ring moves all of
+// them, the grid starts out with where they are
+void CreateScene()
+{
+	using namespace DirectX;
+
+	const XMFLOAT4 identity(0.0f, 0.0f, 0.0f, 1.0f);
+
+	gTransforms.Reserve(gNumRings * (gCubesPerRing + 1));
+	for (uint32_t ring = 0; ring < gNumRings; ++ring)
+	{
+		XMFLOAT3 center(12.0f * ring - 18.0f, 2.0f * (ring % 2), 0.0f);
+		gRingNodes[ring] = gTransforms.Add(TransformHierarchy::gNoParent, center, identity, XMFLOAT3(1.0f, 1.0f, 1.0f));
+
+		for (uint32_t i = 0; i < gCubesPerRing; ++i)
+		{
+			float angle = XM_2PI * i / gCubesPerRing;
+			XMFLOAT3 position(5.0f * cosf(angle), 0.0f, 5.0f * sinf(angle));
+			gObjectNodes.push_back(gTransforms.Add(gRingNodes[ring], position, identity, XMFLOAT3(0.5f, 0.5f, 0.5f)));
+
+			// Every fourth cube of a ring is glass
+			float shade = static_cast<float>(i) / gCubesPerRing;
+			gObjectColors.push_back(XMFLOAT4(0.3f + 0.7f * shade, 0.2f + 0.2f * ring, 1.0f - 0.7f * shade,
+				i % 4 == 3 ? 0.5f : 1.0f));
+		}
+	}
+
+	gTransforms.Update(gJobSystem.get());
+
+	std::vector<XMFLOAT3> positions(gObjectNodes.size());
+	for (size_t i = 0; i < gObjectNodes.size(); ++i)
+	{
+		const XMFLOAT4X4 &world = gTransforms.GetWorld(gObjectNodes[i]);
+		positions[i] = XMFLOAT3(world._41, world._42, world._43);
+	}
+	gObjectGrid.Build(positions.data(), static_cast<uint32_t>(positions.size()), gJobSystem.get());
+}
+
+// One fixed step of the simulation
+void StepScene(double stepSeconds)
+{
+	using namespace DirectX;
+
+	gSceneSeconds += stepSeconds;
+
+	// Neighbouring rings turn the other way
+	for (uint32_t ring = 0; ring < gNumRings; ++ring)
+	{
+		float speed = (ring % 2 ? -1.0f : 1.0f) * (0.5f + 0.25f * ring);
+		XMFLOAT4 rotation;
+		XMStoreFloat4(&rotation, XMQuaternionRotationRollPitchYaw(0.0f, speed * static_cast<float>(gSceneSeconds), 0.0f));
+		gTransforms.SetRotation(gRingNodes[ring], rotation);
+	}
+
+	gTransforms.Update(gJobSystem.get());
+	gObjectGrid.Update(gTransforms, gObjectNodes.data(), gJobSystem.get());
+}
+
 void Update()
 {
 	static uint64_t frameCounter = 0;
@@ -460,7 +781,9 @@ void Update()
 
 	t0 = t1;
 
-	elapsedSeconds += deltaTime.count() * 1e-9;
+	double deltaSeconds = std::chrono::duration<double>(deltaTime).count();
+
+	elapsedSeconds += deltaSeconds;
 	if (elapsedSeconds > 1)
 	{
 		char buffer[500];
@@ -472,6 +795,137 @@ void Update()
 		frameCounter = 0;
 		elapsedSeconds = 0.0;
 	}
+
+	// DrawScene blends the last two steps by gTimestep.GetAlpha()
+	uint32_t steps = gTimestep.Advance(deltaSeconds);
+	for (uint32_t i = 0; i < steps; ++i)
+	{
+		StepScene(gTimestep.GetStep());
+	}
+}
+
+// Every object is drawn with its world matrix blended between the last two
+// fixed steps: the opaque ones first, then the transparent ones back to
+// front over them. Draws are skipped until their variant is compiled.
+void DrawScene(CommandStream &stream)
+{
+	using namespace DirectX;
+
+	if (!gScenePipelines)
+	{
+		return;
+	}
+
+	ID3D12PipelineState *opaque = gScenePipelines->Get(gOpaqueKey);
+	ID3D12PipelineState *transparent = gScenePipelines->Get(gTransparentKey);
+
+	XMVECTOR eye = XMVectorSet(0.0f, 14.0f, -30.0f, 1.0f);
+	XMMATRIX view = XMMatrixLookAtLH(eye, XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	XMMATRIX projection = XMMatrixPerspectiveFovLH(XM_PIDIV4,
+		static_cast<float>(gClientWidth) / static_cast<float>(gClientHeight), 0.1f, 200.0f);
+	XMFLOAT4X4 viewProjection;
+	XMStoreFloat4x4(&viewProjection, XMMatrixMultiply(view, projection));
+
+	// Opaque objects first, then the transparent ones farthest first
+	static std::vector<SceneInstance> instances;
+	static std::vector<std::pair<float, uint32_t>> transparentObjects;		// minus the distance, object
+	static std::vector<uint32_t> order;
+	uint32_t numObjects = static_cast<uint32_t>(gObjectNodes.size());
+	instances.resize(numObjects);
+	transparentObjects.clear();
+	order.clear();
+
+	float alpha = gTimestep.GetAlpha();
+	for (uint32_t i = 0; i < numObjects; ++i)
+	{
+		XMMATRIX world = gTransforms.GetInterpolatedWorld(gObjectNodes[i], alpha);
+		XMStoreFloat4x4(&instances[i].world, world);
+		instances[i].color = gObjectColors[i];
+
+		if (gObjectColors[i].w < 1.0f)
+		{
+			float distance = XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(world.r[3], eye)));
+			transparentObjects.push_back(std::make_pair(-distance, i));
+		}
+		else
+		{
+			order.push_back(i);
+		}
+	}
+
+	uint32_t numOpaque = static_cast<uint32_t>(order.size());
+	uint32_t numTransparent = static_cast<uint32_t>(transparentObjects.size());
+	std::sort(transparentObjects.begin(), transparentObjects.end());
+	for (const std::pair<float, uint32_t> &object : transparentObjects)
+	{
+		order.push_back(object.second);
+	}
+
+	UploadRing::Allocation allocation;
+	if (numObjects == 0 || !gUploadRing->Allocate(sizeof(SceneInstance) * numObjects,
+		D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT, allocation))
+	{
+		return;
+	}
+
+	SceneInstance *uploaded = static_cast<SceneInstance*>(allocation.cpu);
+	for (uint32_t i = 0; i < numObjects; ++i)
+	{
+		uploaded[i] = instances[order[i]];
+	}
+
+	CD3DX12_VIEWPORT viewport(0.0f, 0.0f, static_cast<float>(gClientWidth), static_cast<float>(gClientHeight));
+	CD3DX12_RECT scissorRect(0, 0, LONG_MAX, LONG_MAX);
+	stream.RSSetViewports(1, &viewport);
+	stream.RSSetScissorRects(1, &scissorRect);
+	stream.IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	stream.SetGraphicsRootSignature(gSceneRootSignature.Get());
+	stream.SetGraphicsRoot32BitConstants(gSceneConstantsParameter, gSceneConstantsDwords, &viewProjection, 0);
+
+	// SV_InstanceID starts at 0 for every draw, so the second one starts the buffer further in
+	if (opaque && numOpaque > 0)
+	{
+		stream.SetPipelineState(opaque);
+		stream.SetGraphicsRootShaderResourceView(gSceneInstancesParameter, allocation.gpu);
+		stream.DrawInstanced(36, numOpaque, 0, 0);
+	}
+	if (transparent && numTransparent > 0)
+	{
+		stream.SetPipelineState(transparent);
+		stream.SetGraphicsRootShaderResourceView(gSceneInstancesParameter,
+			allocation.gpu + sizeof(SceneInstance) * numOpaque);
+		stream.DrawInstanced(36, numTransparent, 0, 0);
+	}
+}
+
+// The captured frames should draw everything, so the scene's variants are
+// compiled first. The objects' data is only reached through addresses in the
+// upload ring, so the ring is added by hand.
+void StartCapture()
+{
+	gCommandCapture = std::make_unique<CommandCapture>(gRootSignatureCache.get());
+	gCommandTranslator->SetCapture(gCommandCapture.get());
+	gCommandCapture->Start(gCapturePath, gCaptureFrames);
+	gCommandCapture->AddResource(gUploadRing->GetResource());
+
+	if (gScenePipelines)
+	{
+		const PipelineVariantKey keys[] = { gOpaqueKey, gTransparentKey };
+		for (const PipelineVariantKey &key : keys)
+		{
+			gScenePipelines->GetPipelineKey(key);
+		}
+		gPipelineCompiler->WaitIdle();
+
+		for (const PipelineVariantKey &key : keys)
+		{
+			ID3D12PipelineState *pipeline = gScenePipelines->Get(key);
+			if (pipeline)
+			{
+				gCommandCapture->AddPipelineState(pipeline, gScenePipelines->GetPipelineKey(key));
+			}
+		}
+	}
 }
 
 void Render()
@@ -484,6 +938,8 @@ void Render()
 	gCommandList->Reset(commandAllocator.Get(), nullptr);
 
 	// Clear the render target.
+	// The clear happens as the beginning access of the back buffer pass,
+	// render passes don't transition resources so the barrier stays.
 	{
 		CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
 			backBuffer.Get(),
@@ -491,11 +947,16 @@ void Render()
 
 		gCommandList->ResourceBarrier(1, &barrier);
 
-		FLOAT clearColor[] = { 0.4f, 0.6f, 0.9f, 1.0f };
-		CD3DX12_CPU_DESCRIPTOR_HANDLE rtv(gRTVDescriptorHeap->GetCPUDescriptorHandleForHeapStart(),
-			gCurrBackBufferIdx, gRTVDescriptorSize);
+		gRenderPasses.Begin(gCommandList.Get(), gBackBufferPasses[gCurrBackBufferIdx]);
+
+		gSceneStream.Reset();
+		DrawScene(gSceneStream);
+
+		const CommandStream *const streams[] = { &gSceneStream };
+		ID3D12GraphicsCommandList *const sceneLists[] = { gCommandList.Get() };
+		gCommandTranslator->Translate(streams, _countof(streams), sceneLists, _countof(sceneLists));
 
-		gCommandList->ClearRenderTargetView(rtv, clearColor, 0, nullptr);
+		gRenderPasses.End(gCommandList.Get());
 	}
 
 	// Present
@@ -512,15 +973,62 @@ void Render()
 		};
 		gCommandQueue->ExecuteCommandLists(_countof(commandLists), commandLists);
 
+		// The upload ring holds what this frame's draws read until the next one writes into it
+		if (gCommandCapture)
+		{
+			gCommandCapture->EndFrame();
+		}
+
 		UINT syncInterval = gVsync ? 1 : 0;
 		UINT presentFlags = gTearingSupport && !gVsync ? DXGI_PRESENT_ALLOW_TEARING : 0;
 		ThrowIfFailed(gSwapChain->Present(syncInterval, presentFlags));
 
 		gFrameFenceValues[gCurrBackBufferIdx] = Signal(gCommandQueue, gFence, gFenceValue);
+		gUploadRing->EndFrame(gFrameFenceValues[gCurrBackBufferIdx]);
 
 		gCurrBackBufferIdx = gSwapChain->GetCurrentBackBufferIndex();
 
 		WaitForFenceValue(gFence, gFrameFenceValues[gCurrBackBufferIdx], gFenceEvent);
+
+		// Pooled targets released by finished frames can be handed out again
+		gRenderTargetPool->Retire(gFence->GetCompletedValue());
+		gUploadRing->Retire(gFence->GetCompletedValue());
+
+		// Between frames, the next one sees either the old pipelines or the new ones
+		gShaderHotReload->Update(gFenceValue, gFence->GetCompletedValue());
+
+		PipelineCompiler::Stats compilerStats = gPipelineCompiler->GetStats();
+		if (compilerStats.queueDepth == 0 && compilerStats.inFlight == 0)
+		{
+			gRetiredSceneShaders.clear();
+		}
+	}
+}
+
+// Back buffers are cleared when the pass begins and kept for Present, the
+// depth buffer is cleared and discarded. The RTV slots don't change on
+// resize but the depth buffer does, so the passes are registered again.
+void CreateDepthBuffer()
+{
+	CD3DX12_RESOURCE_DESC depthDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_D32_FLOAT, gClientWidth, gClientHeight,
+		1, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL);
+	gDepthBuffer = gRenderTargetPool->Acquire(depthDesc, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+
+	gRenderPasses.Clear();
+	for (int i = 0; i < gNumFrames; ++i)
+	{
+		CD3DX12_CPU_DESCRIPTOR_HANDLE rtv(gRTVDescriptorHeap->GetCPUDescriptorHandleForHeapStart(),
+			i, gRTVDescriptorSize);
+
+		RenderPassDesc pass;
+		pass.AddRenderTarget(rtv,
+			RenderPassAccess::Clear(CD3DX12_CLEAR_VALUE(DXGI_FORMAT_R8G8B8A8_UNORM, gClearColor)),
+			RenderPassAccess::EndPreserve());
+		pass.SetDepthStencil(gRenderTargetPool->GetView(gDepthBuffer),
+			RenderPassAccess::Clear(gRenderTargetPool->GetClearValue(gDepthBuffer)), RenderPassAccess::EndDiscard(),
+			RenderPassAccess::NoAccess(), RenderPassAccess::EndNoAccess());
+
+		gBackBufferPasses[i] = gRenderPasses.Register(pass);
 	}
 }
 
@@ -556,6 +1064,13 @@ void Resize(uint32_t width, uint32_t height)
 		gCurrBackBufferIdx = gSwapChain->GetCurrentBackBufferIndex();
 
 		UpdateRTVs(gDevice, gSwapChain, gRTVDescriptorHeap);
+
+		// Window sized targets are useless now, the GPU is idle so drop them
+		gRenderTargetPool->Release(gDepthBuffer, gFence->GetCompletedValue());
+		gRenderTargetPool->Retire(gFence->GetCompletedValue());
+		gRenderTargetPool->Trim();
+
+		CreateDepthBuffer();
 	}
 }
 
@@ -699,6 +1214,61 @@ int CALLBACK wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdL
 	ComPtr<IDXGIAdapter4> dxgiAdapter4 = GetAdapter(gUseWarp);
  
 	gDevice = CreateDevice(dxgiAdapter4);
+
+	// This thread is one of them, the workers get the other cores
+	gJobSystem = std::make_unique<JobSystem>(std::max(1u, std::thread::hardware_concurrency()) - 1, true);
+ 
+	if (gRunBenchmarks)
+	{
+		uint32_t failures = Benchmarks::Run(gDevice, *gJobSystem);
+		gJobSystem.reset();
+		::DestroyWindow(gHWnd);
+		return failures == 0 ? 0 : 1;
+	}
+
+	if (gDumpBindings)
+	{
+		// The root signatures the app's shaders generate, to check a shader
+		// change against without running the scene
+		bool created = CreatePipelines(dxgiAdapter4);
+		std::string description = gBindingLayouts->Describe();
+		::OutputDebugString(description.c_str());
+
+		std::ofstream file("bindings.txt", std::ios::trunc);
+		file << description;
+
+		DestroyPipelines();
+		gJobSystem.reset();
+		::DestroyWindow(gHWnd);
+		return created ? 0 : 1;
+	}
+
+	if (!gReplayPath.empty())
+	{
+		// The captured pipeline keys are the scene's variant keys, compile
+		// the ones a capture records so the replay can look them up
+		CreatePipelines(dxgiAdapter4);
+		if (gScenePipelines)
+		{
+			gScenePipelines->GetPipelineKey(gOpaqueKey);
+			gScenePipelines->GetPipelineKey(gTransparentKey);
+		}
+		gPipelineCompiler->WaitIdle();
+
+		CommandReplay replay(gDevice, [](uint64_t key) { return gPipelineCompiler->Get(key); });
+		if (replay.Load(gReplayPath))
+		{
+			std::string report = CommandReplay::Describe(replay.Run(10));
+			::OutputDebugString(report.c_str());
+
+			std::ofstream file("replay.txt", std::ios::trunc);
+			file << report;
+		}
+		DestroyPipelines();
+		gJobSystem.reset();
+		::DestroyWindow(gHWnd);
+		return 0;
+	}
  
 	gCommandQueue = CreateCommandQueue(gDevice, D3D12_COMMAND_LIST_TYPE_DIRECT);
  
@@ -722,6 +1292,27 @@ int CALLBACK wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdL
 	gFence = CreateFence(gDevice);
 	gFenceEvent = CreateEventHandle();
 
+	if (!CreatePipelines(dxgiAdapter4))
+	{
+		::MessageBoxA(gHWnd, "The scene shaders failed to compile, see the debugger output", "Error", MB_OK | MB_ICONERROR);
+	}
+
+	gRenderTargetPool = std::make_unique<RenderTargetPool>(gDevice, gMaxPooledTargets);
+	gRenderTargetPool->RegisterClearValue(DXGI_FORMAT_R8G8B8A8_UNORM, gClearColor);
+	gRenderTargetPool->RegisterClearValue(DXGI_FORMAT_D32_FLOAT, 1.0f, 0);
+
+	CreateDepthBuffer();
+
+	gUploadRing = std::make_unique<UploadRing>(gDevice, gUploadRingSize);
+	gCommandTranslator = std::make_unique<CommandTranslator>(gJobSystem.get());
+
+	CreateScene();
+
+	if (gCaptureFrames > 0)
+	{
+		StartCapture();
+	}
+
 	gIsInitialized = true;
 
 	::ShowWindow(gHWnd, SW_SHOW);
@@ -739,6 +1330,15 @@ int CALLBACK wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdL
 	// Make sure the command queue has finished all commands before closing.
 	Flush(gCommandQueue, gFence, gFenceValue, gFenceEvent);
 
+	gCommandTranslator.reset();
+	gCommandCapture.reset();
+	gUploadRing.reset();
+	gRenderTargetPool.reset();
+
+	DestroyPipelines();
+
+	gJobSystem.reset();
+
 	::CloseHandle(gFenceEvent);
 
 	return 0;
@@ -0,0 +1,373 @@
+#include "occlusionCuller.h"
+#include "jobSystem.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+using namespace DirectX;
+
+namespace
+{
+	// Objects per job when testing
+	const uint32_t gTestBlockSize = 1024;
+}
+
+OcclusionCuller::OcclusionCuller(uint32_t width, uint32_t height) :
+	m_width(width),
+	m_height(height),
+	m_tilesX(width / gTileSize),
+	m_tilesY(height / gTileSize),
+	m_numVisible(0),
+	m_stats()
+{
+	assert(width % gTileSize == 0 && height % gTileSize == 0);
+
+	for (uint32_t level = 0; level < gNumLevels; ++level)
+	{
+		m_levels[level].resize((width >> level) * (height >> level), 1.0f);
+	}
+	m_bins.resize(m_tilesX * m_tilesY);
+
+	XMStoreFloat4x4(&m_viewProjection, XMMatrixIdentity());
+}
+
+void OcclusionCuller::Begin(FXMMATRIX viewProjection)
+{
+	XMStoreFloat4x4(&m_viewProjection, viewProjection);
+
+	m_triangles.clear();
+	for (std::vector<uint32_t> &bin : m_bins)
+	{
+		bin.clear();
+	}
+
+	m_stats.occluderTriangles = 0;
+	m_stats.binnedTriangles = 0;
+}
+
+void OcclusionCuller::AddOccluder(const XMFLOAT3 *vertices, uint32_t numVertices, const uint32_t *indices,
+	uint32_t numIndices, FXMMATRIX world)
+{
+	XMMATRIX transform = XMMatrixMultiply(world, XMLoadFloat4x4(&m_viewProjection));
+
+	m_clip.resize(numVertices);
+	for (uint32_t i = 0; i < numVertices; ++i)
+	{
+		XMStoreFloat4(&m_clip[i], XMVector3Transform(XMLoadFloat3(&vertices[i]), transform));
+	}
+
+	float width = static_cast<float>(m_width);
+	float height = static_cast<float>(m_height);
+
+	for (uint32_t i = 0; i + 2 < numIndices; i += 3)
+	{
+		const XMFLOAT4 *clip[3] = { &m_clip[indices[i]], &m_clip[indices[i + 1]], &m_clip[indices[i + 2]] };
+		if (clip[0]->z < 0.0f || clip[1]->z < 0.0f || clip[2]->z < 0.0f)
+		{
+			continue;
+		}
+
+		float x[3], y[3], z[3];
+		for (uint32_t k = 0; k < 3; ++k)
+		{
+			float invW = 1.0f / clip[k]->w;
+			x[k] = (clip[k]->x * invW * 0.5f + 0.5f) * width;
+			y[k] = (0.5f - clip[k]->y * invW * 0.5f) * height;
+			z[k] = clip[k]->z * invW;
+		}
+
+		// Both windings, turned so the edges are positive inside
+		float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+		if (area < 0.0f)
+		{
+			std::swap(x[1], x[2]);
+			std::swap(y[1], y[2]);
+			std::swap(z[1], z[2]);
+			area = -area;
+		}
+		if (area <= 0.0f)
+		{
+			continue;
+		}
+
+		Triangle triangle;
+		triangle.minX = std::min(x[0], std::min(x[1], x[2]));
+		triangle.minY = std::min(y[0], std::min(y[1], y[2]));
+		triangle.maxX = std::max(x[0], std::max(x[1], x[2]));
+		triangle.maxY = std::max(y[0], std::max(y[1], y[2]));
+
+		if (triangle.maxX <= 0.0f || triangle.maxY <= 0.0f || triangle.minX >= width || triangle.minY >= height)
+		{
+			continue;
+		}
+
+		// Edge k goes from vertex k to the next one
+		for (uint32_t k = 0; k < 3; ++k)
+		{
+			uint32_t next = (k + 1) % 3;
+			float a = y[k] - y[next];
+			float b = x[next] - x[k];
+			triangle.edges[k][0] = a;
+			triangle.edges[k][1] = b;
+			triangle.edges[k][2] = -(a * x[k] + b * y[k]);
+		}
+
+		// The barycentric weights of vertices 1 and 2 are the edges facing them
+		float dz1 = (z[1] - z[0]) / area;
+		float dz2 = (z[2] - z[0]) / area;
+		triangle.depth[0] = dz1 * triangle.edges[2][0] + dz2 * triangle.edges[0][0];
+		triangle.depth[1] = dz1 * triangle.edges[2][1] + dz2 * triangle.edges[0][1];
+		triangle.depth[2] = z[0] + dz1 * triangle.edges[2][2] + dz2 * triangle.edges[0][2];
+
+		uint32_t index = static_cast<uint32_t>(m_triangles.size());
+		m_triangles.push_back(triangle);
+		m_stats.occluderTriangles++;
+
+		uint32_t tileX0 = static_cast<uint32_t>(std::max(triangle.minX, 0.0f)) / gTileSize;
+		uint32_t tileY0 = static_cast<uint32_t>(std::max(triangle.minY, 0.0f)) / gTileSize;
+		uint32_t tileX1 = static_cast<uint32_t>(std::min(triangle.maxX, width - 1.0f)) / gTileSize;
+		uint32_t tileY1 = static_cast<uint32_t>(std::min(triangle.maxY, height - 1.0f)) / gTileSize;
+		for (uint32_t tileY = tileY0; tileY <= tileY1; ++tileY)
+		{
+			for (uint32_t tileX = tileX0; tileX <= tileX1; ++tileX)
+			{
+				m_bins[tileY * m_tilesX + tileX].push_back(index);
+				m_stats.binnedTriangles++;
+			}
+		}
+	}
+}
+
+void OcclusionCuller::Rasterize(JobSystem *jobs)
+{
+	static std::chrono::high_resolution_clock clock;
+	auto t0 = clock.now();
+
+	uint32_t numTiles = m_tilesX * m_tilesY;
+	if (jobs)
+	{
+		jobs->ParallelFor(numTiles, 1, [this](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t tile = begin; tile < end; ++tile)
+			{
+				RasterizeTile(tile);
+			}
+		});
+	}
+	else
+	{
+		for (uint32_t tile = 0; tile < numTiles; ++tile)
+		{
+			RasterizeTile(tile);
+		}
+	}
+
+	m_stats.rasterizeMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+}
+
+void OcclusionCuller::RasterizeTile(uint32_t tile)
+{
+	uint32_t tileX = (tile % m_tilesX) * gTileSize;
+	uint32_t tileY = (tile / m_tilesX) * gTileSize;
+
+	float *depth = m_levels[0].data();
+	for (uint32_t y = tileY; y < tileY + gTileSize; ++y)
+	{
+		std::fill(depth + y * m_width + tileX, depth + y * m_width + tileX + gTileSize, 1.0f);
+	}
+
+	// Pixel centers of 4 pixels in a row
+	const XMVECTOR offsets = XMVectorSet(0.5f, 1.5f, 2.5f, 3.5f);
+	const XMVECTOR zero = XMVectorZero();
+
+	for (uint32_t index : m_bins[tile])
+	{
+		const Triangle &triangle = m_triangles[index];
+
+		// Rows of 4 pixels start on a multiple of 4, like the tile
+		uint32_t x0 = static_cast<uint32_t>(std::max(std::floor(triangle.minX), static_cast<float>(tileX))) & ~3u;
+		uint32_t y0 = static_cast<uint32_t>(std::max(std::floor(triangle.minY), static_cast<float>(tileY)));
+		uint32_t x1 = static_cast<uint32_t>(std::min(std::ceil(triangle.maxX), static_cast<float>(tileX + gTileSize)));
+		uint32_t y1 = static_cast<uint32_t>(std::min(std::ceil(triangle.maxY), static_cast<float>(tileY + gTileSize)));
+
+		XMVECTOR a0 = XMVectorReplicate(triangle.edges[0][0]);
+		XMVECTOR a1 = XMVectorReplicate(triangle.edges[1][0]);
+		XMVECTOR a2 = XMVectorReplicate(triangle.edges[2][0]);
+		XMVECTOR dzdx = XMVectorReplicate(triangle.depth[0]);
+
+		for (uint32_t y = y0; y < y1; ++y)
+		{
+			float centerY = y + 0.5f;
+			XMVECTOR row0 = XMVectorReplicate(triangle.edges[0][1] * centerY + triangle.edges[0][2]);
+			XMVECTOR row1 = XMVectorReplicate(triangle.edges[1][1] * centerY + triangle.edges[1][2]);
+			XMVECTOR row2 = XMVectorReplicate(triangle.edges[2][1] * centerY + triangle.edges[2][2]);
+			XMVECTOR rowZ = XMVectorReplicate(triangle.depth[1] * centerY + triangle.depth[2]);
+
+			float *pixels = depth + y * m_width;
+			for (uint32_t x = x0; x < x1; x += 4)
+			{
+				XMVECTOR centerX = XMVectorAdd(XMVectorReplicate(static_cast<float>(x)), offsets);
+
+				XMVECTOR inside = XMVectorAndInt(
+					XMVectorGreaterOrEqual(XMVectorMultiplyAdd(a0, centerX, row0), zero),
+					XMVectorAndInt(
+						XMVectorGreaterOrEqual(XMVectorMultiplyAdd(a1, centerX, row1), zero),
+						XMVectorGreaterOrEqual(XMVectorMultiplyAdd(a2, centerX, row2), zero)));
+
+				XMVECTOR z = XMVectorMultiplyAdd(dzdx, centerX, rowZ);
+
+				XMFLOAT4 *target = reinterpret_cast<XMFLOAT4*>(pixels + x);
+				XMVECTOR current = XMLoadFloat4(target);
+				XMStoreFloat4(target, XMVectorSelect(current, XMVectorMin(current, z), inside));
+			}
+		}
+	}
+
+	// The tile's part of the pyramid
+	for (uint32_t level = 1; level < gNumLevels; ++level)
+	{
+		const float *src = m_levels[level - 1].data();
+		float *dst = m_levels[level].data();
+		uint32_t srcWidth = m_width >> (level - 1);
+		uint32_t dstWidth = m_width >> level;
+
+		uint32_t size = gTileSize >> level;
+		uint32_t originX = tileX >> level;
+		uint32_t originY = tileY >> level;
+		for (uint32_t y = originY; y < originY + size; ++y)
+		{
+			const float *top = src + (y * 2) * srcWidth;
+			const float *bottom = top + srcWidth;
+			for (uint32_t x = originX; x < originX + size; ++x)
+			{
+				dst[y * dstWidth + x] = std::max(std::max(top[x * 2], top[x * 2 + 1]),
+					std::max(bottom[x * 2], bottom[x * 2 + 1]));
+			}
+		}
+	}
+}
+
+void OcclusionCuller::Test(const uint32_t *indices, uint32_t count, const XMFLOAT3 *centers, const XMFLOAT3 *extents,
+	JobSystem *jobs)
+{
+	static std::chrono::high_resolution_clock clock;
+	auto t0 = clock.now();
+
+	uint32_t numBlocks = (count + gTestBlockSize - 1) / gTestBlockSize;
+	m_visible.resize(count);
+	m_blockCounts.resize(numBlocks);
+
+	auto testBlocks = [&](uint32_t firstBlock, uint32_t lastBlock)
+	{
+		for (uint32_t block = firstBlock; block < lastBlock; ++block)
+		{
+			uint32_t begin = block * gTestBlockSize;
+			uint32_t end = std::min(count, begin + gTestBlockSize);
+			uint32_t *visible = m_visible.data() + begin;
+
+			uint32_t numVisible = 0;
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				uint32_t index = indices[i];
+				visible[numVisible] = index;
+				numVisible += IsVisible(centers[index], extents[index]) ? 1 : 0;
+			}
+			m_blockCounts[block] = numVisible;
+		}
+	};
+
+	if (jobs)
+	{
+		jobs->ParallelFor(numBlocks, 1, testBlocks);
+	}
+	else
+	{
+		testBlocks(0, numBlocks);
+	}
+
+	m_numVisible = 0;
+	for (uint32_t block = 0; block < numBlocks; ++block)
+	{
+		uint32_t begin = block * gTestBlockSize;
+		if (begin != m_numVisible)
+		{
+			std::memmove(&m_visible[m_numVisible], &m_visible[begin], sizeof(uint32_t) * m_blockCounts[block]);
+		}
+		m_numVisible += m_blockCounts[block];
+	}
+
+	m_stats.tested = count;
+	m_stats.occluded = count - m_numVisible;
+	m_stats.testMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+}
+
+bool OcclusionCuller::IsVisible(const XMFLOAT3 &center, const XMFLOAT3 &extents) const
+{
+	XMMATRIX viewProjection = XMLoadFloat4x4(&m_viewProjection);
+	XMVECTOR c = XMLoadFloat3(&center);
+	XMVECTOR e = XMLoadFloat3(&extents);
+
+	float width = static_cast<float>(m_width);
+	float height = static_cast<float>(m_height);
+
+	float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+	float maxX = -FLT_MAX, maxY = -FLT_MAX;
+	for (uint32_t corner = 0; corner < 8; ++corner)
+	{
+		XMVECTOR sign = XMVectorSet(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f, 0.0f);
+
+		XMFLOAT4 clip;
+		XMStoreFloat4(&clip, XMVector3Transform(XMVectorMultiplyAdd(e, sign, c), viewProjection));
+		if (clip.z < 0.0f)
+		{
+			// In front of the near plane, nothing can hide it
+			return true;
+		}
+
+		float invW = 1.0f / clip.w;
+		float x = (clip.x * invW * 0.5f + 0.5f) * width;
+		float y = (0.5f - clip.y * invW * 0.5f) * height;
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+		minZ = std::min(minZ, clip.z * invW);
+	}
+
+	// Off screen, that's for the frustum culling to decide
+	if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height)
+	{
+		return true;
+	}
+
+	uint32_t x0 = static_cast<uint32_t>(std::max(minX, 0.0f));
+	uint32_t y0 = static_cast<uint32_t>(std::max(minY, 0.0f));
+	uint32_t x1 = static_cast<uint32_t>(std::min(maxX, width - 1.0f));
+	uint32_t y1 = static_cast<uint32_t>(std::min(maxY, height - 1.0f));
+
+	// The level where the box covers at most 2x2 texels
+	uint32_t level = 0;
+	while (level + 1 < gNumLevels && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+	{
+		level++;
+	}
+
+	const float *depth = m_levels[level].data();
+	uint32_t levelWidth = m_width >> level;
+	for (uint32_t y = y0 >> level; y <= y1 >> level; ++y)
+	{
+		for (uint32_t x = x0 >> level; x <= x1 >> level; ++x)
+		{
+			if (minZ <= depth[y * levelWidth + x])
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+// Occlusion culling on the CPU, after frustum culling and before the draws
+// are recorded.
+//
+// A few big occluder meshes (walls, terrain, buildings) are rasterized into
+// a small depth buffer, then every object's box is tested against it: an
+// object is hidden if its nearest point is behind the farthest occluder
+// depth everywhere its box covers on screen.
+//
+// The depth buffer is cut in 32x32 tiles. Triangles are binned to the tiles
+// they overlap and every tile is rasterized on its own, 4 pixels at a time
+// with DirectXMath vectors, on the job system's threads. Each tile then
+// builds its part of a max depth pyramid (32x32 down to 1x1) so a box is
+// tested against a handful of texels at the level that fits its size
+// rather than every pixel it covers.
+//
+// Occluders are drawn double sided, without clipping: triangles crossing the
+// near plane are dropped, which only means less is occluded. Boxes crossing
+// the near plane are always visible.
+
+class OcclusionCuller
+{
+public:
+	struct Stats
+	{
+		uint32_t occluderTriangles;		// after dropping the ones crossing the near plane
+		uint32_t binnedTriangles;		// one per tile a triangle overlaps
+		uint32_t tested;
+		uint32_t occluded;
+		double rasterizeMs;
+		double testMs;
+	};
+
+	static const uint32_t gTileSize = 32;
+	static const uint32_t gNumLevels = 6;	// 32x32 texels per tile down to 1x1
+
+	// Width and height in pixels, multiples of gTileSize
+	OcclusionCuller(uint32_t width = 256, uint32_t height = 128);
+
+	// Clears the depth buffer and the occluders
+	void Begin(DirectX::FXMMATRIX viewProjection);
+
+	void AddOccluder(const DirectX::XMFLOAT3 *vertices, uint32_t numVertices, const uint32_t *indices,
+		uint32_t numIndices, DirectX::FXMMATRIX world);
+
+	void Rasterize(JobSystem *jobs = nullptr);
+
+	// Tests the boxes of the objects in indices (e.g. FrustumCuller's visible
+	// ones), centers and extents are indexed by them
+	void Test(const uint32_t *indices, uint32_t count, const DirectX::XMFLOAT3 *centers,
+		const DirectX::XMFLOAT3 *extents, JobSystem *jobs = nullptr);
+
+	// The indices that passed the last Test, in the order they were given
+	const uint32_t *GetVisible() const { return m_visible.data(); }
+	uint32_t GetNumVisible() const { return m_numVisible; }
+
+	uint32_t GetWidth() const { return m_width; }
+	uint32_t GetHeight() const { return m_height; }
+	// Level 0 is the depth buffer, every level after holds the max of 2x2 texels
+	const float *GetDepth(uint32_t level = 0) const { return m_levels[level].data(); }
+
+	const Stats &GetStats() const { return m_stats; }
+
+private:
+	// In pixels, with the depth as a plane over the screen
+	struct Triangle
+	{
+		float minX, minY, maxX, maxY;
+		float edges[3][3];		// a * x + b * y + c >= 0 inside
+		float depth[3];			// dz/dx, dz/dy, z at 0, 0
+	};
+
+	void RasterizeTile(uint32_t tile);
+	bool IsVisible(const DirectX::XMFLOAT3 &center, const DirectX::XMFLOAT3 &extents) const;
+
+	uint32_t m_width;
+	uint32_t m_height;
+	uint32_t m_tilesX;
+	uint32_t m_tilesY;
+
+	DirectX::XMFLOAT4X4 m_viewProjection;
+
+	std::vector<float> m_levels[gNumLevels];
+	std::vector<Triangle> m_triangles;
+	std::vector<std::vector<uint32_t>> m_bins;		// triangles of each tile
+	std::vector<DirectX::XMFLOAT4> m_clip;			// scratch for AddOccluder
+
+	std::vector<uint32_t> m_visible;
+	std::vector<uint32_t> m_blockCounts;
+	uint32_t m_numVisible;
+
+	Stats m_stats;
+};
@@ -0,0 +1,227 @@
+#include "pipelineCache.h"
+
+#include <fstream>
+
+namespace
+{
+	const uint32_t gPipelineCacheMagic = 0x4C4F5350;	// "PSOL"
+	const uint32_t gPipelineCacheVersion = 2;	// bumped whenever the pipeline hash changes
+}
+
+PipelineStateCache::PipelineStateCache(ComPtr<ID3D12Device2> device, ComPtr<IDXGIAdapter4> adapter, const std::wstring &path) :
+	m_device(device),
+	m_path(path),
+	m_dirty(false),
+	m_stats()
+{
+	m_header = MakeHeader(adapter);
+	OpenLibrary();
+}
+
+PipelineStateCache::FileHeader PipelineStateCache::MakeHeader(ComPtr<IDXGIAdapter4> adapter) const
+{
+	DXGI_ADAPTER_DESC1 adapterDesc = {};
+	ThrowIfFailed(adapter->GetDesc1(&adapterDesc));
+
+	// The user mode driver version changes with every driver update, 0 if
+	// the adapter won't tell
+	LARGE_INTEGER driverVersion = {};
+	if (FAILED(adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &driverVersion)))
+	{
+		driverVersion.QuadPart = 0;
+	}
+
+	FileHeader header = {};
+	header.magic = gPipelineCacheMagic;
+	header.version = gPipelineCacheVersion;
+	header.vendorId = adapterDesc.VendorId;
+	header.deviceId = adapterDesc.DeviceId;
+	header.subSysId = adapterDesc.SubSysId;
+	header.revision = adapterDesc.Revision;
+	header.driverVersion = static_cast<uint64_t>(driverVersion.QuadPart);
+
+	return header;
+}
+
+void PipelineStateCache::OpenLibrary()
+{
+	// A library from another driver couldn't be told apart, so nothing is
+	// loaded or saved and only the in-memory cache is used
+	if (m_header.driverVersion == 0)
+	{
+		::OutputDebugString("Unknown driver version, the pipeline library is not used\n");
+		return;
+	}
+
+	ComPtr<ID3D12Device1> device1;
+	if (FAILED(m_device.As(&device1)))
+	{
+		// No pipeline library support, only the in-memory cache is used
+		return;
+	}
+
+	std::ifstream file(m_path, std::ios::binary);
+	if (file)
+	{
+		FileHeader header = {};
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+		header.librarySize = file ? header.librarySize : 0;
+		FileHeader expected = m_header;
+		expected.librarySize = header.librarySize;
+
+		// Anything that doesn't match the current adapter and driver is stale
+		if (header.librarySize > 0 && ::memcmp(&header, &expected, sizeof(header)) == 0)
+		{
+			m_libraryData.resize(static_cast<size_t>(header.librarySize));
+			file.read(m_libraryData.data(), m_libraryData.size());
+			if (!file)
+			{
+				m_libraryData.clear();
+			}
+		}
+	}
+
+	if (!m_libraryData.empty())
+	{
+		HRESULT hr = device1->CreatePipelineLibrary(m_libraryData.data(), m_libraryData.size(), IID_PPV_ARGS(&m_library));
+		if (SUCCEEDED(hr))
+		{
+			return;
+		}
+
+		// D3D12_ERROR_DRIVER_VERSION_MISMATCH, D3D12_ERROR_ADAPTER_NOT_FOUND
+		// or a corrupted file, start over with an empty library
+		m_libraryData.clear();
+	}
+
+	if (FAILED(device1->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(&m_library))))
+	{
+		m_library.Reset();
+	}
+}
+
+uint64_t PipelineStateCache::HashStream(const D3D12_PIPELINE_STATE_STREAM_DESC &desc, uint64_t rootSignatureKey)
+{
+	return HashPipelineStream(desc, rootSignatureKey);
+}
+
+ComPtr<ID3D12PipelineState> PipelineStateCache::GetOrCreate(const D3D12_PIPELINE_STATE_STREAM_DESC &desc, uint64_t rootSignatureKey)
+{
+	PipelineStreamView view;
+	ThrowIfFailed(view.Parse(desc));
+	uint64_t hash = HashPipelineStream(view, rootSignatureKey);
+
+	// Compared without the pointer, the key stands for the root signature
+	view.rootSignature = nullptr;
+
+	bool collision = false;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto it = m_pipelines.find(hash);
+		if (it != m_pipelines.end())
+		{
+			const Entry &entry = it->second;
+			if (entry.rootSignatureKey == rootSignatureKey && PipelineStreamEqual(entry.stream->GetView(), view))
+			{
+				m_stats.memoryHits++;
+				return entry.pipeline;
+			}
+
+			m_stats.collisions++;
+			collision = true;
+		}
+	}
+
+	if (collision)
+	{
+		// Another stream has this hash, it gets a pipeline of its own that isn't cached
+		::OutputDebugString("Pipeline hash collision, compiling without the cache\n");
+
+		ComPtr<ID3D12PipelineState> pipelineState;
+		ThrowIfFailed(m_device->CreatePipelineState(&desc, IID_PPV_ARGS(&pipelineState)));
+		return pipelineState;
+	}
+
+	wchar_t name[32];
+	swprintf_s(name, 32, L"pso_%016llx", static_cast<unsigned long long>(hash));
+
+	// The library synchronizes internally, the device is free threaded.
+	// It checks the stream it stored against the one it's given, so a
+	// colliding name fails to load and is compiled instead.
+	ComPtr<ID3D12PipelineState> pipelineState;
+	bool loaded = m_library && SUCCEEDED(m_library->LoadPipeline(name, &desc, IID_PPV_ARGS(&pipelineState)));
+	bool stored = false;
+	if (!loaded)
+	{
+		ThrowIfFailed(m_device->CreatePipelineState(&desc, IID_PPV_ARGS(&pipelineState)));
+
+		// Fails harmlessly if another thread stored the same pipeline first
+		stored = m_library && SUCCEEDED(m_library->StorePipeline(name, pipelineState.Get()));
+	}
+
+	std::unique_ptr<PipelineStreamCopy> stream = std::make_unique<PipelineStreamCopy>(view);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (loaded)
+	{
+		m_stats.libraryHits++;
+	}
+	else
+	{
+		m_stats.compiled++;
+	}
+	m_dirty = m_dirty || stored;
+
+	// Another thread may have created the same pipeline meanwhile, keep the first one
+	auto inserted = m_pipelines.emplace(hash, Entry());
+	Entry &entry = inserted.first->second;
+	if (inserted.second)
+	{
+		entry.rootSignatureKey = rootSignatureKey;
+		entry.stream = std::move(stream);
+		entry.pipeline = pipelineState;
+	}
+	else if (entry.rootSignatureKey != rootSignatureKey || !PipelineStreamEqual(entry.stream->GetView(), view))
+	{
+		m_stats.collisions++;
+		return pipelineState;
+	}
+
+	return entry.pipeline;
+}
+
+void PipelineStateCache::Save()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_library || !m_dirty)
+	{
+		return;
+	}
+
+	std::vector<char> data(m_library->GetSerializedSize());
+	ThrowIfFailed(m_library->Serialize(data.data(), data.size()));
+
+	FileHeader header = m_header;
+	header.librarySize = data.size();
+
+	// Write to a temporary file first so a crash never leaves half a library behind
+	std::wstring tempPath = m_path + L".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(data.data(), data.size());
+		if (!file)
+		{
+			return;
+		}
+	}
+
+	if (::MoveFileExW(tempPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		m_dirty = false;
+	}
+}
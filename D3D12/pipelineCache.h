@@ -0,0 +1,91 @@
+#pragma once
+
+#include "includes.h"
+#include "pipelineHash.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Compiling a pipeline state object at runtime can take hundreds of
+// milliseconds. The cache keeps every PSO it created in memory and in an
+// ID3D12PipelineLibrary that is written to disk, so the next launch loads
+// the compiled pipelines instead of compiling them again.
+//
+// Pipelines are keyed by a hash of the pipeline state stream. Root signature
+// pointers change between runs, so callers pass a stable key for the root
+// signature instead (e.g. a hash of its serialized blob). A copy of the
+// stream is kept with every pipeline and compared on a hit, so two streams
+// with the same hash never share a pipeline.
+//
+// The file on disk is thrown away when the adapter or driver changes, and
+// isn't used at all if the driver version can't be found.
+//
+// GetOrCreate can be called from several threads, compiles run outside the lock.
+
+class PipelineStateCache
+{
+public:
+	struct Stats
+	{
+		uint32_t memoryHits;	// found in the in-memory map
+		uint32_t libraryHits;	// loaded from the pipeline library
+		uint32_t compiled;		// had to be compiled
+		uint32_t collisions;	// same hash as a cached pipeline but a different stream
+	};
+
+	PipelineStateCache(ComPtr<ID3D12Device2> device, ComPtr<IDXGIAdapter4> adapter, const std::wstring &path);
+
+	ComPtr<ID3D12PipelineState> GetOrCreate(const D3D12_PIPELINE_STATE_STREAM_DESC &desc, uint64_t rootSignatureKey);
+
+	template <typename Stream>
+	ComPtr<ID3D12PipelineState> GetOrCreate(Stream &stream, uint64_t rootSignatureKey)
+	{
+		D3D12_PIPELINE_STATE_STREAM_DESC desc = { sizeof(Stream), &stream };
+		return GetOrCreate(desc, rootSignatureKey);
+	}
+
+	// Writes the pipeline library to disk if anything new was stored
+	void Save();
+
+	static uint64_t HashStream(const D3D12_PIPELINE_STATE_STREAM_DESC &desc, uint64_t rootSignatureKey);
+
+	const Stats &GetStats() const { return m_stats; }
+
+private:
+	// Identifies the adapter and driver the library was created with
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vendorId;
+		uint32_t deviceId;
+		uint32_t subSysId;
+		uint32_t revision;
+		uint64_t driverVersion;
+		uint64_t librarySize;
+	};
+
+	struct Entry
+	{
+		uint64_t rootSignatureKey;
+		std::unique_ptr<PipelineStreamCopy> stream;
+		ComPtr<ID3D12PipelineState> pipeline;
+	};
+
+	FileHeader MakeHeader(ComPtr<IDXGIAdapter4> adapter) const;
+	void OpenLibrary();
+
+	ComPtr<ID3D12Device2> m_device;
+	std::vector<char> m_libraryData;	// must outlive m_library
+	ComPtr<ID3D12PipelineLibrary1> m_library;
+	std::wstring m_path;
+	FileHeader m_header;
+	bool m_dirty;
+
+	std::mutex m_mutex;
+	std::unordered_map<uint64_t, Entry> m_pipelines;
+	Stats m_stats;
+};
@@ -0,0 +1,180 @@
+#include "pipelineCompiler.h"
+#include "pipelineCache.h"
+
+#include <stdexcept>
+
+PipelineCompiler::PipelineCompiler(CompileFunction compile, uint32_t numThreads, int threadPriority) :
+	m_compile(compile),
+	m_nextOrder(0),
+	m_quit(false),
+	m_stats()
+{
+	numThreads = std::max(1u, numThreads);
+	for (uint32_t i = 0; i < numThreads; ++i)
+	{
+		m_workers.emplace_back(&PipelineCompiler::WorkerThread, this);
+		::SetThreadPriority(m_workers.back().native_handle(), threadPriority);
+	}
+}
+
+PipelineCompiler::~PipelineCompiler()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_queueMutex);
+		m_quit = true;
+	}
+	m_queueCondition.notify_all();
+
+	for (std::thread &worker : m_workers)
+	{
+		worker.join();
+	}
+
+	// Whoever still holds a future gets an error instead of a broken promise
+	while (!m_queue.empty())
+	{
+		m_queue.top()->promise.set_exception(std::make_exception_ptr(
+			std::runtime_error("Pipeline compiler destroyed before the request started")));
+		m_queue.pop();
+	}
+}
+
+PipelineCompiler::Request PipelineCompiler::Compile(const D3D12_PIPELINE_STATE_STREAM_DESC &desc,
+	uint64_t rootSignatureKey, Priority priority)
+{
+	Request request;
+	request.key = PipelineStateCache::HashStream(desc, rootSignatureKey);
+
+	std::shared_ptr<Job> job;
+	{
+		std::lock_guard<std::mutex> lock(m_entryMutex);
+
+		Entry &entry = m_entries[request.key];
+		if (entry.future.valid())
+		{
+			request.future = entry.future;
+			return request;
+		}
+
+		job = std::make_shared<Job>();
+		job->key = request.key;
+		job->rootSignatureKey = rootSignatureKey;
+		job->priority = priority;
+
+		const uint8_t *stream = static_cast<const uint8_t*>(desc.pPipelineStateSubobjectStream);
+		job->stream.assign(stream, stream + desc.SizeInBytes);
+
+		entry.future = job->promise.get_future().share();
+		entry.ready = false;
+		request.future = entry.future;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_queueMutex);
+		job->order = m_nextOrder++;
+		m_queue.push(job);
+		m_stats.queueDepth = static_cast<uint32_t>(m_queue.size());
+	}
+	m_queueCondition.notify_one();
+
+	return request;
+}
+
+void PipelineCompiler::SetFallback(uint64_t key, ComPtr<ID3D12PipelineState> fallback)
+{
+	std::lock_guard<std::mutex> lock(m_entryMutex);
+	m_entries[key].fallback = fallback;
+}
+
+ID3D12PipelineState *PipelineCompiler::Get(uint64_t key)
+{
+	std::lock_guard<std::mutex> lock(m_entryMutex);
+
+	auto it = m_entries.find(key);
+	if (it == m_entries.end())
+	{
+		return nullptr;
+	}
+
+	Entry &entry = it->second;
+	return entry.ready && entry.pipeline ? entry.pipeline.Get() : entry.fallback.Get();
+}
+
+void PipelineCompiler::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(m_queueMutex);
+	m_idleCondition.wait(lock, [this]() { return m_queue.empty() && m_stats.inFlight == 0; });
+}
+
+PipelineCompiler::Stats PipelineCompiler::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_queueMutex);
+	return m_stats;
+}
+
+void PipelineCompiler::WorkerThread()
+{
+	static std::chrono::high_resolution_clock clock;
+
+	for (;;)
+	{
+		std::shared_ptr<Job> job;
+		{
+			std::unique_lock<std::mutex> lock(m_queueMutex);
+			m_queueCondition.wait(lock, [this]() { return m_quit || !m_queue.empty(); });
+
+			if (m_quit)
+			{
+				return;
+			}
+
+			job = m_queue.top();
+			m_queue.pop();
+			m_stats.queueDepth = static_cast<uint32_t>(m_queue.size());
+			m_stats.inFlight++;
+		}
+
+		auto t0 = clock.now();
+
+		ComPtr<ID3D12PipelineState> pipeline;
+		bool failed = false;
+		try
+		{
+			D3D12_PIPELINE_STATE_STREAM_DESC desc = { job->stream.size(), job->stream.data() };
+			pipeline = m_compile(desc, job->rootSignatureKey);
+			failed = !pipeline;
+			job->promise.set_value(pipeline);
+		}
+		catch (...)
+		{
+			failed = true;
+			job->promise.set_exception(std::current_exception());
+		}
+
+		double compileMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+
+		{
+			std::lock_guard<std::mutex> lock(m_entryMutex);
+			Entry &entry = m_entries[job->key];
+			entry.pipeline = pipeline;
+			entry.ready = true;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_queueMutex);
+			m_stats.inFlight--;
+			if (failed)
+			{
+				m_stats.failed++;
+			}
+			else
+			{
+				m_stats.completed++;
+			}
+			m_stats.lastCompileMs = compileMs;
+			m_stats.maxCompileMs = std::max(m_stats.maxCompileMs, compileMs);
+			m_stats.totalCompileMs += compileMs;
+		}
+		m_idleCondition.notify_all();
+	}
+}
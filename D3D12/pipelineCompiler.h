@@ -0,0 +1,129 @@
+#pragma once
+
+#include "includes.h"
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Compiles pipeline state objects on a pool of worker threads so the render
+// thread never waits on the driver. A request returns right away with a
+// future; until the pipeline is ready the render thread draws with the
+// fallback registered for it, or skips the draw if there is none.
+//
+// The actual compilation is done by a CompileFunction, normally
+// PipelineStateCache::GetOrCreate. Any other function can be plugged in,
+// e.g. the benchmarks' stub, to exercise the scheduling on its own.
+
+class PipelineCompiler
+{
+public:
+	typedef std::function<ComPtr<ID3D12PipelineState>(const D3D12_PIPELINE_STATE_STREAM_DESC &desc,
+		uint64_t rootSignatureKey)> CompileFunction;
+	typedef std::shared_future<ComPtr<ID3D12PipelineState>> Future;
+
+	enum Priority
+	{
+		PRIORITY_LOW,		// prewarming
+		PRIORITY_NORMAL,
+		PRIORITY_HIGH,		// needed for something on screen
+	};
+
+	struct Request
+	{
+		uint64_t key;		// PipelineStateCache::HashStream of the stream
+		Future future;
+	};
+
+	struct Stats
+	{
+		uint32_t queueDepth;
+		uint32_t inFlight;
+		uint32_t completed;
+		uint32_t failed;
+		double lastCompileMs;
+		double maxCompileMs;
+		double totalCompileMs;
+	};
+
+	// threadPriority is passed to SetThreadPriority for every worker
+	PipelineCompiler(CompileFunction compile, uint32_t numThreads, int threadPriority = THREAD_PRIORITY_BELOW_NORMAL);
+	// Requests that haven't started fail, their futures throw. Call WaitIdle()
+	// first to finish them.
+	~PipelineCompiler();
+
+	// The stream is copied but what it points to (shaders, input layout, ...)
+	// must stay alive until the future is ready.
+	// Requesting a pipeline that was already requested returns the same future.
+	Request Compile(const D3D12_PIPELINE_STATE_STREAM_DESC &desc, uint64_t rootSignatureKey, Priority priority);
+
+	template <typename Stream>
+	Request Compile(Stream &stream, uint64_t rootSignatureKey, Priority priority)
+	{
+		D3D12_PIPELINE_STATE_STREAM_DESC desc = { sizeof(Stream), &stream };
+		return Compile(desc, rootSignatureKey, priority);
+	}
+
+	// Used until the pipeline for key is ready (or if it failed to compile)
+	void SetFallback(uint64_t key, ComPtr<ID3D12PipelineState> fallback);
+
+	// Render thread entry point, never blocks on a compile.
+	// Returns the compiled pipeline, the fallback, or nullptr to skip the draw.
+	ID3D12PipelineState *Get(uint64_t key);
+
+	// Blocks until every queued request is done (loading screens, shutdown)
+	void WaitIdle();
+
+	Stats GetStats();
+
+private:
+	struct Job
+	{
+		uint64_t key;
+		uint64_t rootSignatureKey;
+		Priority priority;
+		uint64_t order;
+		std::vector<uint8_t> stream;
+		std::promise<ComPtr<ID3D12PipelineState>> promise;
+	};
+
+	struct JobOrder
+	{
+		bool operator()(const std::shared_ptr<Job> &a, const std::shared_ptr<Job> &b) const
+		{
+			// Highest priority first, oldest first within a priority
+			return a->priority != b->priority ? a->priority < b->priority : a->order > b->order;
+		}
+	};
+
+	struct Entry
+	{
+		Future future;
+		ComPtr<ID3D12PipelineState> pipeline;
+		ComPtr<ID3D12PipelineState> fallback;
+		bool ready;
+	};
+
+	void WorkerThread();
+
+	CompileFunction m_compile;
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_queueMutex;
+	std::condition_variable m_queueCondition;
+	std::condition_variable m_idleCondition;
+	std::priority_queue<std::shared_ptr<Job>, std::vector<std::shared_ptr<Job>>, JobOrder> m_queue;
+	uint64_t m_nextOrder;
+	bool m_quit;
+
+	std::mutex m_entryMutex;
+	std::unordered_map<uint64_t, Entry> m_entries;
+
+	Stats m_stats;	// guarded by m_queueMutex
+};
@@ -0,0 +1,521 @@
+#pragma once
+
+#include "includes.h"
+
+#include <cstring>
+#include <vector>
+
+// Hashing and comparing pipeline state streams without allocating anything.
+//
+// PipelineStreamView walks a stream with D3DX12ParsePipelineStream and keeps
+// a copy of every subobject it finds in a fixed size struct. Hashing and
+// comparing then work on the view:
+//  - shaders are identified by their content. Compiled shaders live in a DXBC
+//    container that already carries a checksum of the bytecode, so hashing a
+//    shader costs the same no matter how big it is.
+//  - input layout and stream output entries are hashed by value, semantic
+//    names included.
+//  - the root signature isn't hashed by pointer, the caller passes a key for it.
+//    Use the pointer itself for in-process lookups and a hash of the serialized
+//    root signature for anything that is saved to disk.
+//
+// Cheap enough to be done for every draw.
+
+namespace PipelineHash
+{
+	// 8 bytes at a time, seeded so a run of zeros doesn't hash to zero
+	inline uint64_t Mix(uint64_t hash, uint64_t value)
+	{
+		hash ^= value + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+		hash *= 0xFF51AFD7ED558CCDull;
+		return hash ^ (hash >> 32);
+	}
+
+	inline uint64_t Bytes(uint64_t hash, const void *data, size_t size)
+	{
+		const uint8_t *bytes = static_cast<const uint8_t*>(data);
+
+		size_t i = 0;
+		for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+		{
+			uint64_t value;
+			::memcpy(&value, bytes + i, sizeof(value));
+			hash = Mix(hash, value);
+		}
+
+		uint64_t tail = 0;
+		if (size > i)
+		{
+			::memcpy(&tail, bytes + i, size - i);
+		}
+
+		return Mix(hash, tail ^ size);
+	}
+
+	inline uint64_t String(uint64_t hash, const char *str)
+	{
+		return str ? Bytes(hash, str, ::strlen(str)) : Mix(hash, 0);
+	}
+
+	template <typename T>
+	inline uint64_t Value(uint64_t hash, const T &value)
+	{
+		return Bytes(hash, &value, sizeof(value));
+	}
+
+	// Content hash of a shader. Uses the checksum stored in the DXBC container
+	// header (4 byte "DXBC" tag followed by a 16 byte digest) when there is one.
+	inline uint64_t Shader(uint64_t hash, const D3D12_SHADER_BYTECODE &shader)
+	{
+		hash = Mix(hash, shader.BytecodeLength);
+		if (!shader.pShaderBytecode || shader.BytecodeLength == 0)
+		{
+			return hash;
+		}
+
+		const uint8_t *bytecode = static_cast<const uint8_t*>(shader.pShaderBytecode);
+		if (shader.BytecodeLength >= 20 && ::memcmp(bytecode, "DXBC", 4) == 0)
+		{
+			uint64_t digest[2];
+			::memcpy(digest, bytecode + 4, sizeof(digest));
+
+			// Unsigned containers have an empty digest
+			if (digest[0] != 0 || digest[1] != 0)
+			{
+				return Mix(Mix(hash, digest[0]), digest[1]);
+			}
+		}
+
+		return Bytes(hash, bytecode, shader.BytecodeLength);
+	}
+
+	inline bool ShaderEqual(const D3D12_SHADER_BYTECODE &a, const D3D12_SHADER_BYTECODE &b)
+	{
+		if (a.BytecodeLength != b.BytecodeLength)
+		{
+			return false;
+		}
+
+		return a.pShaderBytecode == b.pShaderBytecode || a.BytecodeLength == 0 ||
+			::memcmp(a.pShaderBytecode, b.pShaderBytecode, a.BytecodeLength) == 0;
+	}
+
+	inline bool StringEqual(const char *a, const char *b)
+	{
+		return a == b || (a && b && ::strcmp(a, b) == 0);
+	}
+
+	// The structs below have padding after their UINT8 members,
+	// so they are hashed and compared field by field.
+	inline uint64_t StencilOp(uint64_t hash, const D3D12_DEPTH_STENCILOP_DESC &op)
+	{
+		return Mix(hash, (uint64_t(op.StencilFailOp) << 48) | (uint64_t(op.StencilDepthFailOp) << 32) |
+			(uint64_t(op.StencilPassOp) << 16) | op.StencilFunc);
+	}
+
+	inline uint64_t DepthStencil(uint64_t hash, const D3D12_DEPTH_STENCIL_DESC1 &ds)
+	{
+		hash = Mix(hash, (uint64_t(ds.DepthEnable) << 32) | ds.DepthWriteMask);
+		hash = Mix(hash, (uint64_t(ds.DepthFunc) << 32) | ds.StencilEnable);
+		hash = Mix(hash, (uint64_t(ds.StencilReadMask) << 16) | (uint64_t(ds.StencilWriteMask) << 8) | ds.DepthBoundsTestEnable);
+		hash = StencilOp(hash, ds.FrontFace);
+		return StencilOp(hash, ds.BackFace);
+	}
+
+	inline uint64_t BlendTarget(uint64_t hash, const D3D12_RENDER_TARGET_BLEND_DESC &rt)
+	{
+		hash = Mix(hash, (uint64_t(rt.BlendEnable) << 32) | rt.LogicOpEnable);
+		hash = Mix(hash, (uint64_t(rt.SrcBlend) << 48) | (uint64_t(rt.DestBlend) << 32) | (uint64_t(rt.BlendOp) << 16) | rt.LogicOp);
+		return Mix(hash, (uint64_t(rt.SrcBlendAlpha) << 48) | (uint64_t(rt.DestBlendAlpha) << 32) |
+			(uint64_t(rt.BlendOpAlpha) << 16) | rt.RenderTargetWriteMask);
+	}
+
+	inline bool StencilOpEqual(const D3D12_DEPTH_STENCILOP_DESC &a, const D3D12_DEPTH_STENCILOP_DESC &b)
+	{
+		return a.StencilFailOp == b.StencilFailOp && a.StencilDepthFailOp == b.StencilDepthFailOp &&
+			a.StencilPassOp == b.StencilPassOp && a.StencilFunc == b.StencilFunc;
+	}
+
+	inline bool DepthStencilEqual(const D3D12_DEPTH_STENCIL_DESC1 &a, const D3D12_DEPTH_STENCIL_DESC1 &b)
+	{
+		return a.DepthEnable == b.DepthEnable && a.DepthWriteMask == b.DepthWriteMask &&
+			a.DepthFunc == b.DepthFunc && a.StencilEnable == b.StencilEnable &&
+			a.StencilReadMask == b.StencilReadMask && a.StencilWriteMask == b.StencilWriteMask &&
+			a.DepthBoundsTestEnable == b.DepthBoundsTestEnable &&
+			StencilOpEqual(a.FrontFace, b.FrontFace) && StencilOpEqual(a.BackFace, b.BackFace);
+	}
+
+	inline bool BlendTargetEqual(const D3D12_RENDER_TARGET_BLEND_DESC &a, const D3D12_RENDER_TARGET_BLEND_DESC &b)
+	{
+		return a.BlendEnable == b.BlendEnable && a.LogicOpEnable == b.LogicOpEnable &&
+			a.SrcBlend == b.SrcBlend && a.DestBlend == b.DestBlend && a.BlendOp == b.BlendOp &&
+			a.SrcBlendAlpha == b.SrcBlendAlpha && a.DestBlendAlpha == b.DestBlendAlpha &&
+			a.BlendOpAlpha == b.BlendOpAlpha && a.LogicOp == b.LogicOp &&
+			a.RenderTargetWriteMask == b.RenderTargetWriteMask;
+	}
+}
+
+// Subobjects that weren't in the stream stay zeroed
+struct PipelineStreamData
+{
+	enum ShaderStage
+	{
+		STAGE_VS,
+		STAGE_GS,
+		STAGE_HS,
+		STAGE_DS,
+		STAGE_PS,
+		STAGE_CS,
+		STAGE_COUNT
+	};
+
+	uint32_t presentMask;	// one bit per D3D12_PIPELINE_STATE_SUBOBJECT_TYPE
+	D3D12_PIPELINE_STATE_FLAGS flags;
+	UINT nodeMask;
+	ID3D12RootSignature *rootSignature;
+	D3D12_INPUT_LAYOUT_DESC inputLayout;
+	D3D12_INDEX_BUFFER_STRIP_CUT_VALUE stripCutValue;
+	D3D12_PRIMITIVE_TOPOLOGY_TYPE topologyType;
+	D3D12_SHADER_BYTECODE shaders[STAGE_COUNT];
+	D3D12_STREAM_OUTPUT_DESC streamOutput;
+	D3D12_BLEND_DESC blend;
+	D3D12_DEPTH_STENCIL_DESC1 depthStencil;
+	DXGI_FORMAT dsvFormat;
+	D3D12_RASTERIZER_DESC rasterizer;
+	D3D12_RT_FORMAT_ARRAY rtvFormats;
+	DXGI_SAMPLE_DESC sampleDesc;
+	UINT sampleMask;
+	D3D12_VIEW_INSTANCING_DESC viewInstancing;
+};
+
+struct PipelineStreamView : public PipelineStreamData, public ID3DX12PipelineParserCallbacks
+{
+	static_assert(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_MAX_VALID <= 32, "presentMask is too small");
+
+	PipelineStreamView() : PipelineStreamData() {}
+
+	HRESULT Parse(const D3D12_PIPELINE_STATE_STREAM_DESC &desc)
+	{
+		static_cast<PipelineStreamData&>(*this) = PipelineStreamData();
+		return D3DX12ParsePipelineStream(desc, this);
+	}
+
+	bool Has(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE type) const { return (presentMask & (1u << type)) != 0; }
+
+	void FlagsCb(D3D12_PIPELINE_STATE_FLAGS v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_FLAGS); flags = v; }
+	void NodeMaskCb(UINT v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_NODE_MASK); nodeMask = v; }
+	void RootSignatureCb(ID3D12RootSignature *v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_ROOT_SIGNATURE); rootSignature = v; }
+	void InputLayoutCb(const D3D12_INPUT_LAYOUT_DESC &v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_INPUT_LAYOUT); inputLayout = v; }
+	void IBStripCutValueCb(D3D12_INDEX_BUFFER_STRIP_CUT_VALUE v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_IB_STRIP_CUT_VALUE); stripCutValue = v; }
+	void PrimitiveTopologyTypeCb(D3D12_PRIMITIVE_TOPOLOGY_TYPE v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_PRIMITIVE_TOPOLOGY); topologyType = v; }
+	void VSCb(const D3D12_SHADER_BYTECODE &v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_VS); shaders[STAGE_VS] = v; }
+	void GSCb(const D3D12_SHADER_BYTECODE &v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_GS); shaders[STAGE_GS] = v; }
+	void HSCb(const D3D12_SHADER_BYTECODE &v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_HS); shaders[STAGE_HS] = v; }
+	void DSCb(const D3D12_SHADER_BYTECODE &v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_DS); shaders[STAGE_DS] = v; }
+	void PSCb(const D3D12_SHADER_BYTECODE &v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_PS); shaders[STAGE_PS] = v; }
+	void CSCb(const D3D12_SHADER_BYTECODE &v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_CS); shaders[STAGE_CS] = v; }
+	void StreamOutputCb(const D3D12_STREAM_OUTPUT_DESC &v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_STREAM_OUTPUT); streamOutput = v; }
+	void BlendStateCb(const D3D12_BLEND_DESC &v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_BLEND); blend = v; }
+	void DepthStencilStateCb(const D3D12_DEPTH_STENCIL_DESC &v) override
+	{
+		// Both depth stencil subobjects are stored as DESC1 so they compare equal
+		Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_DEPTH_STENCIL1);
+		depthStencil = CD3DX12_DEPTH_STENCIL_DESC1(v);
+	}
+	void DepthStencilState1Cb(const D3D12_DEPTH_STENCIL_DESC1 &v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_DEPTH_STENCIL1); depthStencil = v; }
+	void DSVFormatCb(DXGI_FORMAT v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_DEPTH_STENCIL_FORMAT); dsvFormat = v; }
+	void RasterizerStateCb(const D3D12_RASTERIZER_DESC &v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_RASTERIZER); rasterizer = v; }
+	void RTVFormatsCb(const D3D12_RT_FORMAT_ARRAY &v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_RENDER_TARGET_FORMATS); rtvFormats = v; }
+	void SampleDescCb(const DXGI_SAMPLE_DESC &v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_SAMPLE_DESC); sampleDesc = v; }
+	void SampleMaskCb(UINT v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_SAMPLE_MASK); sampleMask = v; }
+	void ViewInstancingCb(const D3D12_VIEW_INSTANCING_DESC &v) override { Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_VIEW_INSTANCING); viewInstancing = v; }
+	// Cached blobs only speed up creation, they don't change the pipeline
+
+private:
+	void Set(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE type) { presentMask |= 1u << type; }
+};
+
+// rootSignatureKey replaces the root signature pointer in the hash
+inline uint64_t HashPipelineStream(const PipelineStreamView &view, uint64_t rootSignatureKey)
+{
+	using namespace PipelineHash;
+
+	uint64_t hash = Mix(0, view.presentMask);
+	hash = Mix(hash, rootSignatureKey);
+
+	if (view.Has(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_FLAGS)) hash = Mix(hash, view.flags);
+	if (view.Has(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_NODE_MASK)) hash = Mix(hash, view.nodeMask);
+	if (view.Has(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_IB_STRIP_CUT_VALUE)) hash = Mix(hash, view.stripCutValue);
+	if (view.Has(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_PRIMITIVE_TOPOLOGY)) hash = Mix(hash, view.topologyType);
+	if (view.Has(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_DEPTH_STENCIL_FORMAT)) hash = Mix(hash, view.dsvFormat);
+	if (view.Has(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_SAMPLE_MASK)) hash = Mix(hash, view.sampleMask);
+
+	for (int stage = 0; stage < PipelineStreamView::STAGE_COUNT; ++stage)
+	{
+		hash = Shader(hash, view.shaders[stage]);
+	}
+
+	if (view.Has(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_INPUT_LAYOUT))
+	{
+		hash = Mix(hash, view.inputLayout.NumElements);
+		for (UINT i = 0; i < view.inputLayout.NumElements; ++i)
+		{
+			const D3D12_INPUT_ELEMENT_DESC &element = view.inputLayout.pInputElementDescs[i];
+			hash = String(hash, element.SemanticName);
+			hash = Mix(hash, (uint64_t(element.SemanticIndex) << 32) | element.Format);
+			hash = Mix(hash, (uint64_t(element.InputSlot) << 32) | element.AlignedByteOffset);
+			hash = Mix(hash, (uint64_t(element.InputSlotClass) << 32) | element.InstanceDataStepRate);
+		}
+	}
+
+	if (view.Has(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_STREAM_OUTPUT))
+	{
+		const D3D12_STREAM_OUTPUT_DESC &so = view.streamOutput;
+		hash = Mix(hash, so.NumEntries);
+		for (UINT i = 0; i < so.NumEntries; ++i)
+		{
+			const D3D12_SO_DECLARATION_ENTRY &entry = so.pSODeclaration[i];
+			hash = String(hash, entry.SemanticName);
+			hash = Mix(hash, (uint64_t(entry.Stream) << 32) | entry.SemanticIndex);
+			hash = Mix(hash, (uint64_t(entry.StartComponent) << 16) | (uint64_t(entry.ComponentCount) << 8) | entry.OutputSlot);
+		}
+		hash = Bytes(hash, so.pBufferStrides, so.NumStrides * sizeof(UINT));
+		hash = Mix(hash, so.RasterizedStream);
+	}
+
+	if (view.Has(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_BLEND))
+	{
+		// Only the used render targets matter unless blending is independent
+		UINT numTargets = view.blend.IndependentBlendEnable ? D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT : 1;
+		hash = Mix(hash, (uint64_t(view.blend.AlphaToCoverageEnable) << 1) | view.blend.IndependentBlendEnable);
+		for (UINT i = 0; i < numTargets; ++i)
+		{
+			hash = BlendTarget(hash, view.blend.RenderTarget[i]);
+		}
+	}
+
+	if (view.Has(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_DEPTH_STENCIL1)) hash = DepthStencil(hash, view.depthStencil);
+	if (view.Has(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_RASTERIZER)) hash = Value(hash, view.rasterizer);
+	if (view.Has(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_SAMPLE_DESC)) hash = Value(hash, view.sampleDesc);
+
+	if (view.Has(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_RENDER_TARGET_FORMATS))
+	{
+		hash = Mix(hash, view.rtvFormats.NumRenderTargets);
+		hash = Bytes(hash, view.rtvFormats.RTFormats, view.rtvFormats.NumRenderTargets * sizeof(DXGI_FORMAT));
+	}
+
+	if (view.Has(D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_VIEW_INSTANCING))
+	{
+		hash = Mix(hash, view.viewInstancing.Flags);
+		hash = Bytes(hash, view.viewInstancing.pViewInstanceLocations,
+			view.viewInstancing.ViewInstanceCount * sizeof(D3D12_VIEW_INSTANCE_LOCATION));
+	}
+
+	return hash;
+}
+
+inline uint64_t HashPipelineStream(const D3D12_PIPELINE_STATE_STREAM_DESC &desc, uint64_t rootSignatureKey)
+{
+	PipelineStreamView view;
+	ThrowIfFailed(view.Parse(desc));
+
+	return HashPipelineStream(view, rootSignatureKey);
+}
+
+// Matches HashPipelineStream, except that root signatures are compared by pointer
+inline bool PipelineStreamEqual(const PipelineStreamView &a, const PipelineStreamView &b)
+{
+	using namespace PipelineHash;
+
+	if (a.presentMask != b.presentMask || a.rootSignature != b.rootSignature ||
+		a.flags != b.flags || a.nodeMask != b.nodeMask ||
+		a.stripCutValue != b.stripCutValue || a.topologyType != b.topologyType ||
+		a.dsvFormat != b.dsvFormat || a.sampleMask != b.sampleMask)
+	{
+		return false;
+	}
+
+	for (int stage = 0; stage < PipelineStreamView::STAGE_COUNT; ++stage)
+	{
+		if (!ShaderEqual(a.shaders[stage], b.shaders[stage]))
+		{
+			return false;
+		}
+	}
+
+	if (a.inputLayout.NumElements != b.inputLayout.NumElements)
+	{
+		return false;
+	}
+	for (UINT i = 0; i < a.inputLayout.NumElements; ++i)
+	{
+		const D3D12_INPUT_ELEMENT_DESC &ea = a.inputLayout.pInputElementDescs[i];
+		const D3D12_INPUT_ELEMENT_DESC &eb = b.inputLayout.pInputElementDescs[i];
+		if (!StringEqual(ea.SemanticName, eb.SemanticName) || ea.SemanticIndex != eb.SemanticIndex ||
+			ea.Format != eb.Format || ea.InputSlot != eb.InputSlot ||
+			ea.AlignedByteOffset != eb.AlignedByteOffset || ea.InputSlotClass != eb.InputSlotClass ||
+			ea.InstanceDataStepRate != eb.InstanceDataStepRate)
+		{
+			return false;
+		}
+	}
+
+	const D3D12_STREAM_OUTPUT_DESC &soa = a.streamOutput;
+	const D3D12_STREAM_OUTPUT_DESC &sob = b.streamOutput;
+	if (soa.NumEntries != sob.NumEntries || soa.NumStrides != sob.NumStrides || soa.RasterizedStream != sob.RasterizedStream ||
+		(soa.NumStrides && ::memcmp(soa.pBufferStrides, sob.pBufferStrides, soa.NumStrides * sizeof(UINT)) != 0))
+	{
+		return false;
+	}
+	for (UINT i = 0; i < soa.NumEntries; ++i)
+	{
+		const D3D12_SO_DECLARATION_ENTRY &ea = soa.pSODeclaration[i];
+		const D3D12_SO_DECLARATION_ENTRY &eb = sob.pSODeclaration[i];
+		if (!StringEqual(ea.SemanticName, eb.SemanticName) || ea.Stream != eb.Stream ||
+			ea.SemanticIndex != eb.SemanticIndex || ea.StartComponent != eb.StartComponent ||
+			ea.ComponentCount != eb.ComponentCount || ea.OutputSlot != eb.OutputSlot)
+		{
+			return false;
+		}
+	}
+
+	if (a.blend.AlphaToCoverageEnable != b.blend.AlphaToCoverageEnable ||
+		a.blend.IndependentBlendEnable != b.blend.IndependentBlendEnable)
+	{
+		return false;
+	}
+	UINT numBlendTargets = a.blend.IndependentBlendEnable ? D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT : 1;
+	for (UINT i = 0; i < numBlendTargets; ++i)
+	{
+		if (!BlendTargetEqual(a.blend.RenderTarget[i], b.blend.RenderTarget[i]))
+		{
+			return false;
+		}
+	}
+
+	if (!DepthStencilEqual(a.depthStencil, b.depthStencil) ||
+		::memcmp(&a.rasterizer, &b.rasterizer, sizeof(a.rasterizer)) != 0 ||
+		::memcmp(&a.sampleDesc, &b.sampleDesc, sizeof(a.sampleDesc)) != 0)
+	{
+		return false;
+	}
+
+	if (a.rtvFormats.NumRenderTargets != b.rtvFormats.NumRenderTargets ||
+		::memcmp(a.rtvFormats.RTFormats, b.rtvFormats.RTFormats, a.rtvFormats.NumRenderTargets * sizeof(DXGI_FORMAT)) != 0)
+	{
+		return false;
+	}
+
+	return a.viewInstancing.Flags == b.viewInstancing.Flags &&
+		a.viewInstancing.ViewInstanceCount == b.viewInstancing.ViewInstanceCount &&
+		(a.viewInstancing.ViewInstanceCount == 0 ||
+			::memcmp(a.viewInstancing.pViewInstanceLocations, b.viewInstancing.pViewInstanceLocations,
+				a.viewInstancing.ViewInstanceCount * sizeof(D3D12_VIEW_INSTANCE_LOCATION)) == 0);
+}
+
+// A view that owns what it points to (shader bytecode, input layout, stream
+// output, view instances), so it can be kept next to a cached pipeline after
+// the stream it came from is gone. The root signature is left out, it is
+// only a pointer: compare views with it set to nullptr and keep the root
+// signature key next to the copy.
+class PipelineStreamCopy
+{
+public:
+	explicit PipelineStreamCopy(const PipelineStreamView &source) :
+		m_view(source)
+	{
+		m_view.rootSignature = nullptr;
+
+		for (int stage = 0; stage < PipelineStreamView::STAGE_COUNT; ++stage)
+		{
+			D3D12_SHADER_BYTECODE &shader = m_view.shaders[stage];
+			if (shader.pShaderBytecode && shader.BytecodeLength > 0)
+			{
+				const uint8_t *bytecode = static_cast<const uint8_t*>(shader.pShaderBytecode);
+				m_shaders[stage].assign(bytecode, bytecode + shader.BytecodeLength);
+				shader.pShaderBytecode = m_shaders[stage].data();
+			}
+		}
+
+		// The names are pointed to once they're all in, the buffer doesn't move after that
+		std::vector<size_t> inputNames;
+		D3D12_INPUT_LAYOUT_DESC &inputLayout = m_view.inputLayout;
+		if (inputLayout.NumElements > 0)
+		{
+			m_inputElements.assign(inputLayout.pInputElementDescs, inputLayout.pInputElementDescs + inputLayout.NumElements);
+			for (const D3D12_INPUT_ELEMENT_DESC &element : m_inputElements)
+			{
+				inputNames.push_back(AddName(element.SemanticName));
+			}
+			inputLayout.pInputElementDescs = m_inputElements.data();
+		}
+
+		std::vector<size_t> outputNames;
+		D3D12_STREAM_OUTPUT_DESC &streamOutput = m_view.streamOutput;
+		if (streamOutput.NumEntries > 0)
+		{
+			m_outputEntries.assign(streamOutput.pSODeclaration, streamOutput.pSODeclaration + streamOutput.NumEntries);
+			for (const D3D12_SO_DECLARATION_ENTRY &entry : m_outputEntries)
+			{
+				outputNames.push_back(AddName(entry.SemanticName));
+			}
+			streamOutput.pSODeclaration = m_outputEntries.data();
+		}
+		if (streamOutput.NumStrides > 0)
+		{
+			m_outputStrides.assign(streamOutput.pBufferStrides, streamOutput.pBufferStrides + streamOutput.NumStrides);
+			streamOutput.pBufferStrides = m_outputStrides.data();
+		}
+
+		for (size_t i = 0; i < inputNames.size(); ++i)
+		{
+			m_inputElements[i].SemanticName = GetName(inputNames[i]);
+		}
+		for (size_t i = 0; i < outputNames.size(); ++i)
+		{
+			m_outputEntries[i].SemanticName = GetName(outputNames[i]);
+		}
+
+		D3D12_VIEW_INSTANCING_DESC &viewInstancing = m_view.viewInstancing;
+		if (viewInstancing.ViewInstanceCount > 0)
+		{
+			m_viewInstances.assign(viewInstancing.pViewInstanceLocations,
+				viewInstancing.pViewInstanceLocations + viewInstancing.ViewInstanceCount);
+			viewInstancing.pViewInstanceLocations = m_viewInstances.data();
+		}
+	}
+
+	// The view points into the copy
+	PipelineStreamCopy(const PipelineStreamCopy&) = delete;
+	PipelineStreamCopy &operator=(const PipelineStreamCopy&) = delete;
+
+	const PipelineStreamView &GetView() const { return m_view; }
+
+private:
+	static const size_t gNoName = ~size_t(0);
+
+	size_t AddName(const char *name)
+	{
+		if (!name)
+		{
+			return gNoName;
+		}
+
+		size_t offset = m_names.size();
+		m_names.insert(m_names.end(), name, name + ::strlen(name) + 1);
+		return offset;
+	}
+
+	const char *GetName(size_t offset) const
+	{
+		return offset == gNoName ? nullptr : m_names.data() + offset;
+	}
+
+	PipelineStreamView m_view;
+	std::vector<uint8_t> m_shaders[PipelineStreamView::STAGE_COUNT];
+	std::vector<D3D12_INPUT_ELEMENT_DESC> m_inputElements;
+	std::vector<D3D12_SO_DECLARATION_ENTRY> m_outputEntries;
+	std::vector<UINT> m_outputStrides;
+	std::vector<D3D12_VIEW_INSTANCE_LOCATION> m_viewInstances;
+	std::vector<char> m_names;
+};
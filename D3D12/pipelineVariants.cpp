@@ -0,0 +1,214 @@
+#include "pipelineVariants.h"
+#include "fixedFunctionState.h"
+
+#include <fstream>
+
+namespace
+{
+	// Indexed by the key's modes, the *_BASE entries are never used
+	constexpr D3D12_BLEND_DESC gBlendModes[] =
+	{
+		FixedFunction::gBlendOpaque,
+		FixedFunction::gBlendOpaque,
+		FixedFunction::gBlendAlpha,
+		FixedFunction::gBlendAdditive,
+		FixedFunction::gBlendPremultiplied,
+	};
+
+	constexpr D3D12_DEPTH_STENCIL_DESC1 gDepthModes[] =
+	{
+		FixedFunction::gDepthReadWrite,
+		FixedFunction::gDepthOff,
+		FixedFunction::gDepthRead,
+		FixedFunction::gDepthReadWrite,
+	};
+
+	constexpr D3D12_CULL_MODE gCullModes[] =
+	{
+		D3D12_CULL_MODE_BACK,
+		D3D12_CULL_MODE_NONE,
+		D3D12_CULL_MODE_FRONT,
+		D3D12_CULL_MODE_BACK,
+	};
+
+	// Keys read from a file can hold anything
+	bool HasKnownModes(PipelineVariantKey key)
+	{
+		return key.blend < _countof(gBlendModes) && key.depth < _countof(gDepthModes) && key.cull < _countof(gCullModes);
+	}
+}
+
+PipelineVariantSet::PipelineVariantSet(const std::string &name, const CD3DX12_PIPELINE_STATE_STREAM &base,
+	uint64_t rootSignatureKey, PipelineStateCache *cache, PipelineCompiler *compiler) :
+	m_name(name),
+	m_base(base),
+	m_rootSignatureKey(rootSignatureKey),
+	m_cache(cache),
+	m_compiler(compiler)
+{
+	assert(m_name.find_first_of(" \t\n") == std::string::npos && "Variant set names can't contain whitespace");
+}
+
+uint8_t PipelineVariantSet::RegisterTargetFormats(const D3D12_RT_FORMAT_ARRAY &formats, DXGI_FORMAT dsvFormat)
+{
+	for (size_t i = 0; i < m_targetFormats.size(); ++i)
+	{
+		const TargetFormats &existing = m_targetFormats[i];
+		if (existing.dsvFormat == dsvFormat && existing.rtvFormats.NumRenderTargets == formats.NumRenderTargets &&
+			::memcmp(existing.rtvFormats.RTFormats, formats.RTFormats, formats.NumRenderTargets * sizeof(DXGI_FORMAT)) == 0)
+		{
+			return static_cast<uint8_t>(i + 1);
+		}
+	}
+
+	assert(m_targetFormats.size() < 255);
+	m_targetFormats.push_back({ formats, dsvFormat });
+
+	return static_cast<uint8_t>(m_targetFormats.size());
+}
+
+CD3DX12_PIPELINE_STATE_STREAM PipelineVariantSet::MakeStream(PipelineVariantKey key) const
+{
+	assert(HasKnownModes(key) && key.targetFormats <= m_targetFormats.size());
+
+	CD3DX12_PIPELINE_STATE_STREAM stream = m_base;
+
+	if (key.blend != PipelineVariantKey::BLEND_BASE)
+	{
+		stream.BlendState = CD3DX12_BLEND_DESC(gBlendModes[key.blend]);
+	}
+
+	if (key.depth != PipelineVariantKey::DEPTH_BASE)
+	{
+		stream.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC1(gDepthModes[key.depth]);
+	}
+
+	if (key.cull != PipelineVariantKey::CULL_BASE)
+	{
+		CD3DX12_RASTERIZER_DESC &rasterizer = stream.RasterizerState;
+		rasterizer.CullMode = gCullModes[key.cull];
+	}
+
+	if (key.targetFormats != 0)
+	{
+		const TargetFormats &formats = m_targetFormats[key.targetFormats - 1];
+		stream.RTVFormats = formats.rtvFormats;
+		stream.DSVFormat = formats.dsvFormat;
+	}
+
+	return stream;
+}
+
+PipelineVariantSet::Variant &PipelineVariantSet::Create(PipelineVariantKey key, PipelineCompiler::Priority priority)
+{
+	auto it = m_variants.find(key.Pack());
+	if (it != m_variants.end())
+	{
+		return it->second;
+	}
+
+	CD3DX12_PIPELINE_STATE_STREAM stream = MakeStream(key);
+
+	Variant variant = {};
+	if (m_compiler)
+	{
+		// The compiler copies the stream, the temporary is fine
+		variant.pipelineKey = m_compiler->Compile(stream, m_rootSignatureKey, priority).key;
+	}
+	else
+	{
+		variant.pipelineKey = PipelineStateCache::HashStream({ sizeof(stream), &stream }, m_rootSignatureKey);
+		variant.pipeline = m_cache->GetOrCreate(stream, m_rootSignatureKey);
+	}
+
+	return m_variants.emplace(key.Pack(), variant).first->second;
+}
+
+void PipelineVariantSet::SetBase(const CD3DX12_PIPELINE_STATE_STREAM &base)
+{
+	m_base = base;
+
+	for (auto &entry : m_variants)
+	{
+		CD3DX12_PIPELINE_STATE_STREAM stream = MakeStream(PipelineVariantKey::Unpack(entry.first));
+		Variant &variant = entry.second;
+
+		if (m_compiler)
+		{
+			// The compiler keeps the old pipeline, frames in flight can still use it
+			ComPtr<ID3D12PipelineState> old = m_compiler->Get(variant.pipelineKey);
+			variant.pipelineKey = m_compiler->Compile(stream, m_rootSignatureKey, PipelineCompiler::PRIORITY_HIGH).key;
+			if (old)
+			{
+				m_compiler->SetFallback(variant.pipelineKey, old);
+			}
+		}
+		else
+		{
+			// So does the cache
+			variant.pipelineKey = PipelineStateCache::HashStream({ sizeof(stream), &stream }, m_rootSignatureKey);
+			variant.pipeline = m_cache->GetOrCreate(stream, m_rootSignatureKey);
+		}
+	}
+}
+
+ID3D12PipelineState *PipelineVariantSet::Get(PipelineVariantKey key)
+{
+	Variant &variant = Create(key, PipelineCompiler::PRIORITY_HIGH);
+	variant.requested = true;
+
+	return m_compiler ? m_compiler->Get(variant.pipelineKey) : variant.pipeline.Get();
+}
+
+uint64_t PipelineVariantSet::GetPipelineKey(PipelineVariantKey key)
+{
+	return Create(key, PipelineCompiler::PRIORITY_HIGH).pipelineKey;
+}
+
+void PipelineVariantSet::SaveUsedVariants(const std::wstring &path, const std::vector<PipelineVariantSet*> &sets)
+{
+	// Only what was drawn with, prewarmed variants nothing asked for drop out.
+	// A session that never got to draw keeps the last list.
+	std::vector<std::pair<const PipelineVariantSet*, uint32_t>> used;
+	for (const PipelineVariantSet *set : sets)
+	{
+		for (const auto &variant : set->m_variants)
+		{
+			if (variant.second.requested)
+			{
+				used.emplace_back(set, variant.first);
+			}
+		}
+	}
+	if (used.empty())
+	{
+		return;
+	}
+
+	std::ofstream file(path, std::ios::trunc);
+	for (const auto &variant : used)
+	{
+		file << variant.first->m_name << ' ' << std::hex << variant.second << std::dec << '\n';
+	}
+}
+
+void PipelineVariantSet::PrewarmVariants(const std::wstring &path, const std::vector<PipelineVariantSet*> &sets)
+{
+	std::ifstream file(path);
+
+	std::string name;
+	uint32_t packed;
+	while (file >> name >> std::hex >> packed >> std::dec)
+	{
+		for (PipelineVariantSet *set : sets)
+		{
+			PipelineVariantKey key = PipelineVariantKey::Unpack(packed);
+
+			// Format sets are registered at runtime, skip ones this run doesn't have (yet)
+			if (set->m_name == name && HasKnownModes(key) && key.targetFormats <= set->m_targetFormats.size())
+			{
+				set->Create(key, PipelineCompiler::PRIORITY_LOW);
+			}
+		}
+	}
+}
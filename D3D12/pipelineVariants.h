@@ -0,0 +1,125 @@
+#pragma once
+
+#include "includes.h"
+#include "pipelineCache.h"
+#include "pipelineCompiler.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Materials mostly differ in a few fixed function settings (blending, depth
+// writes, culling, render target formats). Instead of describing every
+// combination up front, a variant set holds one base stream and creates a
+// variant the first time a key asks for it.
+//
+// Keys that were used can be written to a file at the end of a session and
+// compiled ahead of time on the next start (prewarming), so the variants a
+// level actually needs are ready before the first frame.
+
+struct PipelineVariantKey
+{
+	enum BlendMode : uint8_t
+	{
+		BLEND_BASE,				// keep whatever the base stream has
+		BLEND_OPAQUE,
+		BLEND_ALPHA,
+		BLEND_ADDITIVE,
+		BLEND_PREMULTIPLIED,
+	};
+
+	enum DepthMode : uint8_t
+	{
+		DEPTH_BASE,
+		DEPTH_OFF,
+		DEPTH_READ,				// test but don't write
+		DEPTH_READ_WRITE,
+	};
+
+	enum CullMode : uint8_t
+	{
+		CULL_BASE,
+		CULL_NONE,
+		CULL_FRONT,
+		CULL_BACK,
+	};
+
+	BlendMode blend;
+	DepthMode depth;
+	CullMode cull;
+	uint8_t targetFormats;		// 0 = base, otherwise returned by RegisterTargetFormats
+
+	uint32_t Pack() const
+	{
+		return uint32_t(blend) | (uint32_t(depth) << 8) | (uint32_t(cull) << 16) | (uint32_t(targetFormats) << 24);
+	}
+
+	static PipelineVariantKey Unpack(uint32_t packed)
+	{
+		PipelineVariantKey key;
+		key.blend = static_cast<BlendMode>(packed & 0xFF);
+		key.depth = static_cast<DepthMode>((packed >> 8) & 0xFF);
+		key.cull = static_cast<CullMode>((packed >> 16) & 0xFF);
+		key.targetFormats = static_cast<uint8_t>(packed >> 24);
+		return key;
+	}
+};
+
+class PipelineVariantSet
+{
+public:
+	// Everything the base stream points to must outlive the set.
+	// With a compiler, variants are compiled in the background and Get()
+	// returns the compiler's fallback (or nullptr) until they're ready.
+	PipelineVariantSet(const std::string &name, const CD3DX12_PIPELINE_STATE_STREAM &base, uint64_t rootSignatureKey,
+		PipelineStateCache *cache, PipelineCompiler *compiler = nullptr);
+
+	// Returns the value to put in PipelineVariantKey::targetFormats
+	uint8_t RegisterTargetFormats(const D3D12_RT_FORMAT_ARRAY &formats, DXGI_FORMAT dsvFormat);
+
+	ID3D12PipelineState *Get(PipelineVariantKey key);
+	// PipelineStateCache::HashStream of the variant's stream, requesting it if needed
+	uint64_t GetPipelineKey(PipelineVariantKey key);
+
+	// Swaps the base stream (e.g. for hot reloaded shaders) and requests every
+	// variant again with it. With a compiler the old pipelines are the
+	// fallbacks until the new ones are ready.
+	void SetBase(const CD3DX12_PIPELINE_STATE_STREAM &base);
+
+	// The base stream with the key's overrides applied
+	CD3DX12_PIPELINE_STATE_STREAM MakeStream(PipelineVariantKey key) const;
+
+	const std::string &GetName() const { return m_name; }
+	uint32_t GetNumVariants() const { return static_cast<uint32_t>(m_variants.size()); }
+
+	// Writes "<set name> <packed key>" for every variant Get() was called for,
+	// the file is left alone when there were none
+	static void SaveUsedVariants(const std::wstring &path, const std::vector<PipelineVariantSet*> &sets);
+	// Requests every variant listed in the file, at low priority when a compiler is used
+	static void PrewarmVariants(const std::wstring &path, const std::vector<PipelineVariantSet*> &sets);
+
+private:
+	struct TargetFormats
+	{
+		D3D12_RT_FORMAT_ARRAY rtvFormats;
+		DXGI_FORMAT dsvFormat;
+	};
+
+	struct Variant
+	{
+		uint64_t pipelineKey;
+		ComPtr<ID3D12PipelineState> pipeline;
+		bool requested;			// by Get(), not just prewarmed
+	};
+
+	Variant &Create(PipelineVariantKey key, PipelineCompiler::Priority priority);
+
+	std::string m_name;
+	CD3DX12_PIPELINE_STATE_STREAM m_base;
+	uint64_t m_rootSignatureKey;
+	PipelineStateCache *m_cache;
+	PipelineCompiler *m_compiler;
+
+	std::vector<TargetFormats> m_targetFormats;
+	std::unordered_map<uint32_t, Variant> m_variants;
+};
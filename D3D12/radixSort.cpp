@@ -0,0 +1,198 @@
+#include "radixSort.h"
+
+#include "jobSystem.h"
+
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	const uint32_t gNumPasses = 8;
+	const uint32_t gNumBuckets = 256;
+
+	struct Histogram
+	{
+		uint32_t counts[gNumBuckets];
+	};
+
+	struct SortState
+	{
+		uint64_t *keys[2];
+		uint32_t *values[2];
+		size_t count;
+		uint32_t numBlocks;
+
+		// Per block of keys
+		std::vector<Histogram> bytes;		// gNumPasses histograms each, counted once up front
+		std::vector<Histogram> counts;		// the pass being sorted
+		std::vector<Histogram> offsets;
+
+		uint32_t passes[gNumPasses];		// the passes that aren't skipped
+		uint32_t numPasses;
+
+		size_t Begin(uint32_t block) const { return count * block / numBlocks; }
+		size_t End(uint32_t block) const { return count * (block + 1) / numBlocks; }
+	};
+
+	void CountBytes(SortState &state, uint32_t block)
+	{
+		Histogram *histograms = &state.bytes[block * gNumPasses];
+		std::memset(histograms, 0, sizeof(Histogram) * gNumPasses);
+
+		const uint64_t *keys = state.keys[0];
+		for (size_t i = state.Begin(block); i < state.End(block); ++i)
+		{
+			uint64_t key = keys[i];
+			for (uint32_t pass = 0; pass < gNumPasses; ++pass)
+			{
+				histograms[pass].counts[(key >> (pass * 8)) & 0xff]++;
+			}
+		}
+	}
+
+	// A pass is skipped when every key has the same byte there
+	void FindPasses(SortState &state)
+	{
+		state.numPasses = 0;
+
+		uint64_t first = state.keys[0][0];
+		for (uint32_t pass = 0; pass < gNumPasses; ++pass)
+		{
+			uint32_t bucket = (first >> (pass * 8)) & 0xff;
+
+			size_t total = 0;
+			for (uint32_t block = 0; block < state.numBlocks; ++block)
+			{
+				total += state.bytes[block * gNumPasses + pass].counts[bucket];
+			}
+
+			if (total != state.count)
+			{
+				state.passes[state.numPasses++] = pass;
+			}
+		}
+	}
+
+	void CountPass(SortState &state, uint32_t block, uint32_t pass, uint32_t src)
+	{
+		uint32_t *counts = state.counts[block].counts;
+		std::memset(counts, 0, sizeof(Histogram));
+
+		const uint64_t *keys = state.keys[src];
+		uint32_t shift = pass * 8;
+		for (size_t i = state.Begin(block); i < state.End(block); ++i)
+		{
+			counts[(keys[i] >> shift) & 0xff]++;
+		}
+	}
+
+	// Offsets in bucket order, and within a bucket in block order
+	void ComputeOffsets(SortState &state)
+	{
+		uint32_t offset = 0;
+		for (uint32_t bucket = 0; bucket < gNumBuckets; ++bucket)
+		{
+			for (uint32_t block = 0; block < state.numBlocks; ++block)
+			{
+				state.offsets[block].counts[bucket] = offset;
+				offset += state.counts[block].counts[bucket];
+			}
+		}
+	}
+
+	void Scatter(SortState &state, uint32_t block, uint32_t pass, uint32_t src)
+	{
+		const uint64_t *srcKeys = state.keys[src];
+		const uint32_t *srcValues = state.values[src];
+		uint64_t *dstKeys = state.keys[src ^ 1];
+		uint32_t *dstValues = state.values[src ^ 1];
+
+		uint32_t *offsets = state.offsets[block].counts;
+		uint32_t shift = pass * 8;
+		for (size_t i = state.Begin(block); i < state.End(block); ++i)
+		{
+			uint32_t dst = offsets[(srcKeys[i] >> shift) & 0xff]++;
+			dstKeys[dst] = srcKeys[i];
+			dstValues[dst] = srcValues[i];
+		}
+	}
+
+	// Runs function(block) for every block, on the job system's threads if there is one
+	template <typename Function>
+	void ForEachBlock(SortState &state, JobSystem *jobs, const Function &function)
+	{
+		if (state.numBlocks == 1)
+		{
+			function(0u);
+			return;
+		}
+
+		jobs->ParallelFor(state.numBlocks, 1, [&function](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t block = begin; block < end; ++block)
+			{
+				function(block);
+			}
+		});
+	}
+}
+
+void RadixSort::Sort(uint64_t *keys, uint32_t *values, uint64_t *tempKeys, uint32_t *tempValues, size_t count,
+	JobSystem *jobs)
+{
+	if (count < 2)
+	{
+		return;
+	}
+
+	assert(count <= UINT32_MAX);
+
+	SortState state;
+	state.keys[0] = keys;
+	state.keys[1] = tempKeys;
+	state.values[0] = values;
+	state.values[1] = tempValues;
+	state.count = count;
+	state.numBlocks = 1;
+	if (jobs && count >= gParallelThreshold)
+	{
+		state.numBlocks = jobs->GetNumThreads();
+	}
+	state.bytes.resize(state.numBlocks * gNumPasses);
+	state.counts.resize(state.numBlocks);
+	state.offsets.resize(state.numBlocks);
+	state.numPasses = 0;
+
+	ForEachBlock(state, jobs, [&state](uint32_t block) { CountBytes(state, block); });
+	FindPasses(state);
+
+	for (uint32_t i = 0; i < state.numPasses; ++i)
+	{
+		uint32_t pass = state.passes[i];
+		uint32_t src = i & 1;
+
+		// Nothing moved before the first pass, its counts are already there
+		if (i == 0)
+		{
+			for (uint32_t block = 0; block < state.numBlocks; ++block)
+			{
+				state.counts[block] = state.bytes[block * gNumPasses + pass];
+			}
+		}
+		else
+		{
+			ForEachBlock(state, jobs, [&state, pass, src](uint32_t block) { CountPass(state, block, pass, src); });
+		}
+
+		ComputeOffsets(state);
+
+		ForEachBlock(state, jobs, [&state, pass, src](uint32_t block) { Scatter(state, block, pass, src); });
+	}
+
+	// An odd number of passes leaves the result in the temp arrays
+	if (state.numPasses & 1)
+	{
+		std::memcpy(keys, tempKeys, sizeof(uint64_t) * count);
+		std::memcpy(values, tempValues, sizeof(uint32_t) * count);
+	}
+}
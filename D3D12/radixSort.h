@@ -0,0 +1,27 @@
+#pragma once
+
+#include "includes.h"
+
+// LSD radix sort of 64-bit keys, each carrying a 32-bit value along.
+//
+// Eight passes of one byte each, stable, so keys that compare equal keep
+// the order they were added in. One sweep over the keys first counts every
+// byte, and passes where all keys have the same byte (e.g. the pass bits
+// of a frame with one pass) are skipped.
+//
+// Above gParallelThreshold keys, with a JobSystem, every pass is split in
+// one block per thread: each block is counted on its own, the counts are
+// turned into offsets so the blocks keep their order, and each block is
+// scattered on its own.
+
+class JobSystem;
+
+namespace RadixSort
+{
+	// Below this the jobs cost more than they save
+	const size_t gParallelThreshold = 64 * 1024;
+
+	// The temp arrays must hold count elements too. The result is in keys and values.
+	void Sort(uint64_t *keys, uint32_t *values, uint64_t *tempKeys, uint32_t *tempValues, size_t count,
+		JobSystem *jobs = nullptr);
+}
@@ -0,0 +1,284 @@
+#include "renderPass.h"
+
+D3D12_RENDER_PASS_BEGINNING_ACCESS RenderPassAccess::Clear(const D3D12_CLEAR_VALUE &clearValue)
+{
+	D3D12_RENDER_PASS_BEGINNING_ACCESS access = {};
+	access.Type = D3D12_RENDER_PASS_BEGINNING_ACCESS_TYPE_CLEAR;
+	access.Clear.ClearValue = clearValue;
+
+	return access;
+}
+
+D3D12_RENDER_PASS_BEGINNING_ACCESS RenderPassAccess::Preserve()
+{
+	D3D12_RENDER_PASS_BEGINNING_ACCESS access = {};
+	access.Type = D3D12_RENDER_PASS_BEGINNING_ACCESS_TYPE_PRESERVE;
+
+	return access;
+}
+
+D3D12_RENDER_PASS_BEGINNING_ACCESS RenderPassAccess::Discard()
+{
+	D3D12_RENDER_PASS_BEGINNING_ACCESS access = {};
+	access.Type = D3D12_RENDER_PASS_BEGINNING_ACCESS_TYPE_DISCARD;
+
+	return access;
+}
+
+D3D12_RENDER_PASS_BEGINNING_ACCESS RenderPassAccess::NoAccess()
+{
+	D3D12_RENDER_PASS_BEGINNING_ACCESS access = {};
+	access.Type = D3D12_RENDER_PASS_BEGINNING_ACCESS_TYPE_NO_ACCESS;
+
+	return access;
+}
+
+D3D12_RENDER_PASS_ENDING_ACCESS RenderPassAccess::EndPreserve()
+{
+	D3D12_RENDER_PASS_ENDING_ACCESS access = {};
+	access.Type = D3D12_RENDER_PASS_ENDING_ACCESS_TYPE_PRESERVE;
+
+	return access;
+}
+
+D3D12_RENDER_PASS_ENDING_ACCESS RenderPassAccess::EndDiscard()
+{
+	D3D12_RENDER_PASS_ENDING_ACCESS access = {};
+	access.Type = D3D12_RENDER_PASS_ENDING_ACCESS_TYPE_DISCARD;
+
+	return access;
+}
+
+D3D12_RENDER_PASS_ENDING_ACCESS RenderPassAccess::EndNoAccess()
+{
+	D3D12_RENDER_PASS_ENDING_ACCESS access = {};
+	access.Type = D3D12_RENDER_PASS_ENDING_ACCESS_TYPE_NO_ACCESS;
+
+	return access;
+}
+
+D3D12_RENDER_PASS_ENDING_ACCESS RenderPassAccess::EndResolve(ID3D12Resource *src, ID3D12Resource *dst,
+	DXGI_FORMAT format, D3D12_RESOLVE_MODE mode,
+	const D3D12_RENDER_PASS_ENDING_ACCESS_RESOLVE_SUBRESOURCE_PARAMETERS *subresourceParameters,
+	UINT subresourceCount, bool preserveSource)
+{
+	D3D12_RENDER_PASS_ENDING_ACCESS access = {};
+	access.Type = D3D12_RENDER_PASS_ENDING_ACCESS_TYPE_RESOLVE;
+	access.Resolve.pSrcResource = src;
+	access.Resolve.pDstResource = dst;
+	access.Resolve.SubresourceCount = subresourceCount;
+	access.Resolve.pSubresourceParameters = subresourceParameters;
+	access.Resolve.Format = format;
+	access.Resolve.ResolveMode = mode;
+	access.Resolve.PreserveResolveSource = preserveSource ? TRUE : FALSE;
+
+	return access;
+}
+
+RenderPassDesc::RenderPassDesc() :
+	m_numRenderTargets(0),
+	m_depthStencil(),
+	m_hasDepthStencil(false),
+	m_flags(D3D12_RENDER_PASS_FLAG_NONE)
+{
+}
+
+RenderPassDesc &RenderPassDesc::AddRenderTarget(D3D12_CPU_DESCRIPTOR_HANDLE rtv,
+	const D3D12_RENDER_PASS_BEGINNING_ACCESS &beginning, const D3D12_RENDER_PASS_ENDING_ACCESS &ending)
+{
+	assert(m_numRenderTargets < D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT);
+
+	D3D12_RENDER_PASS_RENDER_TARGET_DESC &rt = m_renderTargets[m_numRenderTargets++];
+	rt.cpuDescriptor = rtv;
+	rt.BeginningAccess = beginning;
+	rt.EndingAccess = ending;
+
+	return *this;
+}
+
+RenderPassDesc &RenderPassDesc::SetDepthStencil(D3D12_CPU_DESCRIPTOR_HANDLE dsv,
+	const D3D12_RENDER_PASS_BEGINNING_ACCESS &depthBeginning, const D3D12_RENDER_PASS_ENDING_ACCESS &depthEnding,
+	const D3D12_RENDER_PASS_BEGINNING_ACCESS &stencilBeginning, const D3D12_RENDER_PASS_ENDING_ACCESS &stencilEnding)
+{
+	m_depthStencil.cpuDescriptor = dsv;
+	m_depthStencil.DepthBeginningAccess = depthBeginning;
+	m_depthStencil.DepthEndingAccess = depthEnding;
+	m_depthStencil.StencilBeginningAccess = stencilBeginning;
+	m_depthStencil.StencilEndingAccess = stencilEnding;
+	m_hasDepthStencil = true;
+
+	return *this;
+}
+
+RenderPassDesc &RenderPassDesc::SetFlags(D3D12_RENDER_PASS_FLAGS flags)
+{
+	m_flags = flags;
+
+	return *this;
+}
+
+uint64_t RenderPassDesc::Hash() const
+{
+	// FNV-1a over the fields that usually differ between passes
+	uint64_t hash = 14695981039346656037ull;
+	auto mix = [&hash](uint64_t value)
+	{
+		hash ^= value;
+		hash *= 1099511628211ull;
+	};
+
+	mix(m_numRenderTargets);
+	for (UINT i = 0; i < m_numRenderTargets; ++i)
+	{
+		mix(m_renderTargets[i].cpuDescriptor.ptr);
+		mix(m_renderTargets[i].BeginningAccess.Type);
+		mix(m_renderTargets[i].EndingAccess.Type);
+	}
+
+	if (m_hasDepthStencil)
+	{
+		mix(m_depthStencil.cpuDescriptor.ptr);
+		mix(m_depthStencil.DepthBeginningAccess.Type);
+		mix(m_depthStencil.DepthEndingAccess.Type);
+		mix(m_depthStencil.StencilBeginningAccess.Type);
+		mix(m_depthStencil.StencilEndingAccess.Type);
+	}
+
+	mix(m_flags);
+
+	return hash;
+}
+
+bool RenderPassDesc::operator==(const RenderPassDesc &other) const
+{
+	if (m_numRenderTargets != other.m_numRenderTargets ||
+		m_hasDepthStencil != other.m_hasDepthStencil ||
+		m_flags != other.m_flags)
+	{
+		return false;
+	}
+
+	for (UINT i = 0; i < m_numRenderTargets; ++i)
+	{
+		if (!(m_renderTargets[i] == other.m_renderTargets[i]))
+		{
+			return false;
+		}
+	}
+
+	return !m_hasDepthStencil || m_depthStencil == other.m_depthStencil;
+}
+
+RenderPassCache::PassId RenderPassCache::Register(const RenderPassDesc &desc)
+{
+	uint64_t hash = desc.Hash();
+	for (PassId i = 0; i < m_passes.size(); ++i)
+	{
+		if (m_passes[i].hash == hash && m_passes[i].desc == desc)
+		{
+			return i;
+		}
+	}
+
+	m_passes.push_back({ hash, desc });
+
+	return static_cast<PassId>(m_passes.size() - 1);
+}
+
+ID3D12GraphicsCommandList4 *RenderPassCache::GetCommandList4(ID3D12GraphicsCommandList *commandList)
+{
+	// QueryInterface isn't free, only do it when the command list changes
+	if (commandList != m_lastCommandList)
+	{
+		m_lastCommandList = commandList;
+		m_lastCommandList4.Reset();
+		commandList->QueryInterface(IID_PPV_ARGS(&m_lastCommandList4));
+	}
+
+	return m_lastCommandList4.Get();
+}
+
+void RenderPassCache::Begin(ID3D12GraphicsCommandList *commandList, PassId pass)
+{
+	assert(m_currentPass == ~0u && "Render passes can't be nested");
+	m_currentPass = pass;
+
+	const RenderPassDesc &desc = m_passes[pass].desc;
+
+	ID3D12GraphicsCommandList4 *commandList4 = GetCommandList4(commandList);
+	if (commandList4)
+	{
+		commandList4->BeginRenderPass(desc.GetNumRenderTargets(), desc.GetRenderTargets(),
+			desc.GetDepthStencil(), desc.GetFlags());
+		return;
+	}
+
+	// Older runtime, emulate the beginning accesses
+	D3D12_CPU_DESCRIPTOR_HANDLE rtvs[D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT];
+	for (UINT i = 0; i < desc.GetNumRenderTargets(); ++i)
+	{
+		const D3D12_RENDER_PASS_RENDER_TARGET_DESC &rt = desc.GetRenderTargets()[i];
+		rtvs[i] = rt.cpuDescriptor;
+
+		if (rt.BeginningAccess.Type == D3D12_RENDER_PASS_BEGINNING_ACCESS_TYPE_CLEAR)
+		{
+			commandList->ClearRenderTargetView(rt.cpuDescriptor, rt.BeginningAccess.Clear.ClearValue.Color, 0, nullptr);
+		}
+	}
+
+	const D3D12_RENDER_PASS_DEPTH_STENCIL_DESC *ds = desc.GetDepthStencil();
+	if (ds)
+	{
+		UINT clearFlags = 0;
+		if (ds->DepthBeginningAccess.Type == D3D12_RENDER_PASS_BEGINNING_ACCESS_TYPE_CLEAR)
+		{
+			clearFlags |= D3D12_CLEAR_FLAG_DEPTH;
+		}
+		if (ds->StencilBeginningAccess.Type == D3D12_RENDER_PASS_BEGINNING_ACCESS_TYPE_CLEAR)
+		{
+			clearFlags |= D3D12_CLEAR_FLAG_STENCIL;
+		}
+
+		if (clearFlags)
+		{
+			commandList->ClearDepthStencilView(ds->cpuDescriptor, static_cast<D3D12_CLEAR_FLAGS>(clearFlags),
+				ds->DepthBeginningAccess.Clear.ClearValue.DepthStencil.Depth,
+				ds->StencilBeginningAccess.Clear.ClearValue.DepthStencil.Stencil,
+				0, nullptr);
+		}
+	}
+
+	commandList->OMSetRenderTargets(desc.GetNumRenderTargets(), rtvs, FALSE, ds ? &ds->cpuDescriptor : nullptr);
+}
+
+void RenderPassCache::End(ID3D12GraphicsCommandList *commandList)
+{
+	assert(m_currentPass != ~0u && "End() called without Begin()");
+
+	const RenderPassDesc &desc = m_passes[m_currentPass].desc;
+	m_currentPass = ~0u;
+
+	ID3D12GraphicsCommandList4 *commandList4 = GetCommandList4(commandList);
+	if (commandList4)
+	{
+		commandList4->EndRenderPass();
+		return;
+	}
+
+	// Older runtime, only resolves need to be emulated.
+	// The caller is responsible for the resolve barriers in this case.
+	for (UINT i = 0; i < desc.GetNumRenderTargets(); ++i)
+	{
+		const D3D12_RENDER_PASS_ENDING_ACCESS &ending = desc.GetRenderTargets()[i].EndingAccess;
+		if (ending.Type == D3D12_RENDER_PASS_ENDING_ACCESS_TYPE_RESOLVE)
+		{
+			const D3D12_RENDER_PASS_ENDING_ACCESS_RESOLVE_PARAMETERS &resolve = ending.Resolve;
+			for (UINT s = 0; s < resolve.SubresourceCount; ++s)
+			{
+				const D3D12_RENDER_PASS_ENDING_ACCESS_RESOLVE_SUBRESOURCE_PARAMETERS &sub = resolve.pSubresourceParameters[s];
+				commandList->ResolveSubresource(resolve.pDstResource, sub.DstSubresource,
+					resolve.pSrcResource, sub.SrcSubresource, resolve.Format);
+			}
+		}
+	}
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "includes.h"
+
+#include <vector>
+
+// Render passes declare up front what happens to every attachment when the
+// pass begins (clear, preserve, discard) and when it ends (preserve, discard,
+// resolve). Tile based GPUs use this to skip loading and storing memory they
+// don't need to. Barriers are still the caller's job, BeginRenderPass doesn't
+// transition anything.
+
+namespace RenderPassAccess
+{
+	D3D12_RENDER_PASS_BEGINNING_ACCESS Clear(const D3D12_CLEAR_VALUE &clearValue);
+	D3D12_RENDER_PASS_BEGINNING_ACCESS Preserve();
+	D3D12_RENDER_PASS_BEGINNING_ACCESS Discard();
+	D3D12_RENDER_PASS_BEGINNING_ACCESS NoAccess();
+
+	D3D12_RENDER_PASS_ENDING_ACCESS EndPreserve();
+	D3D12_RENDER_PASS_ENDING_ACCESS EndDiscard();
+	D3D12_RENDER_PASS_ENDING_ACCESS EndNoAccess();
+	// subresourceParameters must stay alive as long as the pass is cached
+	D3D12_RENDER_PASS_ENDING_ACCESS EndResolve(ID3D12Resource *src, ID3D12Resource *dst,
+		DXGI_FORMAT format, D3D12_RESOLVE_MODE mode,
+		const D3D12_RENDER_PASS_ENDING_ACCESS_RESOLVE_SUBRESOURCE_PARAMETERS *subresourceParameters,
+		UINT subresourceCount, bool preserveSource);
+}
+
+class RenderPassDesc
+{
+public:
+	RenderPassDesc();
+
+	RenderPassDesc &AddRenderTarget(D3D12_CPU_DESCRIPTOR_HANDLE rtv,
+		const D3D12_RENDER_PASS_BEGINNING_ACCESS &beginning, const D3D12_RENDER_PASS_ENDING_ACCESS &ending);
+	RenderPassDesc &SetDepthStencil(D3D12_CPU_DESCRIPTOR_HANDLE dsv,
+		const D3D12_RENDER_PASS_BEGINNING_ACCESS &depthBeginning, const D3D12_RENDER_PASS_ENDING_ACCESS &depthEnding,
+		const D3D12_RENDER_PASS_BEGINNING_ACCESS &stencilBeginning, const D3D12_RENDER_PASS_ENDING_ACCESS &stencilEnding);
+	RenderPassDesc &SetFlags(D3D12_RENDER_PASS_FLAGS flags);
+
+	UINT GetNumRenderTargets() const { return m_numRenderTargets; }
+	const D3D12_RENDER_PASS_RENDER_TARGET_DESC *GetRenderTargets() const { return m_renderTargets; }
+	const D3D12_RENDER_PASS_DEPTH_STENCIL_DESC *GetDepthStencil() const { return m_hasDepthStencil ? &m_depthStencil : nullptr; }
+	D3D12_RENDER_PASS_FLAGS GetFlags() const { return m_flags; }
+
+	// Cheap key used to skip most of the full comparisons
+	uint64_t Hash() const;
+
+	// Uses the D3D12_RENDER_PASS_* comparison operators from d3dx12.h
+	bool operator==(const RenderPassDesc &other) const;
+
+private:
+	D3D12_RENDER_PASS_RENDER_TARGET_DESC m_renderTargets[D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT];
+	UINT m_numRenderTargets;
+	D3D12_RENDER_PASS_DEPTH_STENCIL_DESC m_depthStencil;
+	bool m_hasDepthStencil;
+	D3D12_RENDER_PASS_FLAGS m_flags;
+};
+
+// Keeps every pass description that was registered so the same pass isn't
+// rebuilt each frame. Registering an identical description returns the
+// existing id.
+class RenderPassCache
+{
+public:
+	typedef uint32_t PassId;
+
+	PassId Register(const RenderPassDesc &desc);
+	const RenderPassDesc &Get(PassId pass) const { return m_passes[pass].desc; }
+
+	// Falls back to plain clears and resolves when the command list
+	// doesn't support ID3D12GraphicsCommandList4.
+	void Begin(ID3D12GraphicsCommandList *commandList, PassId pass);
+	void End(ID3D12GraphicsCommandList *commandList);
+
+	void Clear() { m_passes.clear(); }
+	uint32_t GetNumPasses() const { return static_cast<uint32_t>(m_passes.size()); }
+
+private:
+	struct Entry
+	{
+		uint64_t hash;
+		RenderPassDesc desc;
+	};
+
+	ID3D12GraphicsCommandList4 *GetCommandList4(ID3D12GraphicsCommandList *commandList);
+
+	std::vector<Entry> m_passes;
+	PassId m_currentPass = ~0u;
+
+	// The last command list that was queried for the render pass interface
+	ID3D12GraphicsCommandList *m_lastCommandList = nullptr;
+	ComPtr<ID3D12GraphicsCommandList4> m_lastCommandList4;
+};
@@ -0,0 +1,234 @@
+#include "renderTargetPool.h"
+
+RenderTargetPool::RenderTargetPool(ComPtr<ID3D12Device2> device, uint32_t maxTargets) :
+	m_device(device),
+	m_maxTargets(maxTargets),
+	m_completedFenceValue(0)
+{
+	D3D12_DESCRIPTOR_HEAP_DESC desc = {};
+	desc.NumDescriptors = maxTargets;
+
+	desc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
+	ThrowIfFailed(m_device->CreateDescriptorHeap(&desc, IID_PPV_ARGS(&m_rtvHeap)));
+
+	desc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_DSV;
+	ThrowIfFailed(m_device->CreateDescriptorHeap(&desc, IID_PPV_ARGS(&m_dsvHeap)));
+
+	m_rtvDescriptorSize = m_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
+	m_dsvDescriptorSize = m_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_DSV);
+
+	// Hand out the lowest slots first
+	for (uint32_t i = maxTargets; i > 0; --i)
+	{
+		m_freeRTVs.push_back(i - 1);
+		m_freeDSVs.push_back(i - 1);
+	}
+
+	m_targets.reserve(maxTargets);
+}
+
+void RenderTargetPool::RegisterClearValue(DXGI_FORMAT format, const FLOAT color[4])
+{
+	m_clearValues[format] = CD3DX12_CLEAR_VALUE(format, color);
+}
+
+void RenderTargetPool::RegisterClearValue(DXGI_FORMAT format, FLOAT depth, UINT8 stencil)
+{
+	m_clearValues[format] = CD3DX12_CLEAR_VALUE(format, depth, stencil);
+}
+
+const D3D12_CLEAR_VALUE &RenderTargetPool::GetRegisteredClearValue(DXGI_FORMAT format)
+{
+	auto it = m_clearValues.find(format);
+	if (it == m_clearValues.end())
+	{
+		const FLOAT black[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+		bool depthFormat = format == DXGI_FORMAT_D24_UNORM_S8_UINT
+			|| format == DXGI_FORMAT_D16_UNORM
+			|| format == DXGI_FORMAT_D32_FLOAT
+			|| format == DXGI_FORMAT_D32_FLOAT_S8X24_UINT;
+
+		it = m_clearValues.emplace(format, depthFormat ?
+			CD3DX12_CLEAR_VALUE(format, 1.0f, 0) : CD3DX12_CLEAR_VALUE(format, black)).first;
+	}
+
+	return it->second;
+}
+
+bool RenderTargetPool::IsDepthStencil(const D3D12_RESOURCE_DESC &desc)
+{
+	return (desc.Flags & D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL) != 0;
+}
+
+uint32_t RenderTargetPool::AllocateDescriptor(bool depthStencil)
+{
+	std::vector<uint32_t> &freeList = depthStencil ? m_freeDSVs : m_freeRTVs;
+	assert(!freeList.empty() && "Render target pool is out of descriptors");
+
+	uint32_t idx = freeList.back();
+	freeList.pop_back();
+
+	return idx;
+}
+
+RenderTargetPool::Handle RenderTargetPool::Acquire(const D3D12_RESOURCE_DESC &desc, D3D12_RESOURCE_STATES initialState)
+{
+	assert((desc.Flags & (D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET | D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL)) != 0 &&
+		"Pooled targets must be render targets or depth buffers");
+
+	const D3D12_CLEAR_VALUE &clearValue = GetRegisteredClearValue(desc.Format);
+
+	// Reuse a target the GPU is done with
+	Handle emptySlot = InvalidHandle;
+	for (Handle i = 0; i < m_targets.size(); ++i)
+	{
+		Target &target = m_targets[i];
+		if (!target.resource)
+		{
+			if (emptySlot == InvalidHandle)
+			{
+				emptySlot = i;
+			}
+			continue;
+		}
+
+		if (!target.inUse && target.fenceValue <= m_completedFenceValue &&
+			target.desc == desc && target.clearValue == clearValue && target.state == initialState)
+		{
+			// Callers hand targets back in the state they acquired them in
+			target.inUse = true;
+			return i;
+		}
+	}
+
+	bool depthStencil = IsDepthStencil(desc);
+
+	Target target = {};
+	target.desc = desc;
+	target.clearValue = CD3DX12_CLEAR_VALUE(clearValue);
+	target.state = initialState;
+	target.inUse = true;
+
+	CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_DEFAULT);
+	ThrowIfFailed(m_device->CreateCommittedResource(
+		&heapProperties,
+		D3D12_HEAP_FLAG_NONE,
+		&desc,
+		initialState,
+		&target.clearValue,		// optimized clear value, enables fast clears
+		IID_PPV_ARGS(&target.resource)
+	));
+
+	target.descriptorIdx = AllocateDescriptor(depthStencil);
+	if (depthStencil)
+	{
+		CD3DX12_CPU_DESCRIPTOR_HANDLE dsv(m_dsvHeap->GetCPUDescriptorHandleForHeapStart(),
+			target.descriptorIdx, m_dsvDescriptorSize);
+		m_device->CreateDepthStencilView(target.resource.Get(), nullptr, dsv);
+	}
+	else
+	{
+		CD3DX12_CPU_DESCRIPTOR_HANDLE rtv(m_rtvHeap->GetCPUDescriptorHandleForHeapStart(),
+			target.descriptorIdx, m_rtvDescriptorSize);
+		m_device->CreateRenderTargetView(target.resource.Get(), nullptr, rtv);
+	}
+
+	if (emptySlot != InvalidHandle)
+	{
+		m_targets[emptySlot] = target;
+		return emptySlot;
+	}
+
+	assert(m_targets.size() < m_maxTargets && "Render target pool is full");
+	m_targets.push_back(target);
+
+	return static_cast<Handle>(m_targets.size() - 1);
+}
+
+void RenderTargetPool::Release(Handle target, uint64_t fenceValue)
+{
+	assert(target < m_targets.size() && m_targets[target].inUse);
+
+	m_targets[target].inUse = false;
+	m_targets[target].fenceValue = fenceValue;
+}
+
+void RenderTargetPool::Retire(uint64_t completedFenceValue)
+{
+	m_completedFenceValue = std::max(m_completedFenceValue, completedFenceValue);
+}
+
+void RenderTargetPool::Trim()
+{
+	for (Target &target : m_targets)
+	{
+		if (target.resource && !target.inUse)
+		{
+			// Make sure the GPU is done with it before calling this
+			assert(target.fenceValue <= m_completedFenceValue);
+
+			(IsDepthStencil(target.desc) ? m_freeDSVs : m_freeRTVs).push_back(target.descriptorIdx);
+			target.resource.Reset();
+		}
+	}
+}
+
+ID3D12Resource *RenderTargetPool::GetResource(Handle target) const
+{
+	return m_targets[target].resource.Get();
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE RenderTargetPool::GetView(Handle target) const
+{
+	const Target &t = m_targets[target];
+	if (IsDepthStencil(t.desc))
+	{
+		return CD3DX12_CPU_DESCRIPTOR_HANDLE(m_dsvHeap->GetCPUDescriptorHandleForHeapStart(),
+			t.descriptorIdx, m_dsvDescriptorSize);
+	}
+
+	return CD3DX12_CPU_DESCRIPTOR_HANDLE(m_rtvHeap->GetCPUDescriptorHandleForHeapStart(),
+		t.descriptorIdx, m_rtvDescriptorSize);
+}
+
+const D3D12_CLEAR_VALUE &RenderTargetPool::GetClearValue(Handle target) const
+{
+	return m_targets[target].clearValue;
+}
+
+void RenderTargetPool::ClearRenderTarget(ID3D12GraphicsCommandList *commandList, Handle target, const FLOAT color[4])
+{
+#if defined(_DEBUG)
+	const D3D12_CLEAR_VALUE &clearValue = m_targets[target].clearValue;
+	if (::memcmp(clearValue.Color, color, sizeof(clearValue.Color)) != 0)
+	{
+		char buffer[256];
+		sprintf_s(buffer, 256, "RenderTargetPool: clear color (%f, %f, %f, %f) doesn't match the optimized "
+			"clear value (%f, %f, %f, %f), this clear will be slow\n",
+			color[0], color[1], color[2], color[3],
+			clearValue.Color[0], clearValue.Color[1], clearValue.Color[2], clearValue.Color[3]);
+		OutputDebugString(buffer);
+	}
+#endif
+
+	commandList->ClearRenderTargetView(GetView(target), color, 0, nullptr);
+}
+
+void RenderTargetPool::ClearDepthStencil(ID3D12GraphicsCommandList *commandList, Handle target,
+	D3D12_CLEAR_FLAGS flags, FLOAT depth, UINT8 stencil)
+{
+#if defined(_DEBUG)
+	const D3D12_CLEAR_VALUE &clearValue = m_targets[target].clearValue;
+	if (((flags & D3D12_CLEAR_FLAG_DEPTH) && clearValue.DepthStencil.Depth != depth) ||
+		((flags & D3D12_CLEAR_FLAG_STENCIL) && clearValue.DepthStencil.Stencil != stencil))
+	{
+		char buffer[256];
+		sprintf_s(buffer, 256, "RenderTargetPool: depth clear (%f, %u) doesn't match the optimized "
+			"clear value (%f, %u), this clear will be slow\n",
+			depth, stencil, clearValue.DepthStencil.Depth, clearValue.DepthStencil.Stencil);
+		OutputDebugString(buffer);
+	}
+#endif
+
+	commandList->ClearDepthStencilView(GetView(target), flags, depth, stencil, 0, nullptr);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "includes.h"
+
+#include <unordered_map>
+#include <vector>
+
+// Transient render targets (and depth buffers) are handed out by the pool
+// instead of being created on the spot. Every target is created with the
+// optimized clear value that was registered for its format so that clears
+// can take the fast path. Targets are given back with the fence value of
+// the frame that last used them and get reused once the GPU passed it.
+
+class RenderTargetPool
+{
+public:
+	typedef uint32_t Handle;
+	static const Handle InvalidHandle = ~0u;
+
+	RenderTargetPool(ComPtr<ID3D12Device2> device, uint32_t maxTargets);
+
+	// Registry of optimized clear values.
+	// Targets of a format that was never registered clear to black / far depth.
+	void RegisterClearValue(DXGI_FORMAT format, const FLOAT color[4]);
+	void RegisterClearValue(DXGI_FORMAT format, FLOAT depth, UINT8 stencil);
+	const D3D12_CLEAR_VALUE &GetRegisteredClearValue(DXGI_FORMAT format);
+
+	// Returns a free target whose desc, clear value and state match or creates
+	// a new one in initialState. Release targets in the state they were acquired in.
+	Handle Acquire(const D3D12_RESOURCE_DESC &desc, D3D12_RESOURCE_STATES initialState);
+	// The target can be reused once the GPU reaches fenceValue.
+	void Release(Handle target, uint64_t fenceValue);
+	// Call once per frame with the last completed fence value.
+	void Retire(uint64_t completedFenceValue);
+	// Frees every target that isn't in use (e.g. after a resize).
+	void Trim();
+
+	ID3D12Resource *GetResource(Handle target) const;
+	D3D12_CPU_DESCRIPTOR_HANDLE GetView(Handle target) const;
+	const D3D12_CLEAR_VALUE &GetClearValue(Handle target) const;
+
+	// Same as ClearRenderTargetView/ClearDepthStencilView but warns
+	// (debug builds only) when the clear misses the fast clear path.
+	void ClearRenderTarget(ID3D12GraphicsCommandList *commandList, Handle target, const FLOAT color[4]);
+	void ClearDepthStencil(ID3D12GraphicsCommandList *commandList, Handle target,
+		D3D12_CLEAR_FLAGS flags, FLOAT depth, UINT8 stencil);
+
+	uint32_t GetNumTargets() const { return static_cast<uint32_t>(m_targets.size()); }
+
+private:
+	struct Target
+	{
+		ComPtr<ID3D12Resource> resource;
+		D3D12_RESOURCE_DESC desc;
+		CD3DX12_CLEAR_VALUE clearValue;
+		D3D12_RESOURCE_STATES state;	// acquired and released in
+		uint32_t descriptorIdx;
+		uint64_t fenceValue;
+		bool inUse;
+	};
+
+	static bool IsDepthStencil(const D3D12_RESOURCE_DESC &desc);
+	uint32_t AllocateDescriptor(bool depthStencil);
+
+	ComPtr<ID3D12Device2> m_device;
+	uint32_t m_maxTargets;
+
+	ComPtr<ID3D12DescriptorHeap> m_rtvHeap;
+	ComPtr<ID3D12DescriptorHeap> m_dsvHeap;
+	UINT m_rtvDescriptorSize;
+	UINT m_dsvDescriptorSize;
+	std::vector<uint32_t> m_freeRTVs;
+	std::vector<uint32_t> m_freeDSVs;
+
+	std::unordered_map<DXGI_FORMAT, CD3DX12_CLEAR_VALUE> m_clearValues;
+
+	// Pools hold tens of targets, a linear search is cheaper than a map here
+	std::vector<Target> m_targets;
+	uint64_t m_completedFenceValue;
+};
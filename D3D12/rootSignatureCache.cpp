@@ -0,0 +1,386 @@
+#include "rootSignatureCache.h"
+#include "pipelineHash.h"
+
+#include <fstream>
+
+using namespace PipelineHash;
+
+namespace
+{
+	const uint32_t gRootSignatureCacheMagic = 0x47495352;	// "RSIG"
+	const uint32_t gRootSignatureCacheVersion = 1;
+	// Far more than the largest root signature serializes to, a bigger size means a corrupt file
+	const uint64_t gMaxBlobSize = 64 * 1024;
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t rootSignatureVersion;	// what the blobs were serialized as
+		uint32_t numBlobs;
+		uint32_t numMappings;
+		uint32_t padding;
+	};
+
+	uint64_t HashRange(uint64_t hash, D3D12_DESCRIPTOR_RANGE_TYPE type, UINT numDescriptors, UINT baseRegister,
+		UINT registerSpace, D3D12_DESCRIPTOR_RANGE_FLAGS flags, UINT offset)
+	{
+		hash = Mix(hash, (uint64_t(type) << 32) | numDescriptors);
+		hash = Mix(hash, (uint64_t(baseRegister) << 32) | registerSpace);
+		return Mix(hash, (uint64_t(flags) << 32) | offset);
+	}
+
+	uint64_t HashSampler(uint64_t hash, const D3D12_STATIC_SAMPLER_DESC &sampler)
+	{
+		hash = Mix(hash, (uint64_t(sampler.Filter) << 32) | sampler.MaxAnisotropy);
+		hash = Mix(hash, (uint64_t(sampler.AddressU) << 32) | (uint64_t(sampler.AddressV) << 16) | sampler.AddressW);
+		hash = Value(hash, sampler.MipLODBias);
+		hash = Mix(hash, (uint64_t(sampler.ComparisonFunc) << 32) | sampler.BorderColor);
+		hash = Value(hash, sampler.MinLOD);
+		hash = Value(hash, sampler.MaxLOD);
+		hash = Mix(hash, (uint64_t(sampler.ShaderRegister) << 32) | sampler.RegisterSpace);
+		return Mix(hash, sampler.ShaderVisibility);
+	}
+
+	// Flags a 1.0 description gets when it's converted to 1.1
+	D3D12_DESCRIPTOR_RANGE_FLAGS DefaultRangeFlags(D3D12_DESCRIPTOR_RANGE_TYPE type)
+	{
+		if (type == D3D12_DESCRIPTOR_RANGE_TYPE_SAMPLER)
+		{
+			return D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE;
+		}
+
+		return D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE | D3D12_DESCRIPTOR_RANGE_FLAG_DATA_VOLATILE;
+	}
+}
+
+RootSignatureCache::RootSignatureCache(ComPtr<ID3D12Device2> device, const std::wstring &path) :
+	m_device(device),
+	m_path(path),
+	m_dirty(false),
+	m_stats()
+{
+	D3D12_FEATURE_DATA_ROOT_SIGNATURE featureData = {};
+	featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1;
+	if (FAILED(m_device->CheckFeatureSupport(D3D12_FEATURE_ROOT_SIGNATURE, &featureData, sizeof(featureData))))
+	{
+		featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
+	}
+	m_highestVersion = featureData.HighestVersion;
+
+	Load();
+}
+
+uint64_t RootSignatureCache::HashDesc(const D3D12_VERSIONED_ROOT_SIGNATURE_DESC &desc)
+{
+	// Both versions are hashed as 1.1, so the same layout
+	// described either way ends up with the same hash.
+	uint64_t hash = Mix(0, gRootSignatureCacheVersion);
+
+	if (desc.Version == D3D_ROOT_SIGNATURE_VERSION_1_0)
+	{
+		const D3D12_ROOT_SIGNATURE_DESC &d = desc.Desc_1_0;
+		hash = Mix(hash, (uint64_t(d.Flags) << 32) | d.NumParameters);
+
+		for (UINT i = 0; i < d.NumParameters; ++i)
+		{
+			const D3D12_ROOT_PARAMETER &param = d.pParameters[i];
+			hash = Mix(hash, (uint64_t(param.ParameterType) << 32) | param.ShaderVisibility);
+
+			switch (param.ParameterType)
+			{
+			case D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE:
+				hash = Mix(hash, param.DescriptorTable.NumDescriptorRanges);
+				for (UINT r = 0; r < param.DescriptorTable.NumDescriptorRanges; ++r)
+				{
+					const D3D12_DESCRIPTOR_RANGE &range = param.DescriptorTable.pDescriptorRanges[r];
+					hash = HashRange(hash, range.RangeType, range.NumDescriptors, range.BaseShaderRegister,
+						range.RegisterSpace, DefaultRangeFlags(range.RangeType), range.OffsetInDescriptorsFromTableStart);
+				}
+				break;
+			case D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS:
+				hash = Mix(hash, (uint64_t(param.Constants.ShaderRegister) << 32) | param.Constants.RegisterSpace);
+				hash = Mix(hash, param.Constants.Num32BitValues);
+				break;
+			default:
+				hash = Mix(hash, (uint64_t(param.Descriptor.ShaderRegister) << 32) | param.Descriptor.RegisterSpace);
+				hash = Mix(hash, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_VOLATILE);
+				break;
+			}
+		}
+
+		hash = Mix(hash, d.NumStaticSamplers);
+		for (UINT i = 0; i < d.NumStaticSamplers; ++i)
+		{
+			hash = HashSampler(hash, d.pStaticSamplers[i]);
+		}
+	}
+	else
+	{
+		const D3D12_ROOT_SIGNATURE_DESC1 &d = desc.Desc_1_1;
+		hash = Mix(hash, (uint64_t(d.Flags) << 32) | d.NumParameters);
+
+		for (UINT i = 0; i < d.NumParameters; ++i)
+		{
+			const D3D12_ROOT_PARAMETER1 &param = d.pParameters[i];
+			hash = Mix(hash, (uint64_t(param.ParameterType) << 32) | param.ShaderVisibility);
+
+			switch (param.ParameterType)
+			{
+			case D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE:
+				hash = Mix(hash, param.DescriptorTable.NumDescriptorRanges);
+				for (UINT r = 0; r < param.DescriptorTable.NumDescriptorRanges; ++r)
+				{
+					const D3D12_DESCRIPTOR_RANGE1 &range = param.DescriptorTable.pDescriptorRanges[r];
+					hash = HashRange(hash, range.RangeType, range.NumDescriptors, range.BaseShaderRegister,
+						range.RegisterSpace, range.Flags, range.OffsetInDescriptorsFromTableStart);
+				}
+				break;
+			case D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS:
+				hash = Mix(hash, (uint64_t(param.Constants.ShaderRegister) << 32) | param.Constants.RegisterSpace);
+				hash = Mix(hash, param.Constants.Num32BitValues);
+				break;
+			default:
+				hash = Mix(hash, (uint64_t(param.Descriptor.ShaderRegister) << 32) | param.Descriptor.RegisterSpace);
+				hash = Mix(hash, param.Descriptor.Flags);
+				break;
+			}
+		}
+
+		hash = Mix(hash, d.NumStaticSamplers);
+		for (UINT i = 0; i < d.NumStaticSamplers; ++i)
+		{
+			hash = HashSampler(hash, d.pStaticSamplers[i]);
+		}
+	}
+
+	return hash;
+}
+
+void RootSignatureCache::Load()
+{
+	std::ifstream file(m_path, std::ios::binary);
+	if (!file)
+	{
+		return;
+	}
+
+	FileHeader header = {};
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+	// Blobs serialized for another root signature version can't be used
+	if (!file || header.magic != gRootSignatureCacheMagic || header.version != gRootSignatureCacheVersion ||
+		header.rootSignatureVersion != static_cast<uint32_t>(m_highestVersion))
+	{
+		return;
+	}
+
+	std::vector<uint8_t> blob;
+	for (uint32_t i = 0; i < header.numBlobs && file; ++i)
+	{
+		uint64_t blobHash = 0;
+		uint64_t blobSize = 0;
+		file.read(reinterpret_cast<char*>(&blobHash), sizeof(blobHash));
+		file.read(reinterpret_cast<char*>(&blobSize), sizeof(blobSize));
+		if (blobSize > gMaxBlobSize)
+		{
+			// The rest of the file can't be found again
+			file.setstate(std::ios::failbit);
+			break;
+		}
+
+		blob.resize(static_cast<size_t>(blobSize));
+		file.read(reinterpret_cast<char*>(blob.data()), blob.size());
+
+		// A blob that doesn't match its hash is left out, its descriptions are serialized again
+		if (file && Bytes(0, blob.data(), blob.size()) == blobHash)
+		{
+			m_entries[blobHash].blob = blob;
+		}
+	}
+
+	for (uint32_t i = 0; i < header.numMappings && file; ++i)
+	{
+		uint64_t mapping[2];	// desc hash, blob hash
+		file.read(reinterpret_cast<char*>(mapping), sizeof(mapping));
+		if (file && m_entries.count(mapping[1]) != 0)
+		{
+			m_descToBlob[mapping[0]] = mapping[1];
+		}
+	}
+
+	if (!file)
+	{
+		// Truncated file, don't trust any of it
+		m_entries.clear();
+		m_descToBlob.clear();
+	}
+}
+
+uint64_t RootSignatureCache::Serialize(const D3D12_VERSIONED_ROOT_SIGNATURE_DESC &desc, ComPtr<ID3DBlob> &blob) const
+{
+	ComPtr<ID3DBlob> error;
+	HRESULT hr = D3DX12SerializeVersionedRootSignature(&desc, m_highestVersion, &blob, &error);
+	if (FAILED(hr) && error)
+	{
+		OutputDebugString(static_cast<const char*>(error->GetBufferPointer()));
+	}
+	ThrowIfFailed(hr);
+
+	return Bytes(0, blob->GetBufferPointer(), blob->GetBufferSize());
+}
+
+HRESULT RootSignatureCache::Create(uint64_t blobHash, ComPtr<ID3D12RootSignature> &rootSignature)
+{
+	Entry &entry = m_entries[blobHash];
+	if (!entry.rootSignature)
+	{
+		HRESULT hr = m_device->CreateRootSignature(0, entry.blob.data(), entry.blob.size(),
+			IID_PPV_ARGS(&entry.rootSignature));
+		if (FAILED(hr))
+		{
+			return hr;
+		}
+		m_keys[entry.rootSignature.Get()] = blobHash;
+	}
+
+	rootSignature = entry.rootSignature;
+	return S_OK;
+}
+
+ComPtr<ID3D12RootSignature> RootSignatureCache::GetOrCreate(const D3D12_VERSIONED_ROOT_SIGNATURE_DESC &desc, uint64_t *key)
+{
+	uint64_t descHash = HashDesc(desc);
+	ComPtr<ID3DBlob> blob;
+
+	auto it = m_descToBlob.find(descHash);
+#if defined(_DEBUG)
+	// Only the hash of the description is kept, make sure it still leads to
+	// what the description serializes to
+	if (it != m_descToBlob.end() && Serialize(desc, blob) != it->second)
+	{
+		::OutputDebugString("Root signature cache: description hash collision, serializing it again\n");
+		m_descToBlob.erase(it);
+		it = m_descToBlob.end();
+	}
+#endif
+
+	if (it != m_descToBlob.end())
+	{
+		uint64_t blobHash = it->second;
+		bool created = m_entries[blobHash].rootSignature.Get() != nullptr;
+
+		ComPtr<ID3D12RootSignature> rootSignature;
+		if (SUCCEEDED(Create(blobHash, rootSignature)))
+		{
+			if (created)
+			{
+				m_stats.descHits++;
+			}
+			else
+			{
+				m_stats.diskHits++;
+			}
+
+			if (key)
+			{
+				*key = blobHash;
+			}
+			return rootSignature;
+		}
+
+		// The device doesn't take the blob from the file, it's a miss
+		m_entries.erase(blobHash);
+		m_descToBlob.erase(it);
+	}
+
+	uint64_t blobHash = Serialize(desc, blob);
+	m_stats.serialized++;
+
+	const uint8_t *bytes = static_cast<const uint8_t*>(blob->GetBufferPointer());
+
+	Entry &entry = m_entries[blobHash];
+	if (entry.blob.empty())
+	{
+		entry.blob.assign(bytes, bytes + blob->GetBufferSize());
+	}
+	else
+	{
+		m_stats.blobHits++;
+	}
+
+	m_descToBlob[descHash] = blobHash;
+	m_dirty = true;
+
+	if (key)
+	{
+		*key = blobHash;
+	}
+
+	ComPtr<ID3D12RootSignature> rootSignature;
+	ThrowIfFailed(Create(blobHash, rootSignature));
+	return rootSignature;
+}
+
+uint64_t RootSignatureCache::GetKey(ID3D12RootSignature *rootSignature) const
+{
+	auto it = m_keys.find(rootSignature);
+	return it != m_keys.end() ? it->second : 0;
+}
+
+const std::vector<uint8_t> *RootSignatureCache::GetBlob(ID3D12RootSignature *rootSignature) const
+{
+	auto it = m_keys.find(rootSignature);
+	if (it == m_keys.end())
+	{
+		return nullptr;
+	}
+
+	auto entry = m_entries.find(it->second);
+	return entry != m_entries.end() ? &entry->second.blob : nullptr;
+}
+
+void RootSignatureCache::Save()
+{
+	if (!m_dirty)
+	{
+		return;
+	}
+
+	FileHeader header = {};
+	header.magic = gRootSignatureCacheMagic;
+	header.version = gRootSignatureCacheVersion;
+	header.rootSignatureVersion = static_cast<uint32_t>(m_highestVersion);
+	header.numBlobs = static_cast<uint32_t>(m_entries.size());
+	header.numMappings = static_cast<uint32_t>(m_descToBlob.size());
+
+	std::wstring tempPath = m_path + L".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		for (const auto &entry : m_entries)
+		{
+			uint64_t blobSize = entry.second.blob.size();
+			file.write(reinterpret_cast<const char*>(&entry.first), sizeof(entry.first));
+			file.write(reinterpret_cast<const char*>(&blobSize), sizeof(blobSize));
+			file.write(reinterpret_cast<const char*>(entry.second.blob.data()), entry.second.blob.size());
+		}
+
+		for (const auto &mapping : m_descToBlob)
+		{
+			uint64_t values[2] = { mapping.first, mapping.second };
+			file.write(reinterpret_cast<const char*>(values), sizeof(values));
+		}
+
+		if (!file)
+		{
+			return;
+		}
+	}
+
+	if (::MoveFileExW(tempPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		m_dirty = false;
+	}
+}
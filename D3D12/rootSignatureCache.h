@@ -0,0 +1,75 @@
+#pragma once
+
+#include "includes.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Root signatures are shared: asking for a description that was seen before
+// returns the same ID3D12RootSignature. Fewer distinct root signatures also
+// means fewer rebinds, since switching root signatures resets all bindings.
+//
+// Descriptions are hashed in a canonical form (1.0 descriptions hash like the
+// equivalent 1.1 description), and serialized blobs are hashed again so
+// descriptions that only differ in ways the serializer ignores still end up
+// with one object. The serialized blobs are saved to disk so later runs skip
+// D3DX12SerializeVersionedRootSignature altogether. Blobs that don't match
+// their hash or that the device rejects are misses, and debug builds
+// serialize every description again to check it maps to the same blob.
+//
+// The blob hash is stable across runs, use it as the root signature key of
+// the pipeline cache.
+
+class RootSignatureCache
+{
+public:
+	struct Stats
+	{
+		uint32_t descHits;		// description seen before
+		uint32_t diskHits;		// blob came from the file
+		uint32_t serialized;	// had to be serialized
+		uint32_t blobHits;		// new description, but same blob as an existing one
+	};
+
+	RootSignatureCache(ComPtr<ID3D12Device2> device, const std::wstring &path);
+
+	// key receives the hash of the serialized blob
+	ComPtr<ID3D12RootSignature> GetOrCreate(const D3D12_VERSIONED_ROOT_SIGNATURE_DESC &desc, uint64_t *key = nullptr);
+
+	// Key of a root signature returned by GetOrCreate, 0 if it didn't come from here
+	uint64_t GetKey(ID3D12RootSignature *rootSignature) const;
+
+	// Serialized blob of a root signature returned by GetOrCreate, nullptr if it didn't come from here
+	const std::vector<uint8_t> *GetBlob(ID3D12RootSignature *rootSignature) const;
+
+	// Writes blobs that aren't on disk yet
+	void Save();
+
+	static uint64_t HashDesc(const D3D12_VERSIONED_ROOT_SIGNATURE_DESC &desc);
+
+	D3D_ROOT_SIGNATURE_VERSION GetHighestVersion() const { return m_highestVersion; }
+	const Stats &GetStats() const { return m_stats; }
+
+private:
+	struct Entry
+	{
+		std::vector<uint8_t> blob;
+		ComPtr<ID3D12RootSignature> rootSignature;
+	};
+
+	void Load();
+	// Returns the hash of the blob
+	uint64_t Serialize(const D3D12_VERSIONED_ROOT_SIGNATURE_DESC &desc, ComPtr<ID3DBlob> &blob) const;
+	HRESULT Create(uint64_t blobHash, ComPtr<ID3D12RootSignature> &rootSignature);
+
+	ComPtr<ID3D12Device2> m_device;
+	std::wstring m_path;
+	D3D_ROOT_SIGNATURE_VERSION m_highestVersion;
+	bool m_dirty;
+
+	std::unordered_map<uint64_t, uint64_t> m_descToBlob;	// desc hash -> blob hash
+	std::unordered_map<uint64_t, Entry> m_entries;			// blob hash -> root signature
+	std::unordered_map<ID3D12RootSignature*, uint64_t> m_keys;
+	Stats m_stats;
+};
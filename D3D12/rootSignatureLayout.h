@@ -0,0 +1,301 @@
+#pragma once
+
+#include "includes.h"
+
+#include <cstddef>
+#include <type_traits>
+
+// Root signatures described by types instead of filled in at runtime.
+// Every parameter is its own type, and the layout is a list of them:
+//
+//	struct PerFrame : RootConstants<0, 16> {};
+//	struct PerDraw : RootCBV<1> {};
+//	struct Material : RootTable<D3D12_SHADER_VISIBILITY_PIXEL,
+//		DescriptorRange<D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 4, 0>> {};
+//
+//	typedef RootSignatureLayout<D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT,
+//		StaticSamplers<StaticSampler<0, D3D12_FILTER_MIN_MAG_MIP_LINEAR>>,
+//		PerFrame, PerDraw, Material> MainLayout;
+//
+//	MainLayout::SetGraphicsRootConstantBufferView<PerDraw>(commandList, address);
+//
+// The parameter and sampler arrays are constants, GetDesc() only points at
+// them. Binding a parameter that isn't in the layout, or binding it as the
+// wrong kind (a table as a CBV, constants of the wrong size), doesn't compile.
+
+// Same layout as D3D12_ROOT_PARAMETER1, but with constexpr constructors
+// for each member of the union
+struct StaticRootParameter
+{
+	union Data
+	{
+		D3D12_ROOT_DESCRIPTOR_TABLE1 DescriptorTable;
+		D3D12_ROOT_CONSTANTS Constants;
+		D3D12_ROOT_DESCRIPTOR1 Descriptor;
+
+		constexpr Data(const D3D12_ROOT_DESCRIPTOR_TABLE1 &table) : DescriptorTable(table) {}
+		constexpr Data(const D3D12_ROOT_CONSTANTS &constants) : Constants(constants) {}
+		constexpr Data(const D3D12_ROOT_DESCRIPTOR1 &descriptor) : Descriptor(descriptor) {}
+	};
+
+	D3D12_ROOT_PARAMETER_TYPE ParameterType;
+	Data data;
+	D3D12_SHADER_VISIBILITY ShaderVisibility;
+
+	constexpr StaticRootParameter(const D3D12_ROOT_DESCRIPTOR_TABLE1 &table, D3D12_SHADER_VISIBILITY visibility) :
+		ParameterType(D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE), data(table), ShaderVisibility(visibility) {}
+
+	constexpr StaticRootParameter(const D3D12_ROOT_CONSTANTS &constants, D3D12_SHADER_VISIBILITY visibility) :
+		ParameterType(D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS), data(constants), ShaderVisibility(visibility) {}
+
+	constexpr StaticRootParameter(D3D12_ROOT_PARAMETER_TYPE type, const D3D12_ROOT_DESCRIPTOR1 &descriptor,
+		D3D12_SHADER_VISIBILITY visibility) :
+		ParameterType(type), data(descriptor), ShaderVisibility(visibility) {}
+};
+
+static_assert(sizeof(StaticRootParameter) == sizeof(D3D12_ROOT_PARAMETER1) &&
+	offsetof(StaticRootParameter, data) == offsetof(D3D12_ROOT_PARAMETER1, DescriptorTable) &&
+	offsetof(StaticRootParameter, ShaderVisibility) == offsetof(D3D12_ROOT_PARAMETER1, ShaderVisibility),
+	"StaticRootParameter has to match D3D12_ROOT_PARAMETER1");
+
+template <UINT ShaderRegister, UINT Num32BitValues, UINT RegisterSpace = 0,
+	D3D12_SHADER_VISIBILITY Visibility = D3D12_SHADER_VISIBILITY_ALL>
+struct RootConstants
+{
+	static constexpr D3D12_ROOT_PARAMETER_TYPE type = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+	static constexpr UINT num32BitValues = Num32BitValues;
+	static constexpr StaticRootParameter parameter =
+		StaticRootParameter(D3D12_ROOT_CONSTANTS{ ShaderRegister, RegisterSpace, Num32BitValues }, Visibility);
+};
+
+template <D3D12_ROOT_PARAMETER_TYPE Type, UINT ShaderRegister, UINT RegisterSpace,
+	D3D12_ROOT_DESCRIPTOR_FLAGS Flags, D3D12_SHADER_VISIBILITY Visibility>
+struct RootDescriptor
+{
+	static constexpr D3D12_ROOT_PARAMETER_TYPE type = Type;
+	static constexpr StaticRootParameter parameter =
+		StaticRootParameter(Type, D3D12_ROOT_DESCRIPTOR1{ ShaderRegister, RegisterSpace, Flags }, Visibility);
+};
+
+template <UINT ShaderRegister, UINT RegisterSpace = 0, D3D12_ROOT_DESCRIPTOR_FLAGS Flags = D3D12_ROOT_DESCRIPTOR_FLAG_NONE,
+	D3D12_SHADER_VISIBILITY Visibility = D3D12_SHADER_VISIBILITY_ALL>
+using RootCBV = RootDescriptor<D3D12_ROOT_PARAMETER_TYPE_CBV, ShaderRegister, RegisterSpace, Flags, Visibility>;
+
+template <UINT ShaderRegister, UINT RegisterSpace = 0, D3D12_ROOT_DESCRIPTOR_FLAGS Flags = D3D12_ROOT_DESCRIPTOR_FLAG_NONE,
+	D3D12_SHADER_VISIBILITY Visibility = D3D12_SHADER_VISIBILITY_ALL>
+using RootSRV = RootDescriptor<D3D12_ROOT_PARAMETER_TYPE_SRV, ShaderRegister, RegisterSpace, Flags, Visibility>;
+
+template <UINT ShaderRegister, UINT RegisterSpace = 0, D3D12_ROOT_DESCRIPTOR_FLAGS Flags = D3D12_ROOT_DESCRIPTOR_FLAG_NONE,
+	D3D12_SHADER_VISIBILITY Visibility = D3D12_SHADER_VISIBILITY_ALL>
+using RootUAV = RootDescriptor<D3D12_ROOT_PARAMETER_TYPE_UAV, ShaderRegister, RegisterSpace, Flags, Visibility>;
+
+template <D3D12_DESCRIPTOR_RANGE_TYPE Type, UINT NumDescriptors, UINT BaseShaderRegister, UINT RegisterSpace = 0,
+	D3D12_DESCRIPTOR_RANGE_FLAGS Flags = D3D12_DESCRIPTOR_RANGE_FLAG_NONE,
+	UINT Offset = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND>
+struct DescriptorRange
+{
+	static constexpr D3D12_DESCRIPTOR_RANGE1 value = { Type, NumDescriptors, BaseShaderRegister, RegisterSpace, Flags, Offset };
+};
+
+template <D3D12_SHADER_VISIBILITY Visibility, typename... Ranges>
+struct RootTable
+{
+	static_assert(sizeof...(Ranges) > 0, "A descriptor table needs at least one range");
+
+	static constexpr D3D12_ROOT_PARAMETER_TYPE type = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+	static constexpr D3D12_DESCRIPTOR_RANGE1 ranges[] = { Ranges::value... };
+	static constexpr StaticRootParameter parameter =
+		StaticRootParameter(D3D12_ROOT_DESCRIPTOR_TABLE1{ sizeof...(Ranges), ranges }, Visibility);
+};
+
+// Same defaults as CD3DX12_STATIC_SAMPLER_DESC
+template <UINT ShaderRegister, D3D12_FILTER Filter, D3D12_TEXTURE_ADDRESS_MODE Address = D3D12_TEXTURE_ADDRESS_MODE_WRAP,
+	D3D12_SHADER_VISIBILITY Visibility = D3D12_SHADER_VISIBILITY_ALL, UINT RegisterSpace = 0,
+	D3D12_COMPARISON_FUNC Comparison = D3D12_COMPARISON_FUNC_LESS_EQUAL>
+struct StaticSampler
+{
+	static constexpr D3D12_STATIC_SAMPLER_DESC value = { Filter, Address, Address, Address, 0.0f, 16, Comparison,
+		D3D12_STATIC_BORDER_COLOR_OPAQUE_WHITE, 0.0f, D3D12_FLOAT32_MAX, ShaderRegister, RegisterSpace, Visibility };
+};
+
+template <typename... Samplers>
+struct StaticSamplers
+{
+	static constexpr UINT count = sizeof...(Samplers);
+	static constexpr D3D12_STATIC_SAMPLER_DESC descs[] = { Samplers::value... };
+	static const D3D12_STATIC_SAMPLER_DESC *Get() { return descs; }
+};
+
+template <>
+struct StaticSamplers<>
+{
+	static constexpr UINT count = 0;
+	static const D3D12_STATIC_SAMPLER_DESC *Get() { return nullptr; }
+};
+
+typedef StaticSamplers<> NoStaticSamplers;
+
+namespace RootSignatureLayoutDetail
+{
+	constexpr UINT gNotFound = ~0u;
+
+	// Index of T in Ts, gNotFound unless it's there exactly once
+	template <typename T, typename... Ts>
+	constexpr UINT IndexOf()
+	{
+		constexpr bool same[] = { false, std::is_same<T, Ts>::value... };
+
+		UINT index = gNotFound;
+		UINT count = 0;
+		for (UINT i = 1; i < sizeof(same) / sizeof(same[0]); ++i)
+		{
+			if (same[i])
+			{
+				index = i - 1;
+				count++;
+			}
+		}
+
+		return count == 1 ? index : gNotFound;
+	}
+}
+
+template <D3D12_ROOT_SIGNATURE_FLAGS Flags, typename Samplers, typename... Parameters>
+struct RootSignatureLayout
+{
+	static_assert(sizeof...(Parameters) > 0, "A layout needs at least one parameter");
+
+	static constexpr UINT numParameters = sizeof...(Parameters);
+	static constexpr StaticRootParameter parameters[] = { Parameters::parameter... };
+
+	template <typename Parameter>
+	static constexpr UINT Index()
+	{
+		static_assert(RootSignatureLayoutDetail::IndexOf<Parameter, Parameters...>() != RootSignatureLayoutDetail::gNotFound,
+			"The parameter isn't part of this root signature, or is in it more than once");
+		return RootSignatureLayoutDetail::IndexOf<Parameter, Parameters...>();
+	}
+
+	// Pass to RootSignatureCache::GetOrCreate
+	static D3D12_VERSIONED_ROOT_SIGNATURE_DESC GetDesc()
+	{
+		D3D12_VERSIONED_ROOT_SIGNATURE_DESC desc = {};
+		desc.Version = D3D_ROOT_SIGNATURE_VERSION_1_1;
+		desc.Desc_1_1.NumParameters = numParameters;
+		desc.Desc_1_1.pParameters = reinterpret_cast<const D3D12_ROOT_PARAMETER1*>(parameters);
+		desc.Desc_1_1.NumStaticSamplers = Samplers::count;
+		desc.Desc_1_1.pStaticSamplers = Samplers::Get();
+		desc.Desc_1_1.Flags = Flags;
+		return desc;
+	}
+
+	template <typename Parameter, typename T>
+	static void SetGraphicsRoot32BitConstants(ID3D12GraphicsCommandList *commandList, const T &data)
+	{
+		CheckConstants<Parameter, T>();
+		commandList->SetGraphicsRoot32BitConstants(Index<Parameter>(), Parameter::num32BitValues, &data, 0);
+	}
+
+	template <typename Parameter, typename T>
+	static void SetComputeRoot32BitConstants(ID3D12GraphicsCommandList *commandList, const T &data)
+	{
+		CheckConstants<Parameter, T>();
+		commandList->SetComputeRoot32BitConstants(Index<Parameter>(), Parameter::num32BitValues, &data, 0);
+	}
+
+	template <typename Parameter>
+	static void SetGraphicsRootConstantBufferView(ID3D12GraphicsCommandList *commandList, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		CheckType<Parameter, D3D12_ROOT_PARAMETER_TYPE_CBV>();
+		commandList->SetGraphicsRootConstantBufferView(Index<Parameter>(), address);
+	}
+
+	template <typename Parameter>
+	static void SetComputeRootConstantBufferView(ID3D12GraphicsCommandList *commandList, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		CheckType<Parameter, D3D12_ROOT_PARAMETER_TYPE_CBV>();
+		commandList->SetComputeRootConstantBufferView(Index<Parameter>(), address);
+	}
+
+	template <typename Parameter>
+	static void SetGraphicsRootShaderResourceView(ID3D12GraphicsCommandList *commandList, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		CheckType<Parameter, D3D12_ROOT_PARAMETER_TYPE_SRV>();
+		commandList->SetGraphicsRootShaderResourceView(Index<Parameter>(), address);
+	}
+
+	template <typename Parameter>
+	static void SetComputeRootShaderResourceView(ID3D12GraphicsCommandList *commandList, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		CheckType<Parameter, D3D12_ROOT_PARAMETER_TYPE_SRV>();
+		commandList->SetComputeRootShaderResourceView(Index<Parameter>(), address);
+	}
+
+	template <typename Parameter>
+	static void SetGraphicsRootUnorderedAccessView(ID3D12GraphicsCommandList *commandList, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		CheckType<Parameter, D3D12_ROOT_PARAMETER_TYPE_UAV>();
+		commandList->SetGraphicsRootUnorderedAccessView(Index<Parameter>(), address);
+	}
+
+	template <typename Parameter>
+	static void SetComputeRootUnorderedAccessView(ID3D12GraphicsCommandList *commandList, D3D12_GPU_VIRTUAL_ADDRESS address)
+	{
+		CheckType<Parameter, D3D12_ROOT_PARAMETER_TYPE_UAV>();
+		commandList->SetComputeRootUnorderedAccessView(Index<Parameter>(), address);
+	}
+
+	template <typename Parameter>
+	static void SetGraphicsRootDescriptorTable(ID3D12GraphicsCommandList *commandList, D3D12_GPU_DESCRIPTOR_HANDLE table)
+	{
+		CheckType<Parameter, D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE>();
+		commandList->SetGraphicsRootDescriptorTable(Index<Parameter>(), table);
+	}
+
+	template <typename Parameter>
+	static void SetComputeRootDescriptorTable(ID3D12GraphicsCommandList *commandList, D3D12_GPU_DESCRIPTOR_HANDLE table)
+	{
+		CheckType<Parameter, D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE>();
+		commandList->SetComputeRootDescriptorTable(Index<Parameter>(), table);
+	}
+
+private:
+	template <typename Parameter, D3D12_ROOT_PARAMETER_TYPE Type>
+	static void CheckType()
+	{
+		static_assert(Parameter::type == Type, "The parameter is bound as the wrong kind");
+	}
+
+	template <typename Parameter, typename T>
+	static void CheckConstants()
+	{
+		CheckType<Parameter, D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS>();
+		static_assert(sizeof(T) == Parameter::num32BitValues * sizeof(UINT), "The constants don't match the parameter size");
+	}
+};
+
+// Static members of class templates still need a definition outside the class before C++17
+
+template <UINT R, UINT N, UINT S, D3D12_SHADER_VISIBILITY V>
+constexpr StaticRootParameter RootConstants<R, N, S, V>::parameter;
+
+template <D3D12_ROOT_PARAMETER_TYPE T, UINT R, UINT S, D3D12_ROOT_DESCRIPTOR_FLAGS F, D3D12_SHADER_VISIBILITY V>
+constexpr StaticRootParameter RootDescriptor<T, R, S, F, V>::parameter;
+
+template <D3D12_DESCRIPTOR_RANGE_TYPE T, UINT N, UINT R, UINT S, D3D12_DESCRIPTOR_RANGE_FLAGS F, UINT O>
+constexpr D3D12_DESCRIPTOR_RANGE1 DescriptorRange<T, N, R, S, F, O>::value;
+
+template <D3D12_SHADER_VISIBILITY V, typename... Ranges>
+constexpr D3D12_DESCRIPTOR_RANGE1 RootTable<V, Ranges...>::ranges[];
+
+template <D3D12_SHADER_VISIBILITY V, typename... Ranges>
+constexpr StaticRootParameter RootTable<V, Ranges...>::parameter;
+
+template <UINT R, D3D12_FILTER F, D3D12_TEXTURE_ADDRESS_MODE A, D3D12_SHADER_VISIBILITY V, UINT S, D3D12_COMPARISON_FUNC C>
+constexpr D3D12_STATIC_SAMPLER_DESC StaticSampler<R, F, A, V, S, C>::value;
+
+template <typename... Samplers>
+constexpr D3D12_STATIC_SAMPLER_DESC StaticSamplers<Samplers...>::descs[];
+
+template <D3D12_ROOT_SIGNATURE_FLAGS Flags, typename Samplers, typename... Parameters>
+constexpr StaticRootParameter RootSignatureLayout<Flags, Samplers, Parameters...>::parameters[];
@@ -0,0 +1,512 @@
+#include "shaderCache.h"
+#include "pipelineHash.h"
+
+#include <fstream>
+#include <list>
+
+using namespace PipelineHash;
+
+namespace
+{
+	bool LoadTextFile(const std::string &path, std::string &contents)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+		{
+			return false;
+		}
+
+		std::ostringstream stream;
+		stream << file.rdbuf();
+		contents = stream.str();
+
+		return true;
+	}
+
+	std::string GetDirectory(const std::string &path)
+	{
+		size_t slash = path.find_last_of("/\\");
+		return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+	}
+
+	uint64_t HashFile(uint64_t hash, const std::string &path, const std::string &contents)
+	{
+		hash = Bytes(hash, path.data(), path.size());
+		return Bytes(hash, contents.data(), contents.size());
+	}
+
+	// Hands includes to D3DCompile. pParentData points at the text of the
+	// including file, which is how its path (and so its directory) is found.
+	class D3DIncludeHandler : public ID3DInclude
+	{
+	public:
+		D3DIncludeHandler(const std::string &sourcePath, const ShaderCompilerBackend::IncludeFunction &include) :
+			m_sourcePath(sourcePath),
+			m_include(include)
+		{
+		}
+
+		HRESULT __stdcall Open(D3D_INCLUDE_TYPE type, LPCSTR pFileName, LPCVOID pParentData,
+			LPCVOID *ppData, UINT *pBytes) override
+		{
+			std::string parentPath = m_sourcePath;
+			for (const File &file : m_files)
+			{
+				if (file.contents.data() == pParentData)
+				{
+					parentPath = file.path;
+					break;
+				}
+			}
+
+			File file;
+			if (!m_include(pFileName, parentPath, file.path, file.contents))
+			{
+				return E_FAIL;
+			}
+
+			// List elements never move, the text stays where the compiler was told it is
+			m_files.push_back(std::move(file));
+			*ppData = m_files.back().contents.data();
+			*pBytes = static_cast<UINT>(m_files.back().contents.size());
+
+			return S_OK;
+		}
+
+		HRESULT __stdcall Close(LPCVOID pData) override
+		{
+			// Kept until the compile is done, nested includes still refer to it
+			return S_OK;
+		}
+
+	private:
+		struct File
+		{
+			std::string path;
+			std::string contents;
+		};
+
+		std::string m_sourcePath;
+		const ShaderCompilerBackend::IncludeFunction &m_include;
+		std::list<File> m_files;
+	};
+}
+
+bool D3DShaderCompiler::Compile(const ShaderDesc &desc, const std::string &source, const IncludeFunction &include,
+	std::vector<uint8_t> &bytecode, std::string &errors)
+{
+	std::vector<D3D_SHADER_MACRO> macros;
+	for (const auto &define : desc.defines)
+	{
+		macros.push_back({ define.first.c_str(), define.second.c_str() });
+	}
+	macros.push_back({ nullptr, nullptr });
+
+	D3DIncludeHandler includeHandler(desc.path, include);
+
+	ComPtr<ID3DBlob> code;
+	ComPtr<ID3DBlob> errorBlob;
+	HRESULT hr = ::D3DCompile(source.data(), source.size(), desc.path.c_str(), macros.data(), &includeHandler,
+		desc.entryPoint.c_str(), desc.target.c_str(), desc.flags, 0, &code, &errorBlob);
+
+	// Warnings show up here too, even when the compile succeeds
+	if (errorBlob)
+	{
+		errors.assign(static_cast<const char*>(errorBlob->GetBufferPointer()), errorBlob->GetBufferSize());
+	}
+
+	if (FAILED(hr))
+	{
+		return false;
+	}
+
+	const uint8_t *data = static_cast<const uint8_t*>(code->GetBufferPointer());
+	bytecode.assign(data, data + code->GetBufferSize());
+
+	return true;
+}
+
+ShaderCache::ShaderCache(std::unique_ptr<ShaderCompilerBackend> compiler, const std::wstring &directory, uint32_t numThreads) :
+	m_compiler(std::move(compiler)),
+	m_directory(directory),
+	m_inFlight(0),
+	m_quit(false),
+	m_stats()
+{
+	// Fails harmlessly if the directory is already there
+	::CreateDirectoryW(m_directory.c_str(), nullptr);
+
+	numThreads = std::max(1u, numThreads);
+	for (uint32_t i = 0; i < numThreads; ++i)
+	{
+		m_workers.emplace_back(&ShaderCache::WorkerThread, this);
+		::SetThreadPriority(m_workers.back().native_handle(), THREAD_PRIORITY_BELOW_NORMAL);
+	}
+}
+
+ShaderCache::~ShaderCache()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_queueMutex);
+		m_quit = true;
+	}
+	m_queueCondition.notify_all();
+
+	for (std::thread &worker : m_workers)
+	{
+		worker.join();
+	}
+}
+
+void ShaderCache::AddIncludeDirectory(const std::string &directory)
+{
+	std::string path = directory;
+	if (!path.empty() && path.back() != '/' && path.back() != '\\')
+	{
+		path += '\\';
+	}
+
+	m_includeDirectories.push_back(path);
+}
+
+uint64_t ShaderCache::HashDesc(const ShaderDesc &desc) const
+{
+	uint64_t hash = Mix(0, m_compiler->GetCompilerVersion());
+	hash = String(hash, desc.path.c_str());
+	hash = String(hash, desc.entryPoint.c_str());
+	hash = String(hash, desc.target.c_str());
+	hash = Mix(hash, (uint64_t(desc.flags) << 32) | desc.defines.size());
+
+	for (const auto &define : desc.defines)
+	{
+		hash = String(hash, define.first.c_str());
+		hash = String(hash, define.second.c_str());
+	}
+
+	return hash;
+}
+
+ShaderCache::Future ShaderCache::Compile(const ShaderDesc &desc)
+{
+	uint64_t descKey = HashDesc(desc);
+
+	std::shared_ptr<Job> job;
+	Future future;
+	{
+		std::lock_guard<std::mutex> lock(m_cacheMutex);
+
+		auto it = m_pending.find(descKey);
+		if (it != m_pending.end())
+		{
+			return it->second;
+		}
+
+		job = std::make_shared<Job>();
+		job->desc = desc;
+		job->descKey = descKey;
+
+		future = job->promise.get_future().share();
+		m_pending[descKey] = future;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_queueMutex);
+		m_queue.push(job);
+	}
+	m_queueCondition.notify_one();
+
+	return future;
+}
+
+void ShaderCache::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(m_queueMutex);
+	m_idleCondition.wait(lock, [this]() { return m_queue.empty() && m_inFlight == 0; });
+}
+
+ShaderCache::Stats ShaderCache::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	return m_stats;
+}
+
+void ShaderCache::WorkerThread()
+{
+	for (;;)
+	{
+		std::shared_ptr<Job> job;
+		{
+			std::unique_lock<std::mutex> lock(m_queueMutex);
+			m_queueCondition.wait(lock, [this]() { return m_quit || !m_queue.empty(); });
+
+			if (m_quit)
+			{
+				return;
+			}
+
+			job = m_queue.front();
+			m_queue.pop();
+			m_inFlight++;
+		}
+
+		ShaderPtr shader;
+		std::exception_ptr exception;
+		try
+		{
+			shader = Build(job->desc, job->descKey);
+		}
+		catch (...)
+		{
+			exception = std::current_exception();
+		}
+
+		// Not pending anymore before the future is ready, so anyone
+		// who sees the result and asks again gets a fresh build
+		{
+			std::lock_guard<std::mutex> lock(m_cacheMutex);
+			m_pending.erase(job->descKey);
+		}
+
+		if (exception)
+		{
+			job->promise.set_exception(exception);
+		}
+		else
+		{
+			job->promise.set_value(shader);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_queueMutex);
+			m_inFlight--;
+		}
+		m_idleCondition.notify_all();
+	}
+}
+
+ShaderCache::ShaderPtr ShaderCache::Lookup(uint64_t descKey)
+{
+	std::vector<std::string> dependencies;
+	if (!LoadManifest(descKey, dependencies))
+	{
+		return nullptr;
+	}
+
+	// The files the last compile read, in the order it read them
+	uint64_t key = descKey;
+	for (const std::string &path : dependencies)
+	{
+		std::string contents;
+		if (!LoadTextFile(path, contents))
+		{
+			return nullptr;
+		}
+		key = HashFile(key, path, contents);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_cacheMutex);
+
+		auto it = m_shaders.find(key);
+		if (it != m_shaders.end())
+		{
+			m_stats.memoryHits++;
+			return it->second;
+		}
+	}
+
+	std::shared_ptr<Shader> shader = std::make_shared<Shader>();
+	shader->key = key;
+	shader->dependencies = std::move(dependencies);
+	if (!LoadBytecode(key, shader->bytecode))
+	{
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	m_stats.diskHits++;
+
+	return m_shaders.emplace(key, shader).first->second;
+}
+
+ShaderCache::ShaderPtr ShaderCache::Build(const ShaderDesc &desc, uint64_t descKey)
+{
+	ShaderPtr cached = Lookup(descKey);
+	if (cached)
+	{
+		return cached;
+	}
+
+	std::shared_ptr<Shader> shader = std::make_shared<Shader>();
+	shader->key = 0;
+
+	std::string source;
+	if (!LoadTextFile(desc.path, source))
+	{
+		shader->errors = "Can't open " + desc.path + "\n";
+		::OutputDebugString(shader->errors.c_str());
+
+		std::lock_guard<std::mutex> lock(m_cacheMutex);
+		m_stats.failed++;
+		return shader;
+	}
+
+	uint64_t key = HashFile(descKey, desc.path, source);
+	std::vector<std::string> &dependencies = shader->dependencies;
+	dependencies.push_back(desc.path);
+
+	// Includes are hashed in the order the compiler asks for them,
+	// which is the order the manifest lists them in
+	ShaderCompilerBackend::IncludeFunction include = [&](const std::string &name, const std::string &parentPath,
+		std::string &path, std::string &contents)
+	{
+		if (!ResolveInclude(name, parentPath, path, contents))
+		{
+			return false;
+		}
+
+		if (std::find(dependencies.begin(), dependencies.end(), path) == dependencies.end())
+		{
+			dependencies.push_back(path);
+			key = HashFile(key, path, contents);
+		}
+
+		return true;
+	};
+
+	if (!m_compiler->Compile(desc, source, include, shader->bytecode, shader->errors))
+	{
+		shader->bytecode.clear();
+		::OutputDebugString(shader->errors.c_str());
+
+		std::lock_guard<std::mutex> lock(m_cacheMutex);
+		m_stats.failed++;
+		return shader;
+	}
+
+	shader->key = key;
+	StoreBytecode(key, shader->bytecode);
+	StoreManifest(descKey, dependencies);
+
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	m_stats.compiled++;
+
+	return m_shaders.emplace(key, shader).first->second;
+}
+
+bool ShaderCache::ResolveInclude(const std::string &name, const std::string &parentPath,
+	std::string &path, std::string &contents) const
+{
+	path = GetDirectory(parentPath) + name;
+	if (LoadTextFile(path, contents))
+	{
+		return true;
+	}
+
+	for (const std::string &directory : m_includeDirectories)
+	{
+		path = directory + name;
+		if (LoadTextFile(path, contents))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool ShaderCache::LoadManifest(uint64_t descKey, std::vector<std::string> &dependencies)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_cacheMutex);
+
+		auto it = m_manifests.find(descKey);
+		if (it != m_manifests.end())
+		{
+			dependencies = it->second;
+			return true;
+		}
+	}
+
+	std::ifstream file(MakePath(descKey, L".dep"));
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		dependencies.push_back(line);
+	}
+
+	if (dependencies.empty())
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	m_manifests[descKey] = dependencies;
+
+	return true;
+}
+
+void ShaderCache::StoreManifest(uint64_t descKey, const std::vector<std::string> &dependencies)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_cacheMutex);
+		m_manifests[descKey] = dependencies;
+	}
+
+	std::wstring path = MakePath(descKey, L".dep");
+	std::wstring tempPath = path + L".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::trunc);
+		for (const std::string &dependency : dependencies)
+		{
+			file << dependency << '\n';
+		}
+		if (!file)
+		{
+			return;
+		}
+	}
+
+	::MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+bool ShaderCache::LoadBytecode(uint64_t key, std::vector<uint8_t> &bytecode) const
+{
+	std::ifstream file(MakePath(key, L".cso"), std::ios::binary | std::ios::ate);
+	if (!file)
+	{
+		return false;
+	}
+
+	bytecode.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(bytecode.data()), bytecode.size());
+
+	return file && !bytecode.empty();
+}
+
+void ShaderCache::StoreBytecode(uint64_t key, const std::vector<uint8_t> &bytecode) const
+{
+	// Write to a temporary file first so a crash never leaves half a shader behind
+	std::wstring path = MakePath(key, L".cso");
+	std::wstring tempPath = path + L".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(bytecode.data()), bytecode.size());
+		if (!file)
+		{
+			return;
+		}
+	}
+
+	::MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+std::wstring ShaderCache::MakePath(uint64_t key, const wchar_t *extension) const
+{
+	wchar_t name[32];
+	swprintf_s(name, 32, L"\\%016llx", static_cast<unsigned long long>(key));
+
+	return m_directory + name + extension;
+}
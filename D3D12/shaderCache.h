@@ -0,0 +1,151 @@
+#pragma once
+
+#include "includes.h"
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Everything that decides what bytecode a shader compiles to,
+// apart from the contents of the files it reads
+struct ShaderDesc
+{
+	std::string path;
+	std::string entryPoint;
+	std::string target;		// e.g. "vs_5_1"
+	std::vector<std::pair<std::string, std::string>> defines;
+	UINT flags;				// D3DCOMPILE_*
+};
+
+// Compiles a single shader. Every #include must be read through the include
+// function so the cache knows which files the result depends on.
+//
+// D3DShaderCompiler is the real one. Anything else can be plugged in, e.g.
+// the benchmarks' stub which returns the preprocessed text, to exercise the
+// cache, dependency tracking and scheduling without a shader compiler.
+class ShaderCompilerBackend
+{
+public:
+	// Resolves an include relative to the file that includes it.
+	// Returns false if the file can't be found.
+	typedef std::function<bool(const std::string &name, const std::string &parentPath,
+		std::string &path, std::string &contents)> IncludeFunction;
+
+	virtual ~ShaderCompilerBackend() {}
+
+	// Called from several threads at once
+	virtual bool Compile(const ShaderDesc &desc, const std::string &source, const IncludeFunction &include,
+		std::vector<uint8_t> &bytecode, std::string &errors) = 0;
+
+	// Part of every cache key, change it when the backend produces different bytecode
+	virtual uint64_t GetCompilerVersion() const = 0;
+};
+
+class D3DShaderCompiler : public ShaderCompilerBackend
+{
+public:
+	bool Compile(const ShaderDesc &desc, const std::string &source, const IncludeFunction &include,
+		std::vector<uint8_t> &bytecode, std::string &errors) override;
+
+	uint64_t GetCompilerVersion() const override { return D3D_COMPILER_VERSION; }
+};
+
+// Compiled shaders are stored on disk under the hash of their contents: the
+// options in ShaderDesc plus the text of the source and of every include.
+// Next to them a small manifest per ShaderDesc lists the files the last
+// compile read, so a lookup can hash those and find the bytecode without
+// running the compiler. Changing any included file changes the hash.
+//
+// Misses are compiled on a pool of worker threads.
+
+class ShaderCache
+{
+public:
+	struct Shader
+	{
+		uint64_t key;							// content hash, 0 if compilation failed
+		std::vector<uint8_t> bytecode;
+		std::vector<std::string> dependencies;	// the source file first, then every include
+		std::string errors;
+
+		D3D12_SHADER_BYTECODE GetBytecode() const { return { bytecode.data(), bytecode.size() }; }
+	};
+
+	typedef std::shared_ptr<const Shader> ShaderPtr;
+	typedef std::shared_future<ShaderPtr> Future;
+
+	struct Stats
+	{
+		uint32_t memoryHits;
+		uint32_t diskHits;
+		uint32_t compiled;
+		uint32_t failed;
+	};
+
+	ShaderCache(std::unique_ptr<ShaderCompilerBackend> compiler, const std::wstring &directory, uint32_t numThreads);
+	// Requests that haven't started are dropped, call WaitIdle() first to finish them
+	~ShaderCache();
+
+	// Searched after the directory of the including file, add them before the first Compile()
+	void AddIncludeDirectory(const std::string &directory);
+
+	// Files are read on a worker thread, so asking again after a file changed
+	// picks up the change. Asking while the same desc is still being
+	// compiled returns the same future.
+	Future Compile(const ShaderDesc &desc);
+
+	// Blocks until every queued request is done
+	void WaitIdle();
+
+	Stats GetStats();
+
+	// Hash of the options only, names the manifest
+	uint64_t HashDesc(const ShaderDesc &desc) const;
+
+private:
+	struct Job
+	{
+		ShaderDesc desc;
+		uint64_t descKey;
+		std::promise<ShaderPtr> promise;
+	};
+
+	void WorkerThread();
+	ShaderPtr Build(const ShaderDesc &desc, uint64_t descKey);
+	ShaderPtr Lookup(uint64_t descKey);
+
+	bool ResolveInclude(const std::string &name, const std::string &parentPath,
+		std::string &path, std::string &contents) const;
+
+	bool LoadManifest(uint64_t descKey, std::vector<std::string> &dependencies);
+	void StoreManifest(uint64_t descKey, const std::vector<std::string> &dependencies);
+	bool LoadBytecode(uint64_t key, std::vector<uint8_t> &bytecode) const;
+	void StoreBytecode(uint64_t key, const std::vector<uint8_t> &bytecode) const;
+	std::wstring MakePath(uint64_t key, const wchar_t *extension) const;
+
+	std::unique_ptr<ShaderCompilerBackend> m_compiler;
+	std::wstring m_directory;
+	std::vector<std::string> m_includeDirectories;
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_queueMutex;
+	std::condition_variable m_queueCondition;
+	std::condition_variable m_idleCondition;
+	std::queue<std::shared_ptr<Job>> m_queue;
+	uint32_t m_inFlight;
+	bool m_quit;
+
+	std::mutex m_cacheMutex;
+	std::unordered_map<uint64_t, Future> m_pending;						// desc hash -> request in flight
+	std::unordered_map<uint64_t, std::vector<std::string>> m_manifests;	// desc hash -> dependencies
+	std::unordered_map<uint64_t, ShaderPtr> m_shaders;					// content hash -> shader
+	Stats m_stats;
+};
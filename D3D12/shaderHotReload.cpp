@@ -0,0 +1,270 @@
+#include "shaderHotReload.h"
+
+namespace
+{
+	// How long a file has to stay untouched before it's recompiled
+	const std::chrono::milliseconds gSettleTime(100);
+
+	template <typename T>
+	bool IsReady(const std::shared_future<T> &future)
+	{
+		return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}
+}
+
+ShaderHotReload::ShaderHotReload(ShaderCache *shaderCache, PipelineCompiler *pipelineCompiler,
+	std::unique_ptr<FileWatcher> watcher) :
+	m_shaderCache(shaderCache),
+	m_pipelineCompiler(pipelineCompiler),
+	m_watcher(std::move(watcher))
+{
+}
+
+bool ShaderHotReload::Watch(const std::string &directory)
+{
+	return m_watcher->Watch(directory);
+}
+
+std::string ShaderHotReload::NormalizePath(const std::string &path)
+{
+	// The compiler, the watcher and the app don't agree on relative paths,
+	// slashes or case, compare full lower case paths instead
+	char fullPath[MAX_PATH];
+	DWORD length = ::GetFullPathNameA(path.c_str(), MAX_PATH, fullPath, nullptr);
+
+	std::string normalized = length > 0 && length < MAX_PATH ? std::string(fullPath, length) : path;
+	std::replace(normalized.begin(), normalized.end(), '/', '\\');
+	std::transform(normalized.begin(), normalized.end(), normalized.begin(),
+		[](char c) { return static_cast<char>(::tolower(static_cast<unsigned char>(c))); });
+
+	return normalized;
+}
+
+ShaderHotReload::PipelineId ShaderHotReload::Register(const std::vector<ShaderDesc> &shaders, uint64_t rootSignatureKey,
+	StreamFunction makeStream, SwapFunction onSwap)
+{
+	PipelineId id = static_cast<PipelineId>(m_pipelines.size());
+
+	m_pipelines.emplace_back();
+	Pipeline &pipeline = m_pipelines.back();
+	pipeline.shaders = shaders;
+	pipeline.rootSignatureKey = rootSignatureKey;
+	pipeline.makeStream = makeStream;
+	pipeline.onSwap = onSwap;
+	pipeline.rebuilding = false;
+	pipeline.rebuildAgain = false;
+
+	Rebuild(id);
+
+	return id;
+}
+
+ID3D12PipelineState *ShaderHotReload::Get(PipelineId id) const
+{
+	return m_pipelines[id].current.Get();
+}
+
+void ShaderHotReload::Update(uint64_t lastSignaledFence, uint64_t completedFence)
+{
+	static std::chrono::high_resolution_clock clock;
+	auto now = clock.now();
+
+	size_t numChanged = m_changed.size();
+	m_watcher->Poll(m_changed);
+	if (m_changed.size() != numChanged)
+	{
+		m_lastChange = now;
+	}
+
+	if (!m_changed.empty() && now - m_lastChange >= gSettleTime)
+	{
+		std::vector<std::string> changed;
+		changed.swap(m_changed);
+
+		for (const std::string &path : changed)
+		{
+			FileChanged(path);
+		}
+	}
+
+	for (PipelineId id = 0; id < m_pipelines.size(); ++id)
+	{
+		UpdateRebuild(id, lastSignaledFence);
+	}
+
+	// Old pipelines the GPU is done with
+	m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(),
+		[completedFence](const RetiredPipeline &retired) { return retired.fenceValue <= completedFence; }),
+		m_retired.end());
+}
+
+void ShaderHotReload::FileChanged(const std::string &path)
+{
+	std::string normalized = NormalizePath(path);
+
+	std::vector<PipelineId> affected;
+	if (!normalized.empty() && normalized.back() == '\\')
+	{
+		// The watcher lost track of a whole directory
+		for (const auto &dependents : m_dependents)
+		{
+			if (dependents.first.compare(0, normalized.size(), normalized) == 0)
+			{
+				affected.insert(affected.end(), dependents.second.begin(), dependents.second.end());
+			}
+		}
+	}
+	else
+	{
+		auto it = m_dependents.find(normalized);
+		if (it != m_dependents.end())
+		{
+			affected = it->second;
+		}
+	}
+
+	std::sort(affected.begin(), affected.end());
+	affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+
+	for (PipelineId id : affected)
+	{
+		Rebuild(id);
+	}
+}
+
+void ShaderHotReload::Rebuild(PipelineId id)
+{
+	Pipeline &pipeline = m_pipelines[id];
+	if (pipeline.rebuilding)
+	{
+		// The files may have been read before this change, go again when done
+		pipeline.rebuildAgain = true;
+		return;
+	}
+
+	pipeline.rebuilding = true;
+	pipeline.rebuildAgain = false;
+
+	for (const ShaderDesc &desc : pipeline.shaders)
+	{
+		pipeline.shaderFutures.push_back(m_shaderCache->Compile(desc));
+	}
+}
+
+void ShaderHotReload::UpdateRebuild(PipelineId id, uint64_t lastSignaledFence)
+{
+	Pipeline &pipeline = m_pipelines[id];
+	if (!pipeline.rebuilding)
+	{
+		return;
+	}
+
+	if (!pipeline.shaderFutures.empty())
+	{
+		for (const auto &future : pipeline.shaderFutures)
+		{
+			if (!IsReady(future))
+			{
+				return;
+			}
+		}
+
+		// The source files are tracked even if they fail to compile (or to
+		// open, halfway through a save), so fixing them triggers a rebuild
+		std::vector<std::string> dependencies;
+		bool failed = false;
+		for (size_t i = 0; i < pipeline.shaderFutures.size(); ++i)
+		{
+			ShaderCache::ShaderPtr shader = pipeline.shaderFutures[i].get();
+			failed = failed || shader->key == 0;
+
+			dependencies.push_back(NormalizePath(pipeline.shaders[i].path));
+			for (const std::string &dependency : shader->dependencies)
+			{
+				dependencies.push_back(NormalizePath(dependency));
+			}
+
+			pipeline.compiledShaders.push_back(shader);
+		}
+		pipeline.shaderFutures.clear();
+
+		SetDependencies(id, dependencies);
+
+		if (!failed)
+		{
+			// The compiler copies the stream, the bytecode it points to is kept in compiledShaders
+			CD3DX12_PIPELINE_STATE_STREAM stream = pipeline.makeStream(pipeline.compiledShaders);
+			pipeline.pipelineFuture = m_pipelineCompiler->Compile(stream, pipeline.rootSignatureKey,
+				PipelineCompiler::PRIORITY_HIGH).future;
+		}
+	}
+
+	if (pipeline.pipelineFuture.valid())
+	{
+		if (!IsReady(pipeline.pipelineFuture))
+		{
+			return;
+		}
+
+		ComPtr<ID3D12PipelineState> rebuilt;
+		try
+		{
+			rebuilt = pipeline.pipelineFuture.get();
+		}
+		catch (...)
+		{
+			::OutputDebugString("Pipeline failed to compile, keeping the old one\n");
+		}
+
+		// Frames up to lastSignaledFence may still be using the old one
+		if (rebuilt && rebuilt != pipeline.current)
+		{
+			bool replaced = pipeline.current != nullptr;
+			if (replaced)
+			{
+				m_retired.push_back({ lastSignaledFence, pipeline.current });
+			}
+			pipeline.current = rebuilt;
+
+			if (replaced && pipeline.onSwap)
+			{
+				pipeline.onSwap(pipeline.compiledShaders);
+			}
+		}
+
+		pipeline.pipelineFuture = PipelineCompiler::Future();
+	}
+
+	pipeline.compiledShaders.clear();
+	pipeline.rebuilding = false;
+
+	if (pipeline.rebuildAgain)
+	{
+		Rebuild(id);
+	}
+}
+
+void ShaderHotReload::SetDependencies(PipelineId id, const std::vector<std::string> &dependencies)
+{
+	Pipeline &pipeline = m_pipelines[id];
+
+	for (const std::string &path : pipeline.dependencies)
+	{
+		std::vector<PipelineId> &dependents = m_dependents[path];
+		dependents.erase(std::remove(dependents.begin(), dependents.end(), id), dependents.end());
+		if (dependents.empty())
+		{
+			m_dependents.erase(path);
+		}
+	}
+
+	pipeline.dependencies = dependencies;
+	std::sort(pipeline.dependencies.begin(), pipeline.dependencies.end());
+	pipeline.dependencies.erase(std::unique(pipeline.dependencies.begin(), pipeline.dependencies.end()),
+		pipeline.dependencies.end());
+
+	for (const std::string &path : pipeline.dependencies)
+	{
+		m_dependents[path].push_back(id);
+	}
+}
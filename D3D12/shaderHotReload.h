@@ -0,0 +1,101 @@
+#pragma once
+
+#include "includes.h"
+#include "fileWatcher.h"
+#include "pipelineCompiler.h"
+#include "shaderCache.h"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Rebuilds pipelines while the app is running when one of their shader
+// files, or any file those include, is saved.
+//
+// Every registered pipeline remembers the files its shaders read (the
+// include graph comes from ShaderCache). When the watcher reports a file,
+// only the pipelines that depend on it are rebuilt: their shaders are
+// recompiled by the shader cache and the pipeline by the pipeline compiler,
+// both in the background. The new pipeline replaces the old one in Update(),
+// which runs between frames, so a frame never sees half a change. The old
+// pipeline is kept until the GPU is done with the frames that used it, the
+// GPU is never flushed.
+//
+// If a shader fails to compile the errors go to the debugger output and the
+// old pipeline stays in use.
+
+class ShaderHotReload
+{
+public:
+	typedef uint32_t PipelineId;
+
+	// Fills in a stream for the compiled shaders, in the order they were registered.
+	// The shaders stay alive until the pipeline is compiled.
+	typedef std::function<CD3DX12_PIPELINE_STATE_STREAM(const std::vector<ShaderCache::ShaderPtr> &shaders)> StreamFunction;
+
+	// Called from Update() when a rebuild replaced the pipeline, with the
+	// shaders it was built from, so whatever else uses them can follow
+	typedef std::function<void(const std::vector<ShaderCache::ShaderPtr> &shaders)> SwapFunction;
+
+	ShaderHotReload(ShaderCache *shaderCache, PipelineCompiler *pipelineCompiler, std::unique_ptr<FileWatcher> watcher);
+
+	bool Watch(const std::string &directory);
+
+	// Builds the pipeline in the background, Get() returns nullptr until it's ready
+	PipelineId Register(const std::vector<ShaderDesc> &shaders, uint64_t rootSignatureKey, StreamFunction makeStream,
+		SwapFunction onSwap = nullptr);
+
+	// Current pipeline, the same object for the whole frame
+	ID3D12PipelineState *Get(PipelineId id) const;
+
+	// Call between frames from the render thread.
+	// lastSignaledFence covers every frame that may have used the current pipelines.
+	void Update(uint64_t lastSignaledFence, uint64_t completedFence);
+
+private:
+	struct Pipeline
+	{
+		std::vector<ShaderDesc> shaders;
+		uint64_t rootSignatureKey;
+		StreamFunction makeStream;
+		SwapFunction onSwap;
+
+		ComPtr<ID3D12PipelineState> current;
+		std::vector<std::string> dependencies;		// normalized paths of every file the shaders read
+
+		// Rebuild in flight
+		bool rebuilding;
+		bool rebuildAgain;							// a file changed while rebuilding
+		std::vector<ShaderCache::Future> shaderFutures;
+		std::vector<ShaderCache::ShaderPtr> compiledShaders;
+		PipelineCompiler::Future pipelineFuture;
+	};
+
+	struct RetiredPipeline
+	{
+		uint64_t fenceValue;
+		ComPtr<ID3D12PipelineState> pipeline;
+	};
+
+	void Rebuild(PipelineId id);
+	void UpdateRebuild(PipelineId id, uint64_t lastSignaledFence);
+	void SetDependencies(PipelineId id, const std::vector<std::string> &dependencies);
+	void FileChanged(const std::string &path);
+
+	static std::string NormalizePath(const std::string &path);
+
+	ShaderCache *m_shaderCache;
+	PipelineCompiler *m_pipelineCompiler;
+	std::unique_ptr<FileWatcher> m_watcher;
+
+	std::vector<Pipeline> m_pipelines;
+	std::unordered_map<std::string, std::vector<PipelineId>> m_dependents;	// normalized path -> pipelines
+	std::vector<RetiredPipeline> m_retired;
+
+	// Editors touch a file several times per save, wait for it to settle
+	std::vector<std::string> m_changed;
+	std::chrono::high_resolution_clock::time_point m_lastChange;
+};
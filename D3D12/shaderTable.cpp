@@ -0,0 +1,257 @@
+#include "shaderTable.h"
+#include "uploadRing.h"
+
+#include <cstring>
+
+namespace
+{
+	uint64_t AlignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+ShaderTable::ShaderTable(const Layout layouts[NUM_KINDS]) :
+	m_bufferState(D3D12_RESOURCE_STATE_COPY_DEST),
+	m_stats()
+{
+	uint64_t size = 0;
+	uint32_t numRecords = 0;
+	for (uint32_t kind = 0; kind < NUM_KINDS; ++kind)
+	{
+		uint64_t alignment = D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT;
+		if (kind == RAY_GENERATION)
+		{
+			alignment = D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT;
+		}
+
+		m_numRecords[kind] = layouts[kind].numRecords;
+		m_rootArgumentsSizes[kind] = layouts[kind].rootArgumentsSize;
+		m_strides[kind] = static_cast<uint32_t>(
+			AlignUp(D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES + layouts[kind].rootArgumentsSize, alignment));
+		assert(m_strides[kind] <= D3D12_RAYTRACING_MAX_SHADER_RECORD_STRIDE);
+
+		m_offsets[kind] = AlignUp(size, D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT);
+		size = m_offsets[kind] + static_cast<uint64_t>(m_strides[kind]) * m_numRecords[kind];
+
+		m_firstRecords[kind] = numRecords;
+		numRecords += m_numRecords[kind];
+	}
+
+	m_data.resize(size);
+
+	// The buffer starts out with whatever was in its memory
+	m_changed.resize(numRecords);
+	for (uint32_t i = 0; i < numRecords; ++i)
+	{
+		m_changed[i] = i;
+	}
+	m_isChanged.resize(numRecords, 1);
+
+	m_stats.size = size;
+	m_stats.records = numRecords;
+}
+
+void ShaderTable::MarkChanged(Kind kind, uint32_t record)
+{
+	uint32_t index = m_firstRecords[kind] + record;
+	if (!m_isChanged[index])
+	{
+		m_isChanged[index] = 1;
+		m_changed.push_back(index);
+	}
+}
+
+void ShaderTable::SetRecord(Kind kind, uint32_t record, const void *identifier, const void *rootArguments,
+	uint32_t rootArgumentsSize)
+{
+	assert(record < m_numRecords[kind]);
+	assert(rootArgumentsSize <= m_rootArgumentsSizes[kind]);
+
+	uint8_t *data = GetRecord(kind, record);
+	if (std::memcmp(data, identifier, D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES) != 0)
+	{
+		std::memcpy(data, identifier, D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
+		MarkChanged(kind, record);
+	}
+
+	SetRootArguments(kind, record, rootArguments, rootArgumentsSize);
+}
+
+void ShaderTable::SetRootArguments(Kind kind, uint32_t record, const void *rootArguments, uint32_t rootArgumentsSize,
+	uint32_t offset)
+{
+	assert(record < m_numRecords[kind]);
+	assert(offset + rootArgumentsSize <= m_rootArgumentsSizes[kind]);
+
+	if (rootArgumentsSize == 0)
+	{
+		return;
+	}
+
+	uint8_t *data = GetRecord(kind, record) + D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES + offset;
+	if (std::memcmp(data, rootArguments, rootArgumentsSize) != 0)
+	{
+		std::memcpy(data, rootArguments, rootArgumentsSize);
+		MarkChanged(kind, record);
+	}
+}
+
+bool ShaderTable::Upload(UploadRing &ring, D3D12_DISPATCH_RAYS_DESC &desc, uint32_t rayGeneration) const
+{
+	UploadRing::Allocation allocation;
+	if (!ring.Allocate(m_data.size(), D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT, allocation))
+	{
+		return false;
+	}
+
+	std::memcpy(allocation.cpu, m_data.data(), m_data.size());
+	FillDispatchRaysDesc(allocation.gpu, rayGeneration, desc);
+	return true;
+}
+
+void ShaderTable::CreateBuffer(ComPtr<ID3D12Device2> device)
+{
+	CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_DEFAULT);
+	CD3DX12_RESOURCE_DESC bufferDesc = CD3DX12_RESOURCE_DESC::Buffer(m_data.size());
+	ThrowIfFailed(device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &bufferDesc,
+		D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&m_buffer)));
+	m_bufferState = D3D12_RESOURCE_STATE_COPY_DEST;
+
+	// A new buffer needs every record
+	m_changed.clear();
+	for (uint32_t i = 0; i < m_isChanged.size(); ++i)
+	{
+		m_isChanged[i] = 1;
+		m_changed.push_back(i);
+	}
+}
+
+bool ShaderTable::Update(UploadRing &ring, ID3D12GraphicsCommandList *commandList)
+{
+	static std::chrono::high_resolution_clock clock;
+	auto t0 = clock.now();
+
+	m_stats.patched = 0;
+	m_stats.copies = 0;
+	m_stats.uploaded = 0;
+
+	if (m_changed.empty())
+	{
+		m_stats.updateMs = 0.0;
+		return true;
+	}
+
+	// In table order, so neighbouring records become one copy
+	std::sort(m_changed.begin(), m_changed.end());
+
+	auto getRange = [&](uint32_t index, uint64_t &begin, uint64_t &end)
+	{
+		uint32_t kind = NUM_KINDS - 1;
+		while (index < m_firstRecords[kind] || m_numRecords[kind] == 0)
+		{
+			--kind;
+		}
+		begin = m_offsets[kind] + static_cast<uint64_t>(m_strides[kind]) * (index - m_firstRecords[kind]);
+		end = begin + m_strides[kind];
+	};
+
+	uint64_t size = 0;
+	for (uint32_t index : m_changed)
+	{
+		uint64_t begin, end;
+		getRange(index, begin, end);
+		size += end - begin;
+	}
+
+	UploadRing::Allocation allocation;
+	if (!ring.Allocate(size, D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT, allocation))
+	{
+		m_stats.updateMs = 0.0;
+		return false;
+	}
+
+	if (commandList && m_bufferState != D3D12_RESOURCE_STATE_COPY_DEST)
+	{
+		CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_buffer.Get(),
+			m_bufferState, D3D12_RESOURCE_STATE_COPY_DEST);
+		commandList->ResourceBarrier(1, &barrier);
+	}
+
+	uint8_t *cpu = static_cast<uint8_t*>(allocation.cpu);
+	uint64_t source = allocation.gpu - ring.GetGpuAddress();
+
+	// The records of a run are next to each other in the ring too
+	auto copyRun = [&](uint64_t begin, uint64_t end)
+	{
+		std::memcpy(cpu, &m_data[begin], end - begin);
+		if (commandList)
+		{
+			commandList->CopyBufferRegion(m_buffer.Get(), begin, ring.GetResource(), source, end - begin);
+		}
+		cpu += end - begin;
+		source += end - begin;
+		m_stats.copies++;
+	};
+
+	uint64_t runBegin = 0;
+	uint64_t runEnd = 0;
+	for (uint32_t index : m_changed)
+	{
+		uint64_t begin, end;
+		getRange(index, begin, end);
+		if (begin != runEnd)
+		{
+			if (runEnd > runBegin)
+			{
+				copyRun(runBegin, runEnd);
+			}
+			runBegin = begin;
+		}
+		runEnd = end;
+
+		m_isChanged[index] = 0;
+	}
+	copyRun(runBegin, runEnd);
+
+	if (commandList)
+	{
+		CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_buffer.Get(),
+			D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		commandList->ResourceBarrier(1, &barrier);
+		m_bufferState = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+	}
+
+	m_stats.patched = static_cast<uint32_t>(m_changed.size());
+	m_stats.uploaded = size;
+	m_changed.clear();
+
+	auto t1 = clock.now();
+	m_stats.updateMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+	return true;
+}
+
+void ShaderTable::GetDispatchRaysDesc(D3D12_DISPATCH_RAYS_DESC &desc, uint32_t rayGeneration) const
+{
+	FillDispatchRaysDesc(m_buffer->GetGPUVirtualAddress(), rayGeneration, desc);
+}
+
+void ShaderTable::FillDispatchRaysDesc(D3D12_GPU_VIRTUAL_ADDRESS address, uint32_t rayGeneration,
+	D3D12_DISPATCH_RAYS_DESC &desc) const
+{
+	assert(rayGeneration < m_numRecords[RAY_GENERATION]);
+
+	auto getRange = [&](Kind kind, D3D12_GPU_VIRTUAL_ADDRESS_RANGE_AND_STRIDE &range)
+	{
+		range.StartAddress = m_numRecords[kind] > 0 ? address + m_offsets[kind] : 0;
+		range.SizeInBytes = static_cast<uint64_t>(m_strides[kind]) * m_numRecords[kind];
+		range.StrideInBytes = m_strides[kind];
+	};
+
+	desc.RayGenerationShaderRecord.StartAddress = address + m_offsets[RAY_GENERATION] +
+		static_cast<uint64_t>(m_strides[RAY_GENERATION]) * rayGeneration;
+	desc.RayGenerationShaderRecord.SizeInBytes = m_strides[RAY_GENERATION];
+	getRange(MISS, desc.MissShaderTable);
+	getRange(HIT_GROUP, desc.HitGroupTable);
+	getRange(CALLABLE, desc.CallableShaderTable);
+}
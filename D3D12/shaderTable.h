@@ -0,0 +1,111 @@
+#pragma once
+
+#include "includes.h"
+
+#include <vector>
+
+class UploadRing;
+
+// Shader binding table for DispatchRays: the ray generation, miss, hit
+// group and callable records one after the other, each a shader identifier
+// followed by its local root arguments.
+//
+// Every record of a kind has the same stride, the identifier plus the
+// biggest root arguments rounded up to
+// D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT, and every kind starts at
+// D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT. Ray generation records take
+// the table alignment as stride too, since DispatchRays starts at one of
+// them.
+//
+// The table is kept on the CPU as the GPU sees it. It can be copied whole
+// into the upload ring every frame, or kept in a buffer on the GPU where
+// Update() only copies the records that changed since the last update, in
+// runs of neighbouring records. Setting a record to what it already holds
+// doesn't count as a change, so the records of every material can be set
+// every frame and only the materials that really changed get copied.
+
+class ShaderTable
+{
+public:
+	enum Kind
+	{
+		RAY_GENERATION,
+		MISS,
+		HIT_GROUP,
+		CALLABLE,
+		NUM_KINDS,
+	};
+
+	struct Layout
+	{
+		uint32_t numRecords;
+		uint32_t rootArgumentsSize;		// the biggest of the records, in bytes
+	};
+
+	struct Stats
+	{
+		uint64_t size;
+		uint32_t records;
+		// Last Update
+		uint32_t patched;			// records
+		uint32_t copies;			// runs of records
+		uint64_t uploaded;			// bytes
+		double updateMs;
+	};
+
+	// The records start zeroed and all of them go to the GPU on the first Update
+	ShaderTable(const Layout layouts[NUM_KINDS]);
+
+	// identifier is D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES from ID3D12StateObjectProperties::GetShaderIdentifier
+	void SetRecord(Kind kind, uint32_t record, const void *identifier, const void *rootArguments = nullptr,
+		uint32_t rootArgumentsSize = 0);
+	// Only the root arguments change, e.g. for a material
+	void SetRootArguments(Kind kind, uint32_t record, const void *rootArguments, uint32_t rootArgumentsSize,
+		uint32_t offset = 0);
+
+	// For a table rewritten every frame: copies it whole into the ring and
+	// points desc at it. Width, Height and Depth are left to the caller.
+	// False when the ring is full.
+	bool Upload(UploadRing &ring, D3D12_DISPATCH_RAYS_DESC &desc, uint32_t rayGeneration = 0) const;
+
+	// A buffer on the GPU that Update() keeps current
+	void CreateBuffer(ComPtr<ID3D12Device2> device);
+	// Writes the changed records into the ring and copies them into the
+	// buffer on commandList. Without a command list only the ring is
+	// written, which the benchmarks use to run without a GPU. False when the
+	// ring is full, the records stay changed then.
+	bool Update(UploadRing &ring, ID3D12GraphicsCommandList *commandList);
+	void GetDispatchRaysDesc(D3D12_DISPATCH_RAYS_DESC &desc, uint32_t rayGeneration = 0) const;
+
+	uint32_t GetStride(Kind kind) const { return m_strides[kind]; }
+	uint64_t GetOffset(Kind kind) const { return m_offsets[kind]; }
+	uint64_t GetSize() const { return m_data.size(); }
+	// The whole table as it goes to the GPU
+	const uint8_t *GetData() const { return m_data.data(); }
+	ID3D12Resource *GetBuffer() const { return m_buffer.Get(); }
+
+	const Stats &GetStats() const { return m_stats; }
+
+private:
+	uint8_t *GetRecord(Kind kind, uint32_t record) { return &m_data[m_offsets[kind] + m_strides[kind] * record]; }
+	void MarkChanged(Kind kind, uint32_t record);
+	void FillDispatchRaysDesc(D3D12_GPU_VIRTUAL_ADDRESS address, uint32_t rayGeneration,
+		D3D12_DISPATCH_RAYS_DESC &desc) const;
+
+	uint32_t m_numRecords[NUM_KINDS];
+	uint32_t m_rootArgumentsSizes[NUM_KINDS];
+	uint32_t m_strides[NUM_KINDS];
+	uint64_t m_offsets[NUM_KINDS];
+	uint32_t m_firstRecords[NUM_KINDS];		// of the kind among all records
+
+	std::vector<uint8_t> m_data;
+
+	// Records changed since the last Update, by number among all records
+	std::vector<uint32_t> m_changed;
+	std::vector<uint8_t> m_isChanged;
+
+	ComPtr<ID3D12Resource> m_buffer;
+	D3D12_RESOURCE_STATES m_bufferState;
+
+	Stats m_stats;
+};
@@ -0,0 +1,57 @@
+// Cubes without a vertex buffer: the vertex id picks a corner of the unit
+// cube, the instance id the object. Every object's world matrix and color
+// are written into the upload ring each frame.
+
+struct Instance
+{
+	row_major float4x4 world;
+	float4 color;				// alpha < 1 for the transparent objects
+};
+
+cbuffer SceneConstants : register(b0)
+{
+	row_major float4x4 gViewProjection;
+};
+
+StructuredBuffer<Instance> gInstances : register(t0);
+
+// Two clockwise triangles per face, corner i is at (i & 1, i & 2, i & 4)
+static const uint gCubeCorners[36] =
+{
+	0, 2, 3, 0, 3, 1,	// -z
+	5, 7, 6, 5, 6, 4,	// +z
+	4, 6, 2, 4, 2, 0,	// -x
+	1, 3, 7, 1, 7, 5,	// +x
+	1, 5, 4, 1, 4, 0,	// -y
+	2, 6, 7, 2, 7, 3,	// +y
+};
+
+struct VSOutput
+{
+	float4 position : SV_Position;
+	float3 worldPosition : POSITION;
+	float4 color : COLOR;
+};
+
+VSOutput VSMain(uint vertexId : SV_VertexID, uint instanceId : SV_InstanceID)
+{
+	uint corner = gCubeCorners[vertexId];
+	float3 position = float3(corner & 1 ? 0.5 : -0.5, corner & 2 ? 0.5 : -0.5, corner & 4 ? 0.5 : -0.5);
+
+	Instance instance = gInstances[instanceId];
+	float4 worldPosition = mul(float4(position, 1.0), instance.world);
+
+	VSOutput output;
+	output.position = mul(worldPosition, gViewProjection);
+	output.worldPosition = worldPosition.xyz;
+	output.color = instance.color;
+	return output;
+}
+
+float4 PSMain(VSOutput input) : SV_Target
+{
+	// Flat shading, the face normal from the screen space derivatives
+	float3 normal = normalize(cross(ddx(input.worldPosition), ddy(input.worldPosition)));
+	float light = 0.3 + 0.7 * saturate(dot(normal, normalize(float3(0.4, 1.0, -0.6))));
+	return float4(input.color.rgb * light, input.color.a);
+}
@@ -0,0 +1,594 @@
+#include "spatialGrid.h"
+#include "jobSystem.h"
+#include "radixSort.h"
+
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+	const int32_t gCoordinateBias = 1 << 20;	// cell coordinates are in [-2^20, 2^20)
+	const uint64_t gCoordinateMask = (1ull << 21) - 1;
+
+	int32_t ToCell(float value)
+	{
+		// Clamped first, far away objects share the border cells
+		float limit = static_cast<float>(gCoordinateBias);
+		return static_cast<int32_t>(std::floor(std::min(std::max(value, -limit), limit - 1.0f)));
+	}
+
+	uint64_t PackKey(int32_t x, int32_t y, int32_t z)
+	{
+		return static_cast<uint64_t>(x + gCoordinateBias) |
+			(static_cast<uint64_t>(y + gCoordinateBias) << 21) |
+			(static_cast<uint64_t>(z + gCoordinateBias) << 42);
+	}
+
+	int32_t UnpackCoordinate(uint64_t key, uint32_t shift)
+	{
+		return static_cast<int32_t>((key >> shift) & gCoordinateMask) - gCoordinateBias;
+	}
+
+	uint32_t Hash(uint64_t key)
+	{
+		return static_cast<uint32_t>((key * 0x9E3779B97F4A7C15ull) >> 32);
+	}
+}
+
+SpatialGrid::SpatialGrid(float cellSize) :
+	m_cellSize(cellSize),
+	m_invCellSize(1.0f / cellSize),
+	m_numEmptyCells(0),
+	m_stats()
+{
+	assert(cellSize > 0.0f);
+}
+
+void SpatialGrid::Clear()
+{
+	m_cells.clear();
+	m_buckets.clear();
+	m_numEmptyCells = 0;
+	m_objectCells.clear();
+	m_objectSlots.clear();
+}
+
+void SpatialGrid::Reserve(uint32_t count)
+{
+	m_objectCells.reserve(count);
+	m_objectSlots.reserve(count);
+}
+
+uint64_t SpatialGrid::GetKey(const XMFLOAT3 &position) const
+{
+	return PackKey(ToCell(position.x * m_invCellSize), ToCell(position.y * m_invCellSize),
+		ToCell(position.z * m_invCellSize));
+}
+
+uint32_t SpatialGrid::FindCell(uint64_t key) const
+{
+	if (m_buckets.empty())
+	{
+		return gNoCell;
+	}
+
+	uint32_t mask = static_cast<uint32_t>(m_buckets.size() - 1);
+	for (uint32_t bucket = Hash(key) & mask; ; bucket = (bucket + 1) & mask)
+	{
+		const Bucket &entry = m_buckets[bucket];
+		if (entry.cell == gNoCell || entry.key == key)
+		{
+			return entry.cell;
+		}
+	}
+}
+
+uint32_t SpatialGrid::FindOrAddCell(uint64_t key)
+{
+	if ((m_cells.size() + 1) * 2 > m_buckets.size())
+	{
+		Rehash(m_buckets.size() * 2);
+	}
+
+	uint32_t mask = static_cast<uint32_t>(m_buckets.size() - 1);
+	uint32_t bucket = Hash(key) & mask;
+	while (m_buckets[bucket].cell != gNoCell)
+	{
+		if (m_buckets[bucket].key == key)
+		{
+			return m_buckets[bucket].cell;
+		}
+		bucket = (bucket + 1) & mask;
+	}
+
+	uint32_t cell = static_cast<uint32_t>(m_cells.size());
+	m_buckets[bucket].key = key;
+	m_buckets[bucket].cell = cell;
+
+	m_cells.emplace_back();
+	Cell &added = m_cells.back();
+	added.key = key;
+	added.x = UnpackCoordinate(key, 0);
+	added.y = UnpackCoordinate(key, 21);
+	added.z = UnpackCoordinate(key, 42);
+
+	return cell;
+}
+
+void SpatialGrid::Rehash(size_t numBuckets)
+{
+	size_t size = 64;
+	while (size < numBuckets)
+	{
+		size *= 2;
+	}
+
+	Bucket empty = { 0, gNoCell };
+	m_buckets.assign(size, empty);
+
+	uint32_t mask = static_cast<uint32_t>(size - 1);
+	for (uint32_t cell = 0; cell < m_cells.size(); ++cell)
+	{
+		uint64_t key = m_cells[cell].key;
+		uint32_t bucket = Hash(key) & mask;
+		while (m_buckets[bucket].cell != gNoCell)
+		{
+			bucket = (bucket + 1) & mask;
+		}
+		m_buckets[bucket].key = key;
+		m_buckets[bucket].cell = cell;
+	}
+}
+
+void SpatialGrid::CompactCells()
+{
+	// The cells that are kept stay in order, only their objects need the new index
+	uint32_t numCells = 0;
+	for (uint32_t cell = 0; cell < m_cells.size(); ++cell)
+	{
+		if (m_cells[cell].entries.empty())
+		{
+			continue;
+		}
+
+		if (numCells != cell)
+		{
+			m_cells[numCells] = std::move(m_cells[cell]);
+			for (const Entry &entry : m_cells[numCells].entries)
+			{
+				m_objectCells[entry.object] = numCells;
+			}
+		}
+		numCells++;
+	}
+
+	m_cells.resize(numCells);
+	m_numEmptyCells = 0;
+	Rehash(static_cast<size_t>(numCells) * 2);
+}
+
+void SpatialGrid::ReclaimEmptyCells()
+{
+	// Emptied cells are kept for objects coming back, until they're most of the grid
+	if (m_numEmptyCells * 2 > m_cells.size())
+	{
+		CompactCells();
+	}
+}
+
+void SpatialGrid::Insert(uint32_t object, const XMFLOAT3 &position, uint64_t key)
+{
+	size_t numCells = m_cells.size();
+	uint32_t cell = FindOrAddCell(key);
+	std::vector<Entry> &entries = m_cells[cell].entries;
+	if (cell < numCells && entries.empty())
+	{
+		m_numEmptyCells--;
+	}
+
+	m_objectCells[object] = cell;
+	m_objectSlots[object] = static_cast<uint32_t>(entries.size());
+
+	Entry entry = { position, object };
+	entries.push_back(entry);
+}
+
+void SpatialGrid::Remove(uint32_t object)
+{
+	std::vector<Entry> &entries = m_cells[m_objectCells[object]].entries;
+	uint32_t slot = m_objectSlots[object];
+
+	// The last entry of the cell takes its place
+	entries[slot] = entries.back();
+	m_objectSlots[entries[slot].object] = slot;
+	entries.pop_back();
+
+	if (entries.empty())
+	{
+		m_numEmptyCells++;
+	}
+}
+
+void SpatialGrid::Build(const XMFLOAT3 *positions, uint32_t count, JobSystem *jobs)
+{
+	static std::chrono::high_resolution_clock clock;
+	auto t0 = clock.now();
+
+	m_objectCells.resize(count);
+	m_objectSlots.resize(count);
+	m_keys.resize(count);
+	m_values.resize(count);
+	m_tempKeys.resize(count);
+	m_tempValues.resize(count);
+
+	auto computeKeys = [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			m_keys[i] = GetKey(positions[i]);
+			m_values[i] = i;
+		}
+	};
+
+	if (jobs)
+	{
+		jobs->ParallelFor(count, gUpdateBlockSize, computeKeys);
+	}
+	else
+	{
+		computeKeys(0, count);
+	}
+
+	RadixSort::Sort(m_keys.data(), m_values.data(), m_tempKeys.data(), m_tempValues.data(), count, jobs);
+
+	// Cell i holds run i of equal keys. The cells that were there before are
+	// reused so their entries don't have to be allocated again.
+	m_runs.clear();
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (i == 0 || m_keys[i] != m_keys[i - 1])
+		{
+			m_runs.push_back(i);
+		}
+	}
+	m_runs.push_back(count);
+
+	uint32_t numCells = static_cast<uint32_t>(m_runs.size() - 1);
+	m_cells.resize(numCells);
+
+	auto fillCells = [&](uint32_t firstCell, uint32_t lastCell)
+	{
+		for (uint32_t cell = firstCell; cell < lastCell; ++cell)
+		{
+			uint32_t begin = m_runs[cell];
+			uint32_t end = m_runs[cell + 1];
+			uint64_t key = m_keys[begin];
+
+			m_cells[cell].key = key;
+			m_cells[cell].x = UnpackCoordinate(key, 0);
+			m_cells[cell].y = UnpackCoordinate(key, 21);
+			m_cells[cell].z = UnpackCoordinate(key, 42);
+
+			std::vector<Entry> &entries = m_cells[cell].entries;
+			entries.resize(end - begin);
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				uint32_t object = m_values[i];
+				entries[i - begin].position = positions[object];
+				entries[i - begin].object = object;
+				m_objectCells[object] = cell;
+				m_objectSlots[object] = i - begin;
+			}
+		}
+	};
+
+	if (jobs)
+	{
+		jobs->ParallelFor(numCells, 64, fillCells);
+	}
+	else
+	{
+		fillCells(0, numCells);
+	}
+
+	Rehash(static_cast<size_t>(numCells) * 2);
+	m_numEmptyCells = 0;
+
+	m_stats.objects = count;
+	m_stats.cells = numCells;
+	m_stats.buildMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+}
+
+uint32_t SpatialGrid::Add(const XMFLOAT3 &position)
+{
+	uint32_t object = GetSize();
+	m_objectCells.resize(object + 1);
+	m_objectSlots.resize(object + 1);
+
+	Insert(object, position, GetKey(position));
+
+	m_stats.objects = GetSize();
+	m_stats.cells = static_cast<uint32_t>(m_cells.size());
+	return object;
+}
+
+bool SpatialGrid::Relocate(uint32_t object, const XMFLOAT3 &position)
+{
+	assert(object < GetSize());
+
+	uint64_t key = GetKey(position);
+	Cell &cell = m_cells[m_objectCells[object]];
+	if (cell.key == key)
+	{
+		cell.entries[m_objectSlots[object]].position = position;
+		return false;
+	}
+
+	Remove(object);
+	Insert(object, position, key);
+	return true;
+}
+
+void SpatialGrid::Move(uint32_t object, const XMFLOAT3 &position)
+{
+	Relocate(object, position);
+	ReclaimEmptyCells();
+	m_stats.cells = static_cast<uint32_t>(m_cells.size());
+}
+
+void SpatialGrid::Move(const uint32_t *objects, const XMFLOAT3 *positions, uint32_t count)
+{
+	static std::chrono::high_resolution_clock clock;
+	auto t0 = clock.now();
+
+	uint32_t moved = 0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (Relocate(objects[i], positions[i]))
+		{
+			moved++;
+		}
+	}
+	ReclaimEmptyCells();
+
+	m_stats.cells = static_cast<uint32_t>(m_cells.size());
+	m_stats.updated = count;
+	m_stats.moved = moved;
+	m_stats.updateMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+}
+
+void SpatialGrid::Update(const TransformHierarchy &transforms, const TransformHierarchy::Node *nodes, JobSystem *jobs)
+{
+	static std::chrono::high_resolution_clock clock;
+	auto t0 = clock.now();
+
+	uint32_t count = GetSize();
+	uint32_t numBlocks = (count + gUpdateBlockSize - 1) / gUpdateBlockSize;
+	m_blockMoves.resize(numBlocks);
+	m_blockCounts.resize(numBlocks);
+
+	// Objects staying in their cell write their own entry, the others are
+	// moved afterwards on this thread since that changes the cells
+	auto updateBlocks = [&](uint32_t firstBlock, uint32_t lastBlock)
+	{
+		for (uint32_t block = firstBlock; block < lastBlock; ++block)
+		{
+			uint32_t begin = block * gUpdateBlockSize;
+			uint32_t end = std::min(count, begin + gUpdateBlockSize);
+
+			std::vector<Entry> &moves = m_blockMoves[block];
+			moves.clear();
+
+			uint32_t updated = 0;
+			for (uint32_t object = begin; object < end; ++object)
+			{
+				if (!transforms.HasChanged(nodes[object]))
+				{
+					continue;
+				}
+				updated++;
+
+				const XMFLOAT4X4 &world = transforms.GetWorld(nodes[object]);
+				Entry entry = { XMFLOAT3(world.m[3][0], world.m[3][1], world.m[3][2]), object };
+
+				Cell &cell = m_cells[m_objectCells[object]];
+				if (cell.key == GetKey(entry.position))
+				{
+					cell.entries[m_objectSlots[object]].position = entry.position;
+				}
+				else
+				{
+					moves.push_back(entry);
+				}
+			}
+			m_blockCounts[block] = updated;
+		}
+	};
+
+	if (jobs)
+	{
+		jobs->ParallelFor(numBlocks, 1, updateBlocks);
+	}
+	else
+	{
+		updateBlocks(0, numBlocks);
+	}
+
+	uint32_t updated = 0;
+	uint32_t moved = 0;
+	for (uint32_t block = 0; block < numBlocks; ++block)
+	{
+		for (const Entry &entry : m_blockMoves[block])
+		{
+			Remove(entry.object);
+			Insert(entry.object, entry.position, GetKey(entry.position));
+		}
+		updated += m_blockCounts[block];
+		moved += static_cast<uint32_t>(m_blockMoves[block].size());
+	}
+	ReclaimEmptyCells();
+
+	m_stats.cells = static_cast<uint32_t>(m_cells.size());
+	m_stats.updated = updated;
+	m_stats.moved = moved;
+	m_stats.updateMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+}
+
+template <typename Function>
+void SpatialGrid::ForEachEntry(const XMFLOAT3 &min, const XMFLOAT3 &max, const Function &function) const
+{
+	int32_t minX = ToCell(min.x * m_invCellSize);
+	int32_t minY = ToCell(min.y * m_invCellSize);
+	int32_t minZ = ToCell(min.z * m_invCellSize);
+	int32_t maxX = ToCell(max.x * m_invCellSize);
+	int32_t maxY = ToCell(max.y * m_invCellSize);
+	int32_t maxZ = ToCell(max.z * m_invCellSize);
+
+	uint64_t numCovered = static_cast<uint64_t>(maxX - minX + 1) * static_cast<uint64_t>(maxY - minY + 1) *
+		static_cast<uint64_t>(maxZ - minZ + 1);
+
+	// A big region is cheaper to test against every cell than to look up
+	if (numCovered > m_cells.size())
+	{
+		for (const Cell &cell : m_cells)
+		{
+			if (cell.x >= minX && cell.x <= maxX && cell.y >= minY && cell.y <= maxY &&
+				cell.z >= minZ && cell.z <= maxZ)
+			{
+				for (const Entry &entry : cell.entries)
+				{
+					function(entry);
+				}
+			}
+		}
+		return;
+	}
+
+	for (int32_t z = minZ; z <= maxZ; ++z)
+	{
+		for (int32_t y = minY; y <= maxY; ++y)
+		{
+			for (int32_t x = minX; x <= maxX; ++x)
+			{
+				uint32_t cell = FindCell(PackKey(x, y, z));
+				if (cell == gNoCell)
+				{
+					continue;
+				}
+
+				for (const Entry &entry : m_cells[cell].entries)
+				{
+					function(entry);
+				}
+			}
+		}
+	}
+}
+
+void SpatialGrid::QuerySphere(const XMFLOAT3 &center, float radius, std::vector<uint32_t> &objects) const
+{
+	XMFLOAT3 min(center.x - radius, center.y - radius, center.z - radius);
+	XMFLOAT3 max(center.x + radius, center.y + radius, center.z + radius);
+	float radiusSquared = radius * radius;
+
+	ForEachEntry(min, max, [&](const Entry &entry)
+	{
+		float x = entry.position.x - center.x;
+		float y = entry.position.y - center.y;
+		float z = entry.position.z - center.z;
+		if (x * x + y * y + z * z <= radiusSquared)
+		{
+			objects.push_back(entry.object);
+		}
+	});
+}
+
+void SpatialGrid::QueryBox(const XMFLOAT3 &min, const XMFLOAT3 &max, std::vector<uint32_t> &objects) const
+{
+	ForEachEntry(min, max, [&](const Entry &entry)
+	{
+		const XMFLOAT3 &position = entry.position;
+		if (position.x >= min.x && position.x <= max.x && position.y >= min.y && position.y <= max.y &&
+			position.z >= min.z && position.z <= max.z)
+		{
+			objects.push_back(entry.object);
+		}
+	});
+}
+
+template <typename Query>
+void SpatialGrid::QueryBatch(uint32_t count, JobSystem *jobs, const Query &query)
+{
+	static std::chrono::high_resolution_clock clock;
+	auto t0 = clock.now();
+
+	uint32_t numBlocks = (count + gQueryBlockSize - 1) / gQueryBlockSize;
+	m_blockResults.resize(numBlocks);
+	m_resultOffsets.resize(count + 1);
+
+	// Every query's count goes where its offset will be
+	auto queryBlocks = [&](uint32_t firstBlock, uint32_t lastBlock)
+	{
+		for (uint32_t block = firstBlock; block < lastBlock; ++block)
+		{
+			uint32_t begin = block * gQueryBlockSize;
+			uint32_t end = std::min(count, begin + gQueryBlockSize);
+
+			std::vector<uint32_t> &results = m_blockResults[block];
+			results.clear();
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				size_t before = results.size();
+				query(i, results);
+				m_resultOffsets[i + 1] = static_cast<uint32_t>(results.size() - before);
+			}
+		}
+	};
+
+	if (jobs)
+	{
+		jobs->ParallelFor(numBlocks, 1, queryBlocks);
+	}
+	else
+	{
+		queryBlocks(0, numBlocks);
+	}
+
+	m_resultOffsets[0] = 0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		m_resultOffsets[i + 1] += m_resultOffsets[i];
+	}
+
+	m_results.resize(m_resultOffsets[count]);
+	for (uint32_t block = 0; block < numBlocks; ++block)
+	{
+		const std::vector<uint32_t> &results = m_blockResults[block];
+		std::copy(results.begin(), results.end(), m_results.begin() + m_resultOffsets[block * gQueryBlockSize]);
+	}
+
+	m_stats.results = m_resultOffsets[count];
+	m_stats.queryMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+}
+
+void SpatialGrid::QuerySpheres(const XMFLOAT3 *centers, const float *radii, uint32_t count, JobSystem *jobs)
+{
+	QueryBatch(count, jobs, [&](uint32_t i, std::vector<uint32_t> &results)
+	{
+		QuerySphere(centers[i], radii[i], results);
+	});
+}
+
+void SpatialGrid::QueryBoxes(const XMFLOAT3 *mins, const XMFLOAT3 *maxs, uint32_t count, JobSystem *jobs)
+{
+	QueryBatch(count, jobs, [&](uint32_t i, std::vector<uint32_t> &results)
+	{
+		QueryBox(mins[i], maxs[i], results);
+	});
+}
+
+const XMFLOAT3 &SpatialGrid::GetPosition(uint32_t object) const
+{
+	return m_cells[m_objectCells[object]].entries[m_objectSlots[object]].position;
+}
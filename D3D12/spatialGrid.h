@@ -0,0 +1,157 @@
+#pragma once
+
+#include "includes.h"
+#include "transformHierarchy.h"
+
+#include <vector>
+
+class JobSystem;
+
+// Finds the objects near a point or in a box (for culling, picking and
+// streaming) without testing all of them.
+//
+// Space is cut in cubic cells and only the cells that hold objects exist:
+// they are found by hashing their integer coordinates into an open
+// addressing table. Every cell keeps its objects' positions next to their
+// indices, so a query reads the few cells it overlaps front to back and
+// never touches the other objects.
+//
+// Objects that move are updated in place: only those whose cell changed are
+// taken out of the old cell and put in the new one. Build() puts all of them
+// in at once instead, sorting them by cell with the radix sort so every cell
+// is filled in one go, on the job system's threads.
+//
+// Cells emptied by moves are kept for objects coming back, until they're
+// more than half of the cells: then they're dropped and the table shrinks.
+//
+// Objects are points: pad the query radius or box with the largest object
+// size to find objects by their bounds.
+
+class SpatialGrid
+{
+public:
+	struct Stats
+	{
+		uint32_t objects;
+		uint32_t cells;			// including the ones emptied by moves, up to half
+		uint32_t updated;		// by the last batch Move or Update
+		uint32_t moved;			// of those, the ones whose cell changed
+		uint32_t results;		// of the last batch query
+		double buildMs;
+		double updateMs;
+		double queryMs;
+	};
+
+	// Queries per job in the batch queries
+	static const uint32_t gQueryBlockSize = 64;
+
+	SpatialGrid(float cellSize);
+
+	void Clear();
+	void Reserve(uint32_t count);
+
+	// Replaces every object, object i at positions[i]
+	void Build(const DirectX::XMFLOAT3 *positions, uint32_t count, JobSystem *jobs = nullptr);
+
+	uint32_t Add(const DirectX::XMFLOAT3 &position);
+	void Move(uint32_t object, const DirectX::XMFLOAT3 &position);
+	void Move(const uint32_t *objects, const DirectX::XMFLOAT3 *positions, uint32_t count);
+
+	// Object i follows the translation of nodes[i]. Call after every
+	// transforms.Update(): only the nodes that changed in it are looked at.
+	void Update(const TransformHierarchy &transforms, const TransformHierarchy::Node *nodes,
+		JobSystem *jobs = nullptr);
+
+	// Append the objects found to objects
+	void QuerySphere(const DirectX::XMFLOAT3 &center, float radius, std::vector<uint32_t> &objects) const;
+	void QueryBox(const DirectX::XMFLOAT3 &min, const DirectX::XMFLOAT3 &max, std::vector<uint32_t> &objects) const;
+
+	// Many queries at once, split between the job system's threads. The
+	// objects found by query i are GetResults(i), until the next batch.
+	void QuerySpheres(const DirectX::XMFLOAT3 *centers, const float *radii, uint32_t count, JobSystem *jobs = nullptr);
+	void QueryBoxes(const DirectX::XMFLOAT3 *mins, const DirectX::XMFLOAT3 *maxs, uint32_t count,
+		JobSystem *jobs = nullptr);
+
+	const uint32_t *GetResults(uint32_t query) const { return m_results.data() + m_resultOffsets[query]; }
+	uint32_t GetNumResults(uint32_t query) const { return m_resultOffsets[query + 1] - m_resultOffsets[query]; }
+
+	const DirectX::XMFLOAT3 &GetPosition(uint32_t object) const;
+	uint32_t GetSize() const { return static_cast<uint32_t>(m_objectCells.size()); }
+	float GetCellSize() const { return m_cellSize; }
+
+	const Stats &GetStats() const { return m_stats; }
+
+private:
+	struct Entry
+	{
+		DirectX::XMFLOAT3 position;
+		uint32_t object;
+	};
+
+	struct Cell
+	{
+		uint64_t key;
+		int32_t x, y, z;
+		std::vector<Entry> entries;
+	};
+
+	struct Bucket
+	{
+		uint64_t key;
+		uint32_t cell;
+	};
+
+	static const uint32_t gNoCell = ~0u;
+	// Objects per job in Build and Update
+	static const uint32_t gUpdateBlockSize = 4096;
+
+	// Packed cell coordinates, 21 bits each
+	uint64_t GetKey(const DirectX::XMFLOAT3 &position) const;
+	uint32_t FindCell(uint64_t key) const;
+	uint32_t FindOrAddCell(uint64_t key);
+	// Puts every cell in a table of at least numBuckets
+	void Rehash(size_t numBuckets);
+
+	void Insert(uint32_t object, const DirectX::XMFLOAT3 &position, uint64_t key);
+	void Remove(uint32_t object);
+	// Returns true if the object changed cells
+	bool Relocate(uint32_t object, const DirectX::XMFLOAT3 &position);
+
+	// Drops the empty cells and shrinks the table
+	void CompactCells();
+	void ReclaimEmptyCells();
+
+	// Calls function(entry) for every entry of the cells overlapping min, max
+	template <typename Function>
+	void ForEachEntry(const DirectX::XMFLOAT3 &min, const DirectX::XMFLOAT3 &max, const Function &function) const;
+	// Runs query(i, results) for every query, in blocks, and gathers the results
+	template <typename Query>
+	void QueryBatch(uint32_t count, JobSystem *jobs, const Query &query);
+
+	float m_cellSize;
+	float m_invCellSize;
+
+	std::vector<Cell> m_cells;
+	std::vector<Bucket> m_buckets;		// power of two, at most half full
+	uint32_t m_numEmptyCells;
+
+	// By object
+	std::vector<uint32_t> m_objectCells;
+	std::vector<uint32_t> m_objectSlots;	// in its cell's entries
+
+	// Build and Update scratch
+	std::vector<uint64_t> m_keys;
+	std::vector<uint32_t> m_values;
+	std::vector<uint64_t> m_tempKeys;
+	std::vector<uint32_t> m_tempValues;
+	std::vector<uint32_t> m_runs;		// first sorted entry of every cell
+	std::vector<std::vector<Entry>> m_blockMoves;
+	std::vector<uint32_t> m_blockCounts;
+
+	// Batch query results
+	std::vector<uint32_t> m_resultOffsets;
+	std::vector<uint32_t> m_results;
+	std::vector<std::vector<uint32_t>> m_blockResults;
+
+	Stats m_stats;
+};
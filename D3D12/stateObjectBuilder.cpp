@@ -0,0 +1,235 @@
+#include "stateObjectBuilder.h"
+
+#include <cstring>
+#include <cwchar>
+
+StateObjectBuilder::StateObjectBuilder(void *memory, size_t size, D3D12_STATE_OBJECT_TYPE type) :
+	m_begin(static_cast<uint8_t*>(memory)),
+	m_end(static_cast<uint8_t*>(memory) + size),
+	m_back(nullptr),
+	m_subobjects(nullptr),
+	m_numSubobjects(0),
+	m_overflowed(false),
+	m_desc()
+{
+	// The subobject array starts the block
+	assert(reinterpret_cast<uintptr_t>(memory) % alignof(D3D12_STATE_SUBOBJECT) == 0);
+
+	Reset(type);
+}
+
+void StateObjectBuilder::Reset(D3D12_STATE_OBJECT_TYPE type)
+{
+	m_back = m_end;
+	m_subobjects = reinterpret_cast<D3D12_STATE_SUBOBJECT*>(m_begin);
+	m_numSubobjects = 0;
+	m_overflowed = false;
+
+	m_desc.Type = type;
+	m_desc.NumSubobjects = 0;
+	m_desc.pSubobjects = nullptr;
+}
+
+void *StateObjectBuilder::Allocate(size_t size, size_t alignment)
+{
+	uint8_t *front = reinterpret_cast<uint8_t*>(m_subobjects + m_numSubobjects);
+	if (m_overflowed || static_cast<size_t>(m_back - front) < size + alignment)
+	{
+		m_overflowed = true;
+		return nullptr;
+	}
+
+	uintptr_t address = (reinterpret_cast<uintptr_t>(m_back) - size) & ~static_cast<uintptr_t>(alignment - 1);
+	m_back = reinterpret_cast<uint8_t*>(address);
+	return m_back;
+}
+
+const wchar_t *StateObjectBuilder::CopyString(const wchar_t *string)
+{
+	if (!string)
+	{
+		return nullptr;
+	}
+
+	size_t size = (std::wcslen(string) + 1) * sizeof(wchar_t);
+	void *copy = Allocate(size, alignof(wchar_t));
+	if (!copy)
+	{
+		return nullptr;
+	}
+
+	std::memcpy(copy, string, size);
+	return static_cast<const wchar_t*>(copy);
+}
+
+LPCWSTR *StateObjectBuilder::CopyStrings(const wchar_t *const *strings, uint32_t count)
+{
+	LPCWSTR *copies = static_cast<LPCWSTR*>(Allocate(sizeof(LPCWSTR) * count, alignof(LPCWSTR)));
+	if (!copies)
+	{
+		return nullptr;
+	}
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		copies[i] = CopyString(strings[i]);
+	}
+	return copies;
+}
+
+StateObjectBuilder::Subobject StateObjectBuilder::AddSubobject(D3D12_STATE_SUBOBJECT_TYPE type, const void *desc)
+{
+	uint8_t *front = reinterpret_cast<uint8_t*>(m_subobjects + m_numSubobjects + 1);
+	if (m_overflowed || !desc || front > m_back)
+	{
+		m_overflowed = true;
+		return gInvalid;
+	}
+
+	D3D12_STATE_SUBOBJECT &subobject = m_subobjects[m_numSubobjects];
+	subobject.Type = type;
+	subobject.pDesc = desc;
+	return m_numSubobjects++;
+}
+
+StateObjectBuilder::Subobject StateObjectBuilder::AddDxilLibrary(const D3D12_SHADER_BYTECODE &library,
+	const wchar_t *const *exports, uint32_t numExports)
+{
+	D3D12_DXIL_LIBRARY_DESC *desc = AllocateDesc<D3D12_DXIL_LIBRARY_DESC>();
+	D3D12_EXPORT_DESC *exportDescs = nullptr;
+	if (numExports > 0)
+	{
+		exportDescs = static_cast<D3D12_EXPORT_DESC*>(Allocate(sizeof(D3D12_EXPORT_DESC) * numExports,
+			alignof(D3D12_EXPORT_DESC)));
+	}
+	if (!desc || (numExports > 0 && !exportDescs))
+	{
+		return gInvalid;
+	}
+
+	for (uint32_t i = 0; i < numExports; ++i)
+	{
+		exportDescs[i].Name = CopyString(exports[i]);
+		exportDescs[i].ExportToRename = nullptr;
+		exportDescs[i].Flags = D3D12_EXPORT_FLAG_NONE;
+	}
+
+	desc->DXILLibrary = library;
+	desc->NumExports = numExports;
+	desc->pExports = exportDescs;
+	return AddSubobject(D3D12_STATE_SUBOBJECT_TYPE_DXIL_LIBRARY, desc);
+}
+
+StateObjectBuilder::Subobject StateObjectBuilder::AddHitGroup(const wchar_t *name, const wchar_t *closestHit,
+	const wchar_t *anyHit, const wchar_t *intersection)
+{
+	D3D12_HIT_GROUP_DESC *desc = AllocateDesc<D3D12_HIT_GROUP_DESC>();
+	if (!desc)
+	{
+		return gInvalid;
+	}
+
+	desc->HitGroupExport = CopyString(name);
+	desc->ClosestHitShaderImport = CopyString(closestHit);
+	desc->AnyHitShaderImport = CopyString(anyHit);
+	desc->IntersectionShaderImport = CopyString(intersection);
+	if (intersection)
+	{
+		desc->Type = D3D12_HIT_GROUP_TYPE_PROCEDURAL_PRIMITIVE;
+	}
+	else
+	{
+		desc->Type = D3D12_HIT_GROUP_TYPE_TRIANGLES;
+	}
+	return AddSubobject(D3D12_STATE_SUBOBJECT_TYPE_HIT_GROUP, desc);
+}
+
+StateObjectBuilder::Subobject StateObjectBuilder::AddShaderConfig(UINT maxPayloadBytes, UINT maxAttributeBytes)
+{
+	D3D12_RAYTRACING_SHADER_CONFIG *desc = AllocateDesc<D3D12_RAYTRACING_SHADER_CONFIG>();
+	if (!desc)
+	{
+		return gInvalid;
+	}
+
+	desc->MaxPayloadSizeInBytes = maxPayloadBytes;
+	desc->MaxAttributeSizeInBytes = maxAttributeBytes;
+	return AddSubobject(D3D12_STATE_SUBOBJECT_TYPE_RAYTRACING_SHADER_CONFIG, desc);
+}
+
+StateObjectBuilder::Subobject StateObjectBuilder::AddPipelineConfig(UINT maxTraceRecursionDepth)
+{
+	D3D12_RAYTRACING_PIPELINE_CONFIG *desc = AllocateDesc<D3D12_RAYTRACING_PIPELINE_CONFIG>();
+	if (!desc)
+	{
+		return gInvalid;
+	}
+
+	desc->MaxTraceRecursionDepth = maxTraceRecursionDepth;
+	return AddSubobject(D3D12_STATE_SUBOBJECT_TYPE_RAYTRACING_PIPELINE_CONFIG, desc);
+}
+
+StateObjectBuilder::Subobject StateObjectBuilder::AddGlobalRootSignature(ID3D12RootSignature *rootSignature)
+{
+	D3D12_GLOBAL_ROOT_SIGNATURE *desc = AllocateDesc<D3D12_GLOBAL_ROOT_SIGNATURE>();
+	if (!desc)
+	{
+		return gInvalid;
+	}
+
+	desc->pGlobalRootSignature = rootSignature;
+	return AddSubobject(D3D12_STATE_SUBOBJECT_TYPE_GLOBAL_ROOT_SIGNATURE, desc);
+}
+
+StateObjectBuilder::Subobject StateObjectBuilder::AddLocalRootSignature(ID3D12RootSignature *rootSignature)
+{
+	D3D12_LOCAL_ROOT_SIGNATURE *desc = AllocateDesc<D3D12_LOCAL_ROOT_SIGNATURE>();
+	if (!desc)
+	{
+		return gInvalid;
+	}
+
+	desc->pLocalRootSignature = rootSignature;
+	return AddSubobject(D3D12_STATE_SUBOBJECT_TYPE_LOCAL_ROOT_SIGNATURE, desc);
+}
+
+StateObjectBuilder::Subobject StateObjectBuilder::AddAssociation(Subobject subobject, const wchar_t *const *exports,
+	uint32_t numExports)
+{
+	if (subobject >= m_numSubobjects)
+	{
+		// gInvalid when the subobject didn't fit already
+		assert(subobject == gInvalid && "associating a subobject that wasn't added");
+		m_overflowed = true;
+		return gInvalid;
+	}
+
+	D3D12_SUBOBJECT_TO_EXPORTS_ASSOCIATION *desc = AllocateDesc<D3D12_SUBOBJECT_TO_EXPORTS_ASSOCIATION>();
+	LPCWSTR *names = CopyStrings(exports, numExports);
+	if (!desc || !names)
+	{
+		return gInvalid;
+	}
+
+	desc->pSubobjectToAssociate = &m_subobjects[subobject];
+	desc->NumExports = numExports;
+	desc->pExports = names;
+	return AddSubobject(D3D12_STATE_SUBOBJECT_TYPE_SUBOBJECT_TO_EXPORTS_ASSOCIATION, desc);
+}
+
+const D3D12_STATE_OBJECT_DESC *StateObjectBuilder::GetDesc()
+{
+	if (m_overflowed)
+	{
+		return nullptr;
+	}
+
+	m_desc.NumSubobjects = m_numSubobjects;
+	m_desc.pSubobjects = m_subobjects;
+	return &m_desc;
+}
+
+size_t StateObjectBuilder::GetUsedSize() const
+{
+	return sizeof(D3D12_STATE_SUBOBJECT) * m_numSubobjects + static_cast<size_t>(m_end - m_back);
+}
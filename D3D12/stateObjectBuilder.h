@@ -0,0 +1,78 @@
+#pragma once
+
+#include "includes.h"
+
+// Describes a raytracing pipeline (or collection) without allocating.
+//
+// CD3DX12_STATE_OBJECT_DESC keeps its subobjects in lists, copies every
+// name into a std::wstring and flattens it all into vectors at the end,
+// which adds up when hundreds of hit group variants are described. This
+// builder puts everything in one block of memory given by the caller (a
+// stack array works): the D3D12_STATE_SUBOBJECT array grows from the front
+// and the descs, export lists and copied names grow from the back. The
+// subobject array never moves, so associations point straight into it and
+// GetDesc() has nothing left to do.
+//
+// Export lists are given whole when their subobject is added since they
+// have to be contiguous. When the block is full, every Add returns
+// gInvalid and GetDesc() returns nullptr; GetUsedSize() after a successful
+// build tells how big the block has to be.
+
+class StateObjectBuilder
+{
+public:
+	typedef uint32_t Subobject;
+	static const Subobject gInvalid = ~0u;
+
+	StateObjectBuilder(void *memory, size_t size,
+		D3D12_STATE_OBJECT_TYPE type = D3D12_STATE_OBJECT_TYPE_RAYTRACING_PIPELINE);
+
+	// Starts over in the same memory
+	void Reset(D3D12_STATE_OBJECT_TYPE type);
+
+	// Without exports, everything the library exports is used
+	Subobject AddDxilLibrary(const D3D12_SHADER_BYTECODE &library, const wchar_t *const *exports = nullptr,
+		uint32_t numExports = 0);
+	// Procedural primitives when there is an intersection shader, triangles otherwise
+	Subobject AddHitGroup(const wchar_t *name, const wchar_t *closestHit, const wchar_t *anyHit = nullptr,
+		const wchar_t *intersection = nullptr);
+	Subobject AddShaderConfig(UINT maxPayloadBytes, UINT maxAttributeBytes);
+	Subobject AddPipelineConfig(UINT maxTraceRecursionDepth);
+	Subobject AddGlobalRootSignature(ID3D12RootSignature *rootSignature);
+	Subobject AddLocalRootSignature(ID3D12RootSignature *rootSignature);
+	// Uses subobject (a local root signature, a shader config, ...) for the exports
+	Subobject AddAssociation(Subobject subobject, const wchar_t *const *exports, uint32_t numExports);
+
+	// Valid until the next Reset, nullptr if the memory ran out
+	const D3D12_STATE_OBJECT_DESC *GetDesc();
+
+	uint32_t GetNumSubobjects() const { return m_numSubobjects; }
+	size_t GetUsedSize() const;
+	bool HasOverflowed() const { return m_overflowed; }
+
+private:
+	// From the back
+	void *Allocate(size_t size, size_t alignment);
+	const wchar_t *CopyString(const wchar_t *string);
+	// The strings are copied, the array of pointers too
+	LPCWSTR *CopyStrings(const wchar_t *const *strings, uint32_t count);
+
+	template <typename Desc>
+	Desc *AllocateDesc()
+	{
+		return static_cast<Desc*>(Allocate(sizeof(Desc), alignof(Desc)));
+	}
+
+	// At the front, desc has to come from the back already
+	Subobject AddSubobject(D3D12_STATE_SUBOBJECT_TYPE type, const void *desc);
+
+	uint8_t *m_begin;
+	uint8_t *m_end;
+	uint8_t *m_back;		// lowest byte used from the back
+
+	D3D12_STATE_SUBOBJECT *m_subobjects;
+	uint32_t m_numSubobjects;
+	bool m_overflowed;
+
+	D3D12_STATE_OBJECT_DESC m_desc;
+};
@@ -0,0 +1,157 @@
+#include "culling.h"
+#include "jobSystem.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// The 4 wide and the AVX2 paths of FrustumCuller against a scalar loop, for
+// spheres and boxes, with and without the job system. Prints the timings too,
+// returns the number of mismatches.
+
+namespace
+{
+	struct Scene
+	{
+		std::vector<DirectX::XMFLOAT3> centers;
+		std::vector<DirectX::XMFLOAT3> extents;
+	};
+
+	// A box frustum looking down +z with a slanted left plane, so every axis
+	// matters. The planes point inside and are normalized.
+	Frustum MakeFrustum()
+	{
+		const float slant = 1.0f / std::sqrt(2.0f);
+
+		Frustum frustum;
+		frustum.planes[0] = DirectX::XMFLOAT4(slant, 0.0f, slant, 200.0f);
+		frustum.planes[1] = DirectX::XMFLOAT4(-1.0f, 0.0f, 0.0f, 400.0f);
+		frustum.planes[2] = DirectX::XMFLOAT4(0.0f, 1.0f, 0.0f, 300.0f);
+		frustum.planes[3] = DirectX::XMFLOAT4(0.0f, -1.0f, 0.0f, 300.0f);
+		frustum.planes[4] = DirectX::XMFLOAT4(0.0f, 0.0f, 1.0f, -0.1f);
+		frustum.planes[5] = DirectX::XMFLOAT4(0.0f, 0.0f, -1.0f, 800.0f);
+		return frustum;
+	}
+
+	std::vector<uint32_t> CullScalar(const Scene &scene, const Frustum &frustum, FrustumCuller::Shape shape)
+	{
+		std::vector<uint32_t> visible;
+		for (uint32_t i = 0; i < scene.centers.size(); ++i)
+		{
+			const DirectX::XMFLOAT3 &center = scene.centers[i];
+			const DirectX::XMFLOAT3 &extents = scene.extents[i];
+			float radius = std::sqrt(extents.x * extents.x + extents.y * extents.y + extents.z * extents.z);
+
+			bool inside = true;
+			for (const DirectX::XMFLOAT4 &plane : frustum.planes)
+			{
+				float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+				float reach = shape == FrustumCuller::SHAPE_BOX ?
+					std::abs(plane.x) * extents.x + std::abs(plane.y) * extents.y + std::abs(plane.z) * extents.z :
+					radius;
+				if (distance < -reach)
+				{
+					inside = false;
+					break;
+				}
+			}
+
+			if (inside)
+			{
+				visible.push_back(i);
+			}
+		}
+		return visible;
+	}
+
+	template <typename Function>
+	double MeasureMs(const Function &function)
+	{
+		static std::chrono::high_resolution_clock clock;
+
+		double best = 1e9;
+		for (uint32_t i = 0; i < 5; ++i)
+		{
+			auto t0 = clock.now();
+			function();
+			best = std::min(best, std::chrono::duration<double, std::milli>(clock.now() - t0).count());
+		}
+		return best;
+	}
+
+	uint32_t Check(const char *name, const FrustumCuller &culler, const std::vector<uint32_t> &expected)
+	{
+		bool same = culler.GetNumVisible() == expected.size() &&
+			std::equal(expected.begin(), expected.end(), culler.GetVisible());
+		if (!same)
+		{
+			std::printf("FAILED: %s, %u visible, expected %zu\n", name, culler.GetNumVisible(), expected.size());
+			return 1;
+		}
+		return 0;
+	}
+}
+
+int main()
+{
+	uint32_t failures = 0;
+
+	JobSystem jobs(3);
+	Frustum frustum = MakeFrustum();
+
+	// A few counts that don't fill the last group of lanes or the last block
+	for (uint32_t count : { 0u, 1u, 7u, 13u, 4097u, 1000003u })
+	{
+		std::mt19937 random(count);
+		std::uniform_real_distribution<float> position(-1000.0f, 1000.0f);
+		std::uniform_real_distribution<float> size(0.5f, 10.0f);
+
+		Scene scene;
+		FrustumCuller culler;
+		culler.Reserve(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			scene.centers.push_back(DirectX::XMFLOAT3(position(random), position(random), position(random)));
+			scene.extents.push_back(DirectX::XMFLOAT3(size(random), size(random), size(random)));
+			culler.Add(scene.centers[i], scene.extents[i]);
+		}
+
+		for (FrustumCuller::Shape shape : { FrustumCuller::SHAPE_SPHERE, FrustumCuller::SHAPE_BOX })
+		{
+			const char *shapeName = shape == FrustumCuller::SHAPE_BOX ? "boxes" : "spheres";
+
+			std::vector<uint32_t> expected;
+			double scalarMs = MeasureMs([&]() { expected = CullScalar(scene, frustum, shape); });
+			std::printf("%u %s, %zu visible: scalar %.3f ms", count, shapeName, expected.size(), scalarMs);
+
+			for (bool avx2 : { false, true })
+			{
+				if (avx2 && !FrustumCuller::CanUseAvx2())
+				{
+					continue;
+				}
+				culler.SetAvx2(avx2);
+
+				double ms = MeasureMs([&]() { culler.Cull(frustum, shape); });
+				failures += Check(shapeName, culler, expected);
+
+				double jobsMs = MeasureMs([&]() { culler.Cull(frustum, shape, &jobs); });
+				failures += Check(shapeName, culler, expected);
+
+				std::printf(", %u lanes %.3f ms, on %u threads %.3f ms", culler.GetSimdWidth(), ms,
+					jobs.GetNumThreads(), jobsMs);
+			}
+			std::printf("\n");
+		}
+	}
+
+	if (!FrustumCuller::CanUseAvx2())
+	{
+		std::printf("AVX2 not built or not on this CPU, only the 4 wide path was tested\n");
+	}
+
+	std::printf("%u failures\n", failures);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+#include "fileWatcher.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+// InotifyWatcher reports saved files, in subdirectories too, including ones
+// created after Watch(). Returns the number of failures.
+
+namespace
+{
+	void WriteFile(const std::string &path, const char *text)
+	{
+		std::ofstream file(path, std::ios::trunc);
+		file << text;
+	}
+
+	// inotify events are queued by the time the write returns, one poll is enough
+	std::vector<std::string> Poll(FileWatcher &watcher)
+	{
+		std::vector<std::string> changed;
+		watcher.Poll(changed);
+		return changed;
+	}
+
+	uint32_t Expect(const char *name, const std::vector<std::string> &changed, const std::string &path)
+	{
+		if (std::find(changed.begin(), changed.end(), path) == changed.end())
+		{
+			std::printf("FAILED: %s, %s wasn't reported\n", name, path.c_str());
+			return 1;
+		}
+		return 0;
+	}
+}
+
+int main()
+{
+	uint32_t failures = 0;
+
+	char directoryName[] = "/tmp/fileWatcherTestsXXXXXX";
+	if (!::mkdtemp(directoryName))
+	{
+		std::printf("FAILED: can't create a directory\n");
+		return 1;
+	}
+	std::string directory = std::string(directoryName) + '/';
+	::mkdir((directory + "include").c_str(), 0755);
+
+	InotifyWatcher watcher;
+	if (!watcher.Watch(directoryName))
+	{
+		std::printf("FAILED: can't watch %s\n", directoryName);
+		return 1;
+	}
+
+	if (!Poll(watcher).empty())
+	{
+		std::printf("FAILED: changes reported before anything changed\n");
+		failures++;
+	}
+
+	WriteFile(directory + "scene.hlsl", "float4 main() : SV_Target { return 0; }");
+	failures += Expect("new file", Poll(watcher), directory + "scene.hlsl");
+
+	WriteFile(directory + "include/common.hlsli", "#define ONE 1");
+	failures += Expect("file in a subdirectory", Poll(watcher), directory + "include/common.hlsli");
+
+	// Written to a copy and renamed over, like most editors do
+	WriteFile(directory + "scene.hlsl.tmp", "float4 main() : SV_Target { return 1; }");
+	Poll(watcher);
+	::rename((directory + "scene.hlsl.tmp").c_str(), (directory + "scene.hlsl").c_str());
+	failures += Expect("renamed over", Poll(watcher), directory + "scene.hlsl");
+
+	::mkdir((directory + "later").c_str(), 0755);
+	failures += Expect("new directory", Poll(watcher), directory + "later/");
+	WriteFile(directory + "later/late.hlsli", "#define TWO 2");
+	failures += Expect("file in a new directory", Poll(watcher), directory + "later/late.hlsli");
+
+	if (!Poll(watcher).empty())
+	{
+		std::printf("FAILED: changes reported twice\n");
+		failures++;
+	}
+
+	::unlink((directory + "later/late.hlsli").c_str());
+	::rmdir((directory + "later").c_str());
+	::unlink((directory + "include/common.hlsli").c_str());
+	::rmdir((directory + "include").c_str());
+	::unlink((directory + "scene.hlsl").c_str());
+	::rmdir(directoryName);
+
+	std::printf("%u failures\n", failures);
+	return failures == 0 ? 0 : 1;
+}
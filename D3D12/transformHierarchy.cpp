@@ -0,0 +1,279 @@
+#include "transformHierarchy.h"
+#include "jobSystem.h"
+
+#include <cassert>
+#include <chrono>
+
+using namespace DirectX;
+
+namespace
+{
+	// Moves every element i to order[i]
+	template <typename T>
+	void Permute(std::vector<T> &values, const std::vector<uint32_t> &order, std::vector<T> &temp)
+	{
+		temp.resize(values.size());
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			temp[order[i]] = values[i];
+		}
+		values.swap(temp);
+	}
+
+	template <typename T>
+	void Permute(std::vector<T> &values, const std::vector<uint32_t> &order)
+	{
+		std::vector<T> temp;
+		Permute(values, order, temp);
+	}
+}
+
+TransformHierarchy::TransformHierarchy() :
+	m_sorted(true),
+	m_stats()
+{
+}
+
+void TransformHierarchy::Reserve(uint32_t count)
+{
+	m_positions.reserve(count);
+	m_rotations.reserve(count);
+	m_scales.reserve(count);
+	m_parents.reserve(count);
+	m_depths.reserve(count);
+	m_worlds.reserve(count);
+	m_previousWorlds.reserve(count);
+	m_dirty.reserve(count);
+	m_changed.reserve(count);
+	m_nodes.reserve(count);
+	m_indices.reserve(count);
+}
+
+TransformHierarchy::Node TransformHierarchy::Add(Node parent, const XMFLOAT3 &position, const XMFLOAT4 &rotation,
+	const XMFLOAT3 &scale)
+{
+	assert(parent == gNoParent || parent < m_indices.size());
+
+	uint32_t parentIndex = gNoParent;
+	uint32_t depth = 0;
+	if (parent != gNoParent)
+	{
+		parentIndex = m_indices[parent];
+		depth = m_depths[parentIndex] + 1;
+	}
+
+	// At the end for now, sorted into its depth by the next Update
+	Node node = static_cast<Node>(m_indices.size());
+	uint32_t index = static_cast<uint32_t>(m_parents.size());
+
+	XMFLOAT4X4 identity;
+	XMStoreFloat4x4(&identity, XMMatrixIdentity());
+
+	m_positions.push_back(position);
+	m_rotations.push_back(rotation);
+	m_scales.push_back(scale);
+	m_parents.push_back(parentIndex);
+	m_depths.push_back(depth);
+	m_worlds.push_back(identity);
+	m_previousWorlds.push_back(identity);
+	m_dirty.push_back(DIRTY_LOCAL | DIRTY_ADDED);
+	m_changed.push_back(0);
+	m_nodes.push_back(node);
+	m_indices.push_back(index);
+
+	if (index > 0 && depth < m_depths[index - 1])
+	{
+		m_sorted = false;
+	}
+
+	return node;
+}
+
+void TransformHierarchy::SetLocal(Node node, const XMFLOAT3 &position, const XMFLOAT4 &rotation, const XMFLOAT3 &scale)
+{
+	uint32_t index = m_indices[node];
+	m_positions[index] = position;
+	m_rotations[index] = rotation;
+	m_scales[index] = scale;
+	m_dirty[index] |= DIRTY_LOCAL;
+}
+
+void TransformHierarchy::SetPosition(Node node, const XMFLOAT3 &position)
+{
+	uint32_t index = m_indices[node];
+	m_positions[index] = position;
+	m_dirty[index] |= DIRTY_LOCAL;
+}
+
+void TransformHierarchy::SetRotation(Node node, const XMFLOAT4 &rotation)
+{
+	uint32_t index = m_indices[node];
+	m_rotations[index] = rotation;
+	m_dirty[index] |= DIRTY_LOCAL;
+}
+
+XMMATRIX TransformHierarchy::GetInterpolatedWorld(Node node, float alpha) const
+{
+	uint32_t index = m_indices[node];
+	XMMATRIX previous = XMLoadFloat4x4(&m_previousWorlds[index]);
+	XMMATRIX current = XMLoadFloat4x4(&m_worlds[index]);
+
+	XMMATRIX world;
+	for (uint32_t row = 0; row < 4; ++row)
+	{
+		world.r[row] = XMVectorLerp(previous.r[row], current.r[row], alpha);
+	}
+	return world;
+}
+
+void TransformHierarchy::Update(JobSystem *jobs)
+{
+	static std::chrono::high_resolution_clock clock;
+	auto t0 = clock.now();
+
+	m_stats.sortMs = 0.0;
+	if (!m_sorted)
+	{
+		Sort();
+		m_stats.sortMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+	}
+	else if (m_depthBegin.empty() || m_depthBegin.back() != m_parents.size())
+	{
+		// Added in order, only the depths grew
+		m_depthBegin.clear();
+		for (uint32_t i = 0; i < m_depths.size(); ++i)
+		{
+			while (m_depthBegin.size() <= m_depths[i])
+			{
+				m_depthBegin.push_back(i);
+			}
+		}
+		m_depthBegin.push_back(static_cast<uint32_t>(m_depths.size()));
+	}
+
+	for (size_t depth = 0; depth + 1 < m_depthBegin.size(); ++depth)
+	{
+		uint32_t begin = m_depthBegin[depth];
+		uint32_t end = m_depthBegin[depth + 1];
+
+		if (jobs)
+		{
+			jobs->ParallelFor(end - begin, gBatchSize, [this, begin](uint32_t first, uint32_t last)
+			{
+				UpdateRange(begin + first, begin + last);
+			});
+		}
+		else
+		{
+			UpdateRange(begin, end);
+		}
+	}
+
+	uint32_t updated = 0;
+	for (uint8_t changed : m_changed)
+	{
+		updated += changed;
+	}
+
+	m_stats.nodes = GetSize();
+	m_stats.depths = m_depthBegin.empty() ? 0 : static_cast<uint32_t>(m_depthBegin.size() - 1);
+	m_stats.updated = updated;
+	m_stats.updateMs = std::chrono::duration<double, std::milli>(clock.now() - t0).count();
+}
+
+void TransformHierarchy::UpdateRange(uint32_t begin, uint32_t end)
+{
+	for (uint32_t i = begin; i < end; ++i)
+	{
+		uint32_t parent = m_parents[i];
+
+		// The parent's depth is done, its flag is final
+		bool changed = m_dirty[i] || (parent != gNoParent && m_changed[parent]);
+		bool changedBefore = m_changed[i] != 0;
+		uint8_t dirty = m_dirty[i];
+		m_changed[i] = changed ? 1 : 0;
+		m_dirty[i] = 0;
+
+		// The previous step is the current one from now on. Nodes that stood
+		// still for two updates already have both the same.
+		if (changed || changedBefore)
+		{
+			m_previousWorlds[i] = m_worlds[i];
+		}
+
+		if (!changed)
+		{
+			continue;
+		}
+
+		XMMATRIX world = XMMatrixAffineTransformation(XMLoadFloat3(&m_scales[i]), XMVectorZero(),
+			XMLoadFloat4(&m_rotations[i]), XMLoadFloat3(&m_positions[i]));
+		if (parent != gNoParent)
+		{
+			world = XMMatrixMultiply(world, XMLoadFloat4x4(&m_worlds[parent]));
+		}
+		XMStoreFloat4x4(&m_worlds[i], world);
+
+		if (dirty & DIRTY_ADDED)
+		{
+			m_previousWorlds[i] = m_worlds[i];
+		}
+	}
+}
+
+void TransformHierarchy::Sort()
+{
+	uint32_t count = GetSize();
+
+	// Stable, so the order within a depth is the order nodes were added in
+	m_depthBegin.clear();
+	for (uint32_t depth : m_depths)
+	{
+		if (m_depthBegin.size() <= depth + 1)
+		{
+			m_depthBegin.resize(depth + 2, 0);
+		}
+		m_depthBegin[depth + 1]++;
+	}
+	for (size_t depth = 1; depth < m_depthBegin.size(); ++depth)
+	{
+		m_depthBegin[depth] += m_depthBegin[depth - 1];
+	}
+
+	std::vector<uint32_t> order(count);
+	std::vector<uint32_t> next(m_depthBegin.begin(), m_depthBegin.end() - 1);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		order[i] = next[m_depths[i]]++;
+	}
+
+	for (uint32_t &parent : m_parents)
+	{
+		if (parent != gNoParent)
+		{
+			parent = order[parent];
+		}
+	}
+
+	Permute(m_positions, order);
+	Permute(m_rotations, order);
+	Permute(m_scales, order);
+	Permute(m_worlds, order);
+	Permute(m_previousWorlds, order);
+	Permute(m_nodes, order);
+
+	std::vector<uint32_t> temp;
+	Permute(m_parents, order, temp);
+	Permute(m_depths, order, temp);
+
+	std::vector<uint8_t> flags;
+	Permute(m_dirty, order, flags);
+	Permute(m_changed, order, flags);
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		m_indices[m_nodes[i]] = i;
+	}
+
+	m_sorted = true;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+// The scene's transforms: every node has a local position, rotation and
+// scale relative to its parent, and a world matrix computed from them.
+//
+// Nodes are kept as structure of arrays, sorted by depth so every parent
+// comes before its children and the nodes of one depth are next to each
+// other. Update() then walks the depths in order with no pointers to chase:
+// a node's world matrix is recomputed if its local transform changed or its
+// parent's world matrix did, so only the changed subtrees cost anything.
+// Each depth is split between the job system's threads, since the nodes in
+// it only read the depth before.
+//
+// Nodes are referred to by the handle Add() returns, which stays the same
+// when nodes are sorted again after new ones were added.
+//
+// The world matrices of the step before are kept too, so a frame rendered
+// between two fixed simulation steps can blend them (see FixedTimestep).
+// The matrices are blended directly rather than the positions and rotations
+// they came from, which is close enough for the small rotation of one step.
+
+class TransformHierarchy
+{
+public:
+	typedef uint32_t Node;
+	static const Node gNoParent = ~0u;
+
+	struct Stats
+	{
+		uint32_t nodes;
+		uint32_t depths;
+		uint32_t updated;		// world matrices recomputed by the last Update
+		double sortMs;			// when nodes were added since the last Update
+		double updateMs;
+	};
+
+	// Nodes per job within a depth
+	static const uint32_t gBatchSize = 1024;
+
+	TransformHierarchy();
+
+	void Reserve(uint32_t count);
+
+	// The parent has to be added first
+	Node Add(Node parent, const DirectX::XMFLOAT3 &position, const DirectX::XMFLOAT4 &rotation,
+		const DirectX::XMFLOAT3 &scale);
+
+	void SetLocal(Node node, const DirectX::XMFLOAT3 &position, const DirectX::XMFLOAT4 &rotation,
+		const DirectX::XMFLOAT3 &scale);
+	void SetPosition(Node node, const DirectX::XMFLOAT3 &position);
+	void SetRotation(Node node, const DirectX::XMFLOAT4 &rotation);
+
+	const DirectX::XMFLOAT3 &GetPosition(Node node) const { return m_positions[m_indices[node]]; }
+
+	void Update(JobSystem *jobs = nullptr);
+
+	// As of the last Update
+	const DirectX::XMFLOAT4X4 &GetWorld(Node node) const { return m_worlds[m_indices[node]]; }
+	// The world matrix changed in the last Update
+	bool HasChanged(Node node) const { return m_changed[m_indices[node]] != 0; }
+	// Between the Update before the last one (0) and the last one (1)
+	DirectX::XMMATRIX GetInterpolatedWorld(Node node, float alpha) const;
+
+	uint32_t GetSize() const { return static_cast<uint32_t>(m_parents.size()); }
+
+	const Stats &GetStats() const { return m_stats; }
+
+private:
+	enum DirtyFlags : uint8_t
+	{
+		DIRTY_LOCAL = 1,
+		DIRTY_ADDED = 2,	// no previous world matrix to blend from
+	};
+
+	// Counting sort of the nodes by depth
+	void Sort();
+	void UpdateRange(uint32_t begin, uint32_t end);
+
+	// By position in the sorted order
+	std::vector<DirectX::XMFLOAT3> m_positions;
+	std::vector<DirectX::XMFLOAT4> m_rotations;
+	std::vector<DirectX::XMFLOAT3> m_scales;
+	std::vector<uint32_t> m_parents;
+	std::vector<uint32_t> m_depths;
+	std::vector<DirectX::XMFLOAT4X4> m_worlds;
+	std::vector<DirectX::XMFLOAT4X4> m_previousWorlds;
+	std::vector<uint8_t> m_dirty;		// DirtyFlags
+	std::vector<uint8_t> m_changed;		// the world matrix changed
+	std::vector<Node> m_nodes;
+
+	// By node
+	std::vector<uint32_t> m_indices;
+
+	// Where each depth starts, and one past the last
+	std::vector<uint32_t> m_depthBegin;
+	bool m_sorted;
+
+	Stats m_stats;
+};
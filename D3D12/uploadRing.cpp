@@ -0,0 +1,124 @@
+#include "uploadRing.h"
+
+UploadRing::UploadRing(ComPtr<ID3D12Device2> device, uint64_t size) :
+	m_cpu(nullptr),
+	m_gpu(0),
+	m_size(size),
+	m_head(0),
+	m_tail(0),
+	m_frameBytes(0),
+	m_stats()
+{
+	CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_UPLOAD);
+	CD3DX12_RESOURCE_DESC bufferDesc = CD3DX12_RESOURCE_DESC::Buffer(size);
+	ThrowIfFailed(device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &bufferDesc,
+		D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&m_resource)));
+
+	// Upload heaps can stay mapped, the CPU never reads them back
+	D3D12_RANGE readRange = { 0, 0 };
+	void *cpu;
+	ThrowIfFailed(m_resource->Map(0, &readRange, &cpu));
+
+	m_cpu = static_cast<uint8_t*>(cpu);
+	m_gpu = m_resource->GetGPUVirtualAddress();
+}
+
+UploadRing::UploadRing(void *memory, D3D12_GPU_VIRTUAL_ADDRESS gpuAddress, uint64_t size) :
+	m_cpu(static_cast<uint8_t*>(memory)),
+	m_gpu(gpuAddress),
+	m_size(size),
+	m_head(0),
+	m_tail(0),
+	m_frameBytes(0),
+	m_stats()
+{
+}
+
+UploadRing::~UploadRing()
+{
+	if (m_resource)
+	{
+		m_resource->Unmap(0, nullptr);
+	}
+}
+
+bool UploadRing::Allocate(uint64_t size, uint64_t alignment, Allocation &allocation)
+{
+	assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+	if (m_stats.used == 0)
+	{
+		// Nothing in flight, start over at the beginning
+		m_head = m_tail = 0;
+	}
+
+	uint64_t offset = (m_head + alignment - 1) & ~(alignment - 1);
+	uint64_t consumed = 0;
+
+	if (m_stats.used > 0 && m_head == m_tail)
+	{
+		m_stats.failed++;
+		return false;
+	}
+
+	if (m_head >= m_tail)
+	{
+		// Free from the head to the end, then from the start to the tail
+		if (offset + size <= m_size)
+		{
+			consumed = offset + size - m_head;
+		}
+		else if (size <= m_tail)
+		{
+			// What's left at the end is wasted until the tail wraps too
+			offset = 0;
+			consumed = (m_size - m_head) + size;
+		}
+		else
+		{
+			m_stats.failed++;
+			return false;
+		}
+	}
+	else
+	{
+		// Free from the head to the tail
+		if (offset + size > m_tail)
+		{
+			m_stats.failed++;
+			return false;
+		}
+		consumed = offset + size - m_head;
+	}
+
+	m_head = offset + size;
+	m_frameBytes += consumed;
+	m_stats.used += consumed;
+	m_stats.peak = std::max(m_stats.peak, m_stats.used);
+
+	allocation.cpu = m_cpu + offset;
+	allocation.gpu = m_gpu + offset;
+	return true;
+}
+
+void UploadRing::EndFrame(uint64_t fenceValue)
+{
+	if (m_frameBytes == 0)
+	{
+		return;
+	}
+
+	Frame frame = { fenceValue, m_head, m_frameBytes };
+	m_frames.push_back(frame);
+	m_frameBytes = 0;
+}
+
+void UploadRing::Retire(uint64_t completedFenceValue)
+{
+	while (!m_frames.empty() && m_frames.front().fenceValue <= completedFenceValue)
+	{
+		m_tail = m_frames.front().end;
+		m_stats.used -= m_frames.front().bytes;
+		m_frames.pop_front();
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "includes.h"
+
+#include <deque>
+
+// Per-frame data the GPU reads straight from upload memory (instance
+// transforms, constants, ...) is written into one persistently mapped ring
+// buffer. Allocations are just a bump of the head; at the end of a frame its
+// allocations are tagged with the frame's fence value and the tail moves
+// past them once the GPU passed it, like the RenderTargetPool retires
+// targets.
+//
+// The ring can also be laid over memory the caller owns, with a made up GPU
+// address, to run everything that writes into it without a GPU.
+
+class UploadRing
+{
+public:
+	struct Allocation
+	{
+		void *cpu;
+		D3D12_GPU_VIRTUAL_ADDRESS gpu;
+	};
+
+	struct Stats
+	{
+		uint64_t used;			// in flight, wasted bytes at the end of the buffer included
+		uint64_t peak;
+		uint32_t failed;		// allocations that didn't fit
+	};
+
+	UploadRing(ComPtr<ID3D12Device2> device, uint64_t size);
+	UploadRing(void *memory, D3D12_GPU_VIRTUAL_ADDRESS gpuAddress, uint64_t size);
+	~UploadRing();
+
+	// Alignment must be a power of two. False when the ring is full.
+	bool Allocate(uint64_t size, uint64_t alignment, Allocation &allocation);
+
+	// The allocations since the last EndFrame can be reused once the GPU reaches fenceValue
+	void EndFrame(uint64_t fenceValue);
+	// Call once per frame with the last completed fence value
+	void Retire(uint64_t completedFenceValue);
+
+	ID3D12Resource *GetResource() const { return m_resource.Get(); }
+	// Allocation.gpu minus this is the offset into GetResource()
+	D3D12_GPU_VIRTUAL_ADDRESS GetGpuAddress() const { return m_gpu; }
+	uint64_t GetSize() const { return m_size; }
+	const Stats &GetStats() const { return m_stats; }
+
+private:
+	struct Frame
+	{
+		uint64_t fenceValue;
+		uint64_t end;		// head when the frame ended
+		uint64_t bytes;
+	};
+
+	ComPtr<ID3D12Resource> m_resource;
+	uint8_t *m_cpu;
+	D3D12_GPU_VIRTUAL_ADDRESS m_gpu;
+	uint64_t m_size;
+
+	uint64_t m_head;
+	uint64_t m_tail;
+	uint64_t m_frameBytes;
+	std::deque<Frame> m_frames;
+
+	Stats m_stats;
+};